@@ -0,0 +1,425 @@
+#include <volk/volk.h>
+
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <exception>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <stb_image.h>
+
+#include "../labutils/ktx2.hpp"
+#include "../labutils/error.hpp"
+#include "../labutils/bcenc.hpp"
+#include "../labutils/mipmap.hpp"
+#include "../labutils/parallel.hpp"
+namespace lut = labutils;
+
+#include "../cw1/model.hpp"
+#include "../cw1/cell_pack.hpp"
+
+// Offline texture baker: converts the textures referenced by OBJ material
+// libraries (map_Kd entries) into KTX2 files with complete mip chains. The
+// output is written next to each source image, with the extension replaced
+// by .ktx2, where cw1 picks it up with --ktx2.
+//
+// Run from the directory that cw1 is run from, e.g.
+//
+//	bin/cw1-bake-release-x64-gcc.exe --format bc7 assets/cw1/scenes/city.mtl
+//
+// Textures are baked in parallel, with the available threads split between
+// them. With --bench-mips, nothing is written; instead, the CPU mip chain
+// generator (labutils/mipmap.hpp) is timed on each texture.
+//
+// With --cells SIZE, the inputs are OBJ models instead, which are split into
+// spatial cells of SIZE x SIZE for out-of-core paging (see cw1/cell_pack.hpp),
+// e.g.
+//
+//	bin/cw1-bake-release-x64-gcc.exe --cells 16 assets/cw1/scenes/city.obj
+//
+// writes assets/cw1/scenes/city.cells, which cw1 pages with --page-cells.
+// Meshes with the same material are merged first, so each cell has one
+// chunk (draw call) per material.
+
+namespace
+{
+	namespace cfg
+	{
+		constexpr char const* kDefaultMaterialLib = "assets/cw1/scenes/city.mtl";
+		constexpr char const* kDefaultModel = "assets/cw1/scenes/city.obj";
+
+		// "rgba8", or one of the BC formats
+		std::string format = "bc7";
+		lut::BcQuality quality = lut::BcQuality::high;
+
+		lut::Ktx2Supercompression supercompression = lut::Ktx2Supercompression::zlib;
+		lut::MipFilter mipFilter = lut::MipFilter::kaiser;
+
+		std::uint32_t threads = 0; // default_thread_count()
+
+		bool benchMips = false;
+		constexpr std::uint32_t kBenchRepeats = 5;
+
+		// Bake cell packs from OBJ models instead, if positive
+		float cellSize = 0.f;
+	}
+
+	std::vector<std::string> parse_options(int aArgc, char* aArgv[]);
+
+	// Source image paths of all map_Kd entries in the material library
+	std::vector<std::string> list_textures(char const* aMtlPath);
+
+	void bake_texture(std::string const& aSourcePath, std::uint32_t aThreadCount);
+	void bench_mips(std::string const& aSourcePath);
+
+	void bake_cells(std::string const& aModelPath);
+
+	std::string with_extension(std::string const& aPath, char const* aExtension);
+	std::string ktx2_path_for(std::string const& aSourcePath);
+	VkFormat vk_format_for(std::string const& aFormat);
+}
+
+int main(int aArgc, char* aArgv[]) try
+{
+	auto materialLibs = parse_options(aArgc, aArgv);
+
+	if (cfg::cellSize > 0.f)
+	{
+		if (materialLibs.empty())
+			materialLibs.emplace_back(cfg::kDefaultModel);
+
+		for (auto const& model : materialLibs)
+			bake_cells(model);
+
+		return 0;
+	}
+
+	if (materialLibs.empty())
+		materialLibs.emplace_back(cfg::kDefaultMaterialLib);
+
+	std::vector<std::string> textures;
+	for (auto const& lib : materialLibs)
+	{
+		for (auto& texture : list_textures(lib.c_str()))
+			textures.emplace_back(std::move(texture));
+	}
+
+	if (cfg::benchMips)
+	{
+		std::printf("Mip chain generation (%s), MPixels/s of level 0:\n", lut::mip_simd_isa());
+		for (auto const& texture : textures)
+			bench_mips(texture);
+
+		return 0;
+	}
+
+	auto const start = std::chrono::steady_clock::now();
+
+	// One texture per thread, each using an equal share of the threads for
+	// mip generation and encoding.
+	std::uint32_t const threads = 0 != cfg::threads ? cfg::threads : lut::default_thread_count();
+	std::uint32_t const parallelTextures = std::uint32_t(std::clamp<std::size_t>(textures.size(), 1, threads));
+	std::uint32_t const threadsPerTexture = std::max(1u, threads / parallelTextures);
+
+	lut::parallel_for(textures.size(), [&] (std::size_t aBegin, std::size_t aEnd) {
+		for (std::size_t i = aBegin; i < aEnd; ++i)
+			bake_texture(textures[i], threadsPerTexture);
+	}, parallelTextures);
+
+	auto const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::printf("Baked %zu textures in %.2f s\n", textures.size(), seconds);
+
+	return 0;
+}
+catch( std::exception const& eErr )
+{
+	std::fprintf( stderr, "\n" );
+	std::fprintf( stderr, "Error: %s\n", eErr.what() );
+	return 1;
+}
+
+namespace
+{
+	std::vector<std::string> parse_options(int aArgc, char* aArgv[])
+	{
+		std::vector<std::string> inputs;
+
+		for (int i = 1; i < aArgc; ++i)
+		{
+			std::string const opt = aArgv[i];
+
+			auto const value = [&] () -> char const* {
+				if (i + 1 >= aArgc)
+					throw lut::Error("Option '%s' requires a value", opt.c_str());
+				return aArgv[++i];
+			};
+
+			if ("--format" == opt)
+			{
+				cfg::format = value();
+				vk_format_for(cfg::format); // validate
+			}
+			else if ("--quality" == opt)
+			{
+				std::string const quality = value();
+				if ("fast" == quality)
+					cfg::quality = lut::BcQuality::fast;
+				else if ("normal" == quality)
+					cfg::quality = lut::BcQuality::normal;
+				else if ("high" == quality)
+					cfg::quality = lut::BcQuality::high;
+				else
+					throw lut::Error("Option '--quality' expects 'fast', 'normal' or 'high'");
+			}
+			else if ("--no-zlib" == opt)
+			{
+				cfg::supercompression = lut::Ktx2Supercompression::none;
+			}
+			else if ("--mip-filter" == opt)
+			{
+				std::string const filter = value();
+				if ("box" == filter)
+					cfg::mipFilter = lut::MipFilter::box;
+				else if ("kaiser" == filter)
+					cfg::mipFilter = lut::MipFilter::kaiser;
+				else
+					throw lut::Error("Option '--mip-filter' expects 'box' or 'kaiser'");
+			}
+			else if ("--threads" == opt)
+			{
+				cfg::threads = std::uint32_t(std::strtoul(value(), nullptr, 10));
+			}
+			else if ("--bench-mips" == opt)
+			{
+				cfg::benchMips = true;
+			}
+			else if ("--cells" == opt)
+			{
+				cfg::cellSize = std::strtof(value(), nullptr);
+				if (!(cfg::cellSize > 0.f))
+					throw lut::Error("Option '--cells' expects a positive cell size");
+			}
+			else if (!opt.empty() && '-' == opt[0])
+			{
+				throw lut::Error("Unknown option '%s'\n"
+					"Usage: %s [--format rgba8|bc1|bc7] [--quality fast|normal|high] [--mip-filter box|kaiser] [--no-zlib]\n"
+					"       [--threads N] [--bench-mips] [MTLFILE...]\n"
+					"       %s --cells SIZE [OBJFILE...]",
+					opt.c_str(), aArgv[0], aArgv[0]
+				);
+			}
+			else
+			{
+				inputs.emplace_back(opt);
+			}
+		}
+
+		return inputs;
+	}
+
+	std::vector<std::string> list_textures(char const* aMtlPath)
+	{
+		std::FILE* fin = std::fopen(aMtlPath, "r");
+		if (!fin)
+			throw lut::Error("Unable to open material library '%s'", aMtlPath);
+
+		// Texture paths are relative to the material library, as in
+		// load_obj_model().
+		std::string directory = aMtlPath;
+		auto const slash = directory.find_last_of("/\\");
+		directory = std::string::npos == slash ? std::string() : directory.substr(0, slash + 1);
+
+		std::vector<std::string> ret;
+
+		char line[1024];
+		while (std::fgets(line, sizeof(line), fin))
+		{
+			char const* str = line;
+			while (' ' == *str || '\t' == *str)
+				++str;
+
+			if (0 != std::strncmp(str, "map_Kd", 6) || (' ' != str[6] && '\t' != str[6]))
+				continue;
+
+			str += 6;
+			while (' ' == *str || '\t' == *str)
+				++str;
+
+			std::string name = str;
+			while (!name.empty() && std::strchr(" \t\r\n", name.back()))
+				name.pop_back();
+
+			if (name.empty())
+				continue;
+
+			std::string path = directory + name;
+
+			bool known = false;
+			for (auto const& other : ret)
+				known = known || other == path;
+
+			if (!known)
+				ret.emplace_back(std::move(path));
+		}
+
+		std::fclose(fin);
+		return ret;
+	}
+
+	void bake_texture(std::string const& aSourcePath, std::uint32_t aThreadCount)
+	{
+		auto const start = std::chrono::steady_clock::now();
+
+		int widthi, heighti, channelsi;
+		stbi_uc* data = stbi_load(aSourcePath.c_str(), &widthi, &heighti, &channelsi, 4);
+		if (!data)
+			throw lut::Error("%s: unable to load image (%s)", aSourcePath.c_str(), stbi_failure_reason());
+
+		auto const width = std::uint32_t(widthi);
+		auto const height = std::uint32_t(heighti);
+
+		lut::Ktx2Texture ktx;
+		ktx.format = vk_format_for(cfg::format);
+		ktx.width = width;
+		ktx.height = height;
+
+		// Diffuse textures are sRGB. The mip chain is filtered in linear
+		// space (see mipmap.hpp).
+		auto const mips = lut::generate_mip_chain_rgba8(data, width, height, true, cfg::mipFilter, aThreadCount);
+
+		for (std::size_t level = 0; level <= mips.size(); ++level)
+		{
+			std::uint8_t const* texels = 0 == level ? data : mips[level-1].texels.data();
+			std::uint32_t const levelWidth = 0 == level ? width : mips[level-1].width;
+			std::uint32_t const levelHeight = 0 == level ? height : mips[level-1].height;
+
+			std::size_t const size = lut::ktx2_level_size(ktx.format, levelWidth, levelHeight);
+			std::uint8_t* dst = lut::ktx2_add_level(ktx, size);
+
+			if ("rgba8" == cfg::format)
+			{
+				std::memcpy(dst, texels, size);
+			}
+			else
+			{
+				lut::BcFormat const bc = "bc1" == cfg::format ? lut::BcFormat::bc1 : lut::BcFormat::bc7;
+				lut::encode_bc(bc, cfg::quality, texels, levelWidth, levelHeight, dst, aThreadCount);
+			}
+		}
+
+		stbi_image_free(data);
+
+		auto const outPath = ktx2_path_for(aSourcePath);
+		lut::write_ktx2(outPath.c_str(), ktx, cfg::supercompression, "cw1-bake");
+
+		auto const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::size_t fileSize = 0;
+		if (std::FILE* fin = std::fopen(outPath.c_str(), "rb"))
+		{
+			std::fseek(fin, 0, SEEK_END);
+			fileSize = std::size_t(std::ftell(fin));
+			std::fclose(fin);
+		}
+
+		std::printf("%s -> %s: %ux%u %s, %s mips, %zu levels, %.1f KiB in memory, %.1f KiB on disk (%.2f s)\n",
+			aSourcePath.c_str(), outPath.c_str(), width, height, cfg::format.c_str(), lut::to_string(cfg::mipFilter),
+			ktx.levels.size(), ktx.data.size() / 1024.0, fileSize / 1024.0, seconds
+		);
+	}
+
+	void bench_mips(std::string const& aSourcePath)
+	{
+		int widthi, heighti, channelsi;
+		stbi_uc* data = stbi_load(aSourcePath.c_str(), &widthi, &heighti, &channelsi, 4);
+		if (!data)
+			throw lut::Error("%s: unable to load image (%s)", aSourcePath.c_str(), stbi_failure_reason());
+
+		auto const width = std::uint32_t(widthi);
+		auto const height = std::uint32_t(heighti);
+
+		std::uint32_t const threads = 0 != cfg::threads ? cfg::threads : lut::default_thread_count();
+
+		std::printf("  %s (%ux%u)\n", aSourcePath.c_str(), width, height);
+
+		for (auto const filter : { lut::MipFilter::box, lut::MipFilter::kaiser })
+		{
+			for (auto const threadCount : { 1u, threads })
+			{
+				// Best of several runs; the first run also warms up the
+				// conversion tables.
+				double best = 0.0;
+				for (std::uint32_t i = 0; i < cfg::kBenchRepeats; ++i)
+				{
+					auto const start = std::chrono::steady_clock::now();
+					auto const mips = lut::generate_mip_chain_rgba8(data, width, height, true, filter, threadCount);
+					auto const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+					if (0 == i || seconds < best)
+						best = seconds;
+				}
+
+				std::printf("    %-6s %2u thread(s): %8.1f MPixels/s (%.2f ms)\n",
+					lut::to_string(filter), threadCount, width * double(height) / best * 1e-6, best * 1e3
+				);
+
+				if (1 == threads)
+					break;
+			}
+		}
+
+		stbi_image_free(data);
+	}
+
+	void bake_cells(std::string const& aModelPath)
+	{
+		auto const start = std::chrono::steady_clock::now();
+
+		ModelData const model = load_obj_model(aModelPath, MeshMerge::material);
+
+		auto const outPath = with_extension(aModelPath, ".cells");
+		auto const stats = write_cell_pack(outPath.c_str(), model, cfg::cellSize);
+
+		auto const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::printf("%s -> %s: %zu cells of %g x %g, %zu chunks, %zu triangles (at most %zu per cell), %.1f KiB (%.2f s)\n",
+			aModelPath.c_str(), outPath.c_str(), stats.cells, cfg::cellSize, cfg::cellSize, stats.chunks,
+			stats.triangles, stats.maxCellTriangles, stats.bytes / 1024.0, seconds
+		);
+	}
+
+	std::string with_extension(std::string const& aPath, char const* aExtension)
+	{
+		std::string ret = aPath;
+
+		auto const dot = ret.find_last_of('.');
+		auto const slash = ret.find_last_of("/\\");
+		if (std::string::npos != dot && (std::string::npos == slash || dot > slash))
+			ret.erase(dot);
+
+		return ret + aExtension;
+	}
+
+	std::string ktx2_path_for(std::string const& aSourcePath)
+	{
+		return with_extension(aSourcePath, ".ktx2");
+	}
+
+	VkFormat vk_format_for(std::string const& aFormat)
+	{
+		if ("rgba8" == aFormat)
+			return VK_FORMAT_R8G8B8A8_SRGB;
+		if ("bc1" == aFormat)
+			return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+		if ("bc7" == aFormat)
+			return VK_FORMAT_BC7_SRGB_BLOCK;
+
+		throw lut::Error("Unknown format '%s', expected 'rgba8', 'bc1' or 'bc7'", aFormat.c_str());
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,255 @@
+#include "benchmark.hpp"
+
+#include <utility>
+#include <algorithm>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "../labutils/error.hpp"
+namespace lut = labutils;
+
+// CameraPath
+float CameraPath::duration() const noexcept
+{
+	return keys.empty() ? 0.f : keys.back().time;
+}
+
+CameraKey CameraPath::sample( float aTime ) const noexcept
+{
+	if( keys.empty() )
+		return CameraKey{ aTime, glm::vec3( 0.f ), 0.f, 0.f };
+
+	if( aTime <= keys.front().time )
+		return keys.front();
+	if( aTime >= keys.back().time )
+		return keys.back();
+
+	// Find first key with time > aTime. The checks above guarantee that it
+	// is neither the first one nor past the end.
+	auto const next = std::upper_bound( keys.begin(), keys.end(), aTime,
+		[] (float aT, CameraKey const& aKey) { return aT < aKey.time; }
+	);
+	auto const prev = next - 1;
+
+	float const span = next->time - prev->time;
+	float const t = span > 0.f ? (aTime - prev->time) / span : 0.f;
+
+	CameraKey ret;
+	ret.time = aTime;
+	ret.position = glm::mix( prev->position, next->position, t );
+	ret.yaw = prev->yaw + (next->yaw - prev->yaw) * t;
+	ret.pitch = prev->pitch + (next->pitch - prev->pitch) * t;
+	return ret;
+}
+
+CameraPath load_camera_path( char const* aPath )
+{
+	std::FILE* fin = std::fopen( aPath, "r" );
+	if( !fin )
+		throw lut::Error( "Unable to open camera path '%s'", aPath );
+
+	CameraPath ret;
+
+	char line[512];
+	std::size_t lineNo = 0;
+	while( std::fgets( line, sizeof(line), fin ) )
+	{
+		++lineNo;
+
+		char const* str = line;
+		while( ' ' == *str || '\t' == *str )
+			++str;
+
+		if( '#' == *str || '\n' == *str || '\r' == *str || '\0' == *str )
+			continue;
+
+		CameraKey key{};
+		if( 6 != std::sscanf( str, "%f %f %f %f %f %f", &key.time, &key.position.x, &key.position.y, &key.position.z, &key.yaw, &key.pitch ) )
+		{
+			std::fclose( fin );
+			throw lut::Error( "%s:%zu: expected 'time x y z yaw pitch'", aPath, lineNo );
+		}
+
+		if( !ret.keys.empty() && key.time < ret.keys.back().time )
+		{
+			std::fclose( fin );
+			throw lut::Error( "%s:%zu: camera keys must be sorted by time", aPath, lineNo );
+		}
+
+		ret.keys.emplace_back( key );
+	}
+
+	std::fclose( fin );
+
+	if( ret.keys.empty() )
+		throw lut::Error( "Camera path '%s' contains no keys", aPath );
+
+	return ret;
+}
+
+void save_camera_path( CameraPath const& aCameraPath, char const* aPath )
+{
+	std::FILE* fout = std::fopen( aPath, "w" );
+	if( !fout )
+		throw lut::Error( "Unable to open '%s' for writing", aPath );
+
+	std::fprintf( fout, "# time x y z yaw pitch\n" );
+	for( auto const& key : aCameraPath.keys )
+	{
+		std::fprintf( fout, "%.4f %.4f %.4f %.4f %.4f %.4f\n", key.time, key.position.x, key.position.y, key.position.z, key.yaw, key.pitch );
+	}
+
+	bool const ok = (0 == std::ferror( fout ));
+	std::fclose( fout );
+
+	if( !ok )
+		throw lut::Error( "Error while writing camera path '%s'", aPath );
+}
+
+CameraPath make_default_camera_path()
+{
+	// Walk once around the city centre at roughly street level, looking
+	// towards the middle, then rise up for an overview at the end. This
+	// covers both close-up (texture heavy) and wide (geometry heavy) views.
+	CameraPath ret;
+
+	constexpr int kSteps = 16;
+	constexpr float kRadius = 12.f;
+	constexpr float kLoopTime = 16.f;
+	constexpr float kPi = 3.14159265359f;
+
+	for( int i = 0; i <= kSteps; ++i )
+	{
+		float const a = 2.f * kPi * float(i) / kSteps;
+
+		CameraKey key;
+		key.time = kLoopTime * float(i) / kSteps;
+		key.position = glm::vec3( kRadius * std::sin( a ), 1.5f, kRadius * std::cos( a ) );
+		key.yaw = a + kPi; // face the centre
+		key.pitch = -0.05f;
+		ret.keys.emplace_back( key );
+	}
+
+	ret.keys.emplace_back( CameraKey{ kLoopTime + 4.f, glm::vec3( 0.f, 25.f, 20.f ), kPi, -0.8f } );
+
+	return ret;
+}
+
+
+// Statistics
+TimingStats compute_timing_stats( std::vector<double> aSamples )
+{
+	TimingStats ret;
+	ret.count = aSamples.size();
+
+	if( aSamples.empty() )
+		return ret;
+
+	std::sort( aSamples.begin(), aSamples.end() );
+
+	double sum = 0.0;
+	for( auto const s : aSamples )
+		sum += s;
+
+	// Nearest-rank percentiles
+	auto const percentile = [&] (double aP) {
+		auto const rank = std::size_t(std::ceil( aP / 100.0 * double(aSamples.size()) ));
+		return aSamples[std::min( std::max( rank, std::size_t(1) ), aSamples.size() ) - 1];
+	};
+
+	ret.mean = sum / double(aSamples.size());
+	ret.min = aSamples.front();
+	ret.max = aSamples.back();
+	ret.p50 = percentile( 50.0 );
+	ret.p95 = percentile( 95.0 );
+	ret.p99 = percentile( 99.0 );
+
+	return ret;
+}
+
+namespace
+{
+	bool has_extension_( char const* aPath, char const* aExt )
+	{
+		std::size_t const len = std::strlen( aPath ), extLen = std::strlen( aExt );
+		return len >= extLen && 0 == std::strcmp( aPath + len - extLen, aExt );
+	}
+
+	void write_stats_json_( std::FILE* aOut, TimingStats const& aStats )
+	{
+		std::fprintf( aOut, "{ \"count\": %zu, \"mean\": %.4f, \"min\": %.4f, \"max\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f }",
+			aStats.count, aStats.mean, aStats.min, aStats.max, aStats.p50, aStats.p95, aStats.p99
+		);
+	}
+
+	void write_samples_json_( std::FILE* aOut, std::vector<double> const& aSamples )
+	{
+		std::fprintf( aOut, "[" );
+		for( std::size_t i = 0; i < aSamples.size(); ++i )
+			std::fprintf( aOut, "%s%.4f", i ? ", " : "", aSamples[i] );
+		std::fprintf( aOut, "]" );
+	}
+}
+
+void write_benchmark_report( FrameTimings const& aTimings, char const* aPath )
+{
+	std::FILE* fout = std::fopen( aPath, "w" );
+	if( !fout )
+		throw lut::Error( "Unable to open '%s' for writing", aPath );
+
+	auto const cpu = compute_timing_stats( aTimings.cpuMs );
+	auto const gpu = compute_timing_stats( aTimings.gpuMs );
+
+	if( has_extension_( aPath, ".json" ) )
+	{
+		std::fprintf( fout, "{\n" );
+		std::fprintf( fout, "  \"cpu_ms\": " );
+		write_stats_json_( fout, cpu );
+		std::fprintf( fout, ",\n  \"gpu_ms\": " );
+		write_stats_json_( fout, gpu );
+		std::fprintf( fout, ",\n  \"frames\": {\n    \"cpu_ms\": " );
+		write_samples_json_( fout, aTimings.cpuMs );
+		std::fprintf( fout, ",\n    \"gpu_ms\": " );
+		write_samples_json_( fout, aTimings.gpuMs );
+		std::fprintf( fout, "\n  }\n}\n" );
+	}
+	else
+	{
+		// One row per metric, so that results from several runs can simply
+		// be concatenated (minus the header) for regression tracking.
+		std::fprintf( fout, "metric,count,mean,min,max,p50,p95,p99\n" );
+		for( auto const& [name, s] : { std::make_pair( "cpu_ms", cpu ), std::make_pair( "gpu_ms", gpu ) } )
+		{
+			std::fprintf( fout, "%s,%zu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n", name, s.count, s.mean, s.min, s.max, s.p50, s.p95, s.p99 );
+		}
+	}
+
+	bool const ok = (0 == std::ferror( fout ));
+	std::fclose( fout );
+
+	if( !ok )
+		throw lut::Error( "Error while writing benchmark report '%s'", aPath );
+
+	std::printf( "Wrote '%s'\n", aPath );
+}
+
+void print_benchmark_summary( FrameTimings const& aTimings )
+{
+	auto const print = [] (char const* aName, TimingStats const& aStats) {
+		if( 0 == aStats.count )
+		{
+			std::printf( "  %s: n/a\n", aName );
+			return;
+		}
+
+		std::printf( "  %s: mean %.3f ms, min %.3f, max %.3f, p50 %.3f, p95 %.3f, p99 %.3f (%zu frames)\n",
+			aName, aStats.mean, aStats.min, aStats.max, aStats.p50, aStats.p95, aStats.p99, aStats.count
+		);
+	};
+
+	std::printf( "Benchmark results:\n" );
+	print( "CPU frame time", compute_timing_stats( aTimings.cpuMs ) );
+	print( "GPU frame time", compute_timing_stats( aTimings.gpuMs ) );
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+/* Support for the benchmark mode of cw1 (see --benchmark in main.cpp).
+ *
+ * A CameraPath is a list of camera poses keyed by time. During a benchmark,
+ * the camera follows the path instead of responding to keyboard/mouse input,
+ * and a fixed number of frames is rendered. Paths are either recorded from
+ * an interactive session (--record) or written by hand.
+ *
+ * The text format is one key per line:
+ *
+ *   # time x y z yaw pitch
+ *   0.0   0.0 1.5 0.0   0.0  0.0
+ *   2.5   4.0 1.5 2.0   1.2 -0.1
+ *
+ * Lines starting with '#' are ignored. Keys must be sorted by time.
+ */
+struct CameraKey
+{
+	float time; // seconds
+
+	glm::vec3 position;
+	float yaw, pitch; // radians, same convention as cfg::yaw/cfg::pitch
+};
+
+struct CameraPath
+{
+	std::vector<CameraKey> keys;
+
+	float duration() const noexcept;
+
+	// Linearly interpolate between the keys surrounding aTime. Times outside
+	// of the path are clamped to the first/last key.
+	CameraKey sample( float aTime ) const noexcept;
+};
+
+CameraPath load_camera_path( char const* aPath );
+void save_camera_path( CameraPath const&, char const* aPath );
+
+// Built-in path (a slow loop through the city) that is used when no path
+// file is given.
+CameraPath make_default_camera_path();
+
+
+/* Per-frame timings collected during a benchmark. GPU times are only present
+ * if the device supports timestamp queries on the graphics queue.
+ */
+struct FrameTimings
+{
+	std::vector<double> cpuMs;
+	std::vector<double> gpuMs;
+};
+
+struct TimingStats
+{
+	std::size_t count = 0;
+
+	double mean = 0.0, min = 0.0, max = 0.0;
+	double p50 = 0.0, p95 = 0.0, p99 = 0.0;
+};
+
+TimingStats compute_timing_stats( std::vector<double> aSamples );
+
+// Writes summary statistics. The format is chosen by the extension: ".json"
+// writes JSON, which also has the per-frame timings; anything else writes
+// CSV, with one summary row per metric.
+void write_benchmark_report( FrameTimings const&, char const* aPath );
+void print_benchmark_summary( FrameTimings const& );
@@ -0,0 +1,375 @@
+#include "cell_pack.hpp"
+
+#include <map>
+#include <limits>
+#include <utility>
+#include <algorithm>
+
+#include <cmath>
+#include <cstring>
+
+#include "../labutils/error.hpp"
+#include "../labutils/trace.hpp"
+namespace lut = labutils;
+
+namespace
+{
+	constexpr char kMagic_[8] = { 'C', 'W', '1', 'C', 'E', 'L', 'L', 'S' };
+
+	// Values are written in host byte order, which is little endian on all
+	// platforms that cw1 runs on
+	struct Writer_
+	{
+		std::vector<std::uint8_t> bytes;
+
+		template< typename tType >
+		void put( tType const& aValue )
+		{
+			auto const* src = reinterpret_cast<std::uint8_t const*>(&aValue);
+			bytes.insert( bytes.end(), src, src + sizeof(tType) );
+		}
+
+		void put_string( std::string const& aStr )
+		{
+			put( std::uint32_t(aStr.size()) );
+			bytes.insert( bytes.end(), aStr.begin(), aStr.end() );
+		}
+
+		template< typename tType >
+		void put_array( std::vector<tType> const& aValues )
+		{
+			auto const* src = reinterpret_cast<std::uint8_t const*>(aValues.data());
+			bytes.insert( bytes.end(), src, src + aValues.size() * sizeof(tType) );
+		}
+	};
+
+	// Reads from the file, or from a cell's data in memory
+	struct Reader_
+	{
+		std::FILE* file = nullptr;
+		char const* path = nullptr;
+
+		std::uint8_t const* data = nullptr;
+		std::size_t size = 0, pos = 0;
+
+		void get( void* aDst, std::size_t aBytes )
+		{
+			if( file )
+			{
+				if( aBytes != std::fread( aDst, 1, aBytes, file ) )
+					throw lut::Error( "%s: unexpected end of cell pack", path );
+				return;
+			}
+
+			if( size - pos < aBytes )
+				throw lut::Error( "%s: cell data is truncated", path );
+
+			std::memcpy( aDst, data + pos, aBytes );
+			pos += aBytes;
+		}
+
+		template< typename tType >
+		tType get()
+		{
+			tType ret;
+			get( &ret, sizeof(tType) );
+			return ret;
+		}
+
+		std::string get_string()
+		{
+			auto const length = get<std::uint32_t>();
+			if( length > 4096 )
+				throw lut::Error( "%s: string of %u bytes in cell pack index", path, length );
+
+			std::string ret( length, '\0' );
+			get( ret.data(), length );
+			return ret;
+		}
+	};
+
+	bool is_textured_( std::vector<MaterialInfo> const& aMaterials, MeshInfo const& aMesh )
+	{
+		return !aMaterials[aMesh.materialIndex].colorTexturePath.empty();
+	}
+
+	int seek_( std::FILE* aFile, std::uint64_t aOffset )
+	{
+#		if defined(_WIN32)
+		return _fseeki64( aFile, static_cast<__int64>(aOffset), SEEK_SET );
+#		else
+		return fseeko( aFile, static_cast<off_t>(aOffset), SEEK_SET );
+#		endif
+	}
+
+	struct BakedCell_
+	{
+		std::int32_t gridX, gridZ;
+		std::map<std::uint32_t, CellChunk> chunks; // by mesh
+	};
+}
+
+CellPackStats write_cell_pack( char const* aPath, ModelData const& aModel, float aCellSize )
+{
+	LUT_TRACE_SCOPE( "write_cell_pack" );
+
+	if( !(aCellSize > 0.f) )
+		throw lut::Error( "Cell size must be positive (got %g)", aCellSize );
+
+	// Sort the triangles into cells, by their centroids. Cells are ordered
+	// by grid coordinates, so that the output doesn't depend on the order of
+	// the meshes.
+	std::map<std::pair<std::int32_t, std::int32_t>, BakedCell_> cells;
+
+	for( std::uint32_t m = 0; m < aModel.meshes.size(); ++m )
+	{
+		auto const& mesh = aModel.meshes[m];
+		bool const textured = is_textured_( aModel.materials, mesh );
+
+		for( std::size_t i = 0; i + 2 < mesh.numberOfVertices; i += 3 )
+		{
+			std::size_t const first = mesh.vertexStartIndex + i;
+			glm::vec3 const centroid = (aModel.vertexPositions[first] + aModel.vertexPositions[first+1] + aModel.vertexPositions[first+2]) / 3.f;
+
+			auto const gx = std::int32_t(std::floor( centroid.x / aCellSize ));
+			auto const gz = std::int32_t(std::floor( centroid.z / aCellSize ));
+
+			auto& cell = cells[{ gx, gz }];
+			cell.gridX = gx;
+			cell.gridZ = gz;
+
+			auto& chunk = cell.chunks[m];
+			chunk.mesh = m;
+			for( std::size_t v = first; v < first + 3; ++v )
+			{
+				chunk.positions.emplace_back( aModel.vertexPositions[v] );
+				if( textured )
+					chunk.texCoords.emplace_back( aModel.vertexTextureCoords[v] );
+			}
+		}
+	}
+
+	CellPackStats stats;
+
+	// Cell data, with offsets relative to its start
+	Writer_ data;
+	std::vector<CellInfo> infos;
+
+	for( auto const& [key, cell] : cells )
+	{
+		CellInfo info{};
+		info.gridX = cell.gridX;
+		info.gridZ = cell.gridZ;
+		info.min = glm::vec3( std::numeric_limits<float>::max() );
+		info.max = glm::vec3( std::numeric_limits<float>::lowest() );
+		info.offset = data.bytes.size();
+		info.chunkCount = std::uint32_t(cell.chunks.size());
+
+		for( auto const& [mesh, chunk] : cell.chunks )
+		{
+			for( auto const& p : chunk.positions )
+			{
+				info.min = glm::min( info.min, p );
+				info.max = glm::max( info.max, p );
+			}
+
+			data.put( chunk.mesh );
+			data.put( std::uint32_t(chunk.positions.size()) );
+			data.put_array( chunk.positions );
+			data.put_array( chunk.texCoords );
+
+			info.vertexCount += std::uint32_t(chunk.positions.size());
+		}
+
+		info.size = data.bytes.size() - info.offset;
+		infos.emplace_back( info );
+
+		stats.chunks += cell.chunks.size();
+		stats.triangles += info.vertexCount / 3;
+		stats.maxCellTriangles = std::max<std::size_t>( stats.maxCellTriangles, info.vertexCount / 3 );
+	}
+
+	stats.cells = infos.size();
+
+	// The index doesn't change size with the offsets, so it is written
+	// once to find the start of the data
+	auto const write_index = [&] (std::uint64_t aDataStart) {
+		Writer_ index;
+		index.bytes.insert( index.bytes.end(), kMagic_, kMagic_ + sizeof(kMagic_) );
+		index.put( kCellPackVersion );
+		index.put( aCellSize );
+		index.put( std::uint32_t(aModel.materials.size()) );
+		index.put( std::uint32_t(aModel.meshes.size()) );
+		index.put( std::uint32_t(infos.size()) );
+
+		for( auto const& mat : aModel.materials )
+		{
+			index.put_string( mat.materialName );
+			index.put( mat.color );
+			index.put_string( mat.colorTexturePath );
+		}
+
+		for( auto const& mesh : aModel.meshes )
+		{
+			index.put_string( mesh.meshName );
+			index.put( mesh.materialIndex );
+		}
+
+		for( auto const& info : infos )
+		{
+			index.put( info.gridX );
+			index.put( info.gridZ );
+			index.put( info.min );
+			index.put( info.max );
+			index.put( aDataStart + info.offset );
+			index.put( info.size );
+			index.put( info.chunkCount );
+			index.put( info.vertexCount );
+		}
+
+		return index.bytes;
+	};
+
+	auto const index = write_index( write_index( 0 ).size() );
+
+	std::FILE* fout = std::fopen( aPath, "wb" );
+	if( !fout )
+		throw lut::Error( "Unable to open '%s' for writing", aPath );
+
+	bool const ok = index.size() == std::fwrite( index.data(), 1, index.size(), fout )
+		&& data.bytes.size() == std::fwrite( data.bytes.data(), 1, data.bytes.size(), fout );
+
+	if( 0 != std::fclose( fout ) || !ok )
+		throw lut::Error( "Unable to write cell pack '%s'", aPath );
+
+	stats.bytes = index.size() + data.bytes.size();
+	return stats;
+}
+
+CellPackIndex load_cell_pack_index( char const* aPath )
+{
+	LUT_TRACE_SCOPE( "load_cell_pack_index" );
+
+	std::FILE* fin = std::fopen( aPath, "rb" );
+	if( !fin )
+		throw lut::Error( "Unable to open cell pack '%s'", aPath );
+
+	CellPackIndex ret;
+	ret.path = aPath;
+
+	try
+	{
+		Reader_ in{ fin, aPath };
+
+		char magic[sizeof(kMagic_)];
+		in.get( magic, sizeof(magic) );
+		if( 0 != std::memcmp( magic, kMagic_, sizeof(kMagic_) ) )
+			throw lut::Error( "%s: not a cell pack", aPath );
+
+		if( auto const version = in.get<std::uint32_t>(); kCellPackVersion != version )
+			throw lut::Error( "%s: cell pack version %u, expected %u (re-bake with cw1-bake --cells)", aPath, version, kCellPackVersion );
+
+		ret.cellSize = in.get<float>();
+
+		auto const materialCount = in.get<std::uint32_t>();
+		auto const meshCount = in.get<std::uint32_t>();
+		auto const cellCount = in.get<std::uint32_t>();
+
+		for( std::uint32_t i = 0; i < materialCount; ++i )
+		{
+			MaterialInfo mat;
+			mat.materialName = in.get_string();
+			mat.color = in.get<glm::vec3>();
+			mat.colorTexturePath = in.get_string();
+			ret.materials.emplace_back( std::move(mat) );
+		}
+
+		for( std::uint32_t i = 0; i < meshCount; ++i )
+		{
+			MeshInfo mesh{};
+			mesh.meshName = in.get_string();
+			mesh.materialIndex = in.get<std::uint32_t>();
+
+			if( mesh.materialIndex >= materialCount )
+				throw lut::Error( "%s: mesh %u refers to material %u of %u", aPath, i, mesh.materialIndex, materialCount );
+
+			ret.meshes.emplace_back( std::move(mesh) );
+		}
+
+		ret.cells.resize( cellCount );
+		for( auto& cell : ret.cells )
+		{
+			cell.gridX = in.get<std::int32_t>();
+			cell.gridZ = in.get<std::int32_t>();
+			cell.min = in.get<glm::vec3>();
+			cell.max = in.get<glm::vec3>();
+			cell.offset = in.get<std::uint64_t>();
+			cell.size = in.get<std::uint64_t>();
+			cell.chunkCount = in.get<std::uint32_t>();
+			cell.vertexCount = in.get<std::uint32_t>();
+		}
+	}
+	catch( ... )
+	{
+		std::fclose( fin );
+		throw;
+	}
+
+	std::fclose( fin );
+	return ret;
+}
+
+CellData read_cell_data( std::FILE* aFile, CellPackIndex const& aIndex, std::uint32_t aCell )
+{
+	LUT_TRACE_SCOPE( "read_cell_data" );
+
+	auto const& info = aIndex.cells.at( aCell );
+
+	std::vector<std::uint8_t> bytes( std::size_t(info.size) );
+	if( 0 != seek_( aFile, info.offset ) || bytes.size() != std::fread( bytes.data(), 1, bytes.size(), aFile ) )
+		throw lut::Error( "%s: unable to read cell %u (%llu bytes at %llu)", aIndex.path.c_str(), aCell, static_cast<unsigned long long>(info.size), static_cast<unsigned long long>(info.offset) );
+
+	Reader_ in{ nullptr, aIndex.path.c_str(), bytes.data(), bytes.size() };
+
+	CellData ret;
+	ret.chunks.resize( info.chunkCount );
+	for( auto& chunk : ret.chunks )
+	{
+		chunk.mesh = in.get<std::uint32_t>();
+		if( chunk.mesh >= aIndex.meshes.size() )
+			throw lut::Error( "%s: cell %u refers to mesh %u of %zu", aIndex.path.c_str(), aCell, chunk.mesh, aIndex.meshes.size() );
+
+		auto const vertexCount = in.get<std::uint32_t>();
+		if( vertexCount > info.vertexCount )
+			throw lut::Error( "%s: cell %u has a chunk of %u vertices, but %u in total", aIndex.path.c_str(), aCell, vertexCount, info.vertexCount );
+
+		chunk.positions.resize( vertexCount );
+		in.get( chunk.positions.data(), vertexCount * sizeof(glm::vec3) );
+
+		if( is_textured_( aIndex.materials, aIndex.meshes[chunk.mesh] ) )
+		{
+			chunk.texCoords.resize( vertexCount );
+			in.get( chunk.texCoords.data(), vertexCount * sizeof(glm::vec2) );
+		}
+	}
+
+	return ret;
+}
+
+ModelData make_cell_pack_model( CellPackIndex const& aIndex )
+{
+	ModelData ret;
+	ret.modelName = aIndex.path;
+	ret.modelSourcePath = aIndex.path;
+	ret.materials = aIndex.materials;
+
+	for( auto const& mesh : aIndex.meshes )
+	{
+		MeshInfo info = mesh;
+		info.vertexStartIndex = 0;
+		info.numberOfVertices = 0;
+		ret.meshes.emplace_back( std::move(info) );
+	}
+
+	return ret;
+}
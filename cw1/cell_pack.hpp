@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "model.hpp"
+
+/* Spatial cell packs, for scenes that don't fit into memory (see cw1-bake
+ * --cells, and --page-cells in main.cpp).
+ *
+ * At bake time, a model is split into the cells of a uniform grid in the XZ
+ * plane. Each triangle goes into the cell that contains its centroid, and
+ * is not split, so the bounds of neighbouring cells (computed from their
+ * triangles) may overlap a little. Within a cell, triangles are grouped by
+ * the mesh they came from into chunks; each chunk is drawn with one draw
+ * call.
+ *
+ * The file starts with an index: the materials and meshes of the model, and
+ * per cell its bounds and where its data is. The index is small and is read
+ * at startup. The cells' vertex data follows, and is read on demand with
+ * read_cell_data(). All values are little endian:
+ *
+ *   header     "CW1CELLS", u32 version, f32 cell size,
+ *              u32 material count, u32 mesh count, u32 cell count
+ *   material   string name, 3 x f32 color, string texture path
+ *   mesh       string name, u32 material index
+ *   cell       2 x i32 grid coordinates, 3 x f32 min, 3 x f32 max,
+ *              u64 offset, u64 size (bytes, of the cell's data),
+ *              u32 chunk count, u32 vertex count
+ *   cell data  per chunk: u32 mesh, u32 vertex count, 3 x f32 per
+ *              position, and 2 x f32 per texture coordinate if the mesh's
+ *              material is textured
+ *
+ * Strings are a u32 length followed by that many bytes. Offsets are from the
+ * start of the file.
+ */
+constexpr std::uint32_t kCellPackVersion = 1;
+
+struct CellInfo
+{
+	std::int32_t gridX, gridZ;
+	glm::vec3 min, max; // model space
+
+	std::uint64_t offset, size;
+	std::uint32_t chunkCount, vertexCount;
+};
+
+struct CellPackIndex
+{
+	std::string path;
+	float cellSize = 0.f;
+
+	// As in ModelData, but without vertices (see make_cell_pack_model())
+	std::vector<MaterialInfo> materials;
+	std::vector<MeshInfo> meshes;
+
+	std::vector<CellInfo> cells;
+};
+
+struct CellChunk
+{
+	std::uint32_t mesh;
+
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> texCoords; // empty unless the mesh is textured
+};
+
+struct CellData
+{
+	std::vector<CellChunk> chunks;
+};
+
+struct CellPackStats
+{
+	std::size_t cells = 0, chunks = 0, triangles = 0;
+	std::size_t maxCellTriangles = 0;
+	std::uint64_t bytes = 0; // of the file
+};
+
+// Splits aModel into cells of aCellSize x aCellSize, and writes them to
+// aPath
+CellPackStats write_cell_pack( char const* aPath, ModelData const& aModel, float aCellSize );
+
+// Reads the index of the pack at aPath
+CellPackIndex load_cell_pack_index( char const* aPath );
+
+// Reads the data of the cell aCell of aIndex from aFile, which must be open
+// for reading (in binary mode) on aIndex.path
+CellData read_cell_data( std::FILE* aFile, CellPackIndex const& aIndex, std::uint32_t aCell );
+
+// A ModelData with the materials and meshes of the pack, whose meshes have
+// no vertices. This stands in for the model at startup (e.g., to load the
+// textures of its materials); the vertices come from the cells.
+ModelData make_cell_pack_model( CellPackIndex const& );
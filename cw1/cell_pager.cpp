@@ -0,0 +1,789 @@
+#include "cell_pager.hpp"
+
+#include <deque>
+#include <mutex>
+#include <limits>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <exception>
+#include <condition_variable>
+
+#include <cmath>
+#include <cassert>
+#include <cstring>
+
+#include "../labutils/error.hpp"
+#include "../labutils/trace.hpp"
+#include "../labutils/vkutil.hpp"
+#include "../labutils/to_string.hpp"
+namespace lut = labutils;
+
+namespace
+{
+	// Time constant of the camera velocity estimate, in seconds
+	constexpr double kVelocitySmoothing = 0.25;
+
+	float box_distance_( glm::vec3 const& aPoint, glm::vec3 const& aMin, glm::vec3 const& aMax ) noexcept
+	{
+		glm::vec3 const d = glm::max( glm::max( aMin - aPoint, aPoint - aMax ), glm::vec3( 0.f ) );
+		return glm::length( d );
+	}
+
+	double seconds_now_() noexcept
+	{
+		using Clock_ = std::chrono::steady_clock;
+		return std::chrono::duration<double>( Clock_::now().time_since_epoch() ).count();
+	}
+}
+
+// Reads cells on its own thread, and prepares their vertex data for upload
+struct CellPager::Loader_
+{
+	struct Done
+	{
+		std::uint32_t cell;
+		std::vector<StagedChunk_> chunks;
+		std::uint64_t bytes;
+	};
+
+	CellPackIndex index;
+	std::FILE* file = nullptr;
+
+	std::mutex mutex;
+	std::condition_variable wake; // work queued, or quit
+	std::condition_variable idle; // a read has completed
+
+	std::deque<std::uint32_t> queue;
+	std::uint32_t active = 0;
+	std::vector<Done> done;
+	std::exception_ptr error;
+	bool quit = false;
+
+	std::thread thread;
+
+	~Loader_()
+	{
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			quit = true;
+		}
+
+		wake.notify_all();
+		if( thread.joinable() )
+			thread.join();
+
+		if( file )
+			std::fclose( file );
+	}
+
+	void run()
+	{
+		lut::trace_set_thread_name( "cell loader" );
+
+		std::unique_lock<std::mutex> lock( mutex );
+		for( ;; )
+		{
+			wake.wait( lock, [this] { return quit || !queue.empty(); } );
+			if( quit )
+				return;
+
+			auto const cell = queue.front();
+			queue.pop_front();
+			++active;
+
+			lock.unlock();
+
+			Done result{ cell, {}, index.cells[cell].size };
+			std::exception_ptr failure;
+			try
+			{
+				result.chunks = stage( cell );
+			}
+			catch( ... )
+			{
+				failure = std::current_exception();
+			}
+
+			lock.lock();
+
+			if( failure && !error )
+				error = failure;
+
+			done.emplace_back( std::move(result) );
+			--active;
+
+			idle.notify_all();
+		}
+	}
+
+	std::vector<StagedChunk_> stage( std::uint32_t aCell )
+	{
+		LUT_TRACE_SCOPE( "stage cell" );
+
+		auto data = read_cell_data( file, index, aCell );
+
+		std::vector<StagedChunk_> ret;
+		ret.reserve( data.chunks.size() );
+
+		for( auto& chunk : data.chunks )
+		{
+			StagedChunk_ staged;
+			staged.mesh = chunk.mesh;
+			staged.vertexCount = std::uint32_t(chunk.positions.size());
+
+			auto const* pos = reinterpret_cast<float const*>(chunk.positions.data());
+			staged.positions.assign( pos, pos + 3 * chunk.positions.size() );
+
+			// Texture coordinates, or the material's color per vertex (as in
+			// create_triangle_mesh())
+			if( !chunk.texCoords.empty() )
+			{
+				auto const* uv = reinterpret_cast<float const*>(chunk.texCoords.data());
+				staged.attributes.assign( uv, uv + 2 * chunk.texCoords.size() );
+			}
+			else
+			{
+				glm::vec3 const color = index.materials[index.meshes[chunk.mesh].materialIndex].color;
+
+				staged.attributes.reserve( 3 * chunk.positions.size() );
+				for( std::size_t i = 0; i < chunk.positions.size(); ++i )
+					staged.attributes.insert( staged.attributes.end(), { color.x, color.y, color.z } );
+			}
+
+			ret.emplace_back( std::move(staged) );
+		}
+
+		return ret;
+	}
+};
+
+
+CellPager::CellPager() noexcept = default;
+
+CellPager::~CellPager()
+{
+	// Buffers of a batch in flight are destroyed with it
+	for( auto const& batch : mInFlight )
+		vkWaitForFences( mContext->device, 1, &batch.fence.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max() );
+}
+
+CellPager::CellPager( CellPager&& ) noexcept = default;
+CellPager& CellPager::operator=( CellPager&& aOther ) noexcept
+{
+	// As in the destructor: this pager's batches go to aOther, and their
+	// buffers are destroyed with it
+	for( auto const& batch : mInFlight )
+		vkWaitForFences( mContext->device, 1, &batch.fence.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max() );
+
+	std::swap( mContext, aOther.mContext );
+	std::swap( mAllocator, aOther.mAllocator );
+	std::swap( mConfig, aOther.mConfig );
+	std::swap( mLoader, aOther.mLoader );
+	std::swap( mCells, aOther.mCells );
+	std::swap( mCmdPool, aOther.mCmdPool );
+	std::swap( mInFlight, aOther.mInFlight );
+	std::swap( mRetired, aOther.mRetired );
+	std::swap( mSlotCount, aOther.mSlotCount );
+	std::swap( mResidentChunks, aOther.mResidentChunks );
+	std::swap( mHaveCamera, aOther.mHaveCamera );
+	std::swap( mLastCamera, aOther.mLastCamera );
+	std::swap( mLastTime, aOther.mLastTime );
+	std::swap( mVelocity, aOther.mVelocity );
+	std::swap( mResidentBytes, aOther.mResidentBytes );
+	std::swap( mReads, aOther.mReads );
+	std::swap( mReadBytes, aOther.mReadBytes );
+	std::swap( mDropped, aOther.mDropped );
+	std::swap( mUploads, aOther.mUploads );
+	std::swap( mEvictions, aOther.mEvictions );
+	std::swap( mPrefetches, aOther.mPrefetches );
+	std::swap( mPrefetchHits, aOther.mPrefetchHits );
+	std::swap( mMissing, aOther.mMissing );
+	std::swap( mOverBudget, aOther.mOverBudget );
+	return *this;
+}
+
+
+CellPackIndex const& CellPager::index() const noexcept
+{
+	assert( mLoader );
+	return mLoader->index;
+}
+
+std::vector<PagedChunk> const& CellPager::resident_chunks() const noexcept
+{
+	return mResidentChunks;
+}
+
+void CellPager::update( std::uint32_t aFrameSlot, glm::vec3 const& aCamera, bool aWait )
+{
+	LUT_TRACE_SCOPE( "CellPager::update" );
+	assert( aFrameSlot < mSlotCount );
+
+	release_retired_( aFrameSlot );
+	finish_batch_( aWait );
+	collect_reads_( false );
+
+	plan_( aCamera );
+	request_reads_();
+
+	if( aWait )
+	{
+		for( ;; )
+		{
+			collect_reads_( true );
+
+			bool const uploaded = start_batch_( aFrameSlot );
+			if( uploaded )
+			{
+				finish_batch_( true );
+				release_retired_( aFrameSlot );
+			}
+
+			request_reads_();
+
+			bool reading = false;
+			for( auto const& cell : mCells )
+				reading = reading || State_::reading == cell.state;
+
+			if( !uploaded && !reading )
+				break;
+		}
+	}
+	else if( mInFlight.empty() )
+	{
+		start_batch_( aFrameSlot );
+	}
+
+	rebuild_chunks_();
+}
+
+CellPagerStats CellPager::stats() const
+{
+	CellPagerStats ret{};
+	ret.cells = std::uint32_t(mCells.size());
+	ret.residentBytes = mResidentBytes;
+	ret.budgetBytes = mConfig.budgetBytes;
+	ret.reads = mReads;
+	ret.readBytes = mReadBytes;
+	ret.dropped = mDropped;
+	ret.uploads = mUploads;
+	ret.evictions = mEvictions;
+	ret.prefetches = mPrefetches;
+	ret.prefetchHits = mPrefetchHits;
+	ret.missingCellFrames = mMissing;
+	ret.overBudgetCellFrames = mOverBudget;
+
+	for( auto const& cell : mCells )
+	{
+		if( State_::resident == cell.state )
+			++ret.residentCells;
+	}
+
+	return ret;
+}
+
+void CellPager::print_stats( std::FILE* aOut ) const
+{
+	auto const st = stats();
+
+	std::fprintf( aOut, "Cell paging: %u of %u cells resident, %.1f of %.1f MiB; %llu reads (%.1f MiB), %llu dropped, %llu uploads, %llu evictions\n",
+		st.residentCells, st.cells,
+		st.residentBytes / (1024.0*1024.0),
+		st.budgetBytes / (1024.0*1024.0),
+		static_cast<unsigned long long>(st.reads),
+		st.readBytes / (1024.0*1024.0),
+		static_cast<unsigned long long>(st.dropped),
+		static_cast<unsigned long long>(st.uploads),
+		static_cast<unsigned long long>(st.evictions)
+	);
+	std::fprintf( aOut, "  prefetched %llu cells (%llu resident in time); %llu cell-frames missing, %llu over budget\n",
+		static_cast<unsigned long long>(st.prefetches),
+		static_cast<unsigned long long>(st.prefetchHits),
+		static_cast<unsigned long long>(st.missingCellFrames),
+		static_cast<unsigned long long>(st.overBudgetCellFrames)
+	);
+}
+
+
+void CellPager::plan_( glm::vec3 const& aCamera )
+{
+	// Direction of travel
+	double const now = seconds_now_();
+	if( mHaveCamera && now > mLastTime )
+	{
+		double const dt = now - mLastTime;
+		glm::vec3 const velocity = (aCamera - mLastCamera) / float(dt);
+
+		float const blend = float(1.0 - std::exp( -dt / kVelocitySmoothing ));
+		mVelocity += (velocity - mVelocity) * blend;
+	}
+
+	mHaveCamera = true;
+	mLastCamera = aCamera;
+	mLastTime = now;
+
+	glm::vec3 const predicted = aCamera + mVelocity * mConfig.prefetchSeconds;
+	bool const prefetch = mConfig.prefetchSeconds > 0.f;
+
+	std::vector<std::uint32_t> order;
+	for( std::uint32_t i = 0; i < mCells.size(); ++i )
+	{
+		auto& cell = mCells[i];
+
+		float current = std::numeric_limits<float>::max(), ahead = current;
+		for( auto const& box : cell.boxes )
+		{
+			current = std::min( current, box_distance_( aCamera, box.min, box.max ) );
+			if( prefetch )
+				ahead = std::min( ahead, box_distance_( predicted, box.min, box.max ) );
+		}
+
+		cell.currentDistance = current;
+		cell.distance = std::min( current, ahead );
+		cell.wanted = false;
+
+		if( cell.distance <= mConfig.loadRadius )
+			order.push_back( i );
+
+		// Prefetched in time?
+		if( cell.prefetched && current <= mConfig.loadRadius )
+		{
+			if( State_::resident == cell.state )
+				++mPrefetchHits;
+
+			cell.prefetched = false;
+		}
+	}
+
+	// Nearest first, as far as the budget goes
+	std::stable_sort( order.begin(), order.end(), [this] (std::uint32_t aX, std::uint32_t aY) {
+		return mCells[aX].distance < mCells[aY].distance;
+	} );
+
+	VkDeviceSize planned = 0;
+	for( std::size_t i = 0; i < order.size(); ++i )
+	{
+		auto& cell = mCells[order[i]];
+		if( planned + cell.plannedBytes > mConfig.budgetBytes )
+		{
+			mOverBudget += order.size() - i;
+			break;
+		}
+
+		planned += cell.plannedBytes;
+		cell.wanted = true;
+	}
+
+	// Drop reads that are no longer wanted. Cells that the loader is
+	// reading already are dropped once they are done.
+	{
+		std::lock_guard<std::mutex> lock( mLoader->mutex );
+
+		auto& queue = mLoader->queue;
+		auto const it = std::remove_if( queue.begin(), queue.end(), [this] (std::uint32_t aCell) {
+			return !mCells[aCell].wanted;
+		} );
+
+		for( auto jt = it; jt != queue.end(); ++jt )
+		{
+			mCells[*jt].state = State_::absent;
+			mCells[*jt].prefetched = false;
+			++mDropped;
+		}
+
+		queue.erase( it, queue.end() );
+	}
+
+	for( auto& cell : mCells )
+	{
+		if( State_::loaded == cell.state && !cell.wanted )
+		{
+			std::vector<StagedChunk_>().swap( cell.staged );
+			cell.state = State_::absent;
+			cell.prefetched = false;
+			++mDropped;
+		}
+	}
+}
+
+void CellPager::collect_reads_( bool aWait )
+{
+	std::vector<Loader_::Done> done;
+	{
+		std::unique_lock<std::mutex> lock( mLoader->mutex );
+
+		if( aWait )
+		{
+			mLoader->idle.wait( lock, [this] {
+				return mLoader->error || (mLoader->queue.empty() && 0 == mLoader->active);
+			} );
+		}
+
+		if( mLoader->error )
+			std::rethrow_exception( mLoader->error );
+
+		std::swap( done, mLoader->done );
+	}
+
+	for( auto& result : done )
+	{
+		auto& cell = mCells[result.cell];
+		assert( State_::reading == cell.state );
+
+		mReadBytes += result.bytes;
+
+		if( !cell.wanted )
+		{
+			cell.state = State_::absent;
+			cell.prefetched = false;
+			++mDropped;
+			continue;
+		}
+
+		cell.staged = std::move(result.chunks);
+		cell.state = State_::loaded;
+	}
+}
+
+void CellPager::request_reads_()
+{
+	std::uint32_t pending = 0;
+	std::vector<std::uint32_t> wanted;
+	for( std::uint32_t i = 0; i < mCells.size(); ++i )
+	{
+		auto const& cell = mCells[i];
+		if( State_::reading == cell.state || State_::loaded == cell.state )
+			++pending;
+		else if( State_::absent == cell.state && cell.wanted )
+			wanted.push_back( i );
+	}
+
+	if( wanted.empty() || pending >= mConfig.maxPendingReads )
+		return;
+
+	std::stable_sort( wanted.begin(), wanted.end(), [this] (std::uint32_t aX, std::uint32_t aY) {
+		return mCells[aX].distance < mCells[aY].distance;
+	} );
+
+	{
+		std::lock_guard<std::mutex> lock( mLoader->mutex );
+		for( std::size_t i = 0; i < wanted.size() && pending < mConfig.maxPendingReads; ++i, ++pending )
+		{
+			auto& cell = mCells[wanted[i]];
+			cell.state = State_::reading;
+
+			if( cell.currentDistance > mConfig.loadRadius )
+			{
+				cell.prefetched = true;
+				++mPrefetches;
+			}
+
+			mLoader->queue.push_back( wanted[i] );
+			++mReads;
+		}
+	}
+
+	mLoader->wake.notify_one();
+}
+
+bool CellPager::finish_batch_( bool aWait )
+{
+	if( mInFlight.empty() )
+		return false;
+
+	auto& batch = mInFlight.front();
+
+	if( aWait )
+	{
+		if( auto const res = vkWaitForFences( mContext->device, 1, &batch.fence.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max() ); VK_SUCCESS != res )
+		{
+			throw lut::Error( "Waiting for cell upload\n" "vkWaitForFences() returned %s", lut::to_string(res).c_str() );
+		}
+	}
+	else if( auto const res = vkGetFenceStatus( mContext->device, batch.fence.handle ); VK_NOT_READY == res )
+	{
+		return false;
+	}
+	else if( VK_SUCCESS != res )
+	{
+		throw lut::Error( "Querying cell upload\n" "vkGetFenceStatus() returned %s", lut::to_string(res).c_str() );
+	}
+
+	for( std::size_t i = 0; i < batch.cells.size(); ++i )
+	{
+		auto& cell = mCells[batch.cells[i]];
+		assert( State_::uploading == cell.state );
+
+		cell.chunks = std::move(batch.chunks[i]);
+		cell.state = State_::resident;
+	}
+
+	vkFreeCommandBuffers( mContext->device, mCmdPool.handle, 1, &batch.cmdBuff );
+	mInFlight.clear();
+	return true;
+}
+
+void CellPager::release_retired_( std::uint32_t aFrameSlot )
+{
+	for( auto& retired : mRetired )
+		retired.pendingSlots &= ~(std::uint64_t(1) << aFrameSlot);
+
+	auto const it = std::partition( mRetired.begin(), mRetired.end(), [] (Retired_ const& aRetired) {
+		return 0 != aRetired.pendingSlots;
+	} );
+
+	for( auto jt = it; jt != mRetired.end(); ++jt )
+		mResidentBytes -= jt->bytes;
+
+	mRetired.erase( it, mRetired.end() );
+}
+
+void CellPager::evict_( std::uint32_t aCell, std::uint32_t aFrameSlot )
+{
+	auto& cell = mCells[aCell];
+	assert( State_::resident == cell.state );
+
+	// The current frame slot is about to be re-recorded (without the cell),
+	// so only the other slots can still draw it
+	std::uint64_t const allSlots = 64 == mSlotCount ? ~std::uint64_t(0) : (std::uint64_t(1) << mSlotCount) - 1;
+
+	Retired_ retired{ std::move(cell.chunks), cell.bytes, allSlots & ~(std::uint64_t(1) << aFrameSlot) };
+
+	cell.chunks.clear();
+	cell.bytes = 0;
+	cell.state = State_::absent;
+	cell.prefetched = false;
+
+	if( 0 == retired.pendingSlots )
+		mResidentBytes -= retired.bytes;
+	else
+		mRetired.emplace_back( std::move(retired) );
+
+	++mEvictions;
+}
+
+bool CellPager::start_batch_( std::uint32_t aFrameSlot )
+{
+	assert( mInFlight.empty() );
+
+	std::vector<std::uint32_t> loaded, evictable;
+	for( std::uint32_t i = 0; i < mCells.size(); ++i )
+	{
+		auto const& cell = mCells[i];
+		if( State_::loaded == cell.state )
+			loaded.push_back( i );
+		else if( State_::resident == cell.state && !cell.wanted )
+			evictable.push_back( i );
+	}
+
+	if( loaded.empty() )
+		return false;
+
+	// Nearest first; evict the farthest first
+	std::stable_sort( loaded.begin(), loaded.end(), [this] (std::uint32_t aX, std::uint32_t aY) {
+		return mCells[aX].distance < mCells[aY].distance;
+	} );
+	std::stable_sort( evictable.begin(), evictable.end(), [this] (std::uint32_t aX, std::uint32_t aY) {
+		return mCells[aX].distance > mCells[aY].distance;
+	} );
+
+	auto const available = [this] {
+		return mConfig.budgetBytes > mResidentBytes ? mConfig.budgetBytes - mResidentBytes : 0;
+	};
+
+	auto const staged_bytes = [] (std::vector<StagedChunk_> const& aChunks) {
+		VkDeviceSize ret = 0;
+		for( auto const& chunk : aChunks )
+			ret += (chunk.positions.size() + chunk.attributes.size()) * sizeof(float);
+		return ret;
+	};
+
+	std::vector<std::uint32_t> cells;
+	VkDeviceSize uploadBytes = 0;
+	std::size_t nextEviction = 0;
+
+	for( auto const i : loaded )
+	{
+		if( uploadBytes >= mConfig.uploadBytesPerUpdate && !cells.empty() )
+			break;
+
+		auto& cell = mCells[i];
+		VkDeviceSize const bytes = staged_bytes( cell.staged );
+
+		// Evicted memory becomes available once it is released, so the
+		// upload may have to wait for a later update()
+		while( available() < bytes && nextEviction < evictable.size() )
+			evict_( evictable[nextEviction++], aFrameSlot );
+
+		if( available() < bytes )
+			break;
+
+		cell.bytes = bytes;
+		mResidentBytes += bytes;
+		uploadBytes += bytes;
+		cells.push_back( i );
+	}
+
+	if( cells.empty() )
+		return false;
+
+	LUT_TRACE_SCOPE( "CellPager::start_batch_" );
+
+	Batch_ batch;
+	batch.fence = lut::create_fence( *mContext );
+	batch.cmdBuff = lut::alloc_command_buffer( *mContext, mCmdPool.handle );
+	batch.cells = cells;
+	batch.staging = lut::create_buffer( *mAllocator, uploadBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, lut::MemoryCategory::staging );
+
+	void* sptr = nullptr;
+	if( auto const res = vmaMapMemory( mAllocator->allocator, batch.staging.allocation, &sptr ); VK_SUCCESS != res )
+	{
+		throw lut::Error( "Mapping memory for writing\n" "vmaMapMemory() returned %s", lut::to_string(res).c_str() );
+	}
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if( auto const res = vkBeginCommandBuffer( batch.cmdBuff, &beginInfo ); VK_SUCCESS != res )
+	{
+		vmaUnmapMemory( mAllocator->allocator, batch.staging.allocation );
+		throw lut::Error( "Beginning command buffer recording\n" "vkBeginCommandBuffer() returned %s", lut::to_string(res).c_str() );
+	}
+
+	VkDeviceSize offset = 0;
+	auto const upload = [&] (std::vector<float> const& aData) {
+		VkDeviceSize const size = aData.size() * sizeof(float);
+
+		lut::Buffer buffer = lut::create_buffer( *mAllocator, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, lut::MemoryCategory::geometry );
+
+		std::memcpy( static_cast<std::uint8_t*>(sptr) + offset, aData.data(), std::size_t(size) );
+
+		VkBufferCopy copy{};
+		copy.srcOffset = offset;
+		copy.size = size;
+		vkCmdCopyBuffer( batch.cmdBuff, batch.staging.buffer, buffer.buffer, 1, &copy );
+
+		offset += size;
+		return buffer;
+	};
+
+	for( auto const i : cells )
+	{
+		auto& cell = mCells[i];
+
+		std::vector<GpuChunk_> chunks;
+		for( auto const& staged : cell.staged )
+			chunks.emplace_back( GpuChunk_{ staged.mesh, staged.vertexCount, upload( staged.positions ), upload( staged.attributes ) } );
+
+		batch.chunks.emplace_back( std::move(chunks) );
+
+		std::vector<StagedChunk_>().swap( cell.staged );
+		cell.state = State_::uploading;
+	}
+
+	vmaUnmapMemory( mAllocator->allocator, batch.staging.allocation );
+
+	// Frames submitted after this batch draw the cells once they are
+	// swapped in; the barrier covers those later submissions.
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+
+	vkCmdPipelineBarrier( batch.cmdBuff, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr );
+
+	if( auto const res = vkEndCommandBuffer( batch.cmdBuff ); VK_SUCCESS != res )
+	{
+		throw lut::Error( "Ending command buffer recording\n" "vkEndCommandBuffer() returned %s", lut::to_string(res).c_str() );
+	}
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.cmdBuff;
+
+	if( auto const res = vkQueueSubmit( mContext->graphicsQueue, 1, &submitInfo, batch.fence.handle ); VK_SUCCESS != res )
+	{
+		throw lut::Error( "Submitting cell upload\n" "vkQueueSubmit() returned %s", lut::to_string(res).c_str() );
+	}
+
+	mUploads += cells.size();
+	mInFlight.emplace_back( std::move(batch) );
+
+	return true;
+}
+
+void CellPager::rebuild_chunks_()
+{
+	mResidentChunks.clear();
+
+	for( std::uint32_t i = 0; i < mCells.size(); ++i )
+	{
+		auto const& cell = mCells[i];
+
+		if( State_::resident != cell.state )
+		{
+			if( cell.wanted && cell.currentDistance <= mConfig.loadRadius )
+				++mMissing;
+			continue;
+		}
+
+		for( auto const& chunk : cell.chunks )
+			mResidentChunks.emplace_back( PagedChunk{ chunk.mesh, i, chunk.positions.buffer, chunk.attributes.buffer, chunk.vertexCount } );
+	}
+}
+
+
+CellPager create_cell_pager( lut::VulkanContext const& aContext, lut::Allocator const& aAllocator, CellPackIndex aIndex, std::vector<glm::mat4> const& aInstances, std::uint32_t aFrameSlotCount, CellPagerConfig const& aConfig )
+{
+	LUT_TRACE_SCOPE( "create_cell_pager" );
+	assert( aFrameSlotCount >= 1 && aFrameSlotCount <= 64 );
+
+	CellPager ret;
+	ret.mContext = &aContext;
+	ret.mAllocator = &aAllocator;
+	ret.mConfig = aConfig;
+	ret.mSlotCount = aFrameSlotCount;
+
+	// World space bounds of each cell in each instance
+	ret.mCells.resize( aIndex.cells.size() );
+	for( std::size_t i = 0; i < aIndex.cells.size(); ++i )
+	{
+		auto const& info = aIndex.cells[i];
+		auto& cell = ret.mCells[i];
+
+		for( auto const& model : aInstances )
+		{
+			CellPager::Box_ box{ glm::vec3( std::numeric_limits<float>::max() ), glm::vec3( std::numeric_limits<float>::lowest() ) };
+			for( int c = 0; c < 8; ++c )
+			{
+				glm::vec3 const corner( (c & 1) ? info.max.x : info.min.x, (c & 2) ? info.max.y : info.min.y, (c & 4) ? info.max.z : info.min.z );
+				glm::vec3 const world = glm::vec3( model * glm::vec4( corner, 1.f ) );
+
+				box.min = glm::min( box.min, world );
+				box.max = glm::max( box.max, world );
+			}
+
+			cell.boxes.emplace_back( box );
+		}
+
+		cell.plannedBytes = VkDeviceSize(info.vertexCount) * 6 * sizeof(float);
+	}
+
+	ret.mCmdPool = lut::create_command_pool( aContext, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT );
+
+	ret.mLoader = std::make_unique<CellPager::Loader_>();
+	ret.mLoader->index = std::move(aIndex);
+
+	auto& loader = *ret.mLoader;
+	loader.file = std::fopen( loader.index.path.c_str(), "rb" );
+	if( !loader.file )
+		throw lut::Error( "Unable to open cell pack '%s'", loader.index.path.c_str() );
+
+	loader.thread = std::thread( [&loader] { loader.run(); } );
+
+	return ret;
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <memory>
+#include <vector>
+
+#include <cstdio>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "cell_pack.hpp"
+
+#include "../labutils/vkobject.hpp"
+#include "../labutils/vkbuffer.hpp"
+#include "../labutils/allocator.hpp"
+#include "../labutils/vulkan_context.hpp"
+
+/* Out-of-core paging of a cell pack (see cell_pack.hpp) around the camera
+ * (see --page-cells in main.cpp).
+ *
+ * Only the pack's index is kept in memory. Each update(), cells whose bounds
+ * are within loadRadius of the camera are wanted, nearest first, as long as
+ * they fit into the memory budget together. So are cells within loadRadius
+ * of where the camera will be in prefetchSeconds, if it keeps moving as it
+ * has recently (its velocity is smoothed over a fraction of a second), so
+ * that cells ahead are read before the camera gets there. Cells count with
+ * the nearer of the two distances.
+ *
+ * Wanted cells are read from disk by a loader thread, a few at a time, and
+ * prepared for upload there (e.g., material colors are expanded into vertex
+ * colors). Read cells are uploaded in batches of one command buffer, with at
+ * most one batch in flight, and are drawn once their batch has completed.
+ * Reads that are no longer wanted by the time they complete are dropped.
+ *
+ * If an upload doesn't fit into the budget, resident cells that are no
+ * longer wanted are evicted, farthest first. As with TextureStreamer, the
+ * buffers of an evicted cell are released once the command buffers of all
+ * frame slots that may still draw the cell have completed, and the cell's
+ * memory counts against the budget until then.
+ *
+ * Each cell's chunks are drawn with vertex buffers as create_triangle_mesh()
+ * creates them: positions, and colors or texture coordinates.
+ */
+struct CellPagerConfig
+{
+	// Device memory that resident cells may use. Cells are planned with an
+	// upper bound of their size (as if all vertices had colors).
+	VkDeviceSize budgetBytes = VkDeviceSize(64) << 20;
+
+	// Cells closer than this (in world space) are wanted
+	float loadRadius = 100.f;
+
+	// Look-ahead along the camera's direction of travel. Zero disables
+	// prefetching.
+	float prefetchSeconds = 2.f;
+
+	// Cells that have been requested from the loader thread and not yet
+	// uploaded, at most
+	std::uint32_t maxPendingReads = 8;
+
+	// Upper limit on the data uploaded by one update(). At least one cell is
+	// uploaded per batch regardless.
+	VkDeviceSize uploadBytesPerUpdate = VkDeviceSize(8) << 20;
+};
+
+struct CellPagerStats
+{
+	std::uint32_t cells;
+	std::uint32_t residentCells;
+
+	VkDeviceSize residentBytes; // including uploads in flight and cells pending release
+	VkDeviceSize budgetBytes;
+
+	std::uint64_t reads;
+	std::uint64_t readBytes; // from disk
+	std::uint64_t dropped; // reads that were no longer wanted
+	std::uint64_t uploads;
+	std::uint64_t evictions;
+
+	std::uint64_t prefetches; // reads for the predicted camera position only
+	std::uint64_t prefetchHits; // ... that were resident by the time the camera got close
+
+	// Summed over updates: cells within loadRadius of the camera that
+	// weren't resident, and those that didn't fit into the budget
+	std::uint64_t missingCellFrames;
+	std::uint64_t overBudgetCellFrames;
+};
+
+// A chunk of a resident cell; see CellPager::resident_chunks()
+struct PagedChunk
+{
+	std::uint32_t mesh; // in CellPackIndex::meshes
+	std::uint32_t cell;
+
+	VkBuffer positions;
+	VkBuffer attributes; // colors or texture coordinates
+	std::uint32_t vertexCount;
+};
+
+class CellPager
+{
+	public:
+		CellPager() noexcept, ~CellPager();
+
+		CellPager( CellPager const& ) = delete;
+		CellPager& operator= (CellPager const&) = delete;
+
+		CellPager( CellPager&& ) noexcept;
+		CellPager& operator = (CellPager&&) noexcept;
+
+	public:
+		CellPackIndex const& index() const noexcept;
+
+		// Chunks of the resident cells, as of the last update(), by cell
+		std::vector<PagedChunk> const& resident_chunks() const noexcept;
+
+		// Completes reads and uploads, releases evicted cells that are no
+		// longer referenced, and starts the next reads and uploads for the
+		// camera at aCamera (world space). Call once per frame, after the
+		// command buffer of aFrameSlot has completed and before recording
+		// it.
+		//
+		// With aWait set, this waits for reads and uploads and keeps going
+		// until the wanted cells are resident, so that results don't depend
+		// on timing (e.g., headless captures).
+		void update( std::uint32_t aFrameSlot, glm::vec3 const& aCamera, bool aWait = false );
+
+		CellPagerStats stats() const;
+		void print_stats( std::FILE* = stdout ) const;
+
+	private:
+		friend CellPager create_cell_pager( labutils::VulkanContext const&, labutils::Allocator const&, CellPackIndex, std::vector<glm::mat4> const&, std::uint32_t, CellPagerConfig const& );
+
+		struct Loader_;
+
+		enum class State_
+		{
+			absent,
+			reading, // queued for or being read by the loader thread
+			loaded, // read, waiting for upload
+			uploading,
+			resident
+		};
+
+		struct Box_
+		{
+			glm::vec3 min, max;
+		};
+
+		// Ready for upload, see Loader_
+		struct StagedChunk_
+		{
+			std::uint32_t mesh;
+			std::uint32_t vertexCount;
+			std::vector<float> positions;
+			std::vector<float> attributes;
+		};
+
+		struct GpuChunk_
+		{
+			std::uint32_t mesh;
+			std::uint32_t vertexCount;
+			labutils::Buffer positions;
+			labutils::Buffer attributes;
+		};
+
+		struct Cell_
+		{
+			State_ state = State_::absent;
+
+			std::vector<Box_> boxes; // world space, one per instance
+			VkDeviceSize plannedBytes = 0; // upper bound, see CellPagerConfig::budgetBytes
+
+			std::vector<StagedChunk_> staged; // when loaded
+			std::vector<GpuChunk_> chunks; // when resident
+			VkDeviceSize bytes = 0; // of chunks
+
+			float distance = 0.f; // nearer of the current and predicted camera
+			float currentDistance = 0.f;
+			bool wanted = false;
+			bool prefetched = false; // read for the predicted position only
+		};
+
+		struct Batch_
+		{
+			labutils::Fence fence;
+			VkCommandBuffer cmdBuff = VK_NULL_HANDLE;
+			labutils::Buffer staging;
+
+			std::vector<std::uint32_t> cells;
+			std::vector<std::vector<GpuChunk_>> chunks; // per cell
+		};
+
+		struct Retired_
+		{
+			std::vector<GpuChunk_> chunks;
+			VkDeviceSize bytes;
+
+			std::uint64_t pendingSlots; // bit per frame slot that hasn't come around yet
+		};
+
+		void plan_( glm::vec3 const& aCamera );
+		void collect_reads_( bool aWait );
+		void request_reads_();
+
+		bool finish_batch_( bool aWait );
+		void release_retired_( std::uint32_t aFrameSlot );
+		bool start_batch_( std::uint32_t aFrameSlot );
+		void evict_( std::uint32_t aCell, std::uint32_t aFrameSlot );
+
+		void rebuild_chunks_();
+
+	private:
+		labutils::VulkanContext const* mContext = nullptr;
+		labutils::Allocator const* mAllocator = nullptr;
+
+		CellPagerConfig mConfig;
+
+		std::unique_ptr<Loader_> mLoader; // owns the index
+		std::vector<Cell_> mCells;
+
+		labutils::CommandPool mCmdPool;
+		std::vector<Batch_> mInFlight; // zero or one
+		std::vector<Retired_> mRetired;
+
+		std::uint32_t mSlotCount = 1;
+
+		std::vector<PagedChunk> mResidentChunks;
+
+		// Camera motion, for prefetching
+		bool mHaveCamera = false;
+		glm::vec3 mLastCamera{ 0.f };
+		double mLastTime = 0.0;
+		glm::vec3 mVelocity{ 0.f };
+
+		VkDeviceSize mResidentBytes = 0;
+
+		std::uint64_t mReads = 0, mReadBytes = 0, mDropped = 0;
+		std::uint64_t mUploads = 0, mEvictions = 0;
+		std::uint64_t mPrefetches = 0, mPrefetchHits = 0;
+		std::uint64_t mMissing = 0, mOverBudget = 0;
+};
+
+// Starts paging aIndex. aInstances are the model matrices that the pack's
+// model is drawn with; a cell's distance is that of its nearest instance.
+// aFrameSlotCount is the number of command buffers in flight (see
+// CellPager::update()), at most 64. Nothing is resident until the first
+// update().
+CellPager create_cell_pager(
+	labutils::VulkanContext const&,
+	labutils::Allocator const&,
+	CellPackIndex,
+	std::vector<glm::mat4> const& aInstances,
+	std::uint32_t aFrameSlotCount,
+	CellPagerConfig const& = CellPagerConfig{}
+);
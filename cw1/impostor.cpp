@@ -0,0 +1,430 @@
+#include "impostor.hpp"
+
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+
+#include <cmath>
+#include <cstring>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../labutils/error.hpp"
+#include "../labutils/trace.hpp"
+#include "../labutils/vkutil.hpp"
+#include "../labutils/to_string.hpp"
+namespace lut = labutils;
+
+namespace
+{
+	// Vertices are connected if their positions are identical; the OBJ
+	// loader copies the positions of shared vertices exactly
+	struct PositionHash_
+	{
+		std::size_t operator() ( glm::vec3 const& aPos ) const noexcept
+		{
+			std::uint32_t words[3];
+			std::memcpy( words, &aPos, sizeof(words) );
+
+			std::uint64_t hash = 14695981039346656037ull;
+			for( auto const word : words )
+				hash = (hash ^ word) * 1099511628211ull;
+			return std::size_t(hash);
+		}
+	};
+
+	struct DisjointSets_
+	{
+		std::vector<std::uint32_t> parents;
+
+		std::uint32_t add()
+		{
+			parents.emplace_back( std::uint32_t(parents.size()) );
+			return parents.back();
+		}
+
+		std::uint32_t find( std::uint32_t aX )
+		{
+			while( parents[aX] != aX )
+			{
+				parents[aX] = parents[parents[aX]];
+				aX = parents[aX];
+			}
+			return aX;
+		}
+
+		void join( std::uint32_t aX, std::uint32_t aY )
+		{
+			aX = find( aX );
+			aY = find( aY );
+			if( aX != aY )
+				parents[std::max( aX, aY )] = std::min( aX, aY );
+		}
+	};
+}
+
+BuildingSplit split_buildings( ModelData& aModel, float aGroundHeight, float aMinHeight, std::uint32_t aViewCount )
+{
+	LUT_TRACE_SCOPE( "split_buildings" );
+
+	BuildingSplit ret;
+	ret.meshesBefore = aModel.meshes.size();
+
+	float lowest = std::numeric_limits<float>::max();
+	for( auto const& pos : aModel.vertexPositions )
+		lowest = std::min( lowest, pos.y );
+
+	float const ground = lowest + aGroundHeight;
+
+	// Connect the triangles above the ground through their positions. The
+	// triangles of a mesh are consecutive vertex triples.
+	DisjointSets_ sets;
+	std::unordered_map<glm::vec3, std::uint32_t, PositionHash_> ids;
+
+	auto const id_of = [&]( glm::vec3 aPos ) {
+		aPos += glm::vec3( 0.f ); // -0 == 0
+		auto const [it, added] = ids.emplace( aPos, 0 );
+		if( added )
+			it->second = sets.add();
+		return it->second;
+	};
+
+	std::size_t const triangleCount = aModel.vertexPositions.size() / 3;
+	std::vector<std::uint32_t> triangleSets( triangleCount, ~std::uint32_t(0) );
+
+	for( auto const& mesh : aModel.meshes )
+	{
+		for( std::size_t i = 0; i + 3 <= mesh.numberOfVertices; i += 3 )
+		{
+			std::size_t const first = mesh.vertexStartIndex + i;
+			glm::vec3 const* v = &aModel.vertexPositions[first];
+
+			if( v[0].y <= ground && v[1].y <= ground && v[2].y <= ground )
+				continue;
+
+			std::uint32_t const a = id_of( v[0] );
+			sets.join( a, id_of( v[1] ) );
+			sets.join( a, id_of( v[2] ) );
+
+			triangleSets[first / 3] = a;
+		}
+	}
+
+	// Parts that are high enough become buildings, in the order in which
+	// they first appear
+	struct Part_
+	{
+		glm::vec3 min{ std::numeric_limits<float>::max() };
+		glm::vec3 max{ std::numeric_limits<float>::lowest() };
+		std::uint32_t triangles = 0;
+		std::int32_t building = -1;
+	};
+
+	std::unordered_map<std::uint32_t, Part_> parts;
+	std::vector<std::uint32_t> partOrder;
+
+	for( std::size_t t = 0; t < triangleCount; ++t )
+	{
+		if( ~std::uint32_t(0) == triangleSets[t] )
+			continue;
+
+		std::uint32_t const root = sets.find( triangleSets[t] );
+		triangleSets[t] = root;
+
+		auto const [it, added] = parts.emplace( root, Part_{} );
+		if( added )
+			partOrder.emplace_back( root );
+
+		auto& part = it->second;
+		for( std::size_t k = 0; k < 3; ++k )
+		{
+			part.min = glm::min( part.min, aModel.vertexPositions[3*t+k] );
+			part.max = glm::max( part.max, aModel.vertexPositions[3*t+k] );
+		}
+		++part.triangles;
+	}
+
+	for( auto const root : partOrder )
+	{
+		auto& part = parts[root];
+		if( part.max.y - lowest < aMinHeight )
+			continue;
+
+		part.building = std::int32_t(ret.buildings.size());
+		ret.buildings.emplace_back( ImpostorBuilding{ part.min, part.max, part.triangles, std::uint32_t(ret.buildings.size()) * aViewCount } );
+	}
+
+	auto const building_of = [&]( std::size_t aTriangle ) {
+		if( ~std::uint32_t(0) == triangleSets[aTriangle] )
+			return std::int32_t(-1);
+		return parts[triangleSets[aTriangle]].building;
+	};
+
+	// Rebuild the meshes: the ground part of each first, then one mesh per
+	// building that uses it. Normals and texture coordinates follow the
+	// positions, where the model has them.
+	bool const haveNormals = aModel.vertexNormals.size() == aModel.vertexPositions.size();
+	bool const haveTexCoords = aModel.vertexTextureCoords.size() == aModel.vertexPositions.size();
+
+	std::vector<MeshInfo> meshes;
+	std::vector<glm::vec3> positions, normals;
+	std::vector<glm::vec2> texCoords;
+
+	positions.reserve( aModel.vertexPositions.size() );
+
+	std::vector<std::vector<std::size_t>> groups( ret.buildings.size() + 1 ); // ground, then per building
+	for( auto const& mesh : aModel.meshes )
+	{
+		for( auto& group : groups )
+			group.clear();
+
+		for( std::size_t i = 0; i + 3 <= mesh.numberOfVertices; i += 3 )
+		{
+			std::size_t const t = (mesh.vertexStartIndex + i) / 3;
+			groups[building_of( t ) + 1].emplace_back( t );
+		}
+
+		for( std::size_t g = 0; g < groups.size(); ++g )
+		{
+			if( groups[g].empty() )
+				continue;
+
+			MeshInfo info;
+			info.meshName = mesh.meshName;
+			info.materialIndex = mesh.materialIndex;
+			info.vertexStartIndex = positions.size();
+			info.numberOfVertices = groups[g].size() * 3;
+
+			if( g > 0 )
+				info.meshName += "#building" + std::to_string( g - 1 );
+
+			for( auto const t : groups[g] )
+			{
+				for( std::size_t k = 0; k < 3; ++k )
+				{
+					positions.emplace_back( aModel.vertexPositions[3*t+k] );
+					if( haveNormals )
+						normals.emplace_back( aModel.vertexNormals[3*t+k] );
+					if( haveTexCoords )
+						texCoords.emplace_back( aModel.vertexTextureCoords[3*t+k] );
+				}
+			}
+
+			meshes.emplace_back( std::move(info) );
+			ret.meshBuildings.emplace_back( std::int32_t(g) - 1 );
+
+			if( 0 == g )
+				ret.groundTriangles += groups[g].size();
+		}
+	}
+
+	aModel.meshes = std::move(meshes);
+	aModel.vertexPositions = std::move(positions);
+	if( haveNormals )
+		aModel.vertexNormals = std::move(normals);
+	if( haveTexCoords )
+		aModel.vertexTextureCoords = std::move(texCoords);
+
+	return ret;
+}
+
+glm::mat4 make_impostor_view( ImpostorBuilding const& aBuilding, std::uint32_t aView, std::uint32_t aViewCount )
+{
+	glm::vec3 const center = 0.5f * (aBuilding.min + aBuilding.max);
+	glm::vec3 const extent = aBuilding.max - aBuilding.min;
+
+	float const halfWidth = 0.5f * glm::length( glm::vec2( extent.x, extent.z ) );
+	float const halfHeight = 0.5f * extent.y;
+	float const radius = 0.5f * glm::length( extent );
+
+	float const angle = 6.28318530718f * float(aView) / float(aViewCount);
+	glm::vec3 const dir( std::sin( angle ), 0.f, std::cos( angle ) );
+
+	// The eye is just outside of the bounding sphere
+	glm::mat4 const view = glm::lookAt( center + dir * (radius + 1.f), center, glm::vec3( 0.f, 1.f, 0.f ) );
+
+	// As update_scene_uniforms() in main.cpp: Y is mirrored, so that the
+	// top of the building is in the first row of the tile
+	glm::mat4 proj = glm::orthoRH_ZO( -halfWidth, halfWidth, -halfHeight, halfHeight, 1.f, 1.f + 2.f * radius );
+	proj[1][1] *= -1.f;
+
+	return proj * view;
+}
+
+void select_impostors( std::vector<ImpostorBuilding> const& aBuildings, std::vector<glm::mat4> const& aInstances, glm::vec3 const& aCamera, float aSwitchDistance, std::uint32_t aViewCount, ImpostorSelection& aSelection )
+{
+	aSelection.impostor.assign( aInstances.size() * aBuildings.size(), 0 );
+	aSelection.instances.clear();
+
+	for( std::size_t inst = 0; inst < aInstances.size(); ++inst )
+	{
+		glm::mat4 const& model = aInstances[inst];
+
+		float const scale = glm::length( glm::vec3( model[0] ) );
+		float const yaw = std::atan2( -model[0].z, model[0].x );
+
+		for( std::size_t b = 0; b < aBuildings.size(); ++b )
+		{
+			auto const& building = aBuildings[b];
+
+			// Distance to the world space bounds of the building
+			glm::vec3 lo( std::numeric_limits<float>::max() ), hi( std::numeric_limits<float>::lowest() );
+			for( int corner = 0; corner < 8; ++corner )
+			{
+				glm::vec3 const pos(
+					(corner & 1) ? building.max.x : building.min.x,
+					(corner & 2) ? building.max.y : building.min.y,
+					(corner & 4) ? building.max.z : building.min.z
+				);
+
+				glm::vec3 const world = glm::vec3( model * glm::vec4( pos, 1.f ) );
+				lo = glm::min( lo, world );
+				hi = glm::max( hi, world );
+			}
+
+			if( glm::length( aCamera - glm::clamp( aCamera, lo, hi ) ) < aSwitchDistance )
+				continue;
+
+			aSelection.impostor[inst * aBuildings.size() + b] = 1;
+
+			glm::vec3 const extent = building.max - building.min;
+			glm::vec3 const center = glm::vec3( model * glm::vec4( 0.5f * (building.min + building.max), 1.f ) );
+
+			ImpostorInstance impostor{};
+			impostor.center = glm::vec4( center, 0.5f * glm::length( glm::vec2( extent.x, extent.z ) ) * scale );
+			impostor.halfHeight = 0.5f * extent.y * scale;
+			impostor.yaw = yaw;
+			impostor.firstLayer = building.firstLayer;
+			impostor.viewCount = aViewCount;
+
+			aSelection.instances.emplace_back( impostor );
+		}
+	}
+}
+
+ImpostorAtlas create_impostor_atlas( lut::VulkanContext const& aContext, lut::Allocator const& aAllocator, std::uint32_t aLayerCount, std::uint32_t aTileSize, VkFormat aFormat )
+{
+	VkPhysicalDeviceProperties props{};
+	vkGetPhysicalDeviceProperties( aContext.physicalDevice, &props );
+
+	if( aLayerCount > props.limits.maxImageArrayLayers )
+	{
+		throw lut::Error( "Impostor atlas needs %u layers, but the device supports at most %u\n"
+			"Use fewer views (--impostor-views)", aLayerCount, props.limits.maxImageArrayLayers
+		);
+	}
+
+	ImpostorAtlas ret;
+	ret.tileSize = aTileSize;
+	ret.layerCount = aLayerCount;
+	ret.mipLevels = lut::compute_mip_level_count( aTileSize, aTileSize );
+
+	ret.image = lut::create_image_texture2d( aAllocator, aTileSize, aTileSize, aFormat,
+		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		lut::MemoryCategory::texture, ret.mipLevels, 0, aLayerCount
+	);
+
+	ret.view = lut::create_image_view_texture2d_array( aContext, ret.image.image, aFormat );
+
+	// Attachments must be views of a single level
+	for( std::uint32_t layer = 0; layer < aLayerCount; ++layer )
+	{
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = ret.image.image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = aFormat;
+		viewInfo.components = VkComponentMapping{};
+		viewInfo.subresourceRange = VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, layer, 1 };
+
+		VkImageView view = VK_NULL_HANDLE;
+		if( auto const res = vkCreateImageView( aContext.device, &viewInfo, nullptr, &view ); VK_SUCCESS != res )
+		{
+			throw lut::Error( "Unable to create impostor layer view\n"
+				"vkCreateImageView() returned %s", lut::to_string(res).c_str()
+			);
+		}
+
+		ret.layerViews.emplace_back( aContext.device, view );
+	}
+
+	// Tiles are sampled right up to their edges, which must not wrap around
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.minLod = 0.f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	VkSampler sampler = VK_NULL_HANDLE;
+	if( auto const res = vkCreateSampler( aContext.device, &samplerInfo, nullptr, &sampler ); VK_SUCCESS != res )
+	{
+		throw lut::Error( "Unable to create impostor sampler\n"
+			"vkCreateSampler() returned %s", lut::to_string(res).c_str()
+		);
+	}
+
+	ret.sampler = lut::Sampler( aContext.device, sampler );
+
+	return ret;
+}
+
+void record_impostor_mips( VkCommandBuffer aCmdBuff, ImpostorAtlas const& aAtlas )
+{
+	std::uint32_t const layers = aAtlas.layerCount;
+
+	if( aAtlas.mipLevels > 1 )
+	{
+		lut::image_barrier( aCmdBuff, aAtlas.image.image,
+			0,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 1, aAtlas.mipLevels - 1, 0, layers }
+		);
+	}
+
+	// One blit per level covers all layers. Transparent texels are black, so
+	// the filtered colors are premultiplied by alpha (see impostor.frag).
+	std::int32_t size = std::int32_t(aAtlas.tileSize);
+	for( std::uint32_t level = 0; level + 1 < aAtlas.mipLevels; ++level )
+	{
+		std::int32_t const next = std::max( size / 2, 1 );
+
+		VkImageBlit blit{};
+		blit.srcOffsets[1] = { size, size, 1 };
+		blit.srcSubresource = VkImageSubresourceLayers{ VK_IMAGE_ASPECT_COLOR_BIT, level, 0, layers };
+		blit.dstOffsets[1] = { next, next, 1 };
+		blit.dstSubresource = VkImageSubresourceLayers{ VK_IMAGE_ASPECT_COLOR_BIT, level + 1, 0, layers };
+
+		vkCmdBlitImage( aCmdBuff, aAtlas.image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, aAtlas.image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR );
+
+		lut::image_barrier( aCmdBuff, aAtlas.image.image,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, level + 1, 1, 0, layers }
+		);
+
+		size = next;
+	}
+
+	lut::image_barrier( aCmdBuff, aAtlas.image.image,
+		VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_ACCESS_SHADER_READ_BIT,
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, aAtlas.mipLevels, 0, layers }
+	);
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "model.hpp"
+
+#include "../labutils/vkobject.hpp"
+#include "../labutils/vkimage.hpp"
+#include "../labutils/allocator.hpp"
+#include "../labutils/vulkan_context.hpp"
+
+/* Billboard impostors for distant buildings (see --impostors in main.cpp).
+ *
+ * city.obj has no per-building meshes (one mesh per material), so buildings
+ * are found at load time: split_buildings() takes the connected parts of
+ * the geometry above the ground (triangles are connected if they share
+ * vertex positions), and gives each building its own mesh per material.
+ * The ground stays in the remaining meshes, and is always drawn.
+ *
+ * Each building is rendered from several directions around the vertical
+ * axis, with an orthographic projection that fits its bounds (see
+ * make_impostor_view()), into the layers of an array image: the impostor
+ * atlas, with one layer per building and view. Texels that the building
+ * doesn't cover stay transparent.
+ *
+ * Instances of a building that are at least the switch distance away from
+ * the camera are drawn as a quad instead (see select_impostors()). The
+ * quad stands at the center of the building, turns about the vertical axis
+ * to face the camera, and samples the view that is closest to the
+ * direction of the camera (shaders/impostor.vert).
+ */
+struct ImpostorBuilding
+{
+	glm::vec3 min, max; // model space
+	std::uint32_t triangleCount;
+
+	std::uint32_t firstLayer; // in the atlas; one layer per view, in order
+};
+
+struct BuildingSplit
+{
+	std::vector<ImpostorBuilding> buildings;
+
+	// Per mesh of the model after splitting: index into buildings, or -1
+	std::vector<std::int32_t> meshBuildings;
+
+	std::size_t groundTriangles = 0;
+	std::size_t meshesBefore = 0;
+};
+
+// Finds the buildings of aModel, and splits its meshes so that each
+// building's triangles of a mesh are a mesh of their own. Triangles no
+// higher than aGroundHeight above the lowest vertex are ground, as are
+// parts lower than aMinHeight. Buildings get aViewCount layers each.
+BuildingSplit split_buildings( ModelData& aModel, float aGroundHeight, float aMinHeight, std::uint32_t aViewCount );
+
+// Maps the building (model space) to the clip space of view aView, which
+// looks at the building's center from the direction (sin a, 0, cos a),
+// where a = 2 pi aView / aViewCount. The view is as wide as the building's
+// bounds in the XZ plane from any direction, and as high as its bounds.
+glm::mat4 make_impostor_view( ImpostorBuilding const&, std::uint32_t aView, std::uint32_t aViewCount );
+
+// One impostor quad, as shaders/impostor.vert reads it (per instance)
+struct ImpostorInstance
+{
+	glm::vec4 center; // world space; w = half width
+	float halfHeight;
+	float yaw; // of the model instance, since views are in model space
+	std::uint32_t firstLayer;
+	std::uint32_t viewCount;
+};
+
+static_assert( 32 == sizeof(ImpostorInstance) );
+
+struct ImpostorSelection
+{
+	// Per model instance and building (instance * buildings + building):
+	// non-zero if drawn as an impostor
+	std::vector<std::uint8_t> impostor;
+
+	std::vector<ImpostorInstance> instances;
+};
+
+// Selects the building instances whose (world space) bounds are at least
+// aSwitchDistance away from aCamera. aInstances are the model matrices of
+// the split model, which may rotate it about the Y axis and scale it
+// uniformly.
+void select_impostors(
+	std::vector<ImpostorBuilding> const&,
+	std::vector<glm::mat4> const& aInstances,
+	glm::vec3 const& aCamera,
+	float aSwitchDistance,
+	std::uint32_t aViewCount,
+	ImpostorSelection&
+);
+
+struct ImpostorAtlas
+{
+	labutils::Image image;
+	labutils::ImageView view; // all layers and levels, for sampling
+	std::vector<labutils::ImageView> layerViews; // level 0 of each layer, to render to
+	labutils::Sampler sampler; // clamps to the edges of the tiles
+
+	std::uint32_t tileSize = 0;
+	std::uint32_t layerCount = 0;
+	std::uint32_t mipLevels = 0;
+};
+
+// An array image of aLayerCount square tiles, with full mip chains
+ImpostorAtlas create_impostor_atlas( labutils::VulkanContext const&, labutils::Allocator const&, std::uint32_t aLayerCount, std::uint32_t aTileSize, VkFormat );
+
+// Generates the mip chains of all layers with linear blits. Expects level 0
+// in TRANSFER_SRC_OPTIMAL, with its writes visible to transfer reads (e.g.,
+// by the render pass's external dependency), and leaves all levels in
+// SHADER_READ_ONLY_OPTIMAL.
+void record_impostor_mips( VkCommandBuffer, ImpostorAtlas const& );
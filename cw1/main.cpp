@@ -2,21 +2,28 @@
 
 #include <iostream>
 
+#include <map>
 #include <tuple>
 #include <chrono>
 #include <limits>
+#include <string>
 #include <vector>
+#include <algorithm>
 #include <stdexcept>
 
+#include <cmath>
 #include <cstdio>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 
+#include <stb_image_write.h>
+
 #define PI 3.14159265359 //Used for calculating mouse-camera movement, as well as right and left movement directions
 
 #if !defined(GLM_FORCE_RADIANS)
@@ -35,13 +42,32 @@ using namespace labutils::literals;
 #include "../labutils/error.hpp"
 #include "../labutils/vkutil.hpp"
 #include "../labutils/vkimage.hpp"
+#include "../labutils/ktx2.hpp"
+#include "../labutils/mipgen.hpp"
+#include "../labutils/hzb.hpp"
+#include "../labutils/atlas.hpp"
+#include "../labutils/texture_streamer.hpp"
+#include "../labutils/staging_ring.hpp"
 #include "../labutils/vkobject.hpp"
 #include "../labutils/vkbuffer.hpp"
 #include "../labutils/allocator.hpp" 
+#include "../labutils/gpu_profiler.hpp"
+#include "../labutils/trace.hpp"
+#include "../labutils/parallel.hpp"
 namespace lut = labutils;
 
 #include "model.hpp"
+#include "benchmark.hpp"
 #include "vertex_data.hpp"
+#include "upload_benchmark.hpp"
+#include "scene_graph_benchmark.hpp"
+#include "scene_file.hpp"
+#include "occlusion_cull.hpp"
+#include "soft_occlusion.hpp"
+#include "soft_occlusion_benchmark.hpp"
+#include "vertex_pulling.hpp"
+#include "cell_pager.hpp"
+#include "impostor.hpp"
 
 namespace
 {
@@ -54,6 +80,15 @@ namespace
 		constexpr char const* kFragShaderPath = SHADERDIR_ "default.frag.spv";
 		constexpr char const* kTexVertShaderPath = SHADERDIR_ "texture.vert.spv"; // Additional Shaders used for textured objects
 		constexpr char const* kTexFragShaderPath = SHADERDIR_ "texture.frag.spv";
+		constexpr char const* kDepthVertShaderPath = SHADERDIR_ "depth.vert.spv";
+		constexpr char const* kPullVertShaderPath = SHADERDIR_ "default_pull.vert.spv"; // see cfg::vertexPulling
+		constexpr char const* kTexPullVertShaderPath = SHADERDIR_ "texture_pull.vert.spv";
+		constexpr char const* kDepthPullVertShaderPath = SHADERDIR_ "depth_pull.vert.spv";
+		constexpr char const* kMipGenShaderPath = SHADERDIR_ "mipgen.comp.spv";
+		constexpr char const* kHzbShaderPath = SHADERDIR_ "hzb.comp.spv";
+		constexpr char const* kMeshletCullShaderPath = SHADERDIR_ "meshlet_cull.comp.spv";
+		constexpr char const* kImpostorVertShaderPath = SHADERDIR_ "impostor.vert.spv"; // see cfg::impostors
+		constexpr char const* kImpostorFragShaderPath = SHADERDIR_ "impostor.frag.spv";
 #		undef SHADERDIR_
 
 #		define SCENEDIR_ "assets/cw1/scenes/"
@@ -83,10 +118,510 @@ namespace
 		/////////////////////////////////////
 
 		constexpr VkFormat kDepthFormat = VK_FORMAT_D32_SFLOAT;
+
+		// Headless mode renders into an offscreen image instead of a swap
+		// chain. It only needs a VulkanContext (no GLFW window or surface), so
+		// it also runs on software implementations such as lavapipe or
+		// SwiftShader (select these via VK_ICD_FILENAMES). See parse_options().
+		constexpr VkFormat kOffscreenFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+		bool headless = false;
+		VkExtent2D headlessExtent{ 1280, 720 };
+
+		// Frames are written to this path (PNG, or PPM if the path ends in
+		// ".ppm"). A "%u" in the path is replaced by the frame index (see
+		// capture_path()); without it, only the final frame is written. The
+		// path may contain no other '%'.
+		std::string capturePath;
+
+		// Number of frames to render before exiting. Zero selects the
+		// default, see frame_count().
+		std::uint32_t frameCount = 0;
+
+		// Benchmark mode replays a camera path (see benchmark.hpp) instead of
+		// using keyboard/mouse input, and reports frame time statistics. The
+		// first benchmarkWarmup frames are not included in the statistics.
+		bool benchmark = false;
+		std::string benchmarkPath; // empty = built-in path
+		std::string benchmarkReport; // .csv (summary) or .json (summary and per-frame timings)
+		std::uint32_t benchmarkWarmup = 10;
+
+		constexpr std::uint32_t kDefaultBenchmarkFrames = 600;
+
+		// Record the camera path of an interactive session to this file
+		std::string recordPath;
+		constexpr double kRecordInterval = 0.1; // seconds between keys
+
+		// Write a Chrome trace (JSON) of the CPU side to this path on exit.
+		// See labutils/trace.hpp.
+		std::string tracePath;
+
+		// Print per-scope GPU times (see labutils/gpu_profiler.hpp)
+		bool gpuProfile = false;
+		constexpr double kGpuReportInterval = 2.0; // seconds
+
+		// Print GPU memory statistics after loading, and on exit. If a path
+		// is given, also write VMA's detailed JSON dump of each, with the
+		// phase inserted before the extension (e.g., "mem.after-loading.json"
+		// and "mem.on-exit.json" for "mem.json").
+		bool memoryStats = false;
+		std::string memoryStatsPath;
+
+		// Block compress textures on load (see labutils/bcenc.hpp). Falls
+		// back to uncompressed textures if the device lacks support.
+		bool compressTextures = false;
+		lut::BcFormat textureFormat = lut::BcFormat::bc7;
+		lut::BcQuality textureQuality = lut::BcQuality::normal;
+
+		// Load textures from pre-baked KTX2 files (see cw1-bake) where they
+		// exist. For a texture 'name.jpg', this looks for 'name.ktx2'. Files
+		// in formats that the device can't sample are skipped.
+		bool preferKtx2 = false;
+
+		// Generate mip chains on the CPU (see labutils/mipmap.hpp) instead of
+		// with GPU blits. The filter is also used for the mip chains of block
+		// compressed textures, which are always generated on the CPU.
+		bool cpuMips = false;
+		lut::MipFilter mipFilter = lut::MipFilter::box;
+
+		// Generate mip chains with a single compute dispatch per texture
+		// (see labutils/mipgen.hpp) instead of one blit per level. Textures
+		// are uploaded in one batch.
+		bool computeMips = false;
+
+		// Stream texture mip levels by camera distance (see
+		// labutils/texture_streamer.hpp). Only small levels are uploaded
+		// before the first frame. Takes precedence over the other texture
+		// loading options.
+		bool streamTextures = false;
+		std::uint32_t streamBudgetMiB = 256;
+
+		// Size of the staging ring that meshes and textures are uploaded
+		// through at startup (see labutils/staging_ring.hpp). Uploads that
+		// don't fit are split up.
+		std::uint32_t stagingRingMiB = 64;
+
+		// Write buffers directly where device memory is host visible (see
+		// StagingRing::create_device_buffer()), instead of staging them
+		bool directUploads = true;
+
+		// Measure upload throughput with and without staging, then exit
+		// (see upload_benchmark.hpp)
+		bool uploadBenchmark = false;
+
+		// Time updates of a large transform hierarchy, then exit (see
+		// scene_graph_benchmark.hpp)
+		bool sceneGraphBenchmark = false;
+
+		// Pack small textures into a shared atlas (see labutils/atlas.hpp),
+		// and remap the texture coordinates of the meshes that use them.
+		// Only textures whose meshes don't repeat them (texture coordinates
+		// in [0,1]) are packed. Not used with compressed or streamed
+		// textures, or for textures loaded from KTX2 files.
+		bool atlasTextures = false;
+		lut::AtlasConfig atlasConfig;
+
+		constexpr float kAtlasUvTolerance = 1e-3f; // accepted outside of [0,1], clamped
+
+		// Load textures of equal size into the layers of shared 2D array
+		// images (see load_image_texture2d_array()), which meshes select
+		// per draw. Applies to the textures that are loaded with GPU blits
+		// or compute mips otherwise, and takes precedence over the latter.
+		bool textureArrays = false;
+		constexpr std::uint32_t kTextureArrayMinLayers = 2;
+
+		// Merge meshes with the same material at load time (see MeshMerge
+		// in model.hpp), for fewer draw calls
+		MeshMerge meshMerge = MeshMerge::none;
+
+		// Scene description with the placements of the models (see
+		// scene_file.hpp). Without one, each model is drawn once, as
+		// authored.
+		std::string scenePath;
+
+		// Index the meshes and split them into meshlets (see meshlet.hpp).
+		// Each frame, meshlets outside of the view frustum or facing away
+		// from the camera are culled on the CPU, and the rest are drawn with
+		// indexed indirect draws. Needs drawIndirectFirstInstance, as the
+		// draws select their instance with firstInstance.
+		bool meshlets = false;
+		MeshletLimits meshletLimits;
+
+		// Cull the meshlets on the GPU instead, including ones hidden behind
+		// others, with a depth pyramid (see occlusion_cull.hpp). Implies
+		// meshlets. Falls back to CPU culling if the device lacks
+		// multiDrawIndirect or drawIndirectFirstInstance, or can't sample
+		// the depth buffer.
+		bool occlusionCulling = false;
+
+		// Cull mesh instances that are hidden behind the city's large
+		// polygons (of at least softOccluderMinArea square metres), with a
+		// small depth buffer that is rasterized on the CPU (see
+		// soft_occlusion.hpp). Not used with meshlets, which are culled on
+		// their own.
+		bool softOcclusion = false;
+		float softOccluderMinArea = 2.f;
+		constexpr std::uint32_t kSoftOcclusionWidth = 320;
+		constexpr std::uint32_t kSoftOcclusionHeight = 160;
+
+		// Time software occlusion culling and compare it to a higher
+		// resolution reference, then exit (see soft_occlusion_benchmark.hpp)
+		bool softOcclusionBenchmark = false;
+
+		// Draw the scene's depth first, with positions only and no fragment
+		// shader, then shade it with an equal depth test, so that each pixel
+		// is shaded (and textured) only once. Toggled with Z.
+		bool depthPrepass = false;
+
+		// Count fragment shader invocations with a pipeline statistics query
+		// each frame, if the device supports them
+		bool fragmentStats = false;
+
+		// Read vertices in the vertex shaders from storage buffers shared by
+		// all meshes, in a compact format, instead of from per-mesh vertex
+		// buffers (see vertex_pulling.hpp). Not used with meshlets, which
+		// are drawn with their own index buffers.
+		bool vertexPulling = false;
+
+		// Page the city in from a cell pack (see cw1-bake --cells) around
+		// the camera, instead of loading all of city.obj (see
+		// cell_pager.hpp). At most pageBudgetMiB of its geometry is kept in
+		// device memory. Cells within pageRadius of the camera, or of where
+		// it will be in pagePrefetch seconds, are loaded. Not used with
+		// meshlets, software occlusion culling, vertex pulling, atlases or
+		// texture streaming, which need all of the city's vertices at
+		// startup.
+		std::string cellPackPath;
+		std::uint32_t pageBudgetMiB = 64;
+		float pageRadius = kCameraFar;
+		float pagePrefetch = 2.f;
+
+		// Draw buildings that are at least impostorDistance away from the
+		// camera as camera-facing quads (see impostor.hpp). At startup, each
+		// building is rendered from impostorViews directions into an atlas,
+		// at impostorSize x impostorSize texels per view. Not used with
+		// meshlets, software occlusion culling, vertex pulling, cell paging
+		// or texture streaming, which draw the city's meshes their own way.
+		bool impostors = false;
+		float impostorDistance = 60.f;
+		std::uint32_t impostorViews = 8;
+		std::uint32_t impostorSize = 256;
+
+		constexpr float kImpostorGroundHeight = 0.5f; // see split_buildings()
+		constexpr float kImpostorMinHeight = 2.f;
+		constexpr VkFormat kImpostorFormat = VK_FORMAT_R8G8B8A8_SRGB;
 	}
 
 
 	// Local types/structures:
+	struct InstanceRange
+	{
+		std::uint32_t first, count; // in SceneResources::instances
+	};
+
+	struct IndirectRange
+	{
+		VkDeviceSize offset; // bytes, into MeshletDraws::commands
+		std::uint32_t count;
+	};
+
+	// Indirect draws of the visible meshlets (see cfg::meshlets), written by
+	// cull_scene_meshlets() for each frame
+	struct MeshletDraws
+	{
+		VkBuffer commands = VK_NULL_HANDLE; // of the current frame slot
+		bool multiDraw = false; // see VulkanContext::haveMultiDrawIndirect
+
+		std::vector<VkBuffer> indexBuffers; // per colored mesh
+		std::vector<VkBuffer> texIndexBuffers; // per textured mesh
+
+		std::vector<IndirectRange> draws; // per colored mesh
+		std::vector<IndirectRange> texDraws; // per textured mesh
+	};
+
+	// With occlusion culling, a frame is drawn in two render passes: the
+	// first clears the attachments and leaves them to be read by the depth
+	// pyramid and loaded by the second
+	enum class PassPart
+	{
+		whole,
+		first,
+		second
+	};
+
+	// Depth test of the shading pipelines. After the depth pre-pass, depth
+	// is final, and only the nearest fragments pass.
+	enum class DepthTest
+	{
+		write, // less or equal, and write
+		equal // equal, without writes
+	};
+
+	// Vertex pulling (see cfg::vertexPulling), for record_commands()
+	struct PulledDraws
+	{
+		VkDescriptorSet descriptors; // set 2, see create_pulled_geometry_layout()
+		std::vector<PulledMesh> draws; // per colored mesh
+		std::vector<PulledMesh> texDraws; // per textured mesh
+	};
+
+	// Depth pre-pass (see cfg::depthPrepass), for record_commands()
+	struct DepthPrepass
+	{
+		VkPipeline depthPipe; // positions only, see create_depth_pipeline()
+		VkPipeline pipe, texPipe; // DepthTest::equal
+	};
+
+	// Fragment shader invocations (see cfg::fragmentStats), one query per
+	// frame slot
+	struct FragmentCounter
+	{
+		lut::QueryPool pool;
+		std::vector<int> pending; // per slot: -1 if none, or whether the pre-pass was on
+	};
+
+	// For record_commands()
+	struct FragmentQuery
+	{
+		VkQueryPool pool;
+		std::uint32_t slot;
+	};
+
+	// Accumulated by collect_fragment_counts(), without and with the
+	// depth pre-pass
+	struct FragmentTotals
+	{
+		std::uint64_t frames[2]{};
+		std::uint64_t invocations[2]{};
+		std::uint64_t pixels[2]{};
+	};
+
+	// Two-phase occlusion culling (see cfg::occlusionCulling), for
+	// record_commands()
+	struct OcclusionPass
+	{
+		OcclusionCuller* culler;
+		lut::DepthPyramidBuilder const* builder;
+		lut::DepthPyramid const* pyramid;
+		VkRenderPass latePass; // PassPart::second; uses the same framebuffer
+		std::uint32_t frameSlot;
+		OcclusionCullView view;
+	};
+
+	// Accumulated from read_occlusion_stats()
+	struct OcclusionTotals
+	{
+		OcclusionCullStats cull;
+		std::uint64_t frames = 0;
+	};
+
+	// Instances of each mesh to draw, as runs of consecutive instances.
+	// Written for each frame by cull_scene_soft() (the visible instances,
+	// see cfg::softOcclusion) or select_scene_impostors() (the instances
+	// that aren't impostors, see cfg::impostors).
+	struct InstanceRuns
+	{
+		std::vector<std::vector<InstanceRange>> draws; // per colored mesh
+		std::vector<std::vector<InstanceRange>> texDraws; // per textured mesh
+	};
+
+	// Accumulated by cull_scene_soft()
+	struct SoftCullTotals
+	{
+		SoftRasterStats raster;
+		std::uint64_t instances = 0, outside = 0, occluded = 0; // of meshes, tested
+		std::uint64_t frames = 0;
+		double rasterMs = 0.0, testMs = 0.0; // CPU
+	};
+
+	// Impostors (see cfg::impostors), for record_commands()
+	struct ImpostorDraws
+	{
+		VkPipeline pipe; // see create_impostor_pipeline()
+		VkDescriptorSet atlas; // set 1
+		VkBuffer instances; // of the current frame slot
+		std::uint32_t count;
+	};
+
+	// Accumulated by select_scene_impostors(), and from the DrawStats of
+	// each frame
+	struct ImpostorTotals
+	{
+		std::uint64_t frames = 0;
+		std::uint64_t impostors = 0, buildingInstances = 0;
+		std::uint64_t draws = 0, triangles = 0;
+	};
+
+	// Accumulated by cull_scene_meshlets()
+	struct MeshletTotals
+	{
+		MeshletCullStats cull;
+		std::uint64_t frames = 0;
+		double cullMs = 0.0; // CPU
+	};
+
+	struct SceneResources
+	{
+		// Owning storage for the GPU meshes and textures
+		std::vector<ColorizedMesh> colorMeshes;
+		std::vector<ColorizedMesh> texMeshes;
+
+		std::vector<lut::Image> textures;
+		std::vector<lut::ImageView> textureViews;
+
+		// Handles passed to record_commands(). With cfg::cellPackPath, the
+		// city's entries are replaced by the chunks of its resident cells
+		// every frame (see update_city_paging()).
+		std::vector<VkBuffer> positionBuffers;
+		std::vector<VkBuffer> colorBuffers;
+		std::vector<std::uint32_t> vertexCounts;
+
+		std::vector<VkBuffer> texPositionBuffers;
+		std::vector<VkBuffer> texCoordBuffers;
+		std::vector<std::uint32_t> texVertexCounts;
+
+		std::vector<VkDescriptorSet> texDescriptors; // one per textured mesh
+		std::vector<std::uint32_t> texLayers; // array layer, per textured mesh
+
+		// Model matrices of all instances (see cfg::scenePath), as a vertex
+		// buffer with one element per instance. Each mesh is drawn once for
+		// all instances of its model.
+		lut::Buffer instances;
+		std::vector<InstanceRange> instanceRanges; // per colored mesh
+		std::vector<InstanceRange> texInstanceRanges; // per textured mesh
+
+		std::vector<glm::mat4> cityInstances; // see update_texture_streaming()
+
+		// With cfg::meshlets. Meshlets are culled for each instance.
+		std::vector<MeshletMesh const*> meshlets; // per colored mesh
+		std::vector<MeshletMesh const*> texMeshlets; // per textured mesh
+		std::vector<glm::mat4> instanceTransforms; // CPU copy of instances; also for cfg::softOcclusion
+
+		std::vector<lut::Buffer> indirectBuffers; // one per frame slot
+		std::uint32_t maxIndirectDraws = 0;
+		MeshletDraws meshletDraws;
+
+		// With cfg::softOcclusion, the city's instances are the occluders
+		SoftOccluders softOccluders;
+		SoftDepthBuffer softDepth;
+		std::vector<SoftBox> meshBoxes; // per colored mesh
+		std::vector<SoftBox> texMeshBoxes; // per textured mesh
+		InstanceRuns instanceRuns; // also for cfg::impostors
+
+		// With cfg::vertexPulling, all meshes are in pulledGeometry, and the
+		// per-mesh vertex buffers above are empty
+		PulledGeometry pulledGeometry;
+		PulledDraws pulledDraws;
+
+		// With cfg::atlasTextures, meshes with packed textures share the
+		// descriptor set of the atlas, and select their page by layer
+		lut::TextureAtlas atlas;
+		lut::ImageView atlasView;
+
+		// With cfg::streamTextures, textures are owned by the streamer, and
+		// texDescriptors is refreshed from it every frame
+		struct StreamedMesh
+		{
+			glm::vec3 center;
+			float radius;
+			float worldPerUv; // world-space length of one texture repeat
+			std::uint32_t texture;
+		};
+
+		lut::TextureStreamer textureStreamer;
+		std::vector<StreamedMesh> streamedMeshes; // one per textured mesh
+
+		// With cfg::cellPackPath. The city's meshes have no vertices of their
+		// own; their textures are loaded as usual.
+		CellPager cityPager;
+		std::size_t carMeshCount = 0; // colored meshes that come before the city's
+		InstanceRange cityInstanceRange{};
+		std::vector<std::int32_t> cityTexSlots; // per city mesh: index into cityTexDescriptors, or -1 if untextured
+		std::vector<VkDescriptorSet> cityTexDescriptors;
+		std::vector<std::uint32_t> cityTexLayers;
+
+		// With cfg::impostors, the city's meshes are split by building (see
+		// split_buildings()). The meshes of a building skip the instances
+		// in which it is an impostor (see instanceRuns).
+		std::vector<ImpostorBuilding> buildings;
+		std::vector<std::int32_t> meshBuildings; // per colored mesh: index into buildings, or -1
+		std::vector<std::int32_t> texMeshBuildings; // per textured mesh
+
+		ImpostorAtlas impostorAtlas;
+		VkDescriptorSet impostorSet = VK_NULL_HANDLE;
+		std::vector<lut::Buffer> impostorBuffers; // one per frame slot
+		ImpostorSelection impostorSelection;
+		std::uint32_t impostorCount = 0; // in the buffer of the current frame slot
+
+		// A frame without impostors, see report_impostor_stats()
+		std::uint64_t fullTriangles = 0;
+		std::uint32_t fullDraws = 0;
+	};
+
+	struct OffscreenTarget
+	{
+		VkExtent2D extent;
+
+		lut::Image color;
+		lut::ImageView colorView;
+
+		lut::Image depth;
+		lut::ImageView depthView;
+
+		lut::Framebuffer framebuffer;
+
+		// Host-visible copy of the color image, see record_commands()
+		lut::Buffer readback;
+	};
+
+	// Inputs of record_commands() for the optional modes, each null unless
+	// its mode is on. See make_frame_draw_options().
+	struct FrameDrawOptions
+	{
+		MeshletDraws const* meshlets = nullptr; // cfg::meshlets
+		OcclusionPass const* occlusion = nullptr; // cfg::occlusionCulling
+		InstanceRuns const* runs = nullptr; // cfg::softOcclusion or cfg::impostors
+		DepthPrepass const* prepass = nullptr; // cfg::depthPrepass
+		FragmentQuery const* fragments = nullptr; // cfg::fragmentStats
+		PulledDraws const* pulled = nullptr; // cfg::vertexPulling
+		ImpostorDraws const* impostors = nullptr; // cfg::impostors
+		OffscreenTarget const* capture = nullptr; // copy the color image to capture->readback
+	};
+
+	// Counted by record_commands()
+	struct DrawStats
+	{
+		std::uint32_t texturedDraws = 0;
+		std::uint32_t descriptorBinds = 0; // texture sets, see cfg::textureArrays
+		std::uint32_t vertexBufferBinds = 0; // see cfg::vertexPulling
+
+		// The late pass of cfg::occlusionCulling draws the textured meshes
+		// again, so its draws and binds are counted separately
+		std::uint32_t lateTexturedDraws = 0;
+		std::uint32_t lateDescriptorBinds = 0;
+
+		// Shaded draws and their triangles over all instances, without the
+		// depth pre-pass and meshlets (see report_meshlet_stats())
+		std::uint32_t draws = 0;
+		std::uint64_t triangles = 0;
+		std::uint32_t impostors = 0; // see cfg::impostors
+	};
+
+	struct BenchmarkState
+	{
+		CameraPath path;
+
+		std::uint32_t frames = 0; // total, including warm-up frames
+		std::uint32_t frame = 0; // number of frames started so far
+
+		std::chrono::steady_clock::time_point lastFrameStart;
+
+		// GPU times come from the profiler's "frame" scope. Profiler frames
+		// before this one are uploads or warm-up frames.
+		std::uint64_t firstGpuFrame = ~std::uint64_t(0);
+
+		FrameTimings timings;
+	};
 
 	// Local functions:
 	// GLFW callbacks
@@ -97,6 +632,9 @@ namespace
 	// Function that controls camera direction
 	void camera();
 
+	// Command line handling
+	void parse_options(int aArgc, char* aArgv[]);
+
 	// Uniform data
 	namespace glsl
 	{
@@ -113,16 +651,18 @@ namespace
 
 	}
 	// Helpers:
-	lut::RenderPass create_render_pass(lut::VulkanWindow const&);
-	
-	lut::DescriptorSetLayout create_scene_descriptor_layout(lut::VulkanWindow const&);
-	lut::DescriptorSetLayout create_object_descriptor_layout(lut::VulkanWindow const&);
+	lut::RenderPass create_render_pass(lut::VulkanContext const&, VkFormat aColorFormat, VkImageLayout aColorFinalLayout, PassPart = PassPart::whole);
+
+	lut::DescriptorSetLayout create_scene_descriptor_layout(lut::VulkanContext const&);
+	lut::DescriptorSetLayout create_object_descriptor_layout(lut::VulkanContext const&);
 
-	lut::PipelineLayout create_pipeline_layout(lut::VulkanContext const&, VkDescriptorSetLayout aSceneLayout, VkDescriptorSetLayout aObjectlayout);
-	lut::Pipeline create_pipeline(lut::VulkanWindow const&, VkRenderPass, VkPipelineLayout);
-	lut::Pipeline create_tex_pipeline(lut::VulkanWindow const&, VkRenderPass, VkPipelineLayout);
+	lut::PipelineLayout create_pipeline_layout(lut::VulkanContext const&, VkDescriptorSetLayout aSceneLayout, VkDescriptorSetLayout aObjectlayout, VkDescriptorSetLayout aGeometryLayout = VK_NULL_HANDLE);
+	lut::Pipeline create_pipeline(lut::VulkanContext const&, VkRenderPass, VkPipelineLayout, VkExtent2D const&, DepthTest = DepthTest::write);
+	lut::Pipeline create_tex_pipeline(lut::VulkanContext const&, VkRenderPass, VkPipelineLayout, VkExtent2D const&, DepthTest = DepthTest::write);
+	lut::Pipeline create_depth_pipeline(lut::VulkanContext const&, VkRenderPass, VkPipelineLayout, VkExtent2D const&);
+	lut::Pipeline create_impostor_pipeline(lut::VulkanContext const&, VkRenderPass, VkPipelineLayout, VkExtent2D const&);
 
-	std::tuple<lut::Image, lut::ImageView> create_depth_buffer(lut::VulkanWindow const&, lut::Allocator const&);
+	std::tuple<lut::Image, lut::ImageView> create_depth_buffer(lut::VulkanContext const&, lut::Allocator const&, VkExtent2D const&);
 
 	void create_swapchain_framebuffers(
 		lut::VulkanWindow const&,
@@ -131,6 +671,104 @@ namespace
 		VkImageView aDepthView
 	);
 
+	VkDescriptorSet create_scene_descriptors(lut::VulkanContext const&, VkDescriptorPool, VkDescriptorSetLayout, VkBuffer aSceneUBO);
+
+	SceneResources create_scene_resources(
+		lut::VulkanContext const&,
+		lut::Allocator const&,
+		VkDescriptorPool,
+		VkDescriptorSetLayout aObjectLayout,
+		VkDescriptorSetLayout aGeometryLayout, // with cfg::vertexPulling
+		VkSampler,
+		ModelData& aCarModel,
+		ModelData& aCityModel,
+		lut::GpuProfiler&,
+		std::uint32_t aFrameSlotCount // command buffers in flight
+	);
+
+	// Texture atlas (see cfg::atlasTextures). Packs the city's textures
+	// that can be packed, and remaps the meshes' texture coordinates.
+	// Returns the index of each packed texture's path in the atlas.
+	std::map<std::string, std::uint32_t> create_texture_atlas(SceneResources&, lut::VulkanContext const&, lut::StagingRing&, lut::Allocator const&, ModelData& aCityModel, lut::GpuProfiler&);
+
+	VkDescriptorSet create_texture_descriptor_set(lut::VulkanContext const&, VkDescriptorPool, VkDescriptorSetLayout, VkImageView, VkSampler);
+
+	// Texture streaming (see cfg::streamTextures)
+	void create_streamed_textures(SceneResources&, lut::VulkanContext const&, lut::Allocator const&, VkDescriptorSetLayout aObjectLayout, VkSampler, ModelData const& aCityModel, std::uint32_t aFrameSlotCount);
+
+	// Requests texture levels for the current camera and updates the
+	// streamer
+	void update_texture_streaming(SceneResources&, std::uint32_t aFrameSlot, std::uint32_t aFramebufferHeight, bool aWait);
+
+	// Cell paging (see cfg::cellPackPath). Takes over the city's entries in
+	// the draw lists of aScene.
+	void create_city_pager(SceneResources&, lut::VulkanContext const&, lut::Allocator const&, ModelData const& aCarModel, ModelData const& aCityModel, std::uint32_t aFrameSlotCount);
+
+	// Updates the pager for the current camera, and puts the chunks of the
+	// resident cells into the draw lists
+	void update_city_paging(SceneResources&, std::uint32_t aFrameSlot, bool aWait);
+
+	// Impostors (see cfg::impostors). Renders the buildings into the atlas
+	// with the scene's pipelines, and creates the per-frame buffers.
+	void create_impostors(SceneResources&, lut::VulkanContext const&, lut::Allocator const&, VkDescriptorPool, VkDescriptorSetLayout aSceneLayout, VkDescriptorSetLayout aObjectLayout, VkPipelineLayout, std::uint32_t aFrameSlotCount);
+
+	// Selects the impostors for the current camera, writes them to the
+	// frame slot's buffer, and updates aScene.instanceRuns
+	void select_scene_impostors(SceneResources&, lut::Allocator const&, std::uint32_t aFrameSlot, ImpostorTotals&);
+	void report_impostor_stats(ImpostorTotals const&, SceneResources const&);
+
+	// Meshlet culling (see cfg::meshlets). Writes the draws of the frame
+	// slot's indirect buffer, and updates aScene.meshletDraws.
+	void check_meshlet_support(lut::VulkanContext const&); // disables meshlets (and occlusion culling) if unsupported
+	void cull_scene_meshlets(SceneResources&, lut::Allocator const&, std::uint32_t aFrameSlot, glm::mat4 const& aProjCam, MeshletTotals&);
+	void report_meshlet_stats(MeshletTotals const&);
+
+	// Software occlusion culling (see cfg::softOcclusion). Rasterizes the
+	// occluders, and updates aScene.instanceRuns.
+	void cull_scene_soft(SceneResources&, glm::mat4 const& aProjCam, SoftCullTotals&);
+	void report_soft_cull_stats(SoftCullTotals const&);
+
+	// Occlusion culling (see cfg::occlusionCulling). The indirect draws of
+	// each mesh are the same range of the culler's command buffers in every
+	// frame, which is set in aScene.meshletDraws.
+	void check_occlusion_culling_support(lut::VulkanContext const&); // disables it if unsupported
+	OcclusionCuller create_scene_occlusion_culler(SceneResources&, lut::VulkanContext const&, lut::Allocator const&, std::uint32_t aFrameSlotCount);
+	void collect_occlusion_stats(OcclusionTotals&, lut::Allocator const&, OcclusionCuller&, std::uint32_t aFrameSlot);
+	void report_occlusion_stats(OcclusionTotals const&);
+
+	void check_fragment_stats_support(lut::VulkanContext const&); // disables them if unsupported
+	FragmentCounter create_fragment_counter(lut::VulkanContext const&, std::uint32_t aFrameSlotCount);
+	void collect_fragment_counts(FragmentTotals&, lut::VulkanContext const&, FragmentCounter&, std::uint32_t aFrameSlot, VkExtent2D const&);
+	void report_fragment_counts(FragmentTotals const&);
+
+	OffscreenTarget create_offscreen_target(
+		lut::VulkanContext const&,
+		lut::Allocator const&,
+		VkRenderPass,
+		VkExtent2D const&
+	);
+	void save_offscreen_frame(lut::Allocator const&, OffscreenTarget const&, char const* aPath);
+
+	int run_headless(ModelData& aCarModel, ModelData& aCityModel);
+
+	std::uint32_t frame_count();
+	std::string capture_path(std::uint32_t aFrame);
+
+	void report_memory_stats(lut::Allocator const&, char const* aWhen);
+
+	// Printed for the first frame
+	void report_draw_stats(DrawStats const&);
+
+	// Path of the baked KTX2 file for a texture, or an empty string if there
+	// is no such file or the device can't sample its format
+	std::string ktx2_path_for(lut::VulkanContext const&, char const* aTexturePath);
+
+	// Benchmark helpers
+	BenchmarkState create_benchmark_state();
+	bool begin_benchmark_frame(BenchmarkState&, lut::GpuProfiler const&); // false once all frames are done
+	void record_gpu_time(BenchmarkState&, char const* aScope, std::uint64_t aFrame, double aMs);
+	void finish_benchmark(BenchmarkState&, lut::GpuProfiler&);
+
 	void update_scene_uniforms(
 		glsl::SceneUniform&,
 		std::uint32_t aFramebufferWidth,
@@ -139,7 +777,7 @@ namespace
 
 	void update_cameraPos(glm::vec3& pos, glm::vec3, double, float);
 
-	void record_commands(
+	DrawStats record_commands(
 		VkCommandBuffer,
 		VkRenderPass,
 		VkFramebuffer,
@@ -152,12 +790,31 @@ namespace
 		std::vector<VkBuffer> aTexPositionBuffer,//Buffers for textured meshes. Same reasoning as above
 		std::vector<VkBuffer> ATexBuffer,
 		std::vector<std::uint32_t> aTexVertexCount,
+		VkBuffer aInstanceBuffer,
+		std::vector<InstanceRange> const& aInstances, // per colored mesh
+		std::vector<InstanceRange> const& aTexInstances, // per textured mesh
 		VkBuffer aSceneUBO,
 		glsl::SceneUniform const&,
 		VkPipelineLayout,
 		VkDescriptorSet aSceneDescriptors,
-		std::vector<VkDescriptorSet> aCityDescriptors // A descriptor for each texture
+		std::vector<VkDescriptorSet> aCityDescriptors, // A descriptor for each texture
+		std::vector<std::uint32_t> const& aCityLayers, // ... and the array layer in it
+		FrameDrawOptions const&,
+		lut::GpuProfiler&
+	);
+
+	// Points the options at the inputs of the modes enabled in cfg, which
+	// must outlive them
+	FrameDrawOptions make_frame_draw_options(
+		SceneResources const&,
+		OcclusionPass const&,
+		DepthPrepass const&,
+		FragmentQuery const&,
+		ImpostorDraws const&,
+		OffscreenTarget const* aCapture = nullptr
 	);
+	void draw_meshlets(VkCommandBuffer, MeshletDraws const&, VkBuffer aCommands, VkBuffer aIndices, IndirectRange const&);
+
 	void submit_commands(
 		lut::VulkanContext const&,
 		VkCommandBuffer,
@@ -167,11 +824,68 @@ namespace
 	);
 }
 
-int main() try
+int main(int aArgc, char* aArgv[]) try
 {
+	parse_options(aArgc, aArgv);
+
+	if (!cfg::tracePath.empty())
+	{
+		lut::trace_enable(true);
+		lut::trace_set_thread_name("main");
+	}
+
+	if (cfg::sceneGraphBenchmark)
+	{
+		run_scene_graph_benchmark();
+
+		if (!cfg::tracePath.empty())
+			lut::write_chrome_trace(cfg::tracePath.c_str());
+
+		return 0;
+	}
+
+	if (cfg::uploadBenchmark)
+	{
+		lut::VulkanContext context = lut::make_vulkan_context();
+		lut::Allocator allocator = lut::create_allocator(context);
+
+		run_upload_benchmark(context, allocator);
+
+		if (!cfg::tracePath.empty())
+			lut::write_chrome_trace(cfg::tracePath.c_str());
+
+		return 0;
+	}
+
+	if (cfg::softOcclusionBenchmark)
+	{
+		ModelData const city = load_obj_model(cfg::kCityScenePath, cfg::meshMerge);
+		run_soft_occlusion_benchmark(city, cfg::softOccluderMinArea, cfg::kSoftOcclusionWidth, cfg::kSoftOcclusionHeight);
+
+		if (!cfg::tracePath.empty())
+			lut::write_chrome_trace(cfg::tracePath.c_str());
+
+		return 0;
+	}
+
 	//Load models
-	ModelData model_car = load_obj_model(cfg::kCarScenePath);
-	ModelData model_city = load_obj_model(cfg::kCityScenePath);
+	// With cell paging, only the city's materials and meshes are known up
+	// front (the pack's index is small, and is read again by
+	// create_city_pager())
+	ModelData model_car = load_obj_model(cfg::kCarScenePath, cfg::meshMerge);
+	ModelData model_city = cfg::cellPackPath.empty()
+		? load_obj_model(cfg::kCityScenePath, cfg::meshMerge)
+		: make_cell_pack_model(load_cell_pack_index(cfg::cellPackPath.c_str()));
+
+	if (cfg::headless)
+	{
+		int const ret = run_headless(model_car, model_city);
+
+		if (!cfg::tracePath.empty())
+			lut::write_chrome_trace(cfg::tracePath.c_str());
+
+		return ret;
+	}
 	
 	// Create our Vulkan Window
 	lut::VulkanWindow window = lut::make_vulkan_window();
@@ -191,17 +905,41 @@ int main() try
 	// Create VMA allocator
 	lut::Allocator allocator = lut::create_allocator(window);
 
+	if (cfg::meshlets)
+		check_meshlet_support(window);
+	if (cfg::occlusionCulling)
+		check_occlusion_culling_support(window);
+
 	// Intialize resources
-	lut::RenderPass renderPass = create_render_pass(window);
+	PassPart const firstPart = cfg::occlusionCulling ? PassPart::first : PassPart::whole;
+	lut::RenderPass renderPass = create_render_pass(window, window.swapchainFormat, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, firstPart);
+
+	lut::RenderPass lateRenderPass;
+	if (cfg::occlusionCulling)
+		lateRenderPass = create_render_pass(window, window.swapchainFormat, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, PassPart::second);
 
 	lut::DescriptorSetLayout sceneLayout = create_scene_descriptor_layout(window);
 	lut::DescriptorSetLayout objectLayout = create_object_descriptor_layout(window);
 
-	lut::PipelineLayout pipeLayout = create_pipeline_layout(window, sceneLayout.handle, objectLayout.handle);
-	lut::Pipeline pipe = create_pipeline(window, renderPass.handle, pipeLayout.handle);
-	lut::Pipeline texpipe = create_tex_pipeline(window, renderPass.handle, pipeLayout.handle);
 
-	auto [depthBuffer, depthBufferView] = create_depth_buffer(window, allocator);
+	lut::DescriptorSetLayout geometryLayout;
+	if (cfg::vertexPulling)
+		geometryLayout = create_pulled_geometry_layout(window);
+
+	lut::PipelineLayout pipeLayout = create_pipeline_layout(window, sceneLayout.handle, objectLayout.handle, geometryLayout.handle);
+	lut::Pipeline pipe = create_pipeline(window, renderPass.handle, pipeLayout.handle, window.swapchainExtent);
+	lut::Pipeline texpipe = create_tex_pipeline(window, renderPass.handle, pipeLayout.handle, window.swapchainExtent);
+
+	// Depth pre-pass; can be toggled at any time
+	lut::Pipeline depthPipe = create_depth_pipeline(window, renderPass.handle, pipeLayout.handle, window.swapchainExtent);
+	lut::Pipeline equalPipe = create_pipeline(window, renderPass.handle, pipeLayout.handle, window.swapchainExtent, DepthTest::equal);
+	lut::Pipeline equalTexPipe = create_tex_pipeline(window, renderPass.handle, pipeLayout.handle, window.swapchainExtent, DepthTest::equal);
+
+	lut::Pipeline impostorPipe;
+	if (cfg::impostors)
+		impostorPipe = create_impostor_pipeline(window, renderPass.handle, pipeLayout.handle, window.swapchainExtent);
+
+	auto [depthBuffer, depthBufferView] = create_depth_buffer(window, allocator, window.swapchainExtent);
 
 	std::vector<lut::Framebuffer> framebuffers;
 	create_swapchain_framebuffers(window, renderPass.handle, framebuffers, depthBufferView.handle);
@@ -221,124 +959,78 @@ int main() try
 	lut::Semaphore imageAvailable = lut::create_semaphore(window);
 	lut::Semaphore renderFinished = lut::create_semaphore(window);
 
-	//The function creates meshes with or without textures.
-	std::vector<ColorizedMesh> color_meshes = create_triangle_mesh(window, allocator, model_car);
-	std::vector<ColorizedMesh> tex_meshes = create_triangle_mesh(window, allocator, model_city);
-	
-	//Buffers for colored objects
-	std::vector<VkBuffer> aPositionBuffer;
-	std::vector<VkBuffer> AColorBuffer;
-	std::vector<std::uint32_t > aVertexCount;
-
-	//Buffers for textured objects
-	std::vector<VkBuffer> aTexPositionBuffer;
-	std::vector<VkBuffer> ATexBuffer;
-	std::vector<std::uint32_t > aTexVertexCount;
-
-	//Set colored buffers
-	for (int i = 0; i < model_car.meshes.size(); i++) {
-		VkBuffer pos = color_meshes[i].positions.buffer;
-		VkBuffer col = color_meshes[i].colors.buffer;
-		std::uint32_t count = color_meshes[i].vertexCount;
-		aPositionBuffer.push_back(pos);
-		AColorBuffer.push_back(col);
-		aVertexCount.push_back(count);
-	}
-
-	//Set textured buffers
-	for (int i = 0; i < model_city.meshes.size(); i++) {
-		VkBuffer pos = tex_meshes[i].positions.buffer;
-		VkBuffer col = tex_meshes[i].colors.buffer;
-		std::uint32_t count = tex_meshes[i].vertexCount;
-		if (model_city.materials[model_city.meshes[i].materialIndex].colorTexturePath.compare("") == 0) {
-			aPositionBuffer.push_back(pos);
-			AColorBuffer.push_back(col);
-			aVertexCount.push_back(count);
-		}
-		else {
-			aTexPositionBuffer.push_back(pos);
-			ATexBuffer.push_back(col);
-			aTexVertexCount.push_back(count);
-		}
-	}
-	
-	lut::Buffer sceneUBO = lut::create_buffer(allocator, sizeof(glsl::SceneUniform), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	lut::Buffer sceneUBO = lut::create_buffer(allocator, sizeof(glsl::SceneUniform), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, lut::MemoryCategory::uniform);
 
 	lut::DescriptorPool dpool = lut::create_descriptor_pool(window);
 	
-	VkDescriptorSet sceneDescriptors = lut::alloc_desc_set(window, dpool.handle, sceneLayout.handle);
-	{
-		VkWriteDescriptorSet desc[1]{};
-
-		VkDescriptorBufferInfo sceneUboInfo{};
-		sceneUboInfo.buffer = sceneUBO.buffer;
-		sceneUboInfo.range = VK_WHOLE_SIZE;
-
-		desc[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		desc[0].dstSet = sceneDescriptors;
-		desc[0].dstBinding = 0;
-		desc[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		desc[0].descriptorCount = 1;
-		desc[0].pBufferInfo = &sceneUboInfo;
+	VkDescriptorSet sceneDescriptors = create_scene_descriptors(window, dpool.handle, sceneLayout.handle, sceneUBO.buffer);
 
+	lut::Sampler defaultSampler = lut::create_default_sampler(window);
 
-		constexpr auto numSets = sizeof(desc) / sizeof(desc[0]);
-		vkUpdateDescriptorSets(window.device, numSets, desc, 0, nullptr);
-	}
+	// GPU profiling. Frames do not necessarily complete in order (depending
+	// on which swapchain image is acquired), so use one additional slot.
+	lut::GpuProfiler profiler;
+	if (cfg::gpuProfile || cfg::benchmark)
+		profiler = lut::create_gpu_profiler(window, std::uint32_t(framebuffers.size() + 1));
 
-	lut::Sampler defaultSampler = lut::create_default_sampler(window);
-	//Exist so that there are no lost data errors
-	std::vector<lut::Image> textures;
-	std::vector<lut::ImageView> textureViews;
-	////////////////////////////////
-	std::vector<VkDescriptorSet> texDescriptors;
-	lut::CommandPool loadCmdPool = lut::create_command_pool(window, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+	SceneResources scene = create_scene_resources(window, allocator, dpool.handle, objectLayout.handle, geometryLayout.handle, defaultSampler.handle, model_car, model_city, profiler, std::uint32_t(cbuffers.size()));
 
-	for (int i = 0; i < model_city.meshes.size(); i++) {
-		if (model_city.materials[model_city.meshes[i].materialIndex].colorTexturePath.compare("") != 0) {
+	if (cfg::impostors)
+		create_impostors(scene, window, allocator, dpool.handle, sceneLayout.handle, objectLayout.handle, pipeLayout.handle, std::uint32_t(cbuffers.size()));
 
-			lut::Image tex;
-			{
-				tex = lut::load_image_texture2d(model_city.materials[model_city.meshes[i].materialIndex].colorTexturePath.c_str(), window, loadCmdPool.handle, allocator);
-			}
-			lut::ImageView texView = lut::create_image_view_texture2d(window, tex.image, VK_FORMAT_R8G8B8A8_SRGB);
+	// Occlusion culling. The pyramid follows the size of the depth buffer.
+	lut::DepthPyramidBuilder pyramidBuilder;
+	lut::DepthPyramid pyramid;
+	OcclusionCuller culler;
+	if (cfg::occlusionCulling)
+	{
+		pyramidBuilder = lut::create_depth_pyramid_builder(window, cfg::kHzbShaderPath);
+		pyramid = lut::create_depth_pyramid(window, allocator, pyramidBuilder, depthBufferView.handle, window.swapchainExtent);
 
-			//allocate and initialize descriptor sets for texture
-			VkDescriptorSet texDescriptor = lut::alloc_desc_set(window, dpool.handle, objectLayout.handle);
-			{
-				VkWriteDescriptorSet desc[1]{};
+		culler = create_scene_occlusion_culler(scene, window, allocator, std::uint32_t(cbuffers.size()));
+		set_occlusion_pyramid(window, culler, pyramid);
+	}
 
-				VkDescriptorImageInfo textureInfo{};
-				textureInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-				textureInfo.imageView = texView.handle;
-				textureInfo.sampler = defaultSampler.handle;
+	if (cfg::fragmentStats)
+		check_fragment_stats_support(window);
 
-				desc[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				desc[0].dstSet = texDescriptor;
-				desc[0].dstBinding = 0;
-				desc[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				desc[0].descriptorCount = 1;
-				desc[0].pImageInfo = &textureInfo;
+	FragmentCounter fragmentCounter;
+	if (cfg::fragmentStats)
+		fragmentCounter = create_fragment_counter(window, std::uint32_t(cbuffers.size()));
 
+	if (cfg::memoryStats)
+		report_memory_stats(allocator, "after loading");
 
-				constexpr auto numSets = sizeof(desc) / sizeof(desc[0]);
-				vkUpdateDescriptorSets(window.device, numSets, desc, 0, nullptr);
-			}
-			textures.push_back(std::move(tex));
-			textureViews.push_back(std::move(texView));
-			texDescriptors.push_back(texDescriptor);
-		}
+	// Benchmark and camera path recording
+	BenchmarkState bench;
+	if (cfg::benchmark)
+	{
+		bench = create_benchmark_state();
+		profiler.onResolve = [&bench] (char const* aScope, std::uint64_t aFrame, double aMs) {
+			record_gpu_time(bench, aScope, aFrame, aMs);
+		};
 	}
 
+	CameraPath recordedPath;
+
 	// Application main loop
 	bool recreateSwapchain = false;
+	bool drawStatsReported = false;
+	MeshletTotals meshletTotals;
+	OcclusionTotals occlusionTotals;
+	SoftCullTotals softTotals;
+	FragmentTotals fragmentTotals;
+	ImpostorTotals impostorTotals;
 	double deltaTime, newTime, currentTime = glfwGetTime();
+	double const startTime = currentTime;
+	double lastReportTime = currentTime;
 
 	// Set Camera once before the loop so that the scene loads
 	camera();
 
 	while (!glfwWindowShouldClose(window.window))
 	{
+		LUT_TRACE_SCOPE("frame");
 
 		newTime = glfwGetTime(); //Used to make sure movement speed isn't tied to frame rate
 		deltaTime = newTime - currentTime;
@@ -382,6 +1074,15 @@ int main() try
 		// reaction to user input (or similar).
 		glfwPollEvents(); // or: glfwWaitEvents()
 
+		// In benchmark mode, the camera path overrides the user's input
+		if (cfg::benchmark && !begin_benchmark_frame(bench, profiler))
+			break;
+
+		if (!cfg::recordPath.empty() && (recordedPath.keys.empty() || newTime - startTime >= recordedPath.keys.back().time + cfg::kRecordInterval))
+		{
+			recordedPath.keys.emplace_back(CameraKey{ float(newTime - startTime), cfg::pos, cfg::yaw, cfg::pitch });
+		}
+
 		//glsl::SceneUniform sceneUniforms{};
 		glsl::SceneUniform sceneUniforms{};
 		update_scene_uniforms(sceneUniforms, window.swapchainExtent.width, window.swapchainExtent.height);
@@ -396,17 +1097,34 @@ int main() try
 			auto const changes = recreate_swapchain(window);
 
 			if (changes.changedFormat)
-				renderPass = create_render_pass(window);
+			{
+				renderPass = create_render_pass(window, window.swapchainFormat, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, firstPart);
+				if (cfg::occlusionCulling)
+					lateRenderPass = create_render_pass(window, window.swapchainFormat, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, PassPart::second);
+			}
 
 			if (changes.changedSize)
-				std::tie(depthBuffer, depthBufferView) = create_depth_buffer(window, allocator);
+			{
+				std::tie(depthBuffer, depthBufferView) = create_depth_buffer(window, allocator, window.swapchainExtent);
+
+				if (cfg::occlusionCulling)
+				{
+					pyramid = lut::create_depth_pyramid(window, allocator, pyramidBuilder, depthBufferView.handle, window.swapchainExtent);
+					set_occlusion_pyramid(window, culler, pyramid);
+				}
+			}
 
 			framebuffers.clear();
 			create_swapchain_framebuffers(window, renderPass.handle, framebuffers, depthBufferView.handle);
 
 			if (changes.changedSize) {
-				pipe = create_pipeline(window, renderPass.handle, pipeLayout.handle);
-				texpipe = create_tex_pipeline(window, renderPass.handle, pipeLayout.handle);
+				pipe = create_pipeline(window, renderPass.handle, pipeLayout.handle, window.swapchainExtent);
+				texpipe = create_tex_pipeline(window, renderPass.handle, pipeLayout.handle, window.swapchainExtent);
+				depthPipe = create_depth_pipeline(window, renderPass.handle, pipeLayout.handle, window.swapchainExtent);
+				equalPipe = create_pipeline(window, renderPass.handle, pipeLayout.handle, window.swapchainExtent, DepthTest::equal);
+				equalTexPipe = create_tex_pipeline(window, renderPass.handle, pipeLayout.handle, window.swapchainExtent, DepthTest::equal);
+				if (cfg::impostors)
+					impostorPipe = create_impostor_pipeline(window, renderPass.handle, pipeLayout.handle, window.swapchainExtent);
 			}
 			recreateSwapchain = false;
 			continue;
@@ -414,7 +1132,11 @@ int main() try
 
 		// Acquire next swap chain image 1
 		std::uint32_t imageIndex = 0;
-		auto const acquireRes = vkAcquireNextImageKHR(window.device, window.swapchain, std::numeric_limits<std::uint64_t>::max(), imageAvailable.handle, VK_NULL_HANDLE, &imageIndex);
+		VkResult acquireRes;
+		{
+			LUT_TRACE_SCOPE("vkAcquireNextImageKHR");
+			acquireRes = vkAcquireNextImageKHR(window.device, window.swapchain, std::numeric_limits<std::uint64_t>::max(), imageAvailable.handle, VK_NULL_HANDLE, &imageIndex);
+		}
 
 		if (VK_SUBOPTIMAL_KHR == acquireRes || VK_ERROR_OUT_OF_DATE_KHR == acquireRes)
 		{
@@ -441,9 +1163,12 @@ int main() try
 		// Make sure that the command buffer is no longer in use 
 		assert(std::size_t(imageIndex) < cbfences.size());
 
-		if (auto const res = vkWaitForFences(window.device, 1, &cbfences[imageIndex].handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max()); VK_SUCCESS != res)
 		{
-			throw lut::Error("Unable to wait for command buffer fence %u\n" "vkWaitForFences() returned %s", imageIndex, lut::to_string(res).c_str());
+			LUT_TRACE_SCOPE("vkWaitForFences");
+			if (auto const res = vkWaitForFences(window.device, 1, &cbfences[imageIndex].handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max()); VK_SUCCESS != res)
+			{
+				throw lut::Error("Unable to wait for command buffer fence %u\n" "vkWaitForFences() returned %s", imageIndex, lut::to_string(res).c_str());
+			}
 		}
 
 		if (auto const res = vkResetFences(window.device, 1, &cbfences[imageIndex].handle); VK_SUCCESS != res)
@@ -453,11 +1178,53 @@ int main() try
 
 		}
 
+		if (cfg::streamTextures)
+			update_texture_streaming(scene, imageIndex, window.swapchainExtent.height, false);
+
+		if (!cfg::cellPackPath.empty())
+			update_city_paging(scene, imageIndex, false);
+
+		if (cfg::impostors)
+			select_scene_impostors(scene, allocator, imageIndex, impostorTotals);
+
+		if (cfg::occlusionCulling)
+			collect_occlusion_stats(occlusionTotals, allocator, culler, imageIndex);
+		else if (cfg::meshlets)
+			cull_scene_meshlets(scene, allocator, imageIndex, sceneUniforms.projCam, meshletTotals);
+		else if (cfg::softOcclusion)
+			cull_scene_soft(scene, sceneUniforms.projCam, softTotals);
+
+		OcclusionPass const occlusion{ &culler, &pyramidBuilder, &pyramid, lateRenderPass.handle, imageIndex,
+			OcclusionCullView{ sceneUniforms.camera, sceneUniforms.projection, sceneUniforms.projCam, cfg::pos, cfg::kCameraNear } };
+
+		DepthPrepass const prepass{ depthPipe.handle, equalPipe.handle, equalTexPipe.handle };
+
+		ImpostorDraws const impostors{ impostorPipe.handle, scene.impostorSet, cfg::impostors ? scene.impostorBuffers[imageIndex].buffer : VK_NULL_HANDLE, scene.impostorCount };
+
+		FragmentQuery const fragments{ fragmentCounter.pool.handle, imageIndex };
+		if (cfg::fragmentStats)
+		{
+			collect_fragment_counts(fragmentTotals, window, fragmentCounter, imageIndex, window.swapchainExtent);
+			fragmentCounter.pending[imageIndex] = cfg::depthPrepass ? 1 : 0;
+		}
+
 		// Record and submit commands for this frame
 		assert(std::size_t(imageIndex) < cbuffers.size());
 		assert(std::size_t(imageIndex) < framebuffers.size());
 
-		record_commands(cbuffers[imageIndex], renderPass.handle, framebuffers[imageIndex].handle, pipe.handle, texpipe.handle, window.swapchainExtent, aPositionBuffer, AColorBuffer, aVertexCount, aTexPositionBuffer, ATexBuffer, aTexVertexCount, sceneUBO.buffer, sceneUniforms, pipeLayout.handle, sceneDescriptors, texDescriptors);
+		auto const drawStats = record_commands(cbuffers[imageIndex], renderPass.handle, framebuffers[imageIndex].handle, pipe.handle, texpipe.handle, window.swapchainExtent, scene.positionBuffers, scene.colorBuffers, scene.vertexCounts, scene.texPositionBuffers, scene.texCoordBuffers, scene.texVertexCounts, scene.instances.buffer, scene.instanceRanges, scene.texInstanceRanges, sceneUBO.buffer, sceneUniforms, pipeLayout.handle, sceneDescriptors, scene.texDescriptors, scene.texLayers, make_frame_draw_options(scene, occlusion, prepass, fragments, impostors), profiler);
+
+		if (!drawStatsReported)
+		{
+			report_draw_stats(drawStats);
+			drawStatsReported = true;
+		}
+
+		if (cfg::impostors)
+		{
+			impostorTotals.draws += drawStats.draws;
+			impostorTotals.triangles += drawStats.triangles;
+		}
 
 		submit_commands(window, cbuffers[imageIndex], cbfences[imageIndex].handle, imageAvailable.handle, renderFinished.handle);
 
@@ -471,7 +1238,11 @@ int main() try
 		presentInfo.pImageIndices = &imageIndex;
 		presentInfo.pResults = nullptr;
 
-		auto const presentRes = vkQueuePresentKHR(window.presentQueue, &presentInfo);
+		VkResult presentRes;
+		{
+			LUT_TRACE_SCOPE("vkQueuePresentKHR");
+			presentRes = vkQueuePresentKHR(window.presentQueue, &presentInfo);
+		}
 
 		if (VK_SUBOPTIMAL_KHR == presentRes || VK_ERROR_OUT_OF_DATE_KHR == presentRes)
 		{
@@ -481,12 +1252,70 @@ int main() try
 		{
 			throw lut::Error("Unable present swapchain image %u\n" "vkQueuePresentKHR() returned %s", imageIndex, lut::to_string(presentRes).c_str());
 		}
+
+		if (cfg::gpuProfile && newTime - lastReportTime >= cfg::kGpuReportInterval)
+		{
+			profiler.print_report();
+			lastReportTime = newTime;
+		}
 	}
 
 	// Cleanup takes place automatically in the destructors, but we sill need
 	// to ensure that all Vulkan commands have finished before that.
 	vkDeviceWaitIdle(window.device);
 
+	if (cfg::benchmark)
+		finish_benchmark(bench, profiler);
+
+	if (cfg::gpuProfile)
+	{
+		profiler.resolve_all();
+		profiler.print_report();
+	}
+
+	if (cfg::memoryStats)
+		report_memory_stats(allocator, "on exit");
+
+	if (cfg::streamTextures)
+		scene.textureStreamer.print_stats();
+
+	if (!cfg::cellPackPath.empty())
+		scene.cityPager.print_stats();
+
+	if (cfg::meshlets)
+		report_meshlet_stats(meshletTotals);
+
+	if (cfg::softOcclusion)
+		report_soft_cull_stats(softTotals);
+
+	if (cfg::impostors)
+		report_impostor_stats(impostorTotals, scene);
+
+	if (cfg::fragmentStats)
+	{
+		for (std::uint32_t i = 0; i < cbuffers.size(); ++i)
+			collect_fragment_counts(fragmentTotals, window, fragmentCounter, i, window.swapchainExtent);
+
+		report_fragment_counts(fragmentTotals);
+	}
+
+	if (cfg::occlusionCulling)
+	{
+		for (std::uint32_t i = 0; i < cbuffers.size(); ++i)
+			collect_occlusion_stats(occlusionTotals, allocator, culler, i);
+
+		report_occlusion_stats(occlusionTotals);
+	}
+
+	if (!cfg::recordPath.empty())
+	{
+		save_camera_path(recordedPath, cfg::recordPath.c_str());
+		std::printf("Wrote '%s'\n", cfg::recordPath.c_str());
+	}
+
+	if (!cfg::tracePath.empty())
+		lut::write_chrome_trace(cfg::tracePath.c_str());
+
 	return 0;
 }
 catch( std::exception const& eErr )
@@ -569,6 +1398,11 @@ namespace
 		{
 			cfg::speed = 1.0;
 		}
+		if (GLFW_KEY_Z == aKey && GLFW_PRESS == aAction)
+		{
+			cfg::depthPrepass = !cfg::depthPrepass;
+			std::printf("Depth pre-pass %s\n", cfg::depthPrepass ? "on" : "off");
+		}
 		
 	}
 
@@ -603,49 +1437,359 @@ namespace
 
 	}
 
-}
-namespace
-{
-	void update_scene_uniforms(glsl::SceneUniform& aSceneUniforms, std::uint32_t aFramebufferWidth, std::uint32_t aFramebufferHeight)
+	void parse_options(int aArgc, char* aArgv[])
 	{
-		float const aspect = aFramebufferWidth / float(aFramebufferHeight);
-
-		aSceneUniforms.projection = glm::perspectiveRH_ZO(
-			lut::Radians(cfg::kCameraFov).value(),
-			aspect,
-			cfg::kCameraNear,
-			cfg::kCameraFar
-		);
+		for (int i = 1; i < aArgc; ++i)
+		{
+			std::string const opt = aArgv[i];
 
-		aSceneUniforms.projection[1][1] *= -1.f; // mirror Y axis 9
+			auto const value = [&] () -> char const* {
+				if (i + 1 >= aArgc)
+					throw lut::Error("Option '%s' requires a value", opt.c_str());
+				return aArgv[++i];
+			};
 
-		aSceneUniforms.camera = glm::lookAt(cfg::pos, cfg::direction + cfg::pos, glm::vec3{ 0.0f,1.0f,0.0f });
+			if ("--headless" == opt)
+			{
+				cfg::headless = true;
+			}
+			else if ("--frames" == opt)
+			{
+				cfg::frameCount = std::uint32_t(std::strtoul(value(), nullptr, 10));
+			}
+			else if ("--size" == opt)
+			{
+				unsigned int width = 0, height = 0;
+				if (2 != std::sscanf(value(), "%ux%u", &width, &height) || 0 == width || 0 == height)
+					throw lut::Error("Option '--size' expects WIDTHxHEIGHT");
 
-		aSceneUniforms.projCam = aSceneUniforms.projection * aSceneUniforms.camera;
-	}
+				cfg::headlessExtent = VkExtent2D{ width, height };
+			}
+			else if ("--capture" == opt)
+			{
+				cfg::capturePath = value();
 
-	void update_cameraPos(glm::vec3& pos, glm::vec3 update, double deltaTime, float speed) {
-		pos = pos + update/(float)deltaTime*speed;
-	}
-}
-namespace
-{
-	lut::RenderPass create_render_pass(lut::VulkanWindow const& aWindow)
-	{
-		VkAttachmentDescription attachments[2]{};
-		attachments[0].format = aWindow.swapchainFormat;
-		attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
-		attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; 
+				// The path isn't a format string; "%u" is its only placeholder
+				auto const percents = std::count(cfg::capturePath.begin(), cfg::capturePath.end(), '%');
+				if (percents > 1 || (1 == percents && std::string::npos == cfg::capturePath.find("%u")))
+					throw lut::Error("Option '--capture' expects a path with at most one '%%u' and no other '%%'");
+			}
+			else if ("--camera" == opt)
+			{
+				// Initial camera pose; also applies to the windowed mode
+				if (5 != std::sscanf(value(), "%f,%f,%f,%f,%f", &cfg::pos.x, &cfg::pos.y, &cfg::pos.z, &cfg::yaw, &cfg::pitch))
+					throw lut::Error("Option '--camera' expects X,Y,Z,YAW,PITCH");
+			}
+			else if ("--benchmark" == opt)
+			{
+				// Camera path file, or "builtin" for make_default_camera_path()
+				cfg::benchmark = true;
+				cfg::benchmarkPath = value();
+				if ("builtin" == cfg::benchmarkPath)
+					cfg::benchmarkPath.clear();
+			}
+			else if ("--report" == opt)
+			{
+				cfg::benchmarkReport = value();
+			}
+			else if ("--warmup" == opt)
+			{
+				cfg::benchmarkWarmup = std::uint32_t(std::strtoul(value(), nullptr, 10));
+			}
+			else if ("--record" == opt)
+			{
+				cfg::recordPath = value();
+			}
+			else if ("--gpu-profile" == opt)
+			{
+				cfg::gpuProfile = true;
+			}
+			else if ("--trace" == opt)
+			{
+				cfg::tracePath = value();
+			}
+			else if ("--compress" == opt)
+			{
+				std::string const format = value();
+				if ("bc1" == format)
+					cfg::textureFormat = lut::BcFormat::bc1;
+				else if ("bc7" == format)
+					cfg::textureFormat = lut::BcFormat::bc7;
+				else
+					throw lut::Error("Option '--compress' expects 'bc1' or 'bc7'");
+
+				cfg::compressTextures = true;
+			}
+			else if ("--bc-quality" == opt)
+			{
+				std::string const quality = value();
+				if ("fast" == quality)
+					cfg::textureQuality = lut::BcQuality::fast;
+				else if ("normal" == quality)
+					cfg::textureQuality = lut::BcQuality::normal;
+				else if ("high" == quality)
+					cfg::textureQuality = lut::BcQuality::high;
+				else
+					throw lut::Error("Option '--bc-quality' expects 'fast', 'normal' or 'high'");
+			}
+			else if ("--ktx2" == opt)
+			{
+				cfg::preferKtx2 = true;
+			}
+			else if ("--cpu-mips" == opt)
+			{
+				std::string const filter = value();
+				if ("box" == filter)
+					cfg::mipFilter = lut::MipFilter::box;
+				else if ("kaiser" == filter)
+					cfg::mipFilter = lut::MipFilter::kaiser;
+				else
+					throw lut::Error("Option '--cpu-mips' expects 'box' or 'kaiser'");
+
+				cfg::cpuMips = true;
+			}
+			else if ("--compute-mips" == opt)
+			{
+				cfg::computeMips = true;
+			}
+			else if ("--stream-textures" == opt)
+			{
+				cfg::streamTextures = true;
 
-		attachments[1].format = cfg::kDepthFormat;
-		attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
-		attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+				// Optional budget in MiB
+				if (i + 1 < aArgc && '-' != aArgv[i+1][0])
+					cfg::streamBudgetMiB = std::uint32_t(std::strtoul(aArgv[++i], nullptr, 10));
+			}
+			else if ("--staging-ring" == opt)
+			{
+				cfg::stagingRingMiB = std::uint32_t(std::strtoul(value(), nullptr, 10));
+				if (0 == cfg::stagingRingMiB)
+					throw lut::Error("Option '--staging-ring' expects a size in MiB");
+			}
+			else if ("--no-direct-uploads" == opt)
+			{
+				cfg::directUploads = false;
+			}
+			else if ("--upload-benchmark" == opt)
+			{
+				cfg::uploadBenchmark = true;
+			}
+			else if ("--scene-graph-benchmark" == opt)
+			{
+				cfg::sceneGraphBenchmark = true;
+			}
+			else if ("--atlas" == opt)
+			{
+				cfg::atlasTextures = true;
+
+				// Optional size limit of packed textures
+				if (i + 1 < aArgc && '-' != aArgv[i+1][0])
+					cfg::atlasConfig.maxTextureExtent = std::uint32_t(std::strtoul(aArgv[++i], nullptr, 10));
+			}
+			else if ("--texture-arrays" == opt)
+			{
+				cfg::textureArrays = true;
+			}
+			else if ("--meshlets" == opt)
+			{
+				cfg::meshlets = true;
+			}
+			else if ("--occlusion-culling" == opt)
+			{
+				cfg::meshlets = true;
+				cfg::occlusionCulling = true;
+			}
+			else if ("--soft-occlusion" == opt)
+			{
+				cfg::softOcclusion = true;
+			}
+			else if ("--soft-occluder-area" == opt)
+			{
+				cfg::softOccluderMinArea = std::strtof(value(), nullptr);
+			}
+			else if ("--soft-occlusion-benchmark" == opt)
+			{
+				cfg::softOcclusionBenchmark = true;
+			}
+			else if ("--depth-prepass" == opt)
+			{
+				cfg::depthPrepass = true;
+			}
+			else if ("--fragment-stats" == opt)
+			{
+				cfg::fragmentStats = true;
+			}
+			else if ("--vertex-pulling" == opt)
+			{
+				cfg::vertexPulling = true;
+			}
+			else if ("--page-cells" == opt)
+			{
+				cfg::cellPackPath = value();
+			}
+			else if ("--page-budget" == opt)
+			{
+				cfg::pageBudgetMiB = std::uint32_t(std::strtoul(value(), nullptr, 10));
+				if (0 == cfg::pageBudgetMiB)
+					throw lut::Error("Option '--page-budget' expects a size in MiB");
+			}
+			else if ("--page-radius" == opt)
+			{
+				cfg::pageRadius = std::strtof(value(), nullptr);
+				if (!(cfg::pageRadius > 0.f))
+					throw lut::Error("Option '--page-radius' expects a positive distance");
+			}
+			else if ("--page-prefetch" == opt)
+			{
+				cfg::pagePrefetch = std::max(std::strtof(value(), nullptr), 0.f);
+			}
+			else if ("--impostors" == opt)
+			{
+				cfg::impostors = true;
+
+				// Optional switch distance
+				if (i + 1 < aArgc && '-' != aArgv[i+1][0])
+					cfg::impostorDistance = std::strtof(aArgv[++i], nullptr);
+			}
+			else if ("--impostor-views" == opt)
+			{
+				cfg::impostorViews = std::uint32_t(std::strtoul(value(), nullptr, 10));
+				if (0 == cfg::impostorViews)
+					throw lut::Error("Option '--impostor-views' expects a number of views");
+			}
+			else if ("--impostor-size" == opt)
+			{
+				cfg::impostorSize = std::uint32_t(std::strtoul(value(), nullptr, 10));
+				if (0 == cfg::impostorSize)
+					throw lut::Error("Option '--impostor-size' expects a size in texels");
+			}
+			else if ("--scene" == opt)
+			{
+				cfg::scenePath = value();
+			}
+			else if ("--merge-meshes" == opt)
+			{
+				std::string const mode = value();
+				if ("shape" == mode)
+					cfg::meshMerge = MeshMerge::shape;
+				else if ("material" == mode)
+					cfg::meshMerge = MeshMerge::material;
+				else
+					throw lut::Error("Option '--merge-meshes' expects 'shape' or 'material'");
+			}
+			else if ("--memory-stats" == opt)
+			{
+				cfg::memoryStats = true;
+
+				// Optional path argument
+				if (i + 1 < aArgc && '-' != aArgv[i+1][0])
+					cfg::memoryStatsPath = aArgv[++i];
+			}
+			else
+			{
+				throw lut::Error("Unknown option '%s'\n"
+					"Usage: %s [--headless] [--frames N] [--size WxH] [--capture PATH] [--camera X,Y,Z,YAW,PITCH]\n"
+					"       [--benchmark PATH|builtin] [--report PATH.csv|PATH.json] [--warmup N] [--record PATH] [--gpu-profile] [--trace PATH.json]\n"
+					"       [--memory-stats [PATH.json]] [--compress bc1|bc7] [--bc-quality fast|normal|high]\n"
+					"       [--ktx2] [--cpu-mips box|kaiser] [--compute-mips]\n"
+					"       [--stream-textures [BUDGET_MIB]] [--staging-ring MIB] [--no-direct-uploads]\n"
+					"       [--upload-benchmark] [--atlas [MAX_EXTENT]] [--texture-arrays] [--merge-meshes shape|material]\n"
+					"       [--scene PATH] [--scene-graph-benchmark] [--meshlets]\n"
+					"       [--occlusion-culling] [--soft-occlusion] [--soft-occluder-area M2] [--soft-occlusion-benchmark]\n"
+					"       [--depth-prepass] [--fragment-stats] [--vertex-pulling]\n"
+					"       [--page-cells PATH.cells] [--page-budget MIB] [--page-radius M] [--page-prefetch SECONDS]\n"
+					"       [--impostors [DISTANCE]] [--impostor-views N] [--impostor-size TEXELS]",
+					opt.c_str(), aArgv[0]
+				);
+			}
+		}
+
+		// Meshlets are culled on their own
+		if (cfg::softOcclusion && cfg::meshlets)
+		{
+			std::fprintf(stderr, "Software occlusion culling is not used with meshlets\n");
+			cfg::softOcclusion = false;
+		}
+
+		if (cfg::vertexPulling && cfg::meshlets)
+		{
+			std::fprintf(stderr, "Vertex pulling is not used with meshlets\n");
+			cfg::vertexPulling = false;
+		}
+
+		if (!cfg::cellPackPath.empty() && (cfg::meshlets || cfg::softOcclusion || cfg::vertexPulling || cfg::atlasTextures || cfg::streamTextures))
+		{
+			std::fprintf(stderr, "Cell paging is not used with meshlets, software occlusion culling, vertex pulling, atlases or texture streaming\n");
+			cfg::cellPackPath.clear();
+		}
+
+		if (cfg::impostors && (cfg::meshlets || cfg::softOcclusion || cfg::vertexPulling || !cfg::cellPackPath.empty() || cfg::streamTextures))
+		{
+			std::fprintf(stderr, "Impostors are not used with meshlets, software occlusion culling, vertex pulling, cell paging or texture streaming\n");
+			cfg::impostors = false;
+		}
+	}
+
+}
+namespace
+{
+	void update_scene_uniforms(glsl::SceneUniform& aSceneUniforms, std::uint32_t aFramebufferWidth, std::uint32_t aFramebufferHeight)
+	{
+		float const aspect = aFramebufferWidth / float(aFramebufferHeight);
+
+		aSceneUniforms.projection = glm::perspectiveRH_ZO(
+			lut::Radians(cfg::kCameraFov).value(),
+			aspect,
+			cfg::kCameraNear,
+			cfg::kCameraFar
+		);
+
+		aSceneUniforms.projection[1][1] *= -1.f; // mirror Y axis 9
+
+		aSceneUniforms.camera = glm::lookAt(cfg::pos, cfg::direction + cfg::pos, glm::vec3{ 0.0f,1.0f,0.0f });
+
+		aSceneUniforms.projCam = aSceneUniforms.projection * aSceneUniforms.camera;
+	}
+
+	void update_cameraPos(glm::vec3& pos, glm::vec3 update, double deltaTime, float speed) {
+		pos = pos + update/(float)deltaTime*speed;
+	}
+}
+namespace
+{
+	lut::RenderPass create_render_pass(lut::VulkanContext const& aContext, VkFormat aColorFormat, VkImageLayout aColorFinalLayout, PassPart aPart)
+	{
+		VkAttachmentDescription attachments[2]{};
+		attachments[0].format = aColorFormat;
+		attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachments[0].finalLayout = aColorFinalLayout; 
+
+		attachments[1].format = cfg::kDepthFormat;
+		attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		// The first part keeps the depth buffer for the depth pyramid, in a
+		// layout that allows sampling it; the second part continues from
+		// there
+		if (PassPart::first == aPart)
+		{
+			attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+			attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		}
+		else if (PassPart::second == aPart)
+		{
+			attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+			attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+			attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+			attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		}
 
 
 		VkAttachmentReference subpassAttachments[1]{};
@@ -664,6 +1808,45 @@ namespace
 		subpasses[0].pDepthStencilAttachment = &depthAttachment;
 
 		// changed: no explicit subpass dependencies 
+		// Except for the two parts of a frame: the depth pyramid reads the
+		// depth that the first part wrote, and the second part waits for
+		// the pyramid and for the first part's attachment writes. And for
+		// passes that leave the color image to be copied: the implicit
+		// dependency at the end would not wait for the color writes.
+		VkSubpassDependency dependencies[2]{};
+		std::uint32_t dependencyCount = 0;
+
+		if (PassPart::first == aPart)
+		{
+			auto& dependency = dependencies[dependencyCount++];
+			dependency.srcSubpass = 0;
+			dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+			dependency.srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			dependency.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+			dependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		}
+		else if (PassPart::second == aPart)
+		{
+			auto& dependency = dependencies[dependencyCount++];
+			dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+			dependency.dstSubpass = 0;
+			dependency.srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		}
+
+		if (PassPart::first != aPart && VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL == aColorFinalLayout)
+		{
+			auto& dependency = dependencies[dependencyCount++];
+			dependency.srcSubpass = 0;
+			dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+			dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			dependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+			dependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		}
 
 		VkRenderPassCreateInfo passInfo{};
 		passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -671,33 +1854,40 @@ namespace
 		passInfo.pAttachments = attachments;
 		passInfo.subpassCount = 1;
 		passInfo.pSubpasses = subpasses;
-		passInfo.dependencyCount = 0; 
-		passInfo.pDependencies = nullptr; 
+		passInfo.dependencyCount = dependencyCount;
+		passInfo.pDependencies = dependencyCount ? dependencies : nullptr;
 
 		VkRenderPass rpass = VK_NULL_HANDLE;
-		if (auto const res = vkCreateRenderPass(aWindow.device, &passInfo, nullptr, &rpass); VK_SUCCESS != res)
+		if (auto const res = vkCreateRenderPass(aContext.device, &passInfo, nullptr, &rpass); VK_SUCCESS != res)
 		{
 			throw lut::Error("Unable to create render pass\n" "vkCreateRenderPass() returned %s", lut::to_string(res).c_str());
 
 		}
 
-		return lut::RenderPass(aWindow.device, rpass);
+		return lut::RenderPass(aContext.device, rpass);
 	}
 
-	lut::PipelineLayout create_pipeline_layout(lut::VulkanContext const& aContext, VkDescriptorSetLayout aSceneLayout, VkDescriptorSetLayout aObjectLayout)
+	lut::PipelineLayout create_pipeline_layout(lut::VulkanContext const& aContext, VkDescriptorSetLayout aSceneLayout, VkDescriptorSetLayout aObjectLayout, VkDescriptorSetLayout aGeometryLayout)
 	{
 		VkDescriptorSetLayout layouts[] = {
 			// Order must match the set = N in the shaders 
 			aSceneLayout,
-			aObjectLayout
+			aObjectLayout,
+			aGeometryLayout // only with vertex pulling
 		};
 
 		VkPipelineLayoutCreateInfo layoutInfo{};
 		layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		layoutInfo.setLayoutCount = sizeof(layouts) / sizeof(layouts[0]); 
+		layoutInfo.setLayoutCount = VK_NULL_HANDLE != aGeometryLayout ? 3 : 2; 
 		layoutInfo.pSetLayouts = layouts; 
-		layoutInfo.pushConstantRangeCount = 0;
-		layoutInfo.pPushConstantRanges = nullptr;
+		// Array layer of the texture (texture.frag)
+		VkPushConstantRange pushRange{};
+		pushRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		pushRange.offset = 0;
+		pushRange.size = sizeof(std::uint32_t);
+
+		layoutInfo.pushConstantRangeCount = 1;
+		layoutInfo.pPushConstantRanges = &pushRange;
 
 		VkPipelineLayout layout = VK_NULL_HANDLE;
 		if (auto const res = vkCreatePipelineLayout(aContext.device, &layoutInfo, nullptr, &layout); VK_SUCCESS != res)
@@ -711,17 +1901,19 @@ namespace
 	}
 
 
-	lut::Pipeline create_pipeline(lut::VulkanWindow const& aWindow, VkRenderPass aRenderPass, VkPipelineLayout aPipelineLayout)
+	lut::Pipeline create_pipeline(lut::VulkanContext const& aContext, VkRenderPass aRenderPass, VkPipelineLayout aPipelineLayout, VkExtent2D const& aExtent, DepthTest aDepthTest)
 	{
+		LUT_TRACE_SCOPE("create_pipeline");
 
-		lut::ShaderModule vert = lut::load_shader_module(aWindow, cfg::kVertShaderPath);
-		lut::ShaderModule frag = lut::load_shader_module(aWindow, cfg::kFragShaderPath);
+
+		lut::ShaderModule vert = lut::load_shader_module(aContext, cfg::vertexPulling ? cfg::kPullVertShaderPath : cfg::kVertShaderPath);
+		lut::ShaderModule frag = lut::load_shader_module(aContext, cfg::kFragShaderPath);
 
 		VkPipelineDepthStencilStateCreateInfo depthInfo{};
 		depthInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 		depthInfo.depthTestEnable = VK_TRUE;
-		depthInfo.depthWriteEnable = VK_TRUE;
-		depthInfo.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+		depthInfo.depthWriteEnable = DepthTest::write == aDepthTest ? VK_TRUE : VK_FALSE;
+		depthInfo.depthCompareOp = DepthTest::write == aDepthTest ? VK_COMPARE_OP_LESS_OR_EQUAL : VK_COMPARE_OP_EQUAL;
 		depthInfo.minDepthBounds = 0.f;
 		depthInfo.maxDepthBounds = 1.f;
 
@@ -736,7 +1928,7 @@ namespace
 		stages[1].module = frag.handle;
 		stages[1].pName = "main";
 
-		VkVertexInputBindingDescription vertexInputs[2]{};
+		VkVertexInputBindingDescription vertexInputs[3]{};
 		vertexInputs[0].binding = 0;
 		vertexInputs[0].stride = sizeof(float) * 3;
 		vertexInputs[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
@@ -745,7 +1937,12 @@ namespace
 		vertexInputs[1].stride = sizeof(float) * 3;
 		vertexInputs[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-		VkVertexInputAttributeDescription vertexAttributes[2]{};
+		// Model matrix, per instance
+		vertexInputs[2].binding = 2;
+		vertexInputs[2].stride = sizeof(glm::mat4);
+		vertexInputs[2].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+		VkVertexInputAttributeDescription vertexAttributes[6]{};
 		vertexAttributes[0].binding = 0; // must match binding above 
 		vertexAttributes[0].location = 0; // must match shader 
 		vertexAttributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
@@ -756,12 +1953,21 @@ namespace
 		vertexAttributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
 		vertexAttributes[1].offset = 0;
 
+		for (std::uint32_t column = 0; column < 4; ++column) // a mat4 takes one location per column
+		{
+			vertexAttributes[2+column].binding = 2;
+			vertexAttributes[2+column].location = 2 + column;
+			vertexAttributes[2+column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			vertexAttributes[2+column].offset = column * sizeof(glm::vec4);
+		}
+
 		VkPipelineVertexInputStateCreateInfo inputInfo{};
 		inputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-		inputInfo.vertexBindingDescriptionCount = 2; // number of vertexInputs above 
+		// With vertex pulling, the shader reads the vertices itself
+		inputInfo.vertexBindingDescriptionCount = cfg::vertexPulling ? 0 : 3; // number of vertexInputs above 
 		inputInfo.pVertexBindingDescriptions = vertexInputs;
-		inputInfo.vertexAttributeDescriptionCount = 2; // number of vertexAttributes above 
+		inputInfo.vertexAttributeDescriptionCount = cfg::vertexPulling ? 0 : 6; // number of vertexAttributes above 
 		inputInfo.pVertexAttributeDescriptions = vertexAttributes;
 
 		// Define which primitive (point, line, triangle, ...) the input is 
@@ -775,14 +1981,14 @@ namespace
 		VkViewport viewport{};
 		viewport.x = 0.f;
 		viewport.y = 0.f;
-		viewport.width = float(aWindow.swapchainExtent.width);
-		viewport.height = float(aWindow.swapchainExtent.height);
+		viewport.width = float(aExtent.width);
+		viewport.height = float(aExtent.height);
 		viewport.minDepth = 0.f;
 		viewport.maxDepth = 1.f;
 
 		VkRect2D scissor{};
 		scissor.offset = VkOffset2D{ 0, 0 };
-		scissor.extent = VkExtent2D{ aWindow.swapchainExtent.width, aWindow.swapchainExtent.height };
+		scissor.extent = VkExtent2D{ aExtent.width, aExtent.height };
 
 		VkPipelineViewportStateCreateInfo viewportInfo{};
 		viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
@@ -843,26 +2049,28 @@ namespace
 		pipeInfo.subpass = 0; // first subpass of aRenderPass 
 
 		VkPipeline pipe = VK_NULL_HANDLE;
-		if (auto const res = vkCreateGraphicsPipelines(aWindow.device, VK_NULL_HANDLE, 1, &pipeInfo, nullptr, &pipe); VK_SUCCESS != res)
+		if (auto const res = vkCreateGraphicsPipelines(aContext.device, VK_NULL_HANDLE, 1, &pipeInfo, nullptr, &pipe); VK_SUCCESS != res)
 		{
 			throw lut::Error("Unable to create graphics pipeline\n" "vkCreateGraphicsPipelines() returned %s", lut::to_string(res).c_str());
 
 		}
 
-		return lut::Pipeline(aWindow.device, pipe);
+		return lut::Pipeline(aContext.device, pipe);
 	}
 
-	lut::Pipeline create_tex_pipeline(lut::VulkanWindow const& aWindow, VkRenderPass aRenderPass, VkPipelineLayout aPipelineLayout)
+	lut::Pipeline create_tex_pipeline(lut::VulkanContext const& aContext, VkRenderPass aRenderPass, VkPipelineLayout aPipelineLayout, VkExtent2D const& aExtent, DepthTest aDepthTest)
 	{
+		LUT_TRACE_SCOPE("create_tex_pipeline");
 
-		lut::ShaderModule vert = lut::load_shader_module(aWindow, cfg::kTexVertShaderPath);
-		lut::ShaderModule frag = lut::load_shader_module(aWindow, cfg::kTexFragShaderPath);
+
+		lut::ShaderModule vert = lut::load_shader_module(aContext, cfg::vertexPulling ? cfg::kTexPullVertShaderPath : cfg::kTexVertShaderPath);
+		lut::ShaderModule frag = lut::load_shader_module(aContext, cfg::kTexFragShaderPath);
 
 		VkPipelineDepthStencilStateCreateInfo depthInfo{};
 		depthInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 		depthInfo.depthTestEnable = VK_TRUE;
-		depthInfo.depthWriteEnable = VK_TRUE;
-		depthInfo.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+		depthInfo.depthWriteEnable = DepthTest::write == aDepthTest ? VK_TRUE : VK_FALSE;
+		depthInfo.depthCompareOp = DepthTest::write == aDepthTest ? VK_COMPARE_OP_LESS_OR_EQUAL : VK_COMPARE_OP_EQUAL;
 		depthInfo.minDepthBounds = 0.f;
 		depthInfo.maxDepthBounds = 1.f;
 
@@ -877,7 +2085,7 @@ namespace
 		stages[1].module = frag.handle;
 		stages[1].pName = "main";
 
-		VkVertexInputBindingDescription vertexInputs[2]{};
+		VkVertexInputBindingDescription vertexInputs[3]{};
 		vertexInputs[0].binding = 0;
 		vertexInputs[0].stride = sizeof(float) * 3;
 		vertexInputs[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
@@ -886,7 +2094,12 @@ namespace
 		vertexInputs[1].stride = sizeof(float) * 2;
 		vertexInputs[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-		VkVertexInputAttributeDescription vertexAttributes[2]{};
+		// Model matrix, per instance
+		vertexInputs[2].binding = 2;
+		vertexInputs[2].stride = sizeof(glm::mat4);
+		vertexInputs[2].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+		VkVertexInputAttributeDescription vertexAttributes[6]{};
 		vertexAttributes[0].binding = 0; // must match binding above 
 		vertexAttributes[0].location = 0; // must match shader 
 		vertexAttributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
@@ -897,12 +2110,21 @@ namespace
 		vertexAttributes[1].format = VK_FORMAT_R32G32_SFLOAT;
 		vertexAttributes[1].offset = 0;
 
+		for (std::uint32_t column = 0; column < 4; ++column) // a mat4 takes one location per column
+		{
+			vertexAttributes[2+column].binding = 2;
+			vertexAttributes[2+column].location = 2 + column;
+			vertexAttributes[2+column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			vertexAttributes[2+column].offset = column * sizeof(glm::vec4);
+		}
+
 		VkPipelineVertexInputStateCreateInfo inputInfo{};
 		inputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-		inputInfo.vertexBindingDescriptionCount = 2; // number of vertexInputs above 
+		// With vertex pulling, the shader reads the vertices itself
+		inputInfo.vertexBindingDescriptionCount = cfg::vertexPulling ? 0 : 3; // number of vertexInputs above 
 		inputInfo.pVertexBindingDescriptions = vertexInputs;
-		inputInfo.vertexAttributeDescriptionCount = 2; // number of vertexAttributes above 
+		inputInfo.vertexAttributeDescriptionCount = cfg::vertexPulling ? 0 : 6; // number of vertexAttributes above 
 		inputInfo.pVertexAttributeDescriptions = vertexAttributes;
 
 		// Define which primitive (point, line, triangle, ...) the input is 
@@ -916,14 +2138,14 @@ namespace
 		VkViewport viewport{};
 		viewport.x = 0.f;
 		viewport.y = 0.f;
-		viewport.width = float(aWindow.swapchainExtent.width);
-		viewport.height = float(aWindow.swapchainExtent.height);
+		viewport.width = float(aExtent.width);
+		viewport.height = float(aExtent.height);
 		viewport.minDepth = 0.f;
 		viewport.maxDepth = 1.f;
 
 		VkRect2D scissor{};
 		scissor.offset = VkOffset2D{ 0, 0 };
-		scissor.extent = VkExtent2D{ aWindow.swapchainExtent.width, aWindow.swapchainExtent.height };
+		scissor.extent = VkExtent2D{ aExtent.width, aExtent.height };
 
 		VkPipelineViewportStateCreateInfo viewportInfo{};
 		viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
@@ -984,228 +2206,2140 @@ namespace
 		pipeInfo.subpass = 0; // first subpass of aRenderPass 
 
 		VkPipeline pipe = VK_NULL_HANDLE;
-		if (auto const res = vkCreateGraphicsPipelines(aWindow.device, VK_NULL_HANDLE, 1, &pipeInfo, nullptr, &pipe); VK_SUCCESS != res)
+		if (auto const res = vkCreateGraphicsPipelines(aContext.device, VK_NULL_HANDLE, 1, &pipeInfo, nullptr, &pipe); VK_SUCCESS != res)
 		{
 			throw lut::Error("Unable to create graphics pipeline\n" "vkCreateGraphicsPipelines() returned %s", lut::to_string(res).c_str());
 
 		}
 
-		return lut::Pipeline(aWindow.device, pipe);
+		return lut::Pipeline(aContext.device, pipe);
 	}
 
-	void create_swapchain_framebuffers(lut::VulkanWindow const& aWindow, VkRenderPass aRenderPass, std::vector<lut::Framebuffer>& aFramebuffers, VkImageView aDepthView)
+	lut::Pipeline create_depth_pipeline(lut::VulkanContext const& aContext, VkRenderPass aRenderPass, VkPipelineLayout aPipelineLayout, VkExtent2D const& aExtent)
 	{
-		assert(aFramebuffers.empty());
-
-		for (std::size_t i = 0; i < aWindow.swapViews.size(); ++i)
-		{
-			VkImageView attachments[2] = {
-				aWindow.swapViews[i],
-				aDepthView
-			};
-
-			VkFramebufferCreateInfo fbInfo{};
-			fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-			fbInfo.flags = 0; // normal framebuffer 
-			fbInfo.renderPass = aRenderPass;
-			fbInfo.attachmentCount = 2;
-			fbInfo.pAttachments = attachments;
-			fbInfo.width = aWindow.swapchainExtent.width;
-			fbInfo.height = aWindow.swapchainExtent.height;
-			fbInfo.layers = 1;
-
-			VkFramebuffer fb = VK_NULL_HANDLE;
-			if (auto const res = vkCreateFramebuffer(aWindow.device, &fbInfo, nullptr, &fb); VK_SUCCESS != res)
-			{
-				throw lut::Error("Unable to create framebuffer for swap chain image %zu\n" "vkCreateFramebuffer() returned %s", i, lut::to_string(res).c_str());
+		LUT_TRACE_SCOPE("create_depth_pipeline");
 
-			}
+		lut::ShaderModule vert = lut::load_shader_module(aContext, cfg::vertexPulling ? cfg::kDepthPullVertShaderPath : cfg::kDepthVertShaderPath);
 
-			aFramebuffers.emplace_back(lut::Framebuffer(aWindow.device, fb));
-		}
+		VkPipelineDepthStencilStateCreateInfo depthInfo{};
+		depthInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depthInfo.depthTestEnable = VK_TRUE;
+		depthInfo.depthWriteEnable = VK_TRUE;
+		depthInfo.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+		depthInfo.minDepthBounds = 0.f;
+		depthInfo.maxDepthBounds = 1.f;
 
-		assert(aWindow.swapViews.size() == aFramebuffers.size());
-	}
+		// No fragment shader; depth is written by the fixed-function tests
+		VkPipelineShaderStageCreateInfo stages[1]{};
+		stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		stages[0].module = vert.handle;
+		stages[0].pName = "main";
 
-	lut::DescriptorSetLayout create_scene_descriptor_layout( lut::VulkanWindow const& aWindow )
-	{
-		VkDescriptorSetLayoutBinding bindings[1]{}; 
-		bindings[0].binding = 0; // number must match the index of the corresponding 
-		// binding = N declaration in the shader(s)! 
-		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; 
-		bindings[0].descriptorCount = 1; 
-		bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		// Positions (binding 0) of both the colored and the textured meshes,
+		// and the model matrices as in the other pipelines
+		VkVertexInputBindingDescription vertexInputs[2]{};
+		vertexInputs[0].binding = 0;
+		vertexInputs[0].stride = sizeof(float) * 3;
+		vertexInputs[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-		VkDescriptorSetLayoutCreateInfo layoutInfo{};
-		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		layoutInfo.bindingCount = sizeof(bindings) / sizeof(bindings[0]);
-		layoutInfo.pBindings = bindings; 
-			
-		VkDescriptorSetLayout layout = VK_NULL_HANDLE; 
-		if(auto const res = vkCreateDescriptorSetLayout(aWindow.device, &layoutInfo, nullptr, &layout); VK_SUCCESS != res)
-		{
-			throw lut::Error("Unable to create descriptor set layout\n" "vkCreateDescriptorSetLayout() returned %s", lut::to_string(res).c_str()); 
-				
-		} 
-			
-		return lut::DescriptorSetLayout(aWindow.device, layout);
-	}
-	lut::DescriptorSetLayout create_object_descriptor_layout( lut::VulkanWindow const& aWindow )
-	{
-		VkDescriptorSetLayoutBinding bindings[1]{}; 
-		bindings[0].binding = 0; // this must match the shaders 
-		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER; 
-		bindings[0].descriptorCount = 1; 
-		bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT; 
-			
-		VkDescriptorSetLayoutCreateInfo layoutInfo{}; 
-		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO; 
-		layoutInfo.bindingCount = sizeof(bindings) / sizeof(bindings[0]); 
-		layoutInfo.pBindings = bindings; 
-			
-		VkDescriptorSetLayout layout = VK_NULL_HANDLE; 
-		if(auto const res = vkCreateDescriptorSetLayout(aWindow.device, &layoutInfo,  nullptr, &layout); VK_SUCCESS != res)
-		{
-			throw lut::Error("Unable to create descriptor set layout\n" "vkCreateDescriptorSetLayout() returned %s", lut::to_string(res).c_str());
-				
-		} 
-			
-		return lut::DescriptorSetLayout(aWindow.device, layout);
-	}
+		vertexInputs[1].binding = 2;
+		vertexInputs[1].stride = sizeof(glm::mat4);
+		vertexInputs[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
-	void record_commands(VkCommandBuffer aCmdBuff, VkRenderPass aRenderPass, VkFramebuffer aFramebuffer, VkPipeline aGraphicsPipe, VkPipeline aTexGraphicsPipe, VkExtent2D const& aImageExtent,
-		std::vector<VkBuffer> aPositionBuffer, std::vector<VkBuffer> aColorBuffer, std::vector<std::uint32_t> aVertexCount,
-		std::vector<VkBuffer> aTexPositionBuffer, std::vector<VkBuffer> ATexBuffer, std::vector<std::uint32_t> aTexVertexCount, 
-		VkBuffer aSceneUBO, glsl::SceneUniform const& aSceneUniform, VkPipelineLayout aGraphicsLayout, VkDescriptorSet aSceneDescriptors, std::vector<VkDescriptorSet> aCityDescriptors)
-	{
-		// Begin recording commands
-		VkCommandBufferBeginInfo begInfo{};
-		begInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		begInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-		begInfo.pInheritanceInfo = nullptr;
+		VkVertexInputAttributeDescription vertexAttributes[5]{};
+		vertexAttributes[0].binding = 0;
+		vertexAttributes[0].location = 0;
+		vertexAttributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+		vertexAttributes[0].offset = 0;
 
-		if (auto const res = vkBeginCommandBuffer(aCmdBuff, &begInfo); VK_SUCCESS != res)
+		for (std::uint32_t column = 0; column < 4; ++column)
 		{
-			throw lut::Error("Unable to begin recording command buffer\n" "vkBeginCommandBuffer() returned %s", lut::to_string(res).c_str());
+			vertexAttributes[1+column].binding = 2;
+			vertexAttributes[1+column].location = 2 + column;
+			vertexAttributes[1+column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			vertexAttributes[1+column].offset = column * sizeof(glm::vec4);
 		}
 
-		lut::buffer_barrier(aCmdBuff,
-			aSceneUBO,
-			VK_ACCESS_UNIFORM_READ_BIT,
-			VK_ACCESS_TRANSFER_WRITE_BIT,
-			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
-			VK_PIPELINE_STAGE_TRANSFER_BIT
-		);
+		VkPipelineVertexInputStateCreateInfo inputInfo{};
+		inputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		inputInfo.vertexBindingDescriptionCount = cfg::vertexPulling ? 0 : 2;
+		inputInfo.pVertexBindingDescriptions = vertexInputs;
+		inputInfo.vertexAttributeDescriptionCount = cfg::vertexPulling ? 0 : 5;
+		inputInfo.pVertexAttributeDescriptions = vertexAttributes;
 
-		vkCmdUpdateBuffer(aCmdBuff, aSceneUBO, 0, sizeof(glsl::SceneUniform), &aSceneUniform);
+		VkPipelineInputAssemblyStateCreateInfo assemblyInfo{};
+		assemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		assemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		assemblyInfo.primitiveRestartEnable = VK_FALSE;
 
-		lut::buffer_barrier(aCmdBuff,
-			aSceneUBO,
-			VK_ACCESS_TRANSFER_WRITE_BIT,
-			VK_ACCESS_UNIFORM_READ_BIT,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
-		);
+		VkViewport viewport{};
+		viewport.x = 0.f;
+		viewport.y = 0.f;
+		viewport.width = float(aExtent.width);
+		viewport.height = float(aExtent.height);
+		viewport.minDepth = 0.f;
+		viewport.maxDepth = 1.f;
 
+		VkRect2D scissor{};
+		scissor.offset = VkOffset2D{ 0, 0 };
+		scissor.extent = VkExtent2D{ aExtent.width, aExtent.height };
 
-		// Begin render pass 
-		VkClearValue clearValues[2]{};
-		clearValues[0].color.float32[0] = 0.1f; // Clear to a dark gray background. 
-		clearValues[0].color.float32[1] = 0.1f; // If we were debugging, this would potentially 
+		VkPipelineViewportStateCreateInfo viewportInfo{};
+		viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportInfo.viewportCount = 1;
+		viewportInfo.pViewports = &viewport;
+		viewportInfo.scissorCount = 1;
+		viewportInfo.pScissors = &scissor;
+
+		// Must rasterize exactly as the shading pipelines do
+		VkPipelineRasterizationStateCreateInfo rasterInfo{};
+		rasterInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterInfo.depthClampEnable = VK_FALSE;
+		rasterInfo.rasterizerDiscardEnable = VK_FALSE;
+		rasterInfo.polygonMode = VK_POLYGON_MODE_FILL;
+		rasterInfo.cullMode = VK_CULL_MODE_BACK_BIT;
+		rasterInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		rasterInfo.depthBiasEnable = VK_FALSE;
+		rasterInfo.lineWidth = 1.f; // required
+
+		VkPipelineMultisampleStateCreateInfo samplingInfo{};
+		samplingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		samplingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+		// The subpass has a color attachment, which is left untouched
+		VkPipelineColorBlendAttachmentState blendStates[1]{};
+		blendStates[0].blendEnable = VK_FALSE;
+		blendStates[0].colorWriteMask = 0;
+
+		VkPipelineColorBlendStateCreateInfo blendInfo{};
+		blendInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		blendInfo.logicOpEnable = VK_FALSE;
+		blendInfo.attachmentCount = 1;
+		blendInfo.pAttachments = blendStates;
+
+		VkGraphicsPipelineCreateInfo pipeInfo{};
+		pipeInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+
+		pipeInfo.stageCount = 1; // vertex stage only
+		pipeInfo.pStages = stages;
+
+		pipeInfo.pVertexInputState = &inputInfo;
+		pipeInfo.pInputAssemblyState = &assemblyInfo;
+		pipeInfo.pTessellationState = nullptr;
+		pipeInfo.pViewportState = &viewportInfo;
+		pipeInfo.pRasterizationState = &rasterInfo;
+		pipeInfo.pMultisampleState = &samplingInfo;
+		pipeInfo.pDepthStencilState = &depthInfo;
+		pipeInfo.pColorBlendState = &blendInfo;
+		pipeInfo.pDynamicState = nullptr;
+
+		pipeInfo.layout = aPipelineLayout;
+		pipeInfo.renderPass = aRenderPass;
+		pipeInfo.subpass = 0;
+
+		VkPipeline pipe = VK_NULL_HANDLE;
+		if (auto const res = vkCreateGraphicsPipelines(aContext.device, VK_NULL_HANDLE, 1, &pipeInfo, nullptr, &pipe); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to create depth pre-pass pipeline\n" "vkCreateGraphicsPipelines() returned %s", lut::to_string(res).c_str());
+		}
+
+		return lut::Pipeline(aContext.device, pipe);
+	}
+
+	lut::Pipeline create_impostor_pipeline(lut::VulkanContext const& aContext, VkRenderPass aRenderPass, VkPipelineLayout aPipelineLayout, VkExtent2D const& aExtent)
+	{
+		LUT_TRACE_SCOPE("create_impostor_pipeline");
+
+		lut::ShaderModule vert = lut::load_shader_module(aContext, cfg::kImpostorVertShaderPath);
+		lut::ShaderModule frag = lut::load_shader_module(aContext, cfg::kImpostorFragShaderPath);
+
+		VkPipelineShaderStageCreateInfo stages[2]{};
+		stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		stages[0].module = vert.handle;
+		stages[0].pName = "main";
+
+		stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		stages[1].module = frag.handle;
+		stages[1].pName = "main";
+
+		VkPipelineDepthStencilStateCreateInfo depthInfo{};
+		depthInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depthInfo.depthTestEnable = VK_TRUE;
+		depthInfo.depthWriteEnable = VK_TRUE;
+		depthInfo.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+		depthInfo.minDepthBounds = 0.f;
+		depthInfo.maxDepthBounds = 1.f;
+
+		// One ImpostorInstance per quad; the corners come from gl_VertexIndex
+		VkVertexInputBindingDescription vertexInputs[1]{};
+		vertexInputs[0].binding = 0;
+		vertexInputs[0].stride = sizeof(ImpostorInstance);
+		vertexInputs[0].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+		VkVertexInputAttributeDescription vertexAttributes[3]{};
+		vertexAttributes[0].binding = 0;
+		vertexAttributes[0].location = 0;
+		vertexAttributes[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		vertexAttributes[0].offset = offsetof(ImpostorInstance, center);
+
+		vertexAttributes[1].binding = 0;
+		vertexAttributes[1].location = 1;
+		vertexAttributes[1].format = VK_FORMAT_R32G32_SFLOAT;
+		vertexAttributes[1].offset = offsetof(ImpostorInstance, halfHeight); // and yaw
+
+		vertexAttributes[2].binding = 0;
+		vertexAttributes[2].location = 2;
+		vertexAttributes[2].format = VK_FORMAT_R32G32_UINT;
+		vertexAttributes[2].offset = offsetof(ImpostorInstance, firstLayer); // and viewCount
+
+		VkPipelineVertexInputStateCreateInfo inputInfo{};
+		inputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		inputInfo.vertexBindingDescriptionCount = 1;
+		inputInfo.pVertexBindingDescriptions = vertexInputs;
+		inputInfo.vertexAttributeDescriptionCount = 3;
+		inputInfo.pVertexAttributeDescriptions = vertexAttributes;
+
+		VkPipelineInputAssemblyStateCreateInfo assemblyInfo{};
+		assemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		assemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		assemblyInfo.primitiveRestartEnable = VK_FALSE;
+
+		VkViewport viewport{};
+		viewport.x = 0.f;
+		viewport.y = 0.f;
+		viewport.width = float(aExtent.width);
+		viewport.height = float(aExtent.height);
+		viewport.minDepth = 0.f;
+		viewport.maxDepth = 1.f;
+
+		VkRect2D scissor{};
+		scissor.offset = VkOffset2D{ 0, 0 };
+		scissor.extent = VkExtent2D{ aExtent.width, aExtent.height };
+
+		VkPipelineViewportStateCreateInfo viewportInfo{};
+		viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportInfo.viewportCount = 1;
+		viewportInfo.pViewports = &viewport;
+		viewportInfo.scissorCount = 1;
+		viewportInfo.pScissors = &scissor;
+
+		// Quads face the camera, but their winding isn't worth keeping track of
+		VkPipelineRasterizationStateCreateInfo rasterInfo{};
+		rasterInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterInfo.depthClampEnable = VK_FALSE;
+		rasterInfo.rasterizerDiscardEnable = VK_FALSE;
+		rasterInfo.polygonMode = VK_POLYGON_MODE_FILL;
+		rasterInfo.cullMode = VK_CULL_MODE_NONE;
+		rasterInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		rasterInfo.depthBiasEnable = VK_FALSE;
+		rasterInfo.lineWidth = 1.f; // required
+
+		VkPipelineMultisampleStateCreateInfo samplingInfo{};
+		samplingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		samplingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+		// Opaque; uncovered texels are discarded instead of blended
+		VkPipelineColorBlendAttachmentState blendStates[1]{};
+		blendStates[0].blendEnable = VK_FALSE;
+		blendStates[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+		VkPipelineColorBlendStateCreateInfo blendInfo{};
+		blendInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		blendInfo.logicOpEnable = VK_FALSE;
+		blendInfo.attachmentCount = 1;
+		blendInfo.pAttachments = blendStates;
+
+		VkGraphicsPipelineCreateInfo pipeInfo{};
+		pipeInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+
+		pipeInfo.stageCount = 2;
+		pipeInfo.pStages = stages;
+
+		pipeInfo.pVertexInputState = &inputInfo;
+		pipeInfo.pInputAssemblyState = &assemblyInfo;
+		pipeInfo.pTessellationState = nullptr;
+		pipeInfo.pViewportState = &viewportInfo;
+		pipeInfo.pRasterizationState = &rasterInfo;
+		pipeInfo.pMultisampleState = &samplingInfo;
+		pipeInfo.pDepthStencilState = &depthInfo;
+		pipeInfo.pColorBlendState = &blendInfo;
+		pipeInfo.pDynamicState = nullptr;
+
+		pipeInfo.layout = aPipelineLayout; // same sets as the textured pipeline
+		pipeInfo.renderPass = aRenderPass;
+		pipeInfo.subpass = 0;
+
+		VkPipeline pipe = VK_NULL_HANDLE;
+		if (auto const res = vkCreateGraphicsPipelines(aContext.device, VK_NULL_HANDLE, 1, &pipeInfo, nullptr, &pipe); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to create impostor pipeline\n" "vkCreateGraphicsPipelines() returned %s", lut::to_string(res).c_str());
+		}
+
+		return lut::Pipeline(aContext.device, pipe);
+	}
+
+	void create_swapchain_framebuffers(lut::VulkanWindow const& aWindow, VkRenderPass aRenderPass, std::vector<lut::Framebuffer>& aFramebuffers, VkImageView aDepthView)
+	{
+		assert(aFramebuffers.empty());
+
+		for (std::size_t i = 0; i < aWindow.swapViews.size(); ++i)
+		{
+			VkImageView attachments[2] = {
+				aWindow.swapViews[i],
+				aDepthView
+			};
+
+			VkFramebufferCreateInfo fbInfo{};
+			fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			fbInfo.flags = 0; // normal framebuffer 
+			fbInfo.renderPass = aRenderPass;
+			fbInfo.attachmentCount = 2;
+			fbInfo.pAttachments = attachments;
+			fbInfo.width = aWindow.swapchainExtent.width;
+			fbInfo.height = aWindow.swapchainExtent.height;
+			fbInfo.layers = 1;
+
+			VkFramebuffer fb = VK_NULL_HANDLE;
+			if (auto const res = vkCreateFramebuffer(aWindow.device, &fbInfo, nullptr, &fb); VK_SUCCESS != res)
+			{
+				throw lut::Error("Unable to create framebuffer for swap chain image %zu\n" "vkCreateFramebuffer() returned %s", i, lut::to_string(res).c_str());
+
+			}
+
+			aFramebuffers.emplace_back(lut::Framebuffer(aWindow.device, fb));
+		}
+
+		assert(aWindow.swapViews.size() == aFramebuffers.size());
+	}
+
+	lut::DescriptorSetLayout create_scene_descriptor_layout( lut::VulkanContext const& aContext )
+	{
+		VkDescriptorSetLayoutBinding bindings[1]{}; 
+		bindings[0].binding = 0; // number must match the index of the corresponding 
+		// binding = N declaration in the shader(s)! 
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; 
+		bindings[0].descriptorCount = 1; 
+		bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = sizeof(bindings) / sizeof(bindings[0]);
+		layoutInfo.pBindings = bindings; 
+			
+		VkDescriptorSetLayout layout = VK_NULL_HANDLE; 
+		if(auto const res = vkCreateDescriptorSetLayout(aContext.device, &layoutInfo, nullptr, &layout); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to create descriptor set layout\n" "vkCreateDescriptorSetLayout() returned %s", lut::to_string(res).c_str()); 
+				
+		} 
+			
+		return lut::DescriptorSetLayout(aContext.device, layout);
+	}
+	lut::DescriptorSetLayout create_object_descriptor_layout( lut::VulkanContext const& aContext )
+	{
+		VkDescriptorSetLayoutBinding bindings[1]{}; 
+		bindings[0].binding = 0; // this must match the shaders 
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER; 
+		bindings[0].descriptorCount = 1; 
+		bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT; 
+			
+		VkDescriptorSetLayoutCreateInfo layoutInfo{}; 
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO; 
+		layoutInfo.bindingCount = sizeof(bindings) / sizeof(bindings[0]); 
+		layoutInfo.pBindings = bindings; 
+			
+		VkDescriptorSetLayout layout = VK_NULL_HANDLE; 
+		if(auto const res = vkCreateDescriptorSetLayout(aContext.device, &layoutInfo,  nullptr, &layout); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to create descriptor set layout\n" "vkCreateDescriptorSetLayout() returned %s", lut::to_string(res).c_str());
+				
+		} 
+			
+		return lut::DescriptorSetLayout(aContext.device, layout);
+	}
+
+	FrameDrawOptions make_frame_draw_options(SceneResources const& aScene, OcclusionPass const& aOcclusion, DepthPrepass const& aPrepass, FragmentQuery const& aFragments, ImpostorDraws const& aImpostors, OffscreenTarget const* aCapture)
+	{
+		FrameDrawOptions ret;
+		ret.meshlets = cfg::meshlets ? &aScene.meshletDraws : nullptr;
+		ret.occlusion = cfg::occlusionCulling ? &aOcclusion : nullptr;
+		ret.runs = cfg::softOcclusion || cfg::impostors ? &aScene.instanceRuns : nullptr;
+		ret.prepass = cfg::depthPrepass ? &aPrepass : nullptr;
+		ret.fragments = cfg::fragmentStats ? &aFragments : nullptr;
+		ret.pulled = cfg::vertexPulling ? &aScene.pulledDraws : nullptr;
+		ret.impostors = cfg::impostors ? &aImpostors : nullptr;
+		ret.capture = aCapture;
+		return ret;
+	}
+
+	DrawStats record_commands(VkCommandBuffer aCmdBuff, VkRenderPass aRenderPass, VkFramebuffer aFramebuffer, VkPipeline aGraphicsPipe, VkPipeline aTexGraphicsPipe, VkExtent2D const& aImageExtent,
+		std::vector<VkBuffer> aPositionBuffer, std::vector<VkBuffer> aColorBuffer, std::vector<std::uint32_t> aVertexCount,
+		std::vector<VkBuffer> aTexPositionBuffer, std::vector<VkBuffer> ATexBuffer, std::vector<std::uint32_t> aTexVertexCount, 
+		VkBuffer aInstanceBuffer, std::vector<InstanceRange> const& aInstances, std::vector<InstanceRange> const& aTexInstances,
+		VkBuffer aSceneUBO, glsl::SceneUniform const& aSceneUniform, VkPipelineLayout aGraphicsLayout, VkDescriptorSet aSceneDescriptors, std::vector<VkDescriptorSet> aCityDescriptors,
+		std::vector<std::uint32_t> const& aCityLayers, FrameDrawOptions const& aOptions, lut::GpuProfiler& aProfiler)
+	{
+		LUT_TRACE_SCOPE("record_commands");
+
+		// Begin recording commands
+		VkCommandBufferBeginInfo begInfo{};
+		begInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		begInfo.pInheritanceInfo = nullptr;
+
+		if (auto const res = vkBeginCommandBuffer(aCmdBuff, &begInfo); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to begin recording command buffer\n" "vkBeginCommandBuffer() returned %s", lut::to_string(res).c_str());
+		}
+
+		aProfiler.begin_frame(aCmdBuff);
+		auto const frameScope = aProfiler.begin_scope(aCmdBuff, "frame");
+
+		lut::buffer_barrier(aCmdBuff,
+			aSceneUBO,
+			VK_ACCESS_UNIFORM_READ_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT
+		);
+
+		vkCmdUpdateBuffer(aCmdBuff, aSceneUBO, 0, sizeof(glsl::SceneUniform), &aSceneUniform);
+
+		lut::buffer_barrier(aCmdBuff,
+			aSceneUBO,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_ACCESS_UNIFORM_READ_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+		);
+
+
+		// Occlusion culling, first phase: the meshlets that were visible in
+		// the previous frame
+		if (aOptions.occlusion)
+		{
+			auto const cullScope = aProfiler.begin_scope(aCmdBuff, "occlusion cull");
+			record_occlusion_cull(aCmdBuff, *aOptions.occlusion->culler, *aOptions.occlusion->pyramid, OcclusionPhase::early, aOptions.occlusion->view, aOptions.occlusion->frameSlot);
+			aProfiler.end_scope(aCmdBuff, cullScope);
+		}
+
+		// Begin render pass 
+		VkClearValue clearValues[2]{};
+		clearValues[0].color.float32[0] = 0.1f; // Clear to a dark gray background. 
+		clearValues[0].color.float32[1] = 0.1f; // If we were debugging, this would potentially 
 		clearValues[0].color.float32[2] = 0.1f; // help us see whether the render pass took 
 		clearValues[0].color.float32[3] = 1.f; // place, even if nothing else was drawn. 
 
-		clearValues[1].depthStencil.depth = 1.f;
+		clearValues[1].depthStencil.depth = 1.f;
+
+		VkRenderPassBeginInfo passInfo{};
+		passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		passInfo.renderPass = aRenderPass;
+		passInfo.framebuffer = aFramebuffer;
+		passInfo.renderArea.offset = VkOffset2D{ 0, 0 };
+		passInfo.renderArea.extent = aImageExtent;
+		passInfo.clearValueCount = 2;
+		passInfo.pClearValues = clearValues;
+
+		DrawStats stats;
+
+		auto const count_draw = [&stats](bool aDepthOnly, std::uint32_t aVertexCount, std::uint32_t aInstanceCount) {
+			if (aDepthOnly)
+				return;
+			++stats.draws;
+			stats.triangles += std::uint64_t(aVertexCount / 3) * aInstanceCount;
+		};
+
+		// Draws all meshes. With meshlets, aCommands holds their indirect
+		// draws. Depth-only draws bind positions only, and no textures.
+		// Profiler scopes are optional.
+		auto const draw_scene = [&](VkBuffer aCommands, VkPipeline aPipe, VkPipeline aTexPipe, bool aDepthOnly, char const* aOpaqueScope, char const* aTexturedScope) {
+			// Begin drawing with our graphics pipeline 
+			vkCmdBindPipeline(aCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aPipe);
+			vkCmdBindDescriptorSets(aCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aGraphicsLayout, 0, 1, &aSceneDescriptors, 0, nullptr);
+
+			// Model matrices, for both pipelines. Draws select their model's
+			// instances with firstInstance. With vertex pulling, they are
+			// read from set 2 with all vertices, which is bound only once.
+			if (aOptions.pulled)
+			{
+				vkCmdBindDescriptorSets(aCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aGraphicsLayout, 2, 1, &aOptions.pulled->descriptors, 0, nullptr);
+			}
+			else
+			{
+				VkDeviceSize const instanceOffset = 0;
+				vkCmdBindVertexBuffers(aCmdBuff, 2, 1, &aInstanceBuffer, &instanceOffset);
+				++stats.vertexBufferBinds;
+			}
+
+			auto const opaqueScope = aOpaqueScope ? aProfiler.begin_scope(aCmdBuff, aOpaqueScope) : 0;
+			for (int i = 0; i < aPositionBuffer.size(); i++) { //Draw every colored mesh
+				if (0 == aInstances[i].count)
+					continue;
+				if (aOptions.meshlets && 0 == aOptions.meshlets->draws[i].count)
+					continue;
+				if (aOptions.runs && aOptions.runs->draws[i].empty())
+					continue;
+
+				// Pulled meshes are ranges of the shared index buffer
+				std::uint32_t vertexCount = aVertexCount[i], firstVertex = 0;
+				if (aOptions.pulled)
+				{
+					vertexCount = aOptions.pulled->draws[i].indexCount;
+					firstVertex = aOptions.pulled->draws[i].firstIndex;
+				}
+				else
+				{
+					VkBuffer buffers[2] = { aPositionBuffer[i], aColorBuffer[i] };
+					VkDeviceSize offsets[2]{};
+
+					vkCmdBindVertexBuffers(aCmdBuff, 0, aDepthOnly ? 1 : 2, buffers, offsets);
+					++stats.vertexBufferBinds;
+				}
+
+				// Draw vertices, once per (visible) instance, or the visible
+				// meshlets of each instance
+				if (aOptions.meshlets)
+					draw_meshlets(aCmdBuff, *aOptions.meshlets, aCommands, aOptions.meshlets->indexBuffers[i], aOptions.meshlets->draws[i]);
+				else if (aOptions.runs)
+				{
+					for (auto const& run : aOptions.runs->draws[i])
+					{
+						vkCmdDraw(aCmdBuff, vertexCount, run.count, firstVertex, run.first);
+						count_draw(aDepthOnly, vertexCount, run.count);
+					}
+				}
+				else
+				{
+					vkCmdDraw(aCmdBuff, vertexCount, aInstances[i].count, firstVertex, aInstances[i].first);
+					count_draw(aDepthOnly, vertexCount, aInstances[i].count);
+				}
+			}
+
+			if (aOpaqueScope)
+				aProfiler.end_scope(aCmdBuff, opaqueScope);
+
+			if (aTexPipe != aPipe)
+				vkCmdBindPipeline(aCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aTexPipe); //Bind new pipeline
+
+			auto const texturedScope = aTexturedScope ? aProfiler.begin_scope(aCmdBuff, aTexturedScope) : 0;
+
+			VkDescriptorSet boundSet = VK_NULL_HANDLE;
+			std::uint32_t boundLayer = ~std::uint32_t(0);
+			for (int i = 0; i < aTexPositionBuffer.size(); i++) { //Draw every textured mesh
+				if (0 == aTexInstances[i].count)
+					continue;
+				if (aOptions.meshlets && 0 == aOptions.meshlets->texDraws[i].count)
+					continue;
+				if (aOptions.runs && aOptions.runs->texDraws[i].empty())
+					continue;
+
+				//Bind new descriptors if the mesh uses a different image. Meshes
+				//with textures in the same array image or atlas share their set,
+				//and only change the layer.
+				if (!aDepthOnly && aCityDescriptors[i] != boundSet)
+				{
+					vkCmdBindDescriptorSets(aCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aGraphicsLayout, 1, 1, &(aCityDescriptors[i]), 0, nullptr);
+					boundSet = aCityDescriptors[i];
+					++stats.descriptorBinds;
+				}
+
+				if (!aDepthOnly && aCityLayers[i] != boundLayer)
+				{
+					vkCmdPushConstants(aCmdBuff, aGraphicsLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(std::uint32_t), &aCityLayers[i]);
+					boundLayer = aCityLayers[i];
+				}
+				std::uint32_t vertexCount = aTexVertexCount[i], firstVertex = 0;
+				if (aOptions.pulled)
+				{
+					vertexCount = aOptions.pulled->texDraws[i].indexCount;
+					firstVertex = aOptions.pulled->texDraws[i].firstIndex;
+				}
+				else
+				{
+					VkBuffer buffers[2] = { aTexPositionBuffer[i], ATexBuffer[i] };
+					VkDeviceSize offsets[2]{};
+
+					vkCmdBindVertexBuffers(aCmdBuff, 0, aDepthOnly ? 1 : 2, buffers, offsets);
+					++stats.vertexBufferBinds;
+				}
+
+				// Draw vertices, once per (visible) instance, or the visible
+				// meshlets of each instance
+				if (aOptions.meshlets)
+					draw_meshlets(aCmdBuff, *aOptions.meshlets, aCommands, aOptions.meshlets->texIndexBuffers[i], aOptions.meshlets->texDraws[i]);
+				else if (aOptions.runs)
+				{
+					for (auto const& run : aOptions.runs->texDraws[i])
+					{
+						vkCmdDraw(aCmdBuff, vertexCount, run.count, firstVertex, run.first);
+						count_draw(aDepthOnly, vertexCount, run.count);
+					}
+				}
+				else
+				{
+					vkCmdDraw(aCmdBuff, vertexCount, aTexInstances[i].count, firstVertex, aTexInstances[i].first);
+					count_draw(aDepthOnly, vertexCount, aTexInstances[i].count);
+				}
+
+				if (!aDepthOnly)
+					++stats.texturedDraws;
+			}
+
+			if (aTexturedScope)
+				aProfiler.end_scope(aCmdBuff, texturedScope);
+		};
+
+		// Impostor quads, from the frame slot's instances. Their fragments
+		// are discarded outside of the buildings.
+		auto const draw_impostors = [&] {
+			if (!aOptions.impostors || 0 == aOptions.impostors->count)
+				return;
+
+			auto const impostorScope = aProfiler.begin_scope(aCmdBuff, "impostors");
+
+			vkCmdBindPipeline(aCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aOptions.impostors->pipe);
+			vkCmdBindDescriptorSets(aCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aGraphicsLayout, 0, 1, &aSceneDescriptors, 0, nullptr);
+			vkCmdBindDescriptorSets(aCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aGraphicsLayout, 1, 1, &aOptions.impostors->atlas, 0, nullptr);
+
+			VkDeviceSize const offset = 0;
+			vkCmdBindVertexBuffers(aCmdBuff, 0, 1, &aOptions.impostors->instances, &offset);
+			++stats.vertexBufferBinds;
+
+			vkCmdDraw(aCmdBuff, 6, aOptions.impostors->count, 0, 0);
+			count_draw(false, 6, aOptions.impostors->count);
+			stats.impostors += aOptions.impostors->count;
+
+			aProfiler.end_scope(aCmdBuff, impostorScope);
+		};
+
+		// With the depth pre-pass, all meshes are drawn twice in the same
+		// subpass: first depth only, then shaded with an equal depth test.
+		// Impostors are not part of the pre-pass, and come last.
+		auto const draw_pass = [&](VkBuffer aCommands, char const* aDepthScope, char const* aOpaqueScope, char const* aTexturedScope) {
+			if (aOptions.prepass)
+			{
+				auto const depthScope = aProfiler.begin_scope(aCmdBuff, aDepthScope);
+				draw_scene(aCommands, aOptions.prepass->depthPipe, aOptions.prepass->depthPipe, true, nullptr, nullptr);
+				aProfiler.end_scope(aCmdBuff, depthScope);
+
+				draw_scene(aCommands, aOptions.prepass->pipe, aOptions.prepass->texPipe, false, aOpaqueScope, aTexturedScope);
+			}
+			else
+				draw_scene(aCommands, aGraphicsPipe, aTexGraphicsPipe, false, aOpaqueScope, aTexturedScope);
+
+			draw_impostors();
+		};
+
+		// Count fragment shader invocations over both render passes. The
+		// compute work in between runs no fragment shaders.
+		if (aOptions.fragments)
+		{
+			vkCmdResetQueryPool(aCmdBuff, aOptions.fragments->pool, aOptions.fragments->slot, 1);
+			vkCmdBeginQuery(aCmdBuff, aOptions.fragments->pool, aOptions.fragments->slot, 0);
+		}
+
+		auto const passScope = aProfiler.begin_scope(aCmdBuff, "render pass");
+		vkCmdBeginRenderPass(aCmdBuff, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+		if (aOptions.occlusion)
+			draw_pass(aOptions.occlusion->culler->earlyCommands.buffer, "depth pre-pass", "opaque draws", "textured draws");
+		else
+			draw_pass(aOptions.meshlets ? aOptions.meshlets->commands : VK_NULL_HANDLE, "depth pre-pass", "opaque draws", "textured draws");
+
+		// End the render pass 
+		vkCmdEndRenderPass(aCmdBuff);
+		aProfiler.end_scope(aCmdBuff, passScope);
+
+		// Occlusion culling, second phase: build the depth pyramid from what
+		// was just drawn, test all meshlets against it, and draw the newly
+		// visible ones on top
+		if (aOptions.occlusion)
+		{
+			auto const pyramidScope = aProfiler.begin_scope(aCmdBuff, "depth pyramid");
+			lut::record_depth_pyramid(aCmdBuff, *aOptions.occlusion->builder, *aOptions.occlusion->pyramid);
+			aProfiler.end_scope(aCmdBuff, pyramidScope);
+
+			auto const cullScope = aProfiler.begin_scope(aCmdBuff, "occlusion cull (late)");
+			record_occlusion_cull(aCmdBuff, *aOptions.occlusion->culler, *aOptions.occlusion->pyramid, OcclusionPhase::late, aOptions.occlusion->view, aOptions.occlusion->frameSlot);
+			aProfiler.end_scope(aCmdBuff, cullScope);
+
+			passInfo.renderPass = aOptions.occlusion->latePass;
+
+			auto const lateScope = aProfiler.begin_scope(aCmdBuff, "late render pass");
+			vkCmdBeginRenderPass(aCmdBuff, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+			auto const texturedDraws = stats.texturedDraws, descriptorBinds = stats.descriptorBinds;
+
+			draw_pass(aOptions.occlusion->culler->lateCommands.buffer, "late depth pre-pass", "late opaque draws", "late textured draws");
+
+			stats.lateTexturedDraws = stats.texturedDraws - texturedDraws;
+			stats.lateDescriptorBinds = stats.descriptorBinds - descriptorBinds;
+			stats.texturedDraws = texturedDraws;
+			stats.descriptorBinds = descriptorBinds;
+
+			vkCmdEndRenderPass(aCmdBuff);
+			aProfiler.end_scope(aCmdBuff, lateScope);
+		}
+
+		if (aOptions.fragments)
+			vkCmdEndQuery(aCmdBuff, aOptions.fragments->pool, aOptions.fragments->slot);
+
+		// Copy the rendered image into the host-visible readback buffer. The
+		// render pass leaves the color attachment in TRANSFER_SRC_OPTIMAL,
+		// and its external dependency makes the writes visible to transfers
+		// (see create_render_pass()).
+		if (aOptions.capture)
+		{
+			VkBufferImageCopy copy{};
+			copy.bufferOffset = 0;
+			copy.bufferRowLength = 0; // tightly packed
+			copy.bufferImageHeight = 0;
+			copy.imageSubresource = VkImageSubresourceLayers{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			copy.imageOffset = VkOffset3D{ 0, 0, 0 };
+			copy.imageExtent = VkExtent3D{ aOptions.capture->extent.width, aOptions.capture->extent.height, 1 };
+
+			vkCmdCopyImageToBuffer(aCmdBuff, aOptions.capture->color.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, aOptions.capture->readback.buffer, 1, &copy);
+
+			lut::buffer_barrier(aCmdBuff,
+				aOptions.capture->readback.buffer,
+				VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_ACCESS_HOST_READ_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_HOST_BIT
+			);
+		}
+
+		aProfiler.end_scope(aCmdBuff, frameScope);
+
+		// End command recording 
+		if (auto const res = vkEndCommandBuffer(aCmdBuff); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to end recording command buffer\n" "vkEndCommandBuffer() returned %s", lut::to_string(res).c_str());
+		}
+
+		return stats;
+	}
+
+	void draw_meshlets(VkCommandBuffer aCmdBuff, MeshletDraws const& aDraws, VkBuffer aCommands, VkBuffer aIndices, IndirectRange const& aRange)
+	{
+		vkCmdBindIndexBuffer(aCmdBuff, aIndices, 0, VK_INDEX_TYPE_UINT32);
+
+		VkDeviceSize const stride = sizeof(VkDrawIndexedIndirectCommand);
+
+		// Without multiDrawIndirect, drawCount must be at most one. With it,
+		// it is limited by maxDrawIndirectCount, which is at least 2^16-1.
+		std::uint32_t const maxPerCall = aDraws.multiDraw ? 65535 : 1;
+		for (std::uint32_t first = 0; first < aRange.count; first += maxPerCall)
+		{
+			std::uint32_t const count = std::min(maxPerCall, aRange.count - first);
+			vkCmdDrawIndexedIndirect(aCmdBuff, aCommands, aRange.offset + first * stride, count, std::uint32_t(stride));
+		}
+	}
+
+	void submit_commands(lut::VulkanContext const& aContext, VkCommandBuffer aCmdBuff, VkFence aFence, VkSemaphore aWaitSemaphore, VkSemaphore aSignalSemaphore)
+	{
+		VkPipelineStageFlags waitPipelineStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &aCmdBuff;
+
+		// Headless rendering doesn't involve a swap chain, and therefore
+		// passes VK_NULL_HANDLE for both semaphores.
+		if (VK_NULL_HANDLE != aWaitSemaphore)
+		{
+			submitInfo.waitSemaphoreCount = 1;
+			submitInfo.pWaitSemaphores = &aWaitSemaphore;
+			submitInfo.pWaitDstStageMask = &waitPipelineStages;
+		}
+
+		if (VK_NULL_HANDLE != aSignalSemaphore)
+		{
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &aSignalSemaphore;
+		}
+
+		LUT_TRACE_SCOPE("vkQueueSubmit");
+		if (auto const res = vkQueueSubmit(aContext.graphicsQueue, 1, &submitInfo, aFence); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to submit command buffer to queue\n" "vkQueueSubmit() returned %s", lut::to_string(res).c_str());
+		}
+	}
+}
+
+namespace
+{
+	std::tuple<lut::Image, lut::ImageView> create_depth_buffer(lut::VulkanContext const& aContext, lut::Allocator const& aAllocator, VkExtent2D const& aExtent)
+	{
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = cfg::kDepthFormat;
+		imageInfo.extent.width = aExtent.width;
+		imageInfo.extent.height = aExtent.height;
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		// Read by the depth pyramid (see cfg::occlusionCulling)
+		if (cfg::occlusionCulling)
+			imageInfo.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+
+		VmaAllocationCreateInfo allocInfo{};
+		allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+		VkImage image = VK_NULL_HANDLE;
+		VmaAllocation allocation = VK_NULL_HANDLE;
+
+		if (auto const res = vmaCreateImage(aAllocator.allocator, &imageInfo, &allocInfo, &image, &allocation, nullptr); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to allocate depth buffer image.\n" "vmaCreateImage() returned %s", lut::to_string(res).c_str());
+		}
+
+		lut::Image depthImage(aAllocator.allocator, image, allocation);
+		lut::track_allocation(aAllocator, allocation, lut::MemoryCategory::attachment);
+
+		// Create the image view 
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = depthImage.image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = cfg::kDepthFormat;
+		viewInfo.components = VkComponentMapping{};
+		viewInfo.subresourceRange = VkImageSubresourceRange{
+		VK_IMAGE_ASPECT_DEPTH_BIT,
+			0, 1,
+			0, 1
+		};
+
+		VkImageView view = VK_NULL_HANDLE;
+		if (auto const res = vkCreateImageView(aContext.device, &viewInfo, nullptr, &view); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to create image view\n" "vkCreateImageView() returned %s", lut::to_string(res).c_str());
+
+		}
+
+		return{ std::move(depthImage), lut::ImageView(aContext.device, view) };
+	}
+}
+namespace
+{
+	VkDescriptorSet create_scene_descriptors(lut::VulkanContext const& aContext, VkDescriptorPool aPool, VkDescriptorSetLayout aLayout, VkBuffer aSceneUBO)
+	{
+		VkDescriptorSet sceneDescriptors = lut::alloc_desc_set(aContext, aPool, aLayout);
+		{
+			VkWriteDescriptorSet desc[1]{};
+
+			VkDescriptorBufferInfo sceneUboInfo{};
+			sceneUboInfo.buffer = aSceneUBO;
+			sceneUboInfo.range = VK_WHOLE_SIZE;
+
+			desc[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			desc[0].dstSet = sceneDescriptors;
+			desc[0].dstBinding = 0;
+			desc[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			desc[0].descriptorCount = 1;
+			desc[0].pBufferInfo = &sceneUboInfo;
+
+
+			constexpr auto numSets = sizeof(desc) / sizeof(desc[0]);
+			vkUpdateDescriptorSets(aContext.device, numSets, desc, 0, nullptr);
+		}
+
+		return sceneDescriptors;
+	}
+
+	void create_streamed_textures(SceneResources& aScene, lut::VulkanContext const& aContext, lut::Allocator const& aAllocator, VkDescriptorSetLayout aObjectLayout, VkSampler aSampler, ModelData const& aCityModel, std::uint32_t aFrameSlotCount)
+	{
+		LUT_TRACE_SCOPE("create_streamed_textures");
+
+		// Meshes that share a texture also share its streamed image
+		std::vector<std::string> paths;
+		std::map<std::string, std::uint32_t> textureIndices;
+
+		for (auto const& mesh : aCityModel.meshes)
+		{
+			std::string const& texPath = aCityModel.materials[mesh.materialIndex].colorTexturePath;
+			if (texPath.empty())
+				continue;
+
+			auto const [it, inserted] = textureIndices.emplace(texPath, std::uint32_t(paths.size()));
+			if (inserted)
+				paths.push_back(texPath);
+
+			// Bounding sphere, and the ratio of world-space to texture-space
+			// area, which gives the size of one texture repeat in the world
+			glm::vec3 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+			float worldArea = 0.f, uvArea = 0.f;
+
+			for (std::size_t v = mesh.vertexStartIndex; v + 2 < mesh.vertexStartIndex + mesh.numberOfVertices; v += 3)
+			{
+				glm::vec3 const& p0 = aCityModel.vertexPositions[v];
+				glm::vec3 const& p1 = aCityModel.vertexPositions[v+1];
+				glm::vec3 const& p2 = aCityModel.vertexPositions[v+2];
+
+				lo = glm::min(lo, glm::min(p0, glm::min(p1, p2)));
+				hi = glm::max(hi, glm::max(p0, glm::max(p1, p2)));
+
+				worldArea += 0.5f * glm::length(glm::cross(p1 - p0, p2 - p0));
+
+				glm::vec2 const e1 = aCityModel.vertexTextureCoords[v+1] - aCityModel.vertexTextureCoords[v];
+				glm::vec2 const e2 = aCityModel.vertexTextureCoords[v+2] - aCityModel.vertexTextureCoords[v];
+				uvArea += 0.5f * std::abs(e1.x * e2.y - e1.y * e2.x);
+			}
+
+			SceneResources::StreamedMesh streamed{};
+			streamed.center = 0.5f * (lo + hi);
+			streamed.radius = 0.5f * glm::length(hi - lo);
+			streamed.worldPerUv = uvArea > 0.f ? std::sqrt(worldArea / uvArea) : std::numeric_limits<float>::max();
+			streamed.texture = it->second;
+			aScene.streamedMeshes.push_back(streamed);
+		}
+
+		lut::TextureStreamerConfig config;
+		config.budgetBytes = VkDeviceSize(cfg::streamBudgetMiB) << 20;
+
+		aScene.textureStreamer = lut::create_texture_streamer(aContext, aAllocator, aObjectLayout, aSampler, paths, aFrameSlotCount, config);
+
+		for (auto const& mesh : aScene.streamedMeshes)
+		{
+			aScene.texDescriptors.push_back(aScene.textureStreamer.descriptor_set(mesh.texture));
+			aScene.texLayers.push_back(0);
+		}
+
+		std::printf("Streaming %zu textures for %zu meshes, budget %u MiB\n", paths.size(), aScene.streamedMeshes.size(), cfg::streamBudgetMiB);
+	}
+
+	void update_texture_streaming(SceneResources& aScene, std::uint32_t aFrameSlot, std::uint32_t aFramebufferHeight, bool aWait)
+	{
+		auto& streamer = aScene.textureStreamer;
+
+		// Screen pixels per world unit at a distance of one
+		float const pixelScale = aFramebufferHeight / (2.f * std::tan(0.5f * lut::Radians(cfg::kCameraFov).value()));
+
+		// The finest level needed is where one texel covers about one pixel
+		// at the mesh's closest point. Meshes that are behind the camera or
+		// off-screen count too, so turning around doesn't show low levels.
+		// With several instances, the one that needs the finest level (the
+		// lowest distance per scale) decides.
+		for (auto const& mesh : aScene.streamedMeshes)
+		{
+			if (aScene.cityInstances.empty())
+				break;
+
+			float distancePerScale = std::numeric_limits<float>::max();
+			for (auto const& model : aScene.cityInstances)
+			{
+				float const scale = glm::length(glm::vec3(model[0])); // uniform, see scene_file.hpp
+				glm::vec3 const center = glm::vec3(model * glm::vec4(mesh.center, 1.f));
+
+				float const distance = std::max(glm::length(cfg::pos - center) - mesh.radius * scale, cfg::kCameraNear);
+				distancePerScale = std::min(distancePerScale, distance / scale);
+			}
+
+			float const texels = float(std::max(streamer.width(mesh.texture), streamer.height(mesh.texture)));
+			float const texelsPerPixel = texels / mesh.worldPerUv * distancePerScale / pixelScale;
+
+			std::uint32_t level = 0;
+			if (texelsPerPixel > 1.f)
+				level = std::min(std::uint32_t(std::log2(texelsPerPixel)), streamer.level_count(mesh.texture) - 1);
+
+			streamer.request_level(mesh.texture, level);
+		}
+
+		streamer.update(aFrameSlot, aWait);
+
+		for (std::size_t i = 0; i < aScene.streamedMeshes.size(); ++i)
+			aScene.texDescriptors[i] = streamer.descriptor_set(aScene.streamedMeshes[i].texture);
+	}
+
+	void create_city_pager(SceneResources& aScene, lut::VulkanContext const& aContext, lut::Allocator const& aAllocator, ModelData const& aCarModel, ModelData const& aCityModel, std::uint32_t aFrameSlotCount)
+	{
+		LUT_TRACE_SCOPE("create_city_pager");
+
+		// The city's textured meshes got one descriptor each, in order (see
+		// create_scene_resources())
+		std::int32_t nextSlot = 0;
+		for (auto const& mesh : aCityModel.meshes)
+		{
+			bool const textured = !aCityModel.materials[mesh.materialIndex].colorTexturePath.empty();
+			aScene.cityTexSlots.push_back(textured ? nextSlot++ : -1);
+		}
+
+		aScene.carMeshCount = aCarModel.meshes.size();
+		aScene.cityTexDescriptors = aScene.texDescriptors;
+		aScene.cityTexLayers = aScene.texLayers;
+
+		// Nothing of the city is drawn until its cells are resident
+		aScene.positionBuffers.resize(aScene.carMeshCount);
+		aScene.colorBuffers.resize(aScene.carMeshCount);
+		aScene.vertexCounts.resize(aScene.carMeshCount);
+		aScene.instanceRanges.resize(aScene.carMeshCount);
+
+		aScene.texPositionBuffers.clear();
+		aScene.texCoordBuffers.clear();
+		aScene.texVertexCounts.clear();
+		aScene.texInstanceRanges.clear();
+		aScene.texDescriptors.clear();
+		aScene.texLayers.clear();
+
+		CellPagerConfig config;
+		config.budgetBytes = VkDeviceSize(cfg::pageBudgetMiB) << 20;
+		config.loadRadius = cfg::pageRadius;
+		config.prefetchSeconds = cfg::pagePrefetch;
+
+		CellPackIndex index = load_cell_pack_index(cfg::cellPackPath.c_str());
+		if (index.meshes.size() != aCityModel.meshes.size())
+			throw lut::Error("Cell pack '%s' changed while loading", cfg::cellPackPath.c_str());
+
+		std::printf("Cell paging: %zu cells of %g x %g from '%s', budget %u MiB, radius %.1f, prefetch %.1f s\n", index.cells.size(), index.cellSize, index.cellSize, cfg::cellPackPath.c_str(), cfg::pageBudgetMiB, cfg::pageRadius, cfg::pagePrefetch);
+
+		aScene.cityPager = create_cell_pager(aContext, aAllocator, std::move(index), aScene.cityInstances, aFrameSlotCount, config);
+	}
+
+	void update_city_paging(SceneResources& aScene, std::uint32_t aFrameSlot, bool aWait)
+	{
+		aScene.cityPager.update(aFrameSlot, cfg::pos, aWait);
+
+		// The car's meshes stay, the city's chunks follow
+		aScene.positionBuffers.resize(aScene.carMeshCount);
+		aScene.colorBuffers.resize(aScene.carMeshCount);
+		aScene.vertexCounts.resize(aScene.carMeshCount);
+		aScene.instanceRanges.resize(aScene.carMeshCount);
+
+		aScene.texPositionBuffers.clear();
+		aScene.texCoordBuffers.clear();
+		aScene.texVertexCounts.clear();
+		aScene.texInstanceRanges.clear();
+		aScene.texDescriptors.clear();
+		aScene.texLayers.clear();
+
+		std::vector<PagedChunk const*> textured;
+		for (auto const& chunk : aScene.cityPager.resident_chunks())
+		{
+			if (aScene.cityTexSlots[chunk.mesh] >= 0)
+			{
+				textured.push_back(&chunk);
+				continue;
+			}
+
+			aScene.positionBuffers.push_back(chunk.positions);
+			aScene.colorBuffers.push_back(chunk.attributes);
+			aScene.vertexCounts.push_back(chunk.vertexCount);
+			aScene.instanceRanges.push_back(aScene.cityInstanceRange);
+		}
+
+		// Chunks that share a descriptor set are drawn one after the other,
+		// so that record_commands() binds each set once
+		auto const set_of = [&aScene](PagedChunk const* aChunk) {
+			auto const slot = aScene.cityTexSlots[aChunk->mesh];
+			return std::make_pair(aScene.cityTexDescriptors[slot], aScene.cityTexLayers[slot]);
+		};
+
+		std::stable_sort(textured.begin(), textured.end(), [&](PagedChunk const* aX, PagedChunk const* aY) {
+			return set_of(aX) < set_of(aY);
+		});
+
+		for (auto const* chunk : textured)
+		{
+			auto const [set, layer] = set_of(chunk);
+
+			aScene.texPositionBuffers.push_back(chunk->positions);
+			aScene.texCoordBuffers.push_back(chunk->attributes);
+			aScene.texVertexCounts.push_back(chunk->vertexCount);
+			aScene.texInstanceRanges.push_back(aScene.cityInstanceRange);
+			aScene.texDescriptors.push_back(set);
+			aScene.texLayers.push_back(layer);
+		}
+	}
+
+	void create_impostors(SceneResources& aScene, lut::VulkanContext const& aContext, lut::Allocator const& aAllocator, VkDescriptorPool aPool, VkDescriptorSetLayout aSceneLayout, VkDescriptorSetLayout aObjectLayout, VkPipelineLayout aPipeLayout, std::uint32_t aFrameSlotCount)
+	{
+		LUT_TRACE_SCOPE("create_impostors");
+
+		// A frame without impostors draws every mesh for all of its instances
+		for (std::size_t i = 0; i < aScene.vertexCounts.size(); ++i)
+		{
+			aScene.fullTriangles += std::uint64_t(aScene.vertexCounts[i] / 3) * aScene.instanceRanges[i].count;
+			aScene.fullDraws += aScene.instanceRanges[i].count ? 1 : 0;
+		}
+		for (std::size_t i = 0; i < aScene.texVertexCounts.size(); ++i)
+		{
+			aScene.fullTriangles += std::uint64_t(aScene.texVertexCounts[i] / 3) * aScene.texInstanceRanges[i].count;
+			aScene.fullDraws += aScene.texInstanceRanges[i].count ? 1 : 0;
+		}
+
+		// Room for every building of every city instance, in each frame slot
+		std::size_t const maxImpostors = std::max<std::size_t>(aScene.buildings.size() * aScene.cityInstances.size(), 1);
+		for (std::uint32_t i = 0; i < aFrameSlotCount; ++i)
+			aScene.impostorBuffers.emplace_back(lut::create_buffer(aAllocator, maxImpostors * sizeof(ImpostorInstance), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, lut::MemoryCategory::geometry));
+
+		std::uint32_t const layerCount = std::max(std::uint32_t(aScene.buildings.size()) * cfg::impostorViews, 1u);
+		aScene.impostorAtlas = create_impostor_atlas(aContext, aAllocator, layerCount, cfg::impostorSize, cfg::kImpostorFormat);
+
+		auto const& atlas = aScene.impostorAtlas;
+		VkExtent2D const tileExtent{ atlas.tileSize, atlas.tileSize };
+
+		// The buildings are rendered with the scene's shaders, into one layer
+		// per view. The views' transforms replace the model matrices (one
+		// per layer, selected with firstInstance), and the scene uniforms
+		// are identities.
+		lut::RenderPass bakePass = create_render_pass(aContext, cfg::kImpostorFormat, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		lut::Pipeline bakePipe = create_pipeline(aContext, bakePass.handle, aPipeLayout, tileExtent);
+		lut::Pipeline bakeTexPipe = create_tex_pipeline(aContext, bakePass.handle, aPipeLayout, tileExtent);
+
+		auto [depth, depthView] = create_depth_buffer(aContext, aAllocator, tileExtent);
+
+		std::vector<lut::Framebuffer> framebuffers;
+		for (std::uint32_t layer = 0; layer < atlas.layerCount; ++layer)
+		{
+			VkImageView attachments[2] = {
+				atlas.layerViews[layer].handle,
+				depthView.handle
+			};
+
+			VkFramebufferCreateInfo fbInfo{};
+			fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			fbInfo.renderPass = bakePass.handle;
+			fbInfo.attachmentCount = 2;
+			fbInfo.pAttachments = attachments;
+			fbInfo.width = tileExtent.width;
+			fbInfo.height = tileExtent.height;
+			fbInfo.layers = 1;
+
+			VkFramebuffer fb = VK_NULL_HANDLE;
+			if (auto const res = vkCreateFramebuffer(aContext.device, &fbInfo, nullptr, &fb); VK_SUCCESS != res)
+			{
+				throw lut::Error("Unable to create framebuffer for impostor layer %u\n" "vkCreateFramebuffer() returned %s", layer, lut::to_string(res).c_str());
+			}
+
+			framebuffers.emplace_back(aContext.device, fb);
+		}
+
+		auto const write_buffer = [&aAllocator](lut::Buffer const& aBuffer, void const* aData, std::size_t aSize) {
+			void* ptr = nullptr;
+			if (auto const res = vmaMapMemory(aAllocator.allocator, aBuffer.allocation, &ptr); VK_SUCCESS != res)
+			{
+				throw lut::Error("Mapping memory for writing\n" "vmaMapMemory() returned %s", lut::to_string(res).c_str());
+			}
+
+			std::memcpy(ptr, aData, aSize);
+
+			vmaFlushAllocation(aAllocator.allocator, aBuffer.allocation, 0, VK_WHOLE_SIZE);
+			vmaUnmapMemory(aAllocator.allocator, aBuffer.allocation);
+		};
+
+		glsl::SceneUniform const identity{ glm::mat4(1.f), glm::mat4(1.f), glm::mat4(1.f) };
+		lut::Buffer bakeUBO = lut::create_buffer(aAllocator, sizeof(glsl::SceneUniform), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, lut::MemoryCategory::uniform);
+		write_buffer(bakeUBO, &identity, sizeof(identity));
+
+		VkDescriptorSet const bakeSceneSet = create_scene_descriptors(aContext, aPool, aSceneLayout, bakeUBO.buffer);
+
+		std::vector<glm::mat4> views(atlas.layerCount, glm::mat4(1.f));
+		for (auto const& building : aScene.buildings)
+		{
+			for (std::uint32_t view = 0; view < cfg::impostorViews; ++view)
+				views[building.firstLayer + view] = make_impostor_view(building, view, cfg::impostorViews);
+		}
+
+		lut::Buffer bakeInstances = lut::create_buffer(aAllocator, views.size() * sizeof(glm::mat4), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, lut::MemoryCategory::geometry);
+		write_buffer(bakeInstances, views.data(), views.size() * sizeof(glm::mat4));
+
+		// Record all views in one command buffer
+		lut::CommandPool cpool = lut::create_command_pool(aContext, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		VkCommandBuffer const cbuff = lut::alloc_command_buffer(aContext, cpool.handle);
+		lut::Fence fence = lut::create_fence(aContext);
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		if (auto const res = vkBeginCommandBuffer(cbuff, &beginInfo); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to begin recording impostor command buffer\n" "vkBeginCommandBuffer() returned %s", lut::to_string(res).c_str());
+		}
+
+		VkClearValue clearValues[2]{};
+		clearValues[0].color.float32[0] = 0.f; // transparent black, see impostor.frag
+		clearValues[0].color.float32[1] = 0.f;
+		clearValues[0].color.float32[2] = 0.f;
+		clearValues[0].color.float32[3] = 0.f;
+		clearValues[1].depthStencil.depth = 1.f;
+
+		VkDeviceSize const zeroOffset = 0;
+
+		for (std::uint32_t layer = 0; layer < atlas.layerCount; ++layer)
+		{
+			// Without buildings, the atlas' only layer stays clear
+			std::int32_t building = -1;
+			for (std::size_t b = 0; b < aScene.buildings.size() && building < 0; ++b)
+			{
+				if (layer >= aScene.buildings[b].firstLayer && layer < aScene.buildings[b].firstLayer + cfg::impostorViews)
+					building = std::int32_t(b);
+			}
+
+			// All views share the depth buffer
+			if (0 != layer)
+			{
+				VkMemoryBarrier barrier{};
+				barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+				barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+				vkCmdPipelineBarrier(cbuff, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			}
+
+			VkRenderPassBeginInfo passInfo{};
+			passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+			passInfo.renderPass = bakePass.handle;
+			passInfo.framebuffer = framebuffers[layer].handle;
+			passInfo.renderArea.offset = VkOffset2D{ 0, 0 };
+			passInfo.renderArea.extent = tileExtent;
+			passInfo.clearValueCount = 2;
+			passInfo.pClearValues = clearValues;
+
+			vkCmdBeginRenderPass(cbuff, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+			if (building >= 0)
+			{
+				vkCmdBindPipeline(cbuff, VK_PIPELINE_BIND_POINT_GRAPHICS, bakePipe.handle);
+				vkCmdBindDescriptorSets(cbuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aPipeLayout, 0, 1, &bakeSceneSet, 0, nullptr);
+				vkCmdBindVertexBuffers(cbuff, 2, 1, &bakeInstances.buffer, &zeroOffset);
+
+				for (std::size_t i = 0; i < aScene.meshBuildings.size(); ++i)
+				{
+					if (building != aScene.meshBuildings[i])
+						continue;
+
+					VkBuffer buffers[2] = { aScene.positionBuffers[i], aScene.colorBuffers[i] };
+					VkDeviceSize offsets[2]{};
+					vkCmdBindVertexBuffers(cbuff, 0, 2, buffers, offsets);
+
+					vkCmdDraw(cbuff, aScene.vertexCounts[i], 1, 0, layer);
+				}
+
+				vkCmdBindPipeline(cbuff, VK_PIPELINE_BIND_POINT_GRAPHICS, bakeTexPipe.handle);
+
+				for (std::size_t i = 0; i < aScene.texMeshBuildings.size(); ++i)
+				{
+					if (building != aScene.texMeshBuildings[i])
+						continue;
+
+					vkCmdBindDescriptorSets(cbuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aPipeLayout, 1, 1, &aScene.texDescriptors[i], 0, nullptr);
+					vkCmdPushConstants(cbuff, aPipeLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(std::uint32_t), &aScene.texLayers[i]);
+
+					VkBuffer buffers[2] = { aScene.texPositionBuffers[i], aScene.texCoordBuffers[i] };
+					VkDeviceSize offsets[2]{};
+					vkCmdBindVertexBuffers(cbuff, 0, 2, buffers, offsets);
+
+					vkCmdDraw(cbuff, aScene.texVertexCounts[i], 1, 0, layer);
+				}
+			}
+
+			vkCmdEndRenderPass(cbuff);
+		}
+
+		record_impostor_mips(cbuff, atlas);
+
+		if (auto const res = vkEndCommandBuffer(cbuff); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to end recording impostor command buffer\n" "vkEndCommandBuffer() returned %s", lut::to_string(res).c_str());
+		}
+
+		submit_commands(aContext, cbuff, fence.handle, VK_NULL_HANDLE, VK_NULL_HANDLE);
+
+		if (auto const res = vkWaitForFences(aContext.device, 1, &fence.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max()); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to wait for impostor fence\n" "vkWaitForFences() returned %s", lut::to_string(res).c_str());
+		}
+
+		aScene.impostorSet = create_texture_descriptor_set(aContext, aPool, aObjectLayout, atlas.view.handle, atlas.sampler.handle);
+
+		std::printf("Impostors: %u view(s) of %u x %u texels per building, %u layer(s), switch at %.1f m\n", cfg::impostorViews, atlas.tileSize, atlas.tileSize, atlas.layerCount, cfg::impostorDistance);
+	}
+
+	void select_scene_impostors(SceneResources& aScene, lut::Allocator const& aAllocator, std::uint32_t aFrameSlot, ImpostorTotals& aTotals)
+	{
+		LUT_TRACE_SCOPE("select_scene_impostors");
+
+		select_impostors(aScene.buildings, aScene.cityInstances, cfg::pos, cfg::impostorDistance, cfg::impostorViews, aScene.impostorSelection);
+
+		auto const& selection = aScene.impostorSelection;
+
+		assert(aFrameSlot < aScene.impostorBuffers.size());
+		auto const& buffer = aScene.impostorBuffers[aFrameSlot];
+
+		if (!selection.instances.empty())
+		{
+			void* ptr = nullptr;
+			if (auto const res = vmaMapMemory(aAllocator.allocator, buffer.allocation, &ptr); VK_SUCCESS != res)
+			{
+				throw lut::Error("Mapping memory for writing\n" "vmaMapMemory() returned %s", lut::to_string(res).c_str());
+			}
+
+			std::memcpy(ptr, selection.instances.data(), selection.instances.size() * sizeof(ImpostorInstance));
+
+			// No-op for HOST_COHERENT memory
+			vmaFlushAllocation(aAllocator.allocator, buffer.allocation, 0, VK_WHOLE_SIZE);
+			vmaUnmapMemory(aAllocator.allocator, buffer.allocation);
+		}
+
+		aScene.impostorCount = std::uint32_t(selection.instances.size());
+
+		// Meshes of a building skip the instances in which it's an impostor;
+		// other meshes are drawn for all of their instances
+		std::size_t const buildingCount = aScene.buildings.size();
+		auto const runs = [&](std::vector<InstanceRange> const& aRanges, std::vector<std::int32_t> const& aBuildings, std::vector<std::vector<InstanceRange>>& aDraws) {
+			aDraws.resize(aRanges.size());
+			for (std::size_t i = 0; i < aRanges.size(); ++i)
+			{
+				aDraws[i].clear();
+				if (0 == aRanges[i].count)
+					continue;
+
+				if (aBuildings[i] < 0)
+				{
+					aDraws[i].emplace_back(aRanges[i]);
+					continue;
+				}
+
+				for (std::uint32_t inst = aRanges[i].first; inst < aRanges[i].first + aRanges[i].count; ++inst)
+				{
+					std::size_t const cityInst = inst - aScene.cityInstanceRange.first;
+					if (selection.impostor[cityInst * buildingCount + aBuildings[i]])
+						continue;
+
+					if (!aDraws[i].empty() && aDraws[i].back().first + aDraws[i].back().count == inst)
+						++aDraws[i].back().count;
+					else
+						aDraws[i].emplace_back(InstanceRange{ inst, 1 });
+				}
+			}
+		};
+
+		runs(aScene.instanceRanges, aScene.meshBuildings, aScene.instanceRuns.draws);
+		runs(aScene.texInstanceRanges, aScene.texMeshBuildings, aScene.instanceRuns.texDraws);
+
+		aTotals.frames += 1;
+		aTotals.impostors += selection.instances.size();
+		aTotals.buildingInstances += buildingCount * aScene.cityInstances.size();
+	}
+
+	void report_impostor_stats(ImpostorTotals const& aTotals, SceneResources const& aScene)
+	{
+		if (0 == aTotals.frames)
+			return;
+
+		double const frames = double(aTotals.frames);
+		auto const percent = [](double aPart, double aWhole) {
+			return aWhole > 0.0 ? 100.0 * aPart / aWhole : 0.0;
+		};
+
+		std::printf("Impostors, average of %llu frame(s), switching at %.1f m:\n", static_cast<unsigned long long>(aTotals.frames), cfg::impostorDistance);
+		std::printf("  impostors %9.1f of %.0f building instances (%.1f%%)\n", aTotals.impostors / frames, aTotals.buildingInstances / frames, percent(double(aTotals.impostors), double(aTotals.buildingInstances)));
+		std::printf("  drawn     %9.0f triangles in %.1f draws per frame\n", aTotals.triangles / frames, aTotals.draws / frames);
+		std::printf("  without   %9llu triangles in %u draws per frame (%.1f%% of the triangles drawn)\n", static_cast<unsigned long long>(aScene.fullTriangles), aScene.fullDraws, percent(aTotals.triangles / frames, double(aScene.fullTriangles)));
+	}
+
+	void check_meshlet_support(lut::VulkanContext const& aContext)
+	{
+		// Each instance's commands have a non-zero firstInstance
+		if (aContext.haveDrawIndirectFirstInstance)
+			return;
+
+		std::fprintf(stderr, "Indirect draws with a first instance not supported by the device, drawing whole meshes instead of meshlets\n");
+		cfg::meshlets = false;
+		cfg::occlusionCulling = false;
+	}
+
+	void cull_scene_meshlets(SceneResources& aScene, lut::Allocator const& aAllocator, std::uint32_t aFrameSlot, glm::mat4 const& aProjCam, MeshletTotals& aTotals)
+	{
+		LUT_TRACE_SCOPE("cull_scene_meshlets");
+
+		using Clock_ = std::chrono::steady_clock;
+		auto const start = Clock_::now();
+
+		assert(aFrameSlot < aScene.indirectBuffers.size());
+		auto const& buffer = aScene.indirectBuffers[aFrameSlot];
+
+		void* ptr = nullptr;
+		if (auto const res = vmaMapMemory(aAllocator.allocator, buffer.allocation, &ptr); VK_SUCCESS != res)
+		{
+			throw lut::Error("Mapping memory for writing\n" "vmaMapMemory() returned %s", lut::to_string(res).c_str());
+		}
+
+		auto* const commands = static_cast<VkDrawIndexedIndirectCommand*>(ptr);
+
+		// Views are the same for all meshes of an instance
+		std::vector<MeshletCullView> views;
+		views.reserve(aScene.instanceTransforms.size());
+		for (auto const& model : aScene.instanceTransforms)
+			views.emplace_back(make_meshlet_cull_view(aProjCam, model, cfg::pos));
+
+		MeshletCullStats stats;
+		std::uint32_t written = 0;
+
+		auto const cull = [&](std::vector<MeshletMesh const*> const& aMeshes, std::vector<InstanceRange> const& aRanges, std::vector<IndirectRange>& aDraws) {
+			aDraws.resize(aMeshes.size());
+			for (std::size_t i = 0; i < aMeshes.size(); ++i)
+			{
+				aDraws[i].offset = written * sizeof(VkDrawIndexedIndirectCommand);
+
+				std::uint32_t const first = written;
+				for (std::uint32_t inst = aRanges[i].first; inst < aRanges[i].first + aRanges[i].count; ++inst)
+					written += cull_meshlets(*aMeshes[i], views[inst], inst, commands + written, stats);
+
+				aDraws[i].count = written - first;
+			}
+		};
+
+		cull(aScene.meshlets, aScene.instanceRanges, aScene.meshletDraws.draws);
+		cull(aScene.texMeshlets, aScene.texInstanceRanges, aScene.meshletDraws.texDraws);
+
+		assert(written <= aScene.maxIndirectDraws);
+
+		// No-op for HOST_COHERENT memory
+		vmaFlushAllocation(aAllocator.allocator, buffer.allocation, 0, VK_WHOLE_SIZE);
+		vmaUnmapMemory(aAllocator.allocator, buffer.allocation);
+
+		aScene.meshletDraws.commands = buffer.buffer;
+
+		aTotals.cull += stats;
+		aTotals.frames += 1;
+		aTotals.cullMs += std::chrono::duration<double, std::milli>(Clock_::now() - start).count();
+	}
+
+	void report_meshlet_stats(MeshletTotals const& aTotals)
+	{
+		if (0 == aTotals.frames)
+			return;
+
+		auto const& cull = aTotals.cull;
+		double const frames = double(aTotals.frames);
+		auto const percent = [](std::uint64_t aPart, std::uint64_t aWhole) {
+			return aWhole ? 100.0 * double(aPart) / double(aWhole) : 0.0;
+		};
+
+		std::printf("Meshlets, average of %llu frame(s):\n", static_cast<unsigned long long>(aTotals.frames));
+		std::printf("  tested   %10.0f meshlets, %.1f%% outside the frustum, %.1f%% back-facing\n", cull.meshlets / frames, percent(cull.frustumCulled, cull.meshlets), percent(cull.coneCulled, cull.meshlets));
+		std::printf("  drawn    %10.0f of %.0f triangles (%.1f%%) in %.0f indirect draws\n", cull.drawnTriangles / frames, cull.triangles / frames, percent(cull.drawnTriangles, cull.triangles), cull.draws / frames);
+		std::printf("  culling  %10.3f ms CPU per frame, %.1f M triangles/s tested\n", aTotals.cullMs / frames, aTotals.cullMs > 0.0 ? cull.triangles / (aTotals.cullMs * 1000.0) : 0.0);
+	}
+
+	void cull_scene_soft(SceneResources& aScene, glm::mat4 const& aProjCam, SoftCullTotals& aTotals)
+	{
+		LUT_TRACE_SCOPE("cull_scene_soft");
+
+		using Clock_ = std::chrono::steady_clock;
+		auto const start = Clock_::now();
+
+		aTotals.raster += rasterize_soft_occluders(aScene.softDepth, aScene.softOccluders, aProjCam);
+
+		auto const rasterized = Clock_::now();
+
+		std::vector<glm::mat4> projCamModel;
+		projCamModel.reserve(aScene.instanceTransforms.size());
+		for (auto const& model : aScene.instanceTransforms)
+			projCamModel.emplace_back(aProjCam * model);
+
+		auto const cull = [&](std::vector<SoftBox> const& aBoxes, std::vector<InstanceRange> const& aRanges, std::vector<std::vector<InstanceRange>>& aDraws) {
+			aDraws.resize(aBoxes.size());
+			for (std::size_t i = 0; i < aBoxes.size(); ++i)
+			{
+				aDraws[i].clear();
+				for (std::uint32_t inst = aRanges[i].first; inst < aRanges[i].first + aRanges[i].count; ++inst)
+				{
+					auto const vis = test_soft_box(aScene.softDepth, projCamModel[inst], aBoxes[i]);
+
+					++aTotals.instances;
+					if (SoftVisibility::outside == vis)
+						++aTotals.outside;
+					else if (SoftVisibility::occluded == vis)
+						++aTotals.occluded;
+					else if (!aDraws[i].empty() && aDraws[i].back().first + aDraws[i].back().count == inst)
+						++aDraws[i].back().count;
+					else
+						aDraws[i].emplace_back(InstanceRange{ inst, 1 });
+				}
+			}
+		};
+
+		cull(aScene.meshBoxes, aScene.instanceRanges, aScene.instanceRuns.draws);
+		cull(aScene.texMeshBoxes, aScene.texInstanceRanges, aScene.instanceRuns.texDraws);
+
+		auto const end = Clock_::now();
+
+		aTotals.frames += 1;
+		aTotals.rasterMs += std::chrono::duration<double, std::milli>(rasterized - start).count();
+		aTotals.testMs += std::chrono::duration<double, std::milli>(end - rasterized).count();
+	}
+
+	void report_soft_cull_stats(SoftCullTotals const& aTotals)
+	{
+		if (0 == aTotals.frames)
+			return;
+
+		double const frames = double(aTotals.frames);
+		auto const percent = [](std::uint64_t aPart, std::uint64_t aWhole) {
+			return aWhole ? 100.0 * double(aPart) / double(aWhole) : 0.0;
+		};
+
+		std::printf("Software occlusion culling, average of %llu frame(s):\n", static_cast<unsigned long long>(aTotals.frames));
+		std::printf("  occluders %9.0f polygons, %.0f rasterized, %.0f binned to tiles\n", aTotals.raster.polygons / frames, aTotals.raster.rasterized / frames, aTotals.raster.binned / frames);
+		std::printf("  tested    %9.0f mesh instances, %.1f%% outside the frustum, %.1f%% occluded\n", aTotals.instances / frames, percent(aTotals.outside, aTotals.instances), percent(aTotals.occluded, aTotals.instances));
+		std::printf("  culling   %9.3f ms rasterizing, %.3f ms testing per frame (CPU, %s, %u threads)\n", aTotals.rasterMs / frames, aTotals.testMs / frames, soft_occlusion_isa(), lut::default_thread_count());
+	}
+
+	void check_occlusion_culling_support(lut::VulkanContext const& aContext)
+	{
+		// All commands of a mesh are drawn with one multi-draw call, the
+		// culling shader writes each instance's firstInstance, and the
+		// depth pyramid samples the depth buffer
+		if (aContext.haveMultiDrawIndirect && aContext.haveDrawIndirectFirstInstance && lut::is_depth_pyramid_supported(aContext, cfg::kDepthFormat))
+			return;
+
+		std::fprintf(stderr, "Occlusion culling not supported by the device, culling meshlets on the CPU instead\n");
+		cfg::occlusionCulling = false;
+	}
+
+	OcclusionCuller create_scene_occlusion_culler(SceneResources& aScene, lut::VulkanContext const& aContext, lut::Allocator const& aAllocator, std::uint32_t aFrameSlotCount)
+	{
+		LUT_TRACE_SCOPE("create_scene_occlusion_culler");
+
+		lut::StagingRing staging = lut::create_staging_ring(aContext, aAllocator, VkDeviceSize(cfg::stagingRingMiB) << 20, cfg::directUploads);
+
+		// The records of each mesh, and thus its commands, form one fixed
+		// range. Colored meshes come first, then textured ones.
+		std::vector<OcclusionRecord> records;
+		auto const append = [&](std::vector<MeshletMesh const*> const& aMeshes, std::vector<InstanceRange> const& aRanges, std::vector<IndirectRange>& aDraws) {
+			aDraws.resize(aMeshes.size());
+			for (std::size_t i = 0; i < aMeshes.size(); ++i)
+			{
+				std::size_t const first = records.size();
+				append_occlusion_records(records, *aMeshes[i], aRanges[i].first, aRanges[i].count);
+
+				aDraws[i].offset = first * sizeof(VkDrawIndexedIndirectCommand);
+				aDraws[i].count = std::uint32_t(records.size() - first);
+			}
+		};
+
+		append(aScene.meshlets, aScene.instanceRanges, aScene.meshletDraws.draws);
+		append(aScene.texMeshlets, aScene.texInstanceRanges, aScene.meshletDraws.texDraws);
+
+		OcclusionCuller ret = create_occlusion_culler(aContext, aAllocator, staging, cfg::kMeshletCullShaderPath, records, aScene.instances.buffer, aFrameSlotCount);
+		staging.finish();
+
+		std::printf("Occlusion culling: %zu meshlet instance(s) tested on the GPU\n", records.size());
+		return ret;
+	}
+
+	void collect_occlusion_stats(OcclusionTotals& aTotals, lut::Allocator const& aAllocator, OcclusionCuller& aCuller, std::uint32_t aFrameSlot)
+	{
+		auto const stats = read_occlusion_stats(aAllocator, aCuller, aFrameSlot);
+		if (0 == stats.records)
+			return;
+
+		aTotals.cull += stats;
+		aTotals.frames += 1;
+	}
+
+	void report_occlusion_stats(OcclusionTotals const& aTotals)
+	{
+		if (0 == aTotals.frames)
+			return;
+
+		auto const& cull = aTotals.cull;
+		double const frames = double(aTotals.frames);
+		auto const percent = [](std::uint64_t aPart, std::uint64_t aWhole) {
+			return aWhole ? 100.0 * double(aPart) / double(aWhole) : 0.0;
+		};
+
+		std::uint64_t const drawn = cull.earlyTriangles + cull.lateTriangles;
+
+		std::printf("Occlusion culling, average of %llu frame(s):\n", static_cast<unsigned long long>(aTotals.frames));
+		std::printf("  tested   %10.0f meshlets, %.1f%% outside the frustum, %.1f%% back-facing, %.1f%% occluded\n", cull.records / frames, percent(cull.frustumCulled, cull.records), percent(cull.coneCulled, cull.records), percent(cull.occluded, cull.records));
+		std::printf("  drawn    %10.0f of %.0f triangles (%.1f%%), %.0f early and %.0f late\n", drawn / frames, cull.triangles / frames, percent(drawn, cull.triangles), cull.earlyTriangles / frames, cull.lateTriangles / frames);
+		std::printf("  draws    %10.0f early and %.0f late non-empty indirect draws\n", cull.earlyDraws / frames, cull.lateDraws / frames);
+	}
+
+	void check_fragment_stats_support(lut::VulkanContext const& aContext)
+	{
+		if (aContext.havePipelineStatistics)
+			return;
+
+		std::fprintf(stderr, "Pipeline statistics queries not supported by the device, not counting fragments\n");
+		cfg::fragmentStats = false;
+	}
+
+	FragmentCounter create_fragment_counter(lut::VulkanContext const& aContext, std::uint32_t aFrameSlotCount)
+	{
+		VkQueryPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+		poolInfo.queryCount = aFrameSlotCount;
+		poolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+		VkQueryPool pool = VK_NULL_HANDLE;
+		if (auto const res = vkCreateQueryPool(aContext.device, &poolInfo, nullptr, &pool); VK_SUCCESS != res)
+		{
+			throw lut::Error("Unable to create pipeline statistics query pool\n" "vkCreateQueryPool() returned %s", lut::to_string(res).c_str());
+		}
+
+		FragmentCounter ret;
+		ret.pool = lut::QueryPool(aContext.device, pool);
+		ret.pending.assign(aFrameSlotCount, -1);
+		return ret;
+	}
+
+	void collect_fragment_counts(FragmentTotals& aTotals, lut::VulkanContext const& aContext, FragmentCounter& aCounter, std::uint32_t aFrameSlot, VkExtent2D const& aExtent)
+	{
+		int const prepass = aCounter.pending[aFrameSlot];
+		if (prepass < 0)
+			return;
+
+		aCounter.pending[aFrameSlot] = -1;
+
+		// The slot's fence has been waited for, so the result should be
+		// available; it is dropped if not
+		std::uint64_t result[2]{}; // invocations, availability
+		auto const res = vkGetQueryPoolResults(aContext.device, aCounter.pool.handle, aFrameSlot, 1, sizeof(result), result, sizeof(result), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+		if (VK_SUCCESS != res && VK_NOT_READY != res)
+		{
+			throw lut::Error("Unable to read fragment shader invocations\n" "vkGetQueryPoolResults() returned %s", lut::to_string(res).c_str());
+		}
+
+		if (0 == result[1])
+			return;
+
+		aTotals.frames[prepass] += 1;
+		aTotals.invocations[prepass] += result[0];
+		aTotals.pixels[prepass] += std::uint64_t(aExtent.width) * aExtent.height;
+	}
+
+	void report_fragment_counts(FragmentTotals const& aTotals)
+	{
+		char const* const modes[2] = { "without depth pre-pass", "with depth pre-pass" };
+
+		std::printf("Fragment shader invocations:\n");
+		for (std::size_t i = 0; i < 2; ++i)
+		{
+			if (0 == aTotals.frames[i])
+				continue;
+
+			// Per pixel, this is the average number of times that each pixel
+			// is shaded, i.e., the overdraw (including empty pixels)
+			double const frames = double(aTotals.frames[i]);
+			std::printf("  %-22s %12.0f per frame, %.2f per pixel (%llu frame(s))\n", modes[i], aTotals.invocations[i] / frames, double(aTotals.invocations[i]) / double(aTotals.pixels[i]), static_cast<unsigned long long>(aTotals.frames[i]));
+		}
+	}
+
+	SceneResources create_scene_resources(lut::VulkanContext const& aContext, lut::Allocator const& aAllocator, VkDescriptorPool aPool, VkDescriptorSetLayout aObjectLayout, VkDescriptorSetLayout aGeometryLayout, VkSampler aSampler, ModelData& aCarModel, ModelData& aCityModel, lut::GpuProfiler& aProfiler, std::uint32_t aFrameSlotCount)
+	{
+		LUT_TRACE_SCOPE("create_scene_resources");
+
+		SceneResources ret;
+
+		// Splits the city's meshes by building, so this comes first
+		std::vector<std::int32_t> cityMeshBuildings(aCityModel.meshes.size(), -1);
+		if (cfg::impostors)
+		{
+			BuildingSplit split = split_buildings(aCityModel, cfg::kImpostorGroundHeight, cfg::kImpostorMinHeight, cfg::impostorViews);
+			ret.buildings = std::move(split.buildings);
+			cityMeshBuildings = std::move(split.meshBuildings);
+
+			std::size_t buildingTriangles = 0;
+			for (auto const& building : ret.buildings)
+				buildingTriangles += building.triangleCount;
+
+			std::printf("Impostors: %zu building(s) with %zu triangles (ground: %zu), %zu meshes split into %zu\n", ret.buildings.size(), buildingTriangles, split.groundTriangles, split.meshesBefore, aCityModel.meshes.size());
+		}
+
+		//The function creates meshes with or without textures.
+		// All startup uploads go through one staging ring. Its memory is
+		// released once loading has completed.
+		lut::StagingRing staging = lut::create_staging_ring(aContext, aAllocator, VkDeviceSize(cfg::stagingRingMiB) << 20, cfg::directUploads);
+
+		// Remaps texture coordinates, so this must come before the meshes
+		// are uploaded
+		std::map<std::string, std::uint32_t> atlasTextures;
+		if (cfg::atlasTextures && !cfg::streamTextures && !cfg::compressTextures)
+			atlasTextures = create_texture_atlas(ret, aContext, staging, aAllocator, aCityModel, aProfiler);
+
+		VkDescriptorSet atlasSet = VK_NULL_HANDLE;
+		if (VK_NULL_HANDLE != ret.atlasView.handle)
+			atlasSet = create_texture_descriptor_set(aContext, aPool, aObjectLayout, ret.atlasView.handle, aSampler);
+
+		// Meshes without vertex buffers, see pulledGeometry and cityPager
+		auto const placeholders = [](ModelData const& aModel) {
+			std::vector<ColorizedMesh> meshes;
+			for (auto const& mesh : aModel.meshes)
+				meshes.emplace_back(ColorizedMesh{ {}, {}, std::uint32_t(mesh.numberOfVertices) });
+			return meshes;
+		};
+
+		MeshletLimits const* meshletLimits = cfg::meshlets ? &cfg::meshletLimits : nullptr;
+		if (!cfg::vertexPulling)
+		{
+			ret.colorMeshes = create_triangle_mesh(aContext, aAllocator, staging, aCarModel, &aProfiler, meshletLimits);
+			ret.texMeshes = cfg::cellPackPath.empty()
+				? create_triangle_mesh(aContext, aAllocator, staging, aCityModel, &aProfiler, meshletLimits)
+				: placeholders(aCityModel);
+		}
+		else
+		{
+			ret.colorMeshes = placeholders(aCarModel);
+			ret.texMeshes = placeholders(aCityModel);
+		}
+
+		// Instances of the car come first in the instance buffer, followed
+		// by those of the city
+		std::vector<std::string> const modelNames{ "car", "city" };
+		SceneDescription const sceneDesc = cfg::scenePath.empty()
+			? make_default_scene_description(modelNames)
+			: load_scene_description(cfg::scenePath.c_str(), modelNames);
+
+		std::vector<glm::mat4> instances = sceneDesc.transforms("car");
+		ret.cityInstances = sceneDesc.transforms("city");
+
+		InstanceRange const carInstances{ 0, std::uint32_t(instances.size()) };
+		InstanceRange const cityInstances{ std::uint32_t(instances.size()), std::uint32_t(ret.cityInstances.size()) };
+		ret.cityInstanceRange = cityInstances;
+
+		instances.insert(instances.end(), ret.cityInstances.begin(), ret.cityInstances.end());
+
+		if (cfg::meshlets || cfg::softOcclusion)
+			ret.instanceTransforms = instances;
+
+		ret.instances = staging.create_device_buffer(
+			instances.data(),
+			instances.size() * sizeof(glm::mat4),
+			// Also read by the occlusion culling compute shader, or by the
+			// vertex shaders with vertex pulling
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | (cfg::occlusionCulling || cfg::vertexPulling ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : 0),
+			VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | (cfg::occlusionCulling || cfg::vertexPulling ? VK_ACCESS_SHADER_READ_BIT : 0),
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | (cfg::occlusionCulling ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : 0) | (cfg::vertexPulling ? VK_PIPELINE_STAGE_VERTEX_SHADER_BIT : 0),
+			lut::MemoryCategory::geometry
+		);
+
+		// The car's meshes come first, as for the instances
+		if (cfg::vertexPulling)
+		{
+			std::vector<ModelData const*> const models{ &aCarModel, &aCityModel };
+			ret.pulledGeometry = create_pulled_geometry(aContext, staging, pack_pulled_geometry(models), aGeometryLayout, ret.instances.buffer);
+			ret.pulledDraws.descriptors = ret.pulledGeometry.descriptors;
+
+			std::printf("Vertex pulling: %zu vertices, %zu indices, %.2f MiB (vertex buffers: %.2f MiB)\n", ret.pulledGeometry.vertexCount, ret.pulledGeometry.indexCount, ret.pulledGeometry.bytes / (1024.0 * 1024.0), fixed_function_geometry_bytes(models) / (1024.0 * 1024.0));
+		}
+
+		if (!cfg::scenePath.empty())
+			std::printf("Scene: %u car and %u city instance(s)\n", carInstances.count, cityInstances.count);
+
+		// Model space bounds, for cfg::softOcclusion
+		std::vector<SoftBox> carBoxes, cityBoxes;
+		if (cfg::softOcclusion)
+		{
+			carBoxes = compute_mesh_boxes(aCarModel);
+			cityBoxes = compute_mesh_boxes(aCityModel);
+		}
+
+		//Set colored buffers
+		for (std::size_t i = 0; i < aCarModel.meshes.size(); i++) {
+			ret.positionBuffers.push_back(ret.colorMeshes[i].positions.buffer);
+			ret.colorBuffers.push_back(ret.colorMeshes[i].colors.buffer);
+			ret.vertexCounts.push_back(ret.colorMeshes[i].vertexCount);
+			ret.instanceRanges.push_back(carInstances);
+			ret.meshBuildings.push_back(-1);
+			ret.meshlets.push_back(&ret.colorMeshes[i].meshlets);
+			ret.meshletDraws.indexBuffers.push_back(ret.colorMeshes[i].indices.buffer);
+			if (cfg::softOcclusion)
+				ret.meshBoxes.push_back(carBoxes[i]);
+			if (cfg::vertexPulling)
+				ret.pulledDraws.draws.push_back(ret.pulledGeometry.meshes[i]);
+		}
+
+		//Set textured buffers
+		for (std::size_t i = 0; i < aCityModel.meshes.size(); i++) {
+			VkBuffer pos = ret.texMeshes[i].positions.buffer;
+			VkBuffer col = ret.texMeshes[i].colors.buffer;
+			std::uint32_t count = ret.texMeshes[i].vertexCount;
+			if (aCityModel.materials[aCityModel.meshes[i].materialIndex].colorTexturePath.compare("") == 0) {
+				ret.positionBuffers.push_back(pos);
+				ret.colorBuffers.push_back(col);
+				ret.vertexCounts.push_back(count);
+				ret.instanceRanges.push_back(cityInstances);
+				ret.meshBuildings.push_back(cityMeshBuildings[i]);
+				ret.meshlets.push_back(&ret.texMeshes[i].meshlets);
+				ret.meshletDraws.indexBuffers.push_back(ret.texMeshes[i].indices.buffer);
+				if (cfg::softOcclusion)
+					ret.meshBoxes.push_back(cityBoxes[i]);
+				if (cfg::vertexPulling)
+					ret.pulledDraws.draws.push_back(ret.pulledGeometry.meshes[aCarModel.meshes.size() + i]);
+			}
+			else {
+				ret.texPositionBuffers.push_back(pos);
+				ret.texCoordBuffers.push_back(col);
+				ret.texVertexCounts.push_back(count);
+				ret.texInstanceRanges.push_back(cityInstances);
+				ret.texMeshBuildings.push_back(cityMeshBuildings[i]);
+				ret.texMeshlets.push_back(&ret.texMeshes[i].meshlets);
+				ret.meshletDraws.texIndexBuffers.push_back(ret.texMeshes[i].indices.buffer);
+				if (cfg::softOcclusion)
+					ret.texMeshBoxes.push_back(cityBoxes[i]);
+				if (cfg::vertexPulling)
+					ret.pulledDraws.texDraws.push_back(ret.pulledGeometry.meshes[aCarModel.meshes.size() + i]);
+			}
+		}
+
+		// Occluders: the city's large polygons, in each of its instances
+		if (cfg::softOcclusion)
+		{
+			for (auto const& model : ret.cityInstances)
+				append_soft_occluders(ret.softOccluders, aCityModel, model, cfg::softOccluderMinArea);
+
+			ret.softDepth = create_soft_depth_buffer(cfg::kSoftOcclusionWidth, cfg::kSoftOcclusionHeight);
+
+			std::printf("Software occlusion: %zu occluder polygon(s) of at least %.1f m^2, %ux%u pixels, %s\n", ret.softOccluders.polygon_count(), cfg::softOccluderMinArea, ret.softDepth.width, ret.softDepth.height, soft_occlusion_isa());
+		}
+
+		// Room for one draw per meshlet and instance, in each frame slot
+		if (cfg::meshlets)
+		{
+			std::size_t meshletCount = 0, triangleCount = 0;
+			auto const count_draws = [&](std::vector<MeshletMesh const*> const& aMeshes, std::vector<InstanceRange> const& aRanges) {
+				for (std::size_t i = 0; i < aMeshes.size(); ++i)
+				{
+					ret.maxIndirectDraws += std::uint32_t(aMeshes[i]->meshlets.size()) * aRanges[i].count;
+					meshletCount += aMeshes[i]->meshlets.size();
+					triangleCount += aMeshes[i]->triangleCount;
+				}
+			};
+			count_draws(ret.meshlets, ret.instanceRanges);
+			count_draws(ret.texMeshlets, ret.texInstanceRanges);
+
+			// With occlusion culling, the draws come from the culler instead
+			for (std::uint32_t i = 0; !cfg::occlusionCulling && i < aFrameSlotCount; ++i)
+				ret.indirectBuffers.emplace_back(lut::create_buffer(aAllocator, std::max(ret.maxIndirectDraws, 1u) * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, lut::MemoryCategory::geometry));
+
+			ret.meshletDraws.multiDraw = aContext.haveMultiDrawIndirect;
+
+			std::printf("Meshlets: %zu for %zu triangles (at most %u vertices and %u triangles each), %s culling, %s\n", meshletCount, triangleCount, cfg::meshletLimits.maxVertices, cfg::meshletLimits.maxTriangles, meshlet_cull_isa(), aContext.haveMultiDrawIndirect ? "multi-draw indirect" : "one indirect draw per call");
+		}
+
+		if (cfg::streamTextures)
+		{
+			staging.finish();
+
+			create_streamed_textures(ret, aContext, aAllocator, aObjectLayout, aSampler, aCityModel, aFrameSlotCount);
+			return ret;
+		}
+
+		// Equally sized textures that would use GPU blits or compute mips
+		// share array images instead, if enabled. Each path is loaded once.
+		struct ArrayTexture
+		{
+			VkDescriptorSet set;
+			std::uint32_t layer;
+		};
+
+		std::map<std::string, ArrayTexture> arrayTextures;
 
-		VkRenderPassBeginInfo passInfo{};
-		passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		passInfo.renderPass = aRenderPass;
-		passInfo.framebuffer = aFramebuffer;
-		passInfo.renderArea.offset = VkOffset2D{ 0, 0 };
-		passInfo.renderArea.extent = aImageExtent;
-		passInfo.clearValueCount = 2;
-		passInfo.pClearValues = clearValues;
+		if (cfg::textureArrays && !cfg::compressTextures && !cfg::cpuMips)
+		{
+			std::vector<std::string> paths;
+			for (auto const& mesh : aCityModel.meshes)
+			{
+				std::string const& texPath = aCityModel.materials[mesh.materialIndex].colorTexturePath;
+				if (!texPath.empty() && !atlasTextures.count(texPath) && (!cfg::preferKtx2 || ktx2_path_for(aContext, texPath.c_str()).empty()))
+					paths.push_back(texPath);
+			}
 
-		vkCmdBeginRenderPass(aCmdBuff, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+			std::sort(paths.begin(), paths.end());
+			paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+			VkPhysicalDeviceProperties props{};
+			vkGetPhysicalDeviceProperties(aContext.physicalDevice, &props);
+
+			auto const groups = lut::group_textures_by_size(paths, cfg::kTextureArrayMinLayers, std::max(props.limits.maxImageArrayLayers, cfg::kTextureArrayMinLayers));
+			for (auto const& group : groups)
+			{
+				std::vector<std::string> groupPaths;
+				for (auto const idx : group)
+					groupPaths.push_back(paths[idx]);
 
-		// Begin drawing with our graphics pipeline 
-		vkCmdBindPipeline(aCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aGraphicsPipe);
-		vkCmdBindDescriptorSets(aCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aGraphicsLayout, 0, 1, &aSceneDescriptors, 0, nullptr);
+				lut::Image tex = lut::load_image_texture2d_array(groupPaths, aContext, staging, aAllocator, &aProfiler);
+				lut::ImageView texView = lut::create_image_view_texture2d_array(aContext, tex.image, VK_FORMAT_R8G8B8A8_SRGB);
 
-		for (int i = 0; i < aPositionBuffer.size(); i++) { //Draw every colored mesh
-			VkBuffer buffers[2] = { aPositionBuffer[i], aColorBuffer[i] };
-			VkDeviceSize offsets[2]{};
+				VkDescriptorSet const set = create_texture_descriptor_set(aContext, aPool, aObjectLayout, texView.handle, aSampler);
+				for (std::uint32_t layer = 0; layer < groupPaths.size(); ++layer)
+					arrayTextures.emplace(groupPaths[layer], ArrayTexture{ set, layer });
 
-			vkCmdBindVertexBuffers(aCmdBuff, 0, 2, buffers, offsets);
+				ret.textures.push_back(std::move(tex));
+				ret.textureViews.push_back(std::move(texView));
+			}
 
-			// Draw vertices 
-			vkCmdDraw(aCmdBuff, aVertexCount[i], 1, 0, 0);
+			std::printf("Texture arrays: %zu of %zu textures in %zu array(s)\n", arrayTextures.size(), paths.size(), groups.size());
 		}
 
-		vkCmdBindPipeline(aCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aTexGraphicsPipe); //Bind new pipeline
+		// Textures that would use GPU blits for their mip chains are instead
+		// loaded in one batch with compute mip generation, if enabled.
+		std::vector<lut::Image> batchedTextures;
+		std::size_t nextBatchedTexture = 0;
 
-		for (int i = 0; i < aTexPositionBuffer.size(); i++) { //Draw every textured mesh
-			
-			//Bind new descriptors because they all use a different image
-			vkCmdBindDescriptorSets(aCmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, aGraphicsLayout, 1, 1, &(aCityDescriptors[i]), 0, nullptr);
-			VkBuffer buffers[2] = { aTexPositionBuffer[i], ATexBuffer[i] };
-			VkDeviceSize offsets[2]{};
+		if (cfg::computeMips && !cfg::compressTextures && !cfg::cpuMips)
+		{
+			if (lut::is_compute_mip_generation_supported(aContext))
+			{
+				lut::ComputeMipGenerator const mipGenerator = lut::create_compute_mip_generator(aContext, cfg::kMipGenShaderPath);
+
+				std::vector<std::string> paths;
+				for (auto const& mesh : aCityModel.meshes)
+				{
+					std::string const& texPath = aCityModel.materials[mesh.materialIndex].colorTexturePath;
+					if (!texPath.empty() && !atlasTextures.count(texPath) && !arrayTextures.count(texPath) && (!cfg::preferKtx2 || ktx2_path_for(aContext, texPath.c_str()).empty()) && paths.end() == std::find(paths.begin(), paths.end(), texPath))
+						paths.push_back(texPath);
+				}
 
-			vkCmdBindVertexBuffers(aCmdBuff, 0, 2, buffers, offsets);
+				batchedTextures = lut::load_image_textures2d(paths, aContext, staging, aAllocator, &mipGenerator, &aProfiler);
+			}
+			else
+			{
+				std::fprintf(stderr, "Compute mip generation not supported by device, using blits\n");
+			}
+		}
 
-			// Draw vertices 
-			vkCmdDraw(aCmdBuff, aTexVertexCount[i], 1, 0, 0);
+		// Meshes split by building (see cfg::impostors) share their
+		// material's texture: index into texDescriptors, by path
+		std::map<std::string, std::size_t> loadedTextures;
+
+		for (std::size_t i = 0; i < aCityModel.meshes.size(); i++) {
+			if (aCityModel.materials[aCityModel.meshes[i].materialIndex].colorTexturePath.compare("") != 0) {
+
+				char const* texPath = aCityModel.materials[aCityModel.meshes[i].materialIndex].colorTexturePath.c_str();
+
+				if (auto const it = loadedTextures.find(texPath); loadedTextures.end() != it)
+				{
+					ret.texDescriptors.push_back(ret.texDescriptors[it->second]);
+					ret.texLayers.push_back(ret.texLayers[it->second]);
+					continue;
+				}
+
+				if (auto const it = atlasTextures.find(texPath); atlasTextures.end() != it)
+				{
+					ret.texDescriptors.push_back(atlasSet);
+					ret.texLayers.push_back(ret.atlas.layout.placements[it->second].layer);
+					continue;
+				}
+
+				if (auto const it = arrayTextures.find(texPath); arrayTextures.end() != it)
+				{
+					ret.texDescriptors.push_back(it->second.set);
+					ret.texLayers.push_back(it->second.layer);
+					continue;
+				}
+
+				lut::Image tex;
+				VkFormat texFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+				std::string const ktxPath = cfg::preferKtx2 ? ktx2_path_for(aContext, texPath) : std::string();
+				if (!ktxPath.empty())
+					std::tie(tex, texFormat) = lut::load_image_texture2d_ktx2(ktxPath.c_str(), aContext, staging, aAllocator, &aProfiler);
+				else if (cfg::compressTextures)
+					std::tie(tex, texFormat) = lut::load_image_texture2d_bc(texPath, aContext, staging, aAllocator, cfg::textureFormat, cfg::textureQuality, cfg::mipFilter, &aProfiler);
+				else if (cfg::cpuMips)
+					tex = lut::load_image_texture2d(texPath, aContext, staging, aAllocator, cfg::mipFilter, &aProfiler);
+				else if (nextBatchedTexture < batchedTextures.size())
+					tex = std::move(batchedTextures[nextBatchedTexture++]);
+				else
+					tex = lut::load_image_texture2d(texPath, aContext, staging, aAllocator, &aProfiler);
+
+				lut::ImageView texView = lut::create_image_view_texture2d_array(aContext, tex.image, texFormat, VK_IMAGE_USAGE_SAMPLED_BIT);
+
+				//allocate and initialize descriptor sets for texture
+				VkDescriptorSet texDescriptor = create_texture_descriptor_set(aContext, aPool, aObjectLayout, texView.handle, aSampler);
+
+				ret.textures.push_back(std::move(tex));
+				ret.textureViews.push_back(std::move(texView));
+				loadedTextures.emplace(texPath, ret.texDescriptors.size());
+				ret.texDescriptors.push_back(texDescriptor);
+				ret.texLayers.push_back(0);
+			}
 		}
 
-		// End the render pass 
-		vkCmdEndRenderPass(aCmdBuff);
+		staging.finish();
 
-		// End command recording 
-		if (auto const res = vkEndCommandBuffer(aCmdBuff); VK_SUCCESS != res)
+		if (cfg::memoryStats)
+			staging.print_stats();
+
+		// The pager orders the city's draws itself
+		if (!cfg::cellPackPath.empty())
 		{
-			throw lut::Error("Unable to end recording command buffer\n" "vkEndCommandBuffer() returned %s", lut::to_string(res).c_str());
+			create_city_pager(ret, aContext, aAllocator, aCarModel, aCityModel, aFrameSlotCount);
+			return ret;
+		}
+
+		// Draw meshes that share a descriptor set one after the other, so
+		// that record_commands() binds each set once, and by layer within
+		// a set
+		if (VK_NULL_HANDLE != atlasSet || !arrayTextures.empty())
+		{
+			std::vector<std::size_t> order(ret.texDescriptors.size());
+			for (std::size_t i = 0; i < order.size(); ++i)
+				order[i] = i;
+
+			std::stable_sort(order.begin(), order.end(), [&](std::size_t aX, std::size_t aY) {
+				if (ret.texDescriptors[aX] != ret.texDescriptors[aY])
+					return ret.texDescriptors[aX] < ret.texDescriptors[aY];
+				return ret.texLayers[aX] < ret.texLayers[aY];
+			});
+
+			auto const permute = [&order](auto& aVec) {
+				std::remove_reference_t<decltype(aVec)> sorted;
+				for (auto const idx : order)
+					sorted.push_back(aVec[idx]);
+				aVec = std::move(sorted);
+			};
+
+			permute(ret.texPositionBuffers);
+			permute(ret.texCoordBuffers);
+			permute(ret.texVertexCounts);
+			permute(ret.texDescriptors);
+			permute(ret.texLayers);
+			permute(ret.texInstanceRanges);
+			permute(ret.texMeshBuildings);
+			permute(ret.texMeshlets);
+			permute(ret.meshletDraws.texIndexBuffers);
+			if (cfg::softOcclusion)
+				permute(ret.texMeshBoxes);
+			if (cfg::vertexPulling)
+				permute(ret.pulledDraws.texDraws);
 		}
+
+		return ret;
 	}
 
-	void submit_commands(lut::VulkanContext const& aContext, VkCommandBuffer aCmdBuff, VkFence aFence, VkSemaphore aWaitSemaphore, VkSemaphore aSignalSemaphore)
+	std::map<std::string, std::uint32_t> create_texture_atlas(SceneResources& aScene, lut::VulkanContext const& aContext, lut::StagingRing& aRing, lut::Allocator const& aAllocator, ModelData& aCityModel, lut::GpuProfiler& aProfiler)
 	{
-		VkPipelineStageFlags waitPipelineStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		LUT_TRACE_SCOPE("create_texture_atlas");
 
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &aCmdBuff;
+		// A texture can be packed if none of its meshes repeat it
+		std::map<std::string, bool> packable;
+		for (auto const& mesh : aCityModel.meshes)
+		{
+			std::string const& texPath = aCityModel.materials[mesh.materialIndex].colorTexturePath;
+			if (texPath.empty())
+				continue;
+
+			bool inRange = !cfg::preferKtx2 || ktx2_path_for(aContext, texPath.c_str()).empty();
+			for (std::size_t v = mesh.vertexStartIndex; inRange && v < mesh.vertexStartIndex + mesh.numberOfVertices; ++v)
+			{
+				glm::vec2 const& uv = aCityModel.vertexTextureCoords[v];
+				inRange = uv.x >= -cfg::kAtlasUvTolerance && uv.x <= 1.f + cfg::kAtlasUvTolerance
+					&& uv.y >= -cfg::kAtlasUvTolerance && uv.y <= 1.f + cfg::kAtlasUvTolerance;
+			}
+
+			auto const [it, inserted] = packable.emplace(texPath, inRange);
+			if (!inserted)
+				it->second = it->second && inRange;
+		}
 
-		submitInfo.waitSemaphoreCount = 1;
-		submitInfo.pWaitSemaphores = &aWaitSemaphore;
-		submitInfo.pWaitDstStageMask = &waitPipelineStages;
+		std::vector<std::string> paths;
+		for (auto const& [path, ok] : packable)
+		{
+			if (ok)
+				paths.push_back(path);
+		}
 
-		submitInfo.signalSemaphoreCount = 1;
-		submitInfo.pSignalSemaphores = &aSignalSemaphore;
+		aScene.atlas = lut::load_texture_atlas(paths, aContext, aRing, aAllocator, cfg::atlasConfig, &aProfiler);
 
-		if (auto const res = vkQueueSubmit(aContext.graphicsQueue, 1, &submitInfo, aFence); VK_SUCCESS != res)
+		std::map<std::string, std::uint32_t> ret;
+		for (std::uint32_t i = 0; i < paths.size(); ++i)
 		{
-			throw lut::Error("Unable to submit command buffer to queue\n" "vkQueueSubmit() returned %s", lut::to_string(res).c_str());
+			if (aScene.atlas.layout.placements[i].packed)
+				ret.emplace(paths[i], i);
+		}
+
+		if (aScene.atlas.layout.layers > 0)
+			aScene.atlasView = lut::create_image_view_texture2d_array(aContext, aScene.atlas.image.image, VK_FORMAT_R8G8B8A8_SRGB);
+
+		for (auto const& mesh : aCityModel.meshes)
+		{
+			auto const it = ret.find(aCityModel.materials[mesh.materialIndex].colorTexturePath);
+			if (ret.end() == it)
+				continue;
+
+			auto const xform = aScene.atlas.uv_transform(it->second);
+			glm::vec2 const offset(xform.offset[0], xform.offset[1]);
+			glm::vec2 const scale(xform.scale[0], xform.scale[1]);
+
+			for (std::size_t v = mesh.vertexStartIndex; v < mesh.vertexStartIndex + mesh.numberOfVertices; ++v)
+			{
+				auto& uv = aCityModel.vertexTextureCoords[v];
+				uv = offset + glm::clamp(uv, glm::vec2(0.f), glm::vec2(1.f)) * scale;
+			}
+		}
+
+		std::printf("Atlas: packed %zu of %zu textures into %u layer(s) of %ux%u\n", ret.size(), packable.size(), aScene.atlas.layout.layers, aScene.atlas.layout.width, aScene.atlas.layout.height);
+
+		return ret;
+	}
+
+	VkDescriptorSet create_texture_descriptor_set(lut::VulkanContext const& aContext, VkDescriptorPool aPool, VkDescriptorSetLayout aLayout, VkImageView aView, VkSampler aSampler)
+	{
+		VkDescriptorSet texDescriptor = lut::alloc_desc_set(aContext, aPool, aLayout);
+		{
+			VkWriteDescriptorSet desc[1]{};
+
+			VkDescriptorImageInfo textureInfo{};
+			textureInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			textureInfo.imageView = aView;
+			textureInfo.sampler = aSampler;
+
+			desc[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			desc[0].dstSet = texDescriptor;
+			desc[0].dstBinding = 0;
+			desc[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			desc[0].descriptorCount = 1;
+			desc[0].pImageInfo = &textureInfo;
+
+
+			constexpr auto numSets = sizeof(desc) / sizeof(desc[0]);
+			vkUpdateDescriptorSets(aContext.device, numSets, desc, 0, nullptr);
 		}
+
+		return texDescriptor;
 	}
 }
 
 namespace
 {
-	std::tuple<lut::Image, lut::ImageView> create_depth_buffer(lut::VulkanWindow const& aWindow, lut::Allocator const& aAllocator)
+	OffscreenTarget create_offscreen_target(lut::VulkanContext const& aContext, lut::Allocator const& aAllocator, VkRenderPass aRenderPass, VkExtent2D const& aExtent)
 	{
+		OffscreenTarget ret;
+		ret.extent = aExtent;
+
+		// Color image: rendered to, then copied to the readback buffer
 		VkImageCreateInfo imageInfo{};
 		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 		imageInfo.imageType = VK_IMAGE_TYPE_2D;
-		imageInfo.format = cfg::kDepthFormat;
-		imageInfo.extent.width = aWindow.swapchainExtent.width;
-		imageInfo.extent.height = aWindow.swapchainExtent.height;
+		imageInfo.format = cfg::kOffscreenFormat;
+		imageInfo.extent.width = aExtent.width;
+		imageInfo.extent.height = aExtent.height;
 		imageInfo.extent.depth = 1;
 		imageInfo.mipLevels = 1;
 		imageInfo.arrayLayers = 1;
 		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-		imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
@@ -1217,32 +4351,488 @@ namespace
 
 		if (auto const res = vmaCreateImage(aAllocator.allocator, &imageInfo, &allocInfo, &image, &allocation, nullptr); VK_SUCCESS != res)
 		{
-			throw lut::Error("Unable to allocate depth buffer image.\n" "vmaCreateImage() returned %s", lut::to_string(res).c_str());
+			throw lut::Error("Unable to allocate offscreen color image.\n" "vmaCreateImage() returned %s", lut::to_string(res).c_str());
 		}
 
-		lut::Image depthImage(aAllocator.allocator, image, allocation);
+		ret.color = lut::Image(aAllocator.allocator, image, allocation);
+		lut::track_allocation(aAllocator, allocation, lut::MemoryCategory::attachment);
+		ret.colorView = lut::create_image_view_texture2d(aContext, ret.color.image, cfg::kOffscreenFormat);
 
-		// Create the image view 
-		VkImageViewCreateInfo viewInfo{};
-		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		viewInfo.image = depthImage.image;
-		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		viewInfo.format = cfg::kDepthFormat;
-		viewInfo.components = VkComponentMapping{};
-		viewInfo.subresourceRange = VkImageSubresourceRange{
-		VK_IMAGE_ASPECT_DEPTH_BIT,
-			0, 1,
-			0, 1
+		std::tie(ret.depth, ret.depthView) = create_depth_buffer(aContext, aAllocator, aExtent);
+
+		// Framebuffer
+		VkImageView attachments[2] = {
+			ret.colorView.handle,
+			ret.depthView.handle
 		};
 
-		VkImageView view = VK_NULL_HANDLE;
-		if (auto const res = vkCreateImageView(aWindow.device, &viewInfo, nullptr, &view); VK_SUCCESS != res)
+		VkFramebufferCreateInfo fbInfo{};
+		fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		fbInfo.flags = 0; // normal framebuffer 
+		fbInfo.renderPass = aRenderPass;
+		fbInfo.attachmentCount = 2;
+		fbInfo.pAttachments = attachments;
+		fbInfo.width = aExtent.width;
+		fbInfo.height = aExtent.height;
+		fbInfo.layers = 1;
+
+		VkFramebuffer fb = VK_NULL_HANDLE;
+		if (auto const res = vkCreateFramebuffer(aContext.device, &fbInfo, nullptr, &fb); VK_SUCCESS != res)
 		{
-			throw lut::Error("Unable to create image view\n" "vkCreateImageView() returned %s", lut::to_string(res).c_str());
+			throw lut::Error("Unable to create offscreen framebuffer\n" "vkCreateFramebuffer() returned %s", lut::to_string(res).c_str());
+		}
+
+		ret.framebuffer = lut::Framebuffer(aContext.device, fb);
+
+		// Readback buffer (4 bytes per texel, tightly packed)
+		ret.readback = lut::create_buffer(
+			aAllocator,
+			VkDeviceSize(aExtent.width) * aExtent.height * 4,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VMA_MEMORY_USAGE_GPU_TO_CPU,
+			lut::MemoryCategory::readback
+		);
+
+		return ret;
+	}
+
+	void save_offscreen_frame(lut::Allocator const& aAllocator, OffscreenTarget const& aTarget, char const* aPath)
+	{
+		void* ptr = nullptr;
+		if (auto const res = vmaMapMemory(aAllocator.allocator, aTarget.readback.allocation, &ptr); VK_SUCCESS != res)
+		{
+			throw lut::Error("Mapping memory for reading\n" "vmaMapMemory() returned %s", lut::to_string(res).c_str());
+		}
+
+		// The readback memory is not necessarily HOST_COHERENT
+		vmaInvalidateAllocation(aAllocator.allocator, aTarget.readback.allocation, 0, VK_WHOLE_SIZE);
+
+		auto const* pixels = static_cast<std::uint8_t const*>(ptr);
+		auto const width = aTarget.extent.width;
+		auto const height = aTarget.extent.height;
+
+		bool ok = false;
+
+		std::string const path = aPath;
+		if (path.size() >= 4 && 0 == path.compare(path.size() - 4, 4, ".ppm"))
+		{
+			// Binary PPM: RGB only
+			if (std::FILE* fout = std::fopen(aPath, "wb"))
+			{
+				std::fprintf(fout, "P6\n%u %u\n255\n", width, height);
+
+				std::vector<std::uint8_t> row(std::size_t(width) * 3);
+				for (std::uint32_t y = 0; y < height; ++y)
+				{
+					auto const* src = pixels + std::size_t(y) * width * 4;
+					for (std::uint32_t x = 0; x < width; ++x)
+					{
+						row[x * 3 + 0] = src[x * 4 + 0];
+						row[x * 3 + 1] = src[x * 4 + 1];
+						row[x * 3 + 2] = src[x * 4 + 2];
+					}
+
+					std::fwrite(row.data(), 1, row.size(), fout);
+				}
+
+				ok = (0 == std::ferror(fout));
+				std::fclose(fout);
+			}
+		}
+		else
+		{
+			ok = (0 != stbi_write_png(aPath, int(width), int(height), 4, pixels, int(width * 4)));
+		}
+
+		vmaUnmapMemory(aAllocator.allocator, aTarget.readback.allocation);
+
+		if (!ok)
+			throw lut::Error("Unable to write frame to '%s'", aPath);
+
+		std::printf("Wrote '%s'\n", aPath);
+	}
+
+	int run_headless(ModelData& aCarModel, ModelData& aCityModel)
+	{
+		// Create Vulkan context (no window or surface)
+		lut::VulkanContext context = lut::make_vulkan_context();
+
+		// Create VMA allocator
+		lut::Allocator allocator = lut::create_allocator(context);
+
+		if (cfg::meshlets)
+			check_meshlet_support(context);
+		if (cfg::occlusionCulling)
+			check_occlusion_culling_support(context);
+
+		VkExtent2D const extent = cfg::headlessExtent;
+
+		// Intialize resources
+		// The render pass leaves the color image ready for the readback copy.
+		lut::RenderPass renderPass = create_render_pass(context, cfg::kOffscreenFormat, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, cfg::occlusionCulling ? PassPart::first : PassPart::whole);
+
+		lut::RenderPass lateRenderPass;
+		if (cfg::occlusionCulling)
+			lateRenderPass = create_render_pass(context, cfg::kOffscreenFormat, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, PassPart::second);
+
+		lut::DescriptorSetLayout sceneLayout = create_scene_descriptor_layout(context);
+		lut::DescriptorSetLayout objectLayout = create_object_descriptor_layout(context);
+
+
+		lut::DescriptorSetLayout geometryLayout;
+		if (cfg::vertexPulling)
+			geometryLayout = create_pulled_geometry_layout(context);
 
+		lut::PipelineLayout pipeLayout = create_pipeline_layout(context, sceneLayout.handle, objectLayout.handle, geometryLayout.handle);
+		lut::Pipeline pipe = create_pipeline(context, renderPass.handle, pipeLayout.handle, extent);
+		lut::Pipeline texpipe = create_tex_pipeline(context, renderPass.handle, pipeLayout.handle, extent);
+
+		lut::Pipeline depthPipe = create_depth_pipeline(context, renderPass.handle, pipeLayout.handle, extent);
+		lut::Pipeline equalPipe = create_pipeline(context, renderPass.handle, pipeLayout.handle, extent, DepthTest::equal);
+		lut::Pipeline equalTexPipe = create_tex_pipeline(context, renderPass.handle, pipeLayout.handle, extent, DepthTest::equal);
+
+		lut::Pipeline impostorPipe;
+		if (cfg::impostors)
+			impostorPipe = create_impostor_pipeline(context, renderPass.handle, pipeLayout.handle, extent);
+
+		OffscreenTarget target = create_offscreen_target(context, allocator, renderPass.handle, extent);
+
+		lut::CommandPool cpool = lut::create_command_pool(context, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+
+		VkCommandBuffer cbuffer = lut::alloc_command_buffer(context, cpool.handle);
+		lut::Fence cbfence = lut::create_fence(context, VK_FENCE_CREATE_SIGNALED_BIT);
+
+		lut::Buffer sceneUBO = lut::create_buffer(allocator, sizeof(glsl::SceneUniform), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, lut::MemoryCategory::uniform);
+
+		lut::DescriptorPool dpool = lut::create_descriptor_pool(context);
+		VkDescriptorSet sceneDescriptors = create_scene_descriptors(context, dpool.handle, sceneLayout.handle, sceneUBO.buffer);
+
+		lut::Sampler defaultSampler = lut::create_default_sampler(context);
+
+		lut::GpuProfiler profiler;
+		if (cfg::gpuProfile || cfg::benchmark)
+			profiler = lut::create_gpu_profiler(context, 2);
+
+		SceneResources scene = create_scene_resources(context, allocator, dpool.handle, objectLayout.handle, geometryLayout.handle, defaultSampler.handle, aCarModel, aCityModel, profiler, 1);
+
+		if (cfg::impostors)
+			create_impostors(scene, context, allocator, dpool.handle, sceneLayout.handle, objectLayout.handle, pipeLayout.handle, 1);
+
+		lut::DepthPyramidBuilder pyramidBuilder;
+		lut::DepthPyramid pyramid;
+		OcclusionCuller culler;
+		if (cfg::occlusionCulling)
+		{
+			pyramidBuilder = lut::create_depth_pyramid_builder(context, cfg::kHzbShaderPath);
+			pyramid = lut::create_depth_pyramid(context, allocator, pyramidBuilder, target.depthView.handle, extent);
+
+			culler = create_scene_occlusion_culler(scene, context, allocator, 1);
+			set_occlusion_pyramid(context, culler, pyramid);
+		}
+
+		if (cfg::fragmentStats)
+			check_fragment_stats_support(context);
+
+		FragmentCounter fragmentCounter;
+		if (cfg::fragmentStats)
+			fragmentCounter = create_fragment_counter(context, 1);
+
+		if (cfg::memoryStats)
+			report_memory_stats(allocator, "after loading");
+
+		BenchmarkState bench;
+		if (cfg::benchmark)
+		{
+			bench = create_benchmark_state();
+			profiler.onResolve = [&bench] (char const* aScope, std::uint64_t aFrame, double aMs) {
+				record_gpu_time(bench, aScope, aFrame, aMs);
+			};
+		}
+
+		// Render frames
+		// The camera is static (see parse_options()) or follows the benchmark
+		// path. Neither depends on wall-clock time, so the output is
+		// deterministic for a given device.
+		camera();
+
+		std::uint32_t const frameCount = frame_count();
+		bool const capturePerFrame = std::string::npos != cfg::capturePath.find("%u");
+
+		MeshletTotals meshletTotals;
+		OcclusionTotals occlusionTotals;
+		SoftCullTotals softTotals;
+		FragmentTotals fragmentTotals;
+		ImpostorTotals impostorTotals;
+
+		DepthPrepass const prepass{ depthPipe.handle, equalPipe.handle, equalTexPipe.handle };
+		FragmentQuery const fragments{ fragmentCounter.pool.handle, 0 };
+
+		for (std::uint32_t frame = 0; frame < frameCount; ++frame)
+		{
+			LUT_TRACE_SCOPE("frame");
+
+			if (cfg::benchmark)
+				begin_benchmark_frame(bench, profiler);
+
+			if (auto const res = vkWaitForFences(context.device, 1, &cbfence.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max()); VK_SUCCESS != res)
+			{
+				throw lut::Error("Unable to wait for command buffer fence\n" "vkWaitForFences() returned %s", lut::to_string(res).c_str());
+			}
+
+			if (auto const res = vkResetFences(context.device, 1, &cbfence.handle); VK_SUCCESS != res)
+			{
+				throw lut::Error("Unable to reset command buffer fence\n" "vkResetFences() returned %s", lut::to_string(res).c_str());
+			}
+
+			glsl::SceneUniform sceneUniforms{};
+			update_scene_uniforms(sceneUniforms, extent.width, extent.height);
+
+			bool const capture = !cfg::capturePath.empty() && (capturePerFrame || frame + 1 == frameCount);
+
+			// Streaming waits for its uploads here, so that captures don't
+			// depend on GPU timing
+			if (cfg::streamTextures)
+				update_texture_streaming(scene, 0, extent.height, true);
+
+			if (!cfg::cellPackPath.empty())
+				update_city_paging(scene, 0, true);
+
+			if (cfg::impostors)
+				select_scene_impostors(scene, allocator, 0, impostorTotals);
+
+			ImpostorDraws const impostors{ impostorPipe.handle, scene.impostorSet, cfg::impostors ? scene.impostorBuffers[0].buffer : VK_NULL_HANDLE, scene.impostorCount };
+
+			if (cfg::occlusionCulling)
+				collect_occlusion_stats(occlusionTotals, allocator, culler, 0);
+			else if (cfg::meshlets)
+				cull_scene_meshlets(scene, allocator, 0, sceneUniforms.projCam, meshletTotals);
+			else if (cfg::softOcclusion)
+				cull_scene_soft(scene, sceneUniforms.projCam, softTotals);
+
+			OcclusionPass const occlusion{ &culler, &pyramidBuilder, &pyramid, lateRenderPass.handle, 0,
+				OcclusionCullView{ sceneUniforms.camera, sceneUniforms.projection, sceneUniforms.projCam, cfg::pos, cfg::kCameraNear } };
+
+			if (cfg::fragmentStats)
+			{
+				collect_fragment_counts(fragmentTotals, context, fragmentCounter, 0, extent);
+				fragmentCounter.pending[0] = cfg::depthPrepass ? 1 : 0;
+			}
+
+			auto const drawStats = record_commands(cbuffer, renderPass.handle, target.framebuffer.handle, pipe.handle, texpipe.handle, extent, scene.positionBuffers, scene.colorBuffers, scene.vertexCounts, scene.texPositionBuffers, scene.texCoordBuffers, scene.texVertexCounts, scene.instances.buffer, scene.instanceRanges, scene.texInstanceRanges, sceneUBO.buffer, sceneUniforms, pipeLayout.handle, sceneDescriptors, scene.texDescriptors, scene.texLayers, make_frame_draw_options(scene, occlusion, prepass, fragments, impostors, capture ? &target : nullptr), profiler);
+
+			if (0 == frame)
+				report_draw_stats(drawStats);
+
+			if (cfg::impostors)
+			{
+				impostorTotals.draws += drawStats.draws;
+				impostorTotals.triangles += drawStats.triangles;
+			}
+
+			submit_commands(context, cbuffer, cbfence.handle, VK_NULL_HANDLE, VK_NULL_HANDLE);
+
+			if (capture)
+			{
+				if (auto const res = vkWaitForFences(context.device, 1, &cbfence.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max()); VK_SUCCESS != res)
+				{
+					throw lut::Error("Unable to wait for command buffer fence\n" "vkWaitForFences() returned %s", lut::to_string(res).c_str());
+				}
+
+				save_offscreen_frame(allocator, target, capture_path(frame).c_str());
+			}
+		}
+
+		// Ends the last frame's CPU time, as the next frame's start does in
+		// the windowed loop
+		if (cfg::benchmark)
+			begin_benchmark_frame(bench, profiler);
+
+		vkDeviceWaitIdle(context.device);
+
+		if (cfg::benchmark)
+			finish_benchmark(bench, profiler);
+
+		if (cfg::gpuProfile)
+		{
+			profiler.resolve_all();
+			profiler.print_report();
+		}
+
+		if (cfg::memoryStats)
+			report_memory_stats(allocator, "on exit");
+
+		if (cfg::streamTextures)
+			scene.textureStreamer.print_stats();
+
+		if (!cfg::cellPackPath.empty())
+			scene.cityPager.print_stats();
+
+		if (cfg::meshlets)
+			report_meshlet_stats(meshletTotals);
+
+		if (cfg::softOcclusion)
+			report_soft_cull_stats(softTotals);
+
+		if (cfg::impostors)
+			report_impostor_stats(impostorTotals, scene);
+
+		if (cfg::fragmentStats)
+		{
+			collect_fragment_counts(fragmentTotals, context, fragmentCounter, 0, extent);
+			report_fragment_counts(fragmentTotals);
+		}
+
+		if (cfg::occlusionCulling)
+		{
+			collect_occlusion_stats(occlusionTotals, allocator, culler, 0);
+			report_occlusion_stats(occlusionTotals);
+		}
+
+		return 0;
+	}
+
+	std::uint32_t frame_count()
+	{
+		if (0 != cfg::frameCount)
+			return cfg::frameCount;
+
+		return cfg::benchmark ? cfg::kDefaultBenchmarkFrames : 1;
+	}
+
+	std::string capture_path(std::uint32_t aFrame)
+	{
+		std::string ret = cfg::capturePath;
+
+		if (auto const pos = ret.find("%u"); std::string::npos != pos)
+			ret.replace(pos, 2, std::to_string(aFrame));
+
+		return ret;
+	}
+
+	std::string ktx2_path_for(lut::VulkanContext const& aContext, char const* aTexturePath)
+	{
+		std::string ret = aTexturePath;
+
+		auto const dot = ret.find_last_of('.');
+		auto const slash = ret.find_last_of("/\\");
+		if (std::string::npos != dot && (std::string::npos == slash || dot > slash))
+			ret.erase(dot);
+
+		ret += ".ktx2";
+
+		VkFormat const format = lut::read_ktx2_format(ret.c_str());
+		if (VK_FORMAT_UNDEFINED == format)
+			return std::string();
+
+		// Noted once; a texture is looked up several times
+		if (!lut::is_texture_format_supported(aContext, format))
+		{
+			static bool noted = false;
+			if (!noted)
+				std::fprintf(stderr, "KTX2 format %d is not supported by the device, loading the source images of such textures instead\n", int(format));
+			noted = true;
+			return std::string();
+		}
+
+		return ret;
+	}
+
+	void report_memory_stats(lut::Allocator const& aAllocator, char const* aWhen)
+	{
+		std::printf("GPU memory %s:\n", aWhen);
+		lut::print_memory_stats(lut::query_memory_stats(aAllocator));
+
+		if (!cfg::memoryStatsPath.empty())
+		{
+			std::string phase = aWhen;
+			std::replace(phase.begin(), phase.end(), ' ', '-');
+
+			std::string path = cfg::memoryStatsPath;
+			auto const dot = path.find_last_of('.');
+			auto const slash = path.find_last_of("/\\");
+			if (std::string::npos != dot && (std::string::npos == slash || dot > slash))
+				path.insert(dot, "." + phase);
+			else
+				path += "." + phase;
+
+			lut::write_memory_stats_json(aAllocator, path.c_str());
+		}
+	}
+
+	void report_draw_stats(DrawStats const& aStats)
+	{
+		// Without shared sets, each textured draw binds its own
+		std::printf("Textured draws: %u, texture descriptor binds: %u (%u saved by shared arrays/atlases)\n", aStats.texturedDraws, aStats.descriptorBinds, aStats.texturedDraws - aStats.descriptorBinds);
+		if (cfg::occlusionCulling)
+			std::printf("Late pass textured draws: %u, texture descriptor binds: %u (%u saved)\n", aStats.lateTexturedDraws, aStats.lateDescriptorBinds, aStats.lateTexturedDraws - aStats.lateDescriptorBinds);
+		std::printf("Vertex buffer binds: %u%s\n", aStats.vertexBufferBinds, cfg::vertexPulling ? " (vertex pulling)" : "");
+
+		// Meshlet draws are counted by report_meshlet_stats()
+		if (!cfg::meshlets)
+			std::printf("Draws: %u, triangles: %llu%s\n", aStats.draws, static_cast<unsigned long long>(aStats.triangles), aStats.impostors ? " (including impostors)" : "");
+	}
+}
+
+namespace
+{
+	BenchmarkState create_benchmark_state()
+	{
+		BenchmarkState ret;
+		ret.path = cfg::benchmarkPath.empty() ? make_default_camera_path() : load_camera_path(cfg::benchmarkPath.c_str());
+		ret.frames = frame_count();
+		return ret;
+	}
+
+	bool begin_benchmark_frame(BenchmarkState& aState, lut::GpuProfiler const& aProfiler)
+	{
+		using Clock_ = std::chrono::steady_clock;
+		auto const now = Clock_::now();
+
+		// CPU frame time = time between the starts of consecutive frames
+		if (aState.frame > cfg::benchmarkWarmup)
+		{
+			aState.timings.cpuMs.emplace_back(std::chrono::duration<double, std::milli>(now - aState.lastFrameStart).count());
 		}
 
-		return{ std::move(depthImage), lut::ImageView(aWindow.device, view) };
+		aState.lastFrameStart = now;
+
+		if (aState.frame >= aState.frames)
+			return false;
+
+		// The profiler frame that the first measured frame will record into
+		if (aState.frame == cfg::benchmarkWarmup)
+			aState.firstGpuFrame = aProfiler.frame_count();
+
+		// Frames are spread evenly across the path, independent of how long
+		// each one takes to render.
+		float const t = aState.frames > 1 ? aState.path.duration() * float(aState.frame) / float(aState.frames - 1) : 0.f;
+		CameraKey const key = aState.path.sample(t);
+
+		cfg::pos = key.position;
+		cfg::yaw = key.yaw;
+		cfg::pitch = key.pitch;
+		camera();
+
+		++aState.frame;
+		return true;
+	}
+
+	void record_gpu_time(BenchmarkState& aState, char const* aScope, std::uint64_t aFrame, double aMs)
+	{
+		if (aFrame >= aState.firstGpuFrame && 0 == std::strcmp(aScope, "frame"))
+			aState.timings.gpuMs.emplace_back(aMs);
+	}
+
+	void finish_benchmark(BenchmarkState& aState, lut::GpuProfiler& aProfiler)
+	{
+		// The caller has already waited for the device to become idle, so
+		// all remaining results are available.
+		aProfiler.resolve_all();
+
+		print_benchmark_summary(aState.timings);
+
+		if (!cfg::benchmarkReport.empty())
+			write_benchmark_report(aState.timings, cfg::benchmarkReport.c_str());
 	}
 }
 //EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab: 
@@ -0,0 +1,373 @@
+#include "meshlet.hpp"
+
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+
+#include <cmath>
+#include <cassert>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#	define MESHLET_SSE2_ 1
+#	include <emmintrin.h>
+#else
+#	define MESHLET_SSE2_ 0
+#endif
+
+namespace
+{
+	// Vertices are merged if they are bit-for-bit identical
+	struct VertexKey_
+	{
+		std::uint32_t bits[5];
+
+		bool operator== ( VertexKey_ const& aOther ) const noexcept
+		{
+			return 0 == std::memcmp( bits, aOther.bits, sizeof(bits) );
+		}
+	};
+
+	struct VertexKeyHash_
+	{
+		std::size_t operator() ( VertexKey_ const& aKey ) const noexcept
+		{
+			std::uint64_t hash = 14695981039346656037ull;
+			for( auto const word : aKey.bits )
+				hash = (hash ^ word) * 1099511628211ull;
+			return std::size_t(hash);
+		}
+	};
+
+	// A normal cone that never culls
+	constexpr float kNoConeCutoff = 1.f;
+
+	// Normals that spread further than this (minimum dot product with the
+	// axis) give no useful cone, as in meshoptimizer
+	constexpr float kMinConeSpread = 0.1f;
+
+	// Unit length, or zero for degenerate triangles
+	glm::vec3 triangle_normal_( glm::vec3 const& aA, glm::vec3 const& aB, glm::vec3 const& aC ) noexcept
+	{
+		glm::vec3 const n = glm::cross( aB - aA, aC - aA );
+		float const len = glm::length( n );
+		return len > 0.f ? n / len : glm::vec3( 0.f );
+	}
+
+	void compute_bounds_( MeshletMesh& aMesh, Meshlet const& aMeshlet, glm::vec3 const* aPositions )
+	{
+		auto const* indices = aMesh.indices.data() + aMeshlet.firstIndex;
+		std::size_t const indexCount = std::size_t(aMeshlet.triangleCount) * 3;
+
+		auto const position = [&] (std::size_t aIdx) {
+			return aPositions[aMesh.vertices[indices[aIdx]]];
+		};
+
+		// Sphere around the center of the bounding box
+		glm::vec3 lo( std::numeric_limits<float>::max() ), hi( -std::numeric_limits<float>::max() );
+		for( std::size_t i = 0; i < indexCount; ++i )
+		{
+			lo = glm::min( lo, position( i ) );
+			hi = glm::max( hi, position( i ) );
+		}
+
+		glm::vec3 const center = (lo + hi) * 0.5f;
+
+		float radius = 0.f;
+		for( std::size_t i = 0; i < indexCount; ++i )
+			radius = std::max( radius, glm::length( position( i ) - center ) );
+
+		// Cone around the average of the triangle normals. Degenerate
+		// triangles have no normal, and are ignored.
+		std::vector<glm::vec3> normals;
+		normals.reserve( aMeshlet.triangleCount );
+
+		glm::vec3 sum( 0.f );
+		for( std::size_t i = 0; i < indexCount; i += 3 )
+		{
+			glm::vec3 const n = triangle_normal_( position( i ), position( i+1 ), position( i+2 ) );
+			if( glm::dot( n, n ) == 0.f )
+				continue;
+
+			normals.emplace_back( n );
+			sum += n;
+		}
+
+		glm::vec3 axis( 0.f );
+		float cutoff = kNoConeCutoff;
+
+		if( float const len = glm::length( sum ); len > 0.f )
+		{
+			glm::vec3 const avg = sum / len;
+
+			float minDot = 1.f;
+			for( auto const& n : normals )
+				minDot = std::min( minDot, glm::dot( n, avg ) );
+
+			if( minDot > kMinConeSpread )
+			{
+				axis = avg;
+				cutoff = std::sqrt( 1.f - minDot * minDot );
+			}
+		}
+
+		auto& b = aMesh.bounds;
+		b.centerX.emplace_back( center.x ); b.centerY.emplace_back( center.y ); b.centerZ.emplace_back( center.z );
+		b.radius.emplace_back( radius );
+		b.axisX.emplace_back( axis.x ); b.axisY.emplace_back( axis.y ); b.axisZ.emplace_back( axis.z );
+		b.cutoff.emplace_back( cutoff );
+	}
+
+	// Appends the command for meshlet aIdx, or extends the previous one if
+	// it ends where the meshlet begins
+	void emit_( MeshletMesh const& aMesh, std::size_t aIdx, std::uint32_t aFirstInstance, VkDrawIndexedIndirectCommand* aOut, std::uint32_t& aCount, MeshletCullStats& aStats )
+	{
+		auto const& meshlet = aMesh.meshlets[aIdx];
+		std::uint32_t const indexCount = meshlet.triangleCount * 3;
+
+		aStats.drawnTriangles += meshlet.triangleCount;
+
+		if( aCount > 0 )
+		{
+			auto& prev = aOut[aCount-1];
+			if( prev.firstIndex + prev.indexCount == meshlet.firstIndex )
+			{
+				prev.indexCount += indexCount;
+				return;
+			}
+		}
+
+		aOut[aCount++] = VkDrawIndexedIndirectCommand{ indexCount, 1, meshlet.firstIndex, 0, aFirstInstance };
+	}
+}
+
+MeshletMesh build_meshlets( glm::vec3 const* aPositions, glm::vec2 const* aTexCoords, std::size_t aVertexCount, MeshletLimits const& aLimits )
+{
+	assert( aLimits.maxVertices >= 3 && aLimits.maxTriangles >= 1 );
+
+	MeshletMesh ret;
+
+	// Index the mesh
+	std::vector<std::uint32_t> remap( aVertexCount );
+	{
+		std::unordered_map<VertexKey_, std::uint32_t, VertexKeyHash_> unique;
+		unique.reserve( aVertexCount );
+
+		for( std::size_t i = 0; i < aVertexCount; ++i )
+		{
+			VertexKey_ key{};
+			std::memcpy( key.bits, &aPositions[i], sizeof(glm::vec3) );
+			if( aTexCoords )
+				std::memcpy( key.bits + 3, &aTexCoords[i], sizeof(glm::vec2) );
+
+			auto const [it, added] = unique.emplace( key, std::uint32_t(ret.vertices.size()) );
+			if( added )
+				ret.vertices.emplace_back( std::uint32_t(i) );
+
+			remap[i] = it->second;
+		}
+	}
+
+	// Split the triangles. A vertex belongs to the current meshlet if its
+	// mark is the meshlet's index.
+	std::size_t const triangles = aVertexCount / 3;
+	ret.triangleCount = std::uint32_t(triangles);
+	ret.indices.reserve( triangles * 3 );
+
+	std::vector<std::uint32_t> marks( ret.vertices.size(), ~std::uint32_t(0) );
+
+	Meshlet current{ 0, 0, 0 };
+	glm::vec3 firstNormal( 0.f );
+	auto const meshlet_index = [&] { return std::uint32_t(ret.meshlets.size()); };
+
+	for( std::size_t t = 0; t < triangles; ++t )
+	{
+		std::uint32_t const tri[3] = { remap[t*3+0], remap[t*3+1], remap[t*3+2] };
+
+		std::uint32_t added = 0;
+		for( int i = 0; i < 3; ++i )
+		{
+			if( marks[tri[i]] != meshlet_index() && std::find( tri, tri + i, tri[i] ) == tri + i )
+				++added;
+		}
+
+		glm::vec3 const normal = triangle_normal_( aPositions[ret.vertices[tri[0]]], aPositions[ret.vertices[tri[1]]], aPositions[ret.vertices[tri[2]]] );
+
+		bool const full = current.triangleCount + 1 > aLimits.maxTriangles || current.vertexCount + added > aLimits.maxVertices;
+		bool const turns = current.triangleCount > 0 && glm::dot( normal, normal ) > 0.f && glm::dot( normal, firstNormal ) < aLimits.minNormalDot;
+
+		if( full || turns )
+		{
+			ret.meshlets.emplace_back( current );
+			current = Meshlet{ std::uint32_t(ret.indices.size()), 0, 0 };
+
+			added = 0;
+			for( int i = 0; i < 3; ++i )
+			{
+				if( std::find( tri, tri + i, tri[i] ) == tri + i )
+					++added;
+			}
+		}
+
+		for( auto const v : tri )
+		{
+			marks[v] = meshlet_index();
+			ret.indices.emplace_back( v );
+		}
+
+		if( 0 == current.triangleCount || glm::dot( firstNormal, firstNormal ) == 0.f )
+			firstNormal = normal;
+
+		current.vertexCount += added;
+		++current.triangleCount;
+	}
+
+	if( current.triangleCount > 0 )
+		ret.meshlets.emplace_back( current );
+
+	for( auto const& meshlet : ret.meshlets )
+		compute_bounds_( ret, meshlet, aPositions );
+
+	return ret;
+}
+
+MeshletCullView make_meshlet_cull_view( glm::mat4 const& aProjCam, glm::mat4 const& aModel, glm::vec3 aCameraWorld )
+{
+	// Planes from the rows of the combined matrix (Gribb & Hartmann), with
+	// a [0,1] depth range
+	glm::mat4 const m = aProjCam * aModel;
+	auto const row = [&m] (int aRow) {
+		return glm::vec4( m[0][aRow], m[1][aRow], m[2][aRow], m[3][aRow] );
+	};
+
+	MeshletCullView ret;
+	ret.planes[0] = row(3) + row(0);
+	ret.planes[1] = row(3) - row(0);
+	ret.planes[2] = row(3) + row(1);
+	ret.planes[3] = row(3) - row(1);
+	ret.planes[4] = row(2);
+	ret.planes[5] = row(3) - row(2);
+
+	for( auto& plane : ret.planes )
+		plane /= glm::length( glm::vec3( plane ) );
+
+	ret.camera = glm::vec3( glm::inverse( aModel ) * glm::vec4( aCameraWorld, 1.f ) );
+	return ret;
+}
+
+MeshletCullStats& MeshletCullStats::operator+= ( MeshletCullStats const& aOther ) noexcept
+{
+	meshlets += aOther.meshlets;
+	frustumCulled += aOther.frustumCulled;
+	coneCulled += aOther.coneCulled;
+	triangles += aOther.triangles;
+	drawnTriangles += aOther.drawnTriangles;
+	draws += aOther.draws;
+	return *this;
+}
+
+std::uint32_t cull_meshlets( MeshletMesh const& aMesh, MeshletCullView const& aView, std::uint32_t aFirstInstance, VkDrawIndexedIndirectCommand* aOut, MeshletCullStats& aStats )
+{
+	auto const& b = aMesh.bounds;
+	std::size_t const count = aMesh.meshlets.size();
+
+	aStats.meshlets += count;
+	aStats.triangles += aMesh.triangleCount;
+
+	std::uint32_t ret = 0;
+	std::size_t i = 0;
+
+#	if MESHLET_SSE2_
+	// Four meshlets per iteration. Each plane and the cone test produce a
+	// mask of the meshlets they reject.
+	__m128 planes[6][4];
+	for( int p = 0; p < 6; ++p )
+	{
+		for( int c = 0; c < 4; ++c )
+			planes[p][c] = _mm_set1_ps( aView.planes[p][c] );
+	}
+
+	__m128 const camX = _mm_set1_ps( aView.camera.x );
+	__m128 const camY = _mm_set1_ps( aView.camera.y );
+	__m128 const camZ = _mm_set1_ps( aView.camera.z );
+
+	for( ; i + 4 <= count; i += 4 )
+	{
+		__m128 const cx = _mm_loadu_ps( b.centerX.data() + i );
+		__m128 const cy = _mm_loadu_ps( b.centerY.data() + i );
+		__m128 const cz = _mm_loadu_ps( b.centerZ.data() + i );
+		__m128 const r = _mm_loadu_ps( b.radius.data() + i );
+		__m128 const negR = _mm_sub_ps( _mm_setzero_ps(), r );
+
+		__m128 outside = _mm_setzero_ps();
+		for( int p = 0; p < 6; ++p )
+		{
+			__m128 d = _mm_add_ps( _mm_mul_ps( planes[p][0], cx ), planes[p][3] );
+			d = _mm_add_ps( d, _mm_mul_ps( planes[p][1], cy ) );
+			d = _mm_add_ps( d, _mm_mul_ps( planes[p][2], cz ) );
+			outside = _mm_or_ps( outside, _mm_cmplt_ps( d, negR ) );
+		}
+
+		__m128 const vx = _mm_sub_ps( cx, camX ), vy = _mm_sub_ps( cy, camY ), vz = _mm_sub_ps( cz, camZ );
+		__m128 const len = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( vx, vx ), _mm_mul_ps( vy, vy ) ), _mm_mul_ps( vz, vz ) ) );
+
+		__m128 dot = _mm_mul_ps( vx, _mm_loadu_ps( b.axisX.data() + i ) );
+		dot = _mm_add_ps( dot, _mm_mul_ps( vy, _mm_loadu_ps( b.axisY.data() + i ) ) );
+		dot = _mm_add_ps( dot, _mm_mul_ps( vz, _mm_loadu_ps( b.axisZ.data() + i ) ) );
+
+		__m128 const limit = _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( b.cutoff.data() + i ), len ), r );
+		__m128 const backFacing = _mm_cmpge_ps( dot, limit );
+
+		int const outsideMask = _mm_movemask_ps( outside );
+		int const backMask = _mm_movemask_ps( backFacing ) & ~outsideMask;
+
+		for( int j = 0; j < 4; ++j )
+		{
+			if( outsideMask & (1 << j) )
+				++aStats.frustumCulled;
+			else if( backMask & (1 << j) )
+				++aStats.coneCulled;
+			else
+				emit_( aMesh, i + j, aFirstInstance, aOut, ret, aStats );
+		}
+	}
+#	endif // ~ SSE2
+
+	// Remaining meshlets (all of them without SSE2)
+	for( ; i < count; ++i )
+	{
+		glm::vec3 const center( b.centerX[i], b.centerY[i], b.centerZ[i] );
+
+		bool outside = false;
+		for( auto const& plane : aView.planes )
+			outside = outside || glm::dot( glm::vec3( plane ), center ) + plane.w < -b.radius[i];
+
+		if( outside )
+		{
+			++aStats.frustumCulled;
+			continue;
+		}
+
+		glm::vec3 const v = center - aView.camera;
+		glm::vec3 const axis( b.axisX[i], b.axisY[i], b.axisZ[i] );
+		if( glm::dot( v, axis ) >= b.cutoff[i] * glm::length( v ) + b.radius[i] )
+		{
+			++aStats.coneCulled;
+			continue;
+		}
+
+		emit_( aMesh, i, aFirstInstance, aOut, ret, aStats );
+	}
+
+	aStats.draws += ret;
+	return ret;
+}
+
+char const* meshlet_cull_isa() noexcept
+{
+#	if MESHLET_SSE2_
+	return "sse2";
+#	else
+	return "scalar";
+#	endif
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+/* Meshlets (clusters) for culling parts of large meshes (see --meshlets in
+ * main.cpp).
+ *
+ * build_meshlets() indexes a mesh (vertices with the same position and
+ * texture coordinates are merged) and splits its triangles into meshlets of
+ * at most MeshletLimits::maxVertices unique vertices and maxTriangles
+ * triangles. Triangles are taken in their original order, which for OBJ
+ * files is spatially coherent; a triangle that faces away from the start of
+ * the current meshlet begins a new one. The indices are grouped by meshlet,
+ * so each meshlet is a contiguous range of the index buffer and can be drawn
+ * with a regular indexed draw.
+ *
+ * Each meshlet has a bounding sphere and a normal cone. The cone contains
+ * the normals of all of the meshlet's triangles; if the camera sees all of
+ * them from behind, the meshlet can be skipped. The cone test is the one
+ * from meshoptimizer (meshopt_computeMeshletBounds()): a meshlet is
+ * back-facing if
+ *
+ *   dot(center - camera, axis) >= cutoff * length(center - camera) + radius
+ *
+ * Meshlets whose normals spread too widely get a cone that never culls.
+ * Bounds are stored as structure-of-arrays, so that cull_meshlets() can
+ * test four meshlets at once.
+ */
+struct MeshletLimits
+{
+	std::uint32_t maxVertices = 64;
+	std::uint32_t maxTriangles = 124;
+
+	// A triangle starts a new meshlet if the dot product of its normal with
+	// that of the meshlet's first triangle is below this. Keeps the normal
+	// cones narrow enough to cull; -1 disables the check.
+	float minNormalDot = 0.5f;
+};
+
+struct Meshlet
+{
+	std::uint32_t firstIndex;
+	std::uint32_t triangleCount;
+	std::uint32_t vertexCount; // unique
+};
+
+struct MeshletBounds
+{
+	std::vector<float> centerX, centerY, centerZ, radius;
+	std::vector<float> axisX, axisY, axisZ, cutoff;
+};
+
+struct MeshletMesh
+{
+	// Source vertex (relative to the start of the mesh) of each vertex of
+	// the indexed mesh
+	std::vector<std::uint32_t> vertices;
+
+	// Into vertices, three per triangle, grouped by meshlet
+	std::vector<std::uint32_t> indices;
+
+	std::vector<Meshlet> meshlets;
+	MeshletBounds bounds; // one element per meshlet
+
+	std::uint32_t triangleCount = 0;
+};
+
+MeshletMesh build_meshlets( glm::vec3 const* aPositions, glm::vec2 const* aTexCoords, std::size_t aVertexCount, MeshletLimits const& = MeshletLimits{} );
+
+
+// Culling happens in the space of the mesh, so that bounds don't need to be
+// transformed for each instance. Instances must be rigid, with at most a
+// uniform scale.
+struct MeshletCullView
+{
+	glm::vec4 planes[6]; // frustum, normalized, pointing inwards
+	glm::vec3 camera;
+};
+
+MeshletCullView make_meshlet_cull_view( glm::mat4 const& aProjCam, glm::mat4 const& aModel, glm::vec3 aCameraWorld );
+
+struct MeshletCullStats
+{
+	std::uint64_t meshlets = 0; // tested
+	std::uint64_t frustumCulled = 0;
+	std::uint64_t coneCulled = 0; // of the ones in the frustum
+
+	std::uint64_t triangles = 0; // of all tested meshlets
+	std::uint64_t drawnTriangles = 0;
+
+	std::uint64_t draws = 0; // indirect commands written
+
+	MeshletCullStats& operator+= ( MeshletCullStats const& ) noexcept;
+};
+
+// Writes one indexed draw per run of consecutive visible meshlets, with
+// aFirstInstance, to aOut (which has room for one per meshlet). Returns the
+// number of commands written.
+std::uint32_t cull_meshlets( MeshletMesh const&, MeshletCullView const&, std::uint32_t aFirstInstance, VkDrawIndexedIndirectCommand* aOut, MeshletCullStats& );
+
+// "sse2" or "scalar", depending on which code path was compiled in
+char const* meshlet_cull_isa() noexcept;
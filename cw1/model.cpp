@@ -1,13 +1,74 @@
 #include "model.hpp"
 
 #include <utility>
+#include <algorithm>
 
 #include <cstdio>
 #include <cassert>
 
 #include "../labutils/error.hpp"
+#include "../labutils/trace.hpp"
 namespace lut = labutils;
 
+namespace
+{
+	// Merges the meshes from aFirstMesh onwards into one mesh per material,
+	// in order of first use. The meshes' vertices must be contiguous; they
+	// are reordered in place.
+	void coalesce_meshes_( ModelData& aModel, std::size_t aFirstMesh, std::string const& aNamePrefix )
+	{
+		if( aModel.meshes.size() <= aFirstMesh )
+			return;
+
+		std::size_t const begin = aModel.meshes[aFirstMesh].vertexStartIndex;
+
+		std::vector<std::uint32_t> materials; // in order of first use
+		for( std::size_t i = aFirstMesh; i < aModel.meshes.size(); ++i )
+		{
+			auto const mat = aModel.meshes[i].materialIndex;
+			if( materials.end() == std::find( materials.begin(), materials.end(), mat ) )
+				materials.push_back( mat );
+		}
+
+		std::vector<glm::vec3> positions, normals;
+		std::vector<glm::vec2> texcoords;
+
+		std::vector<MeshInfo> merged;
+		merged.reserve( materials.size() );
+
+		for( auto const mat : materials )
+		{
+			MeshInfo mesh{};
+			mesh.materialIndex     = mat;
+			mesh.meshName          = aNamePrefix + aModel.materials[mat].materialName;
+			mesh.vertexStartIndex  = begin + positions.size();
+
+			for( std::size_t i = aFirstMesh; i < aModel.meshes.size(); ++i )
+			{
+				auto const& src = aModel.meshes[i];
+				if( src.materialIndex != mat )
+					continue;
+
+				auto const first = src.vertexStartIndex, last = src.vertexStartIndex + src.numberOfVertices;
+				positions.insert( positions.end(), aModel.vertexPositions.begin() + first, aModel.vertexPositions.begin() + last );
+				normals.insert( normals.end(), aModel.vertexNormals.begin() + first, aModel.vertexNormals.begin() + last );
+				texcoords.insert( texcoords.end(), aModel.vertexTextureCoords.begin() + first, aModel.vertexTextureCoords.begin() + last );
+			}
+
+			mesh.numberOfVertices  = begin + positions.size() - mesh.vertexStartIndex;
+			merged.emplace_back( std::move(mesh) );
+		}
+
+		std::copy( positions.begin(), positions.end(), aModel.vertexPositions.begin() + begin );
+		std::copy( normals.begin(), normals.end(), aModel.vertexNormals.begin() + begin );
+		std::copy( texcoords.begin(), texcoords.end(), aModel.vertexTextureCoords.begin() + begin );
+
+		aModel.meshes.resize( aFirstMesh );
+		for( auto& mesh : merged )
+			aModel.meshes.emplace_back( std::move(mesh) );
+	}
+}
+
 // ModelData
 ModelData::ModelData() noexcept = default;
 
@@ -35,8 +96,10 @@ ModelData& ModelData::operator=( ModelData&& aOther ) noexcept
 
 
 // load_obj_model()
-ModelData load_obj_model( std::string_view const& aOBJPath )
+ModelData load_obj_model( std::string_view const& aOBJPath, MeshMerge aMerge )
 {
+	LUT_TRACE_SCOPE( "load_obj_model" );
+
 	// "Decode" path
 	std::string fileName, directory;
 
@@ -113,9 +176,11 @@ ModelData load_obj_model( std::string_view const& aOBJPath )
 	model.vertexTextureCoords.reserve( totalVertices );
 
 	std::size_t currentIndex = 0;
+	std::size_t unmergedMeshes = 0;
 	for( auto const& s : shapes )
 	{
 		auto const& objMesh = s.mesh;
+		std::size_t const firstMesh = model.meshes.size();
 
 		if( objMesh.indices.empty() )
 			continue;
@@ -217,6 +282,19 @@ ModelData load_obj_model( std::string_view const& aOBJPath )
 
 			model.meshes.emplace_back(mesh);
 		}
+
+		unmergedMeshes += model.meshes.size() - firstMesh;
+
+		if( MeshMerge::shape == aMerge )
+			coalesce_meshes_( model, firstMesh, s.name + "::" );
+	}
+
+	if( MeshMerge::material == aMerge )
+		coalesce_meshes_( model, 0, "" );
+
+	if( MeshMerge::none != aMerge )
+	{
+		std::printf( "  %zu meshes after merging by %s (%zu before)\n", model.meshes.size(), MeshMerge::shape == aMerge ? "shape and material" : "material", unmergedMeshes );
 	}
 
 	assert( model.vertexPositions.size() == totalVertices );
@@ -75,4 +75,17 @@ struct ModelData
 	std::vector<glm::vec2> vertexTextureCoords;
 };
 
-ModelData load_obj_model( std::string_view const& aOBJPath );
+// The OBJ loader creates a new mesh each time the material changes within a
+// shape, so shapes that alternate between materials result in many small
+// meshes (and draw calls). Optionally, meshes with the same material are
+// merged after loading, by reordering the vertices so that each material's
+// triangles are contiguous. The loader prints the mesh count before and
+// after merging.
+enum class MeshMerge
+{
+	none,     // one mesh per run of faces with the same material
+	shape,    // one mesh per material in each OBJ shape
+	material  // one mesh per material
+};
+
+ModelData load_obj_model( std::string_view const& aOBJPath, MeshMerge = MeshMerge::none );
@@ -0,0 +1,372 @@
+#include "occlusion_cull.hpp"
+
+#include <algorithm>
+
+#include <cmath>
+#include <cassert>
+#include <cstring>
+
+#include "../labutils/error.hpp"
+#include "../labutils/vkutil.hpp"
+#include "../labutils/to_string.hpp"
+namespace lut = labutils;
+
+namespace
+{
+	// Must match meshlet_cull.comp
+	constexpr std::uint32_t kWorkGroupSize = 64;
+
+	enum Counter_ : std::uint32_t
+	{
+		kEarlyDraws_,
+		kEarlyTriangles_,
+		kLateDraws_,
+		kLateTriangles_,
+		kFrustumCulled_,
+		kConeCulled_,
+		kOccluded_,
+
+		kCounterCount_ = 8 // padded
+	};
+
+	struct CullUniform_ // std140
+	{
+		glm::mat4 camera;
+		glm::vec4 planes[6]; // world space, pointing inwards
+		glm::vec4 position; // xyz
+		glm::vec4 projection; // P00, |P11|, P22, P32
+		glm::vec4 depth; // depth buffer width and height, near plane
+		glm::uvec4 pyramid; // level 0 width and height, levels, record count
+	};
+
+	static_assert( sizeof(CullUniform_) <= 65536 && sizeof(CullUniform_) % 4 == 0, "CullUniform_ must be updatable with vkCmdUpdateBuffer" );
+	static_assert( sizeof(OcclusionRecord) == 48, "OcclusionRecord must match meshlet_cull.comp" );
+
+	void memory_barrier_( VkCommandBuffer aCmdBuff, VkAccessFlags aSrcAccess, VkAccessFlags aDstAccess, VkPipelineStageFlags aSrcStages, VkPipelineStageFlags aDstStages )
+	{
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = aSrcAccess;
+		barrier.dstAccessMask = aDstAccess;
+
+		vkCmdPipelineBarrier( aCmdBuff, aSrcStages, aDstStages, 0, 1, &barrier, 0, nullptr, 0, nullptr );
+	}
+}
+
+void append_occlusion_records( std::vector<OcclusionRecord>& aRecords, MeshletMesh const& aMesh, std::uint32_t aFirstInstance, std::uint32_t aInstanceCount )
+{
+	auto const& b = aMesh.bounds;
+
+	aRecords.reserve( aRecords.size() + aMesh.meshlets.size() * aInstanceCount );
+	for( std::uint32_t inst = aFirstInstance; inst < aFirstInstance + aInstanceCount; ++inst )
+	{
+		for( std::size_t i = 0; i < aMesh.meshlets.size(); ++i )
+		{
+			OcclusionRecord rec{};
+			rec.sphere = glm::vec4( b.centerX[i], b.centerY[i], b.centerZ[i], b.radius[i] );
+			rec.cone = glm::vec4( b.axisX[i], b.axisY[i], b.axisZ[i], b.cutoff[i] );
+			rec.firstIndex = aMesh.meshlets[i].firstIndex;
+			rec.indexCount = 3 * aMesh.meshlets[i].triangleCount;
+			rec.instance = inst;
+
+			aRecords.emplace_back( rec );
+		}
+	}
+}
+
+OcclusionCullStats& OcclusionCullStats::operator+= ( OcclusionCullStats const& aOther ) noexcept
+{
+	records += aOther.records;
+	frustumCulled += aOther.frustumCulled;
+	coneCulled += aOther.coneCulled;
+	occluded += aOther.occluded;
+	triangles += aOther.triangles;
+	earlyTriangles += aOther.earlyTriangles;
+	lateTriangles += aOther.lateTriangles;
+	earlyDraws += aOther.earlyDraws;
+	lateDraws += aOther.lateDraws;
+	return *this;
+}
+
+OcclusionCuller create_occlusion_culler( lut::VulkanContext const& aContext, lut::Allocator const& aAllocator, lut::StagingRing& aStaging, char const* aSpirvPath, std::vector<OcclusionRecord> const& aRecords, VkBuffer aInstances, std::uint32_t aFrameSlotCount )
+{
+	OcclusionCuller ret;
+	ret.recordCount = std::uint32_t(aRecords.size());
+	for( auto const& rec : aRecords )
+		ret.triangleCount += rec.indexCount / 3;
+
+	// Descriptor set layout
+	VkDescriptorSetLayoutBinding bindings[8]{};
+	for( std::uint32_t i = 0; i < 8; ++i )
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; // uniforms
+	// 1: records, 2: instances, 3: visibility, 4, 5: early and late commands, 6: counters
+	bindings[7].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE; // pyramid
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = sizeof(bindings) / sizeof(bindings[0]);
+	layoutInfo.pBindings = bindings;
+
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	if( auto const res = vkCreateDescriptorSetLayout( aContext.device, &layoutInfo, nullptr, &setLayout ); VK_SUCCESS != res )
+	{
+		throw lut::Error( "Unable to create descriptor set layout\n" "vkCreateDescriptorSetLayout() returned %s", lut::to_string(res).c_str() );
+	}
+
+	ret.setLayout = lut::DescriptorSetLayout( aContext.device, setLayout );
+
+	// Pipeline layout; the push constant selects the phase
+	VkPushConstantRange pushRange{};
+	pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushRange.offset = 0;
+	pushRange.size = sizeof(std::uint32_t);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &ret.setLayout.handle;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	if( auto const res = vkCreatePipelineLayout( aContext.device, &pipelineLayoutInfo, nullptr, &pipelineLayout ); VK_SUCCESS != res )
+	{
+		throw lut::Error( "Unable to create pipeline layout\n" "vkCreatePipelineLayout() returned %s", lut::to_string(res).c_str() );
+	}
+
+	ret.pipelineLayout = lut::PipelineLayout( aContext.device, pipelineLayout );
+
+	// Pipeline
+	lut::ShaderModule shader = lut::load_shader_module( aContext, aSpirvPath );
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shader.handle;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = ret.pipelineLayout.handle;
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	if( auto const res = vkCreateComputePipelines( aContext.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline ); VK_SUCCESS != res )
+	{
+		throw lut::Error( "Unable to create compute pipeline\n" "vkCreateComputePipelines() returned %s", lut::to_string(res).c_str() );
+	}
+
+	ret.pipeline = lut::Pipeline( aContext.device, pipeline );
+
+	// Buffers. Empty buffers aren't allowed, so there is room for at least
+	// one record.
+	VkDeviceSize const recordSlots = std::max( ret.recordCount, 1u );
+
+	ret.uniforms = lut::create_buffer( aAllocator, sizeof(CullUniform_), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, lut::MemoryCategory::uniform );
+
+	if( aRecords.empty() )
+		ret.records = lut::create_buffer( aAllocator, sizeof(OcclusionRecord), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY, lut::MemoryCategory::geometry );
+	else
+		ret.records = aStaging.create_device_buffer( aRecords.data(), aRecords.size() * sizeof(OcclusionRecord), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, lut::MemoryCategory::geometry );
+
+	ret.visibility = lut::create_buffer( aAllocator, recordSlots * sizeof(std::uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, lut::MemoryCategory::geometry );
+	ret.earlyCommands = lut::create_buffer( aAllocator, recordSlots * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY, lut::MemoryCategory::geometry );
+	ret.lateCommands = lut::create_buffer( aAllocator, recordSlots * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY, lut::MemoryCategory::geometry );
+	ret.counters = lut::create_buffer( aAllocator, kCounterCount_ * sizeof(std::uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, lut::MemoryCategory::other );
+
+	for( std::uint32_t i = 0; i < aFrameSlotCount; ++i )
+		ret.readback.emplace_back( lut::create_buffer( aAllocator, kCounterCount_ * sizeof(std::uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU, lut::MemoryCategory::readback ) );
+
+	ret.readbackPending.assign( aFrameSlotCount, 0 );
+
+	// Descriptors
+	VkDescriptorPoolSize const poolSizes[] = {
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6 },
+		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1 }
+	};
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = sizeof(poolSizes) / sizeof(poolSizes[0]);
+	poolInfo.pPoolSizes = poolSizes;
+
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	if( auto const res = vkCreateDescriptorPool( aContext.device, &poolInfo, nullptr, &pool ); VK_SUCCESS != res )
+	{
+		throw lut::Error( "Unable to create descriptor pool\n" "vkCreateDescriptorPool() returned %s", lut::to_string(res).c_str() );
+	}
+
+	ret.pool = lut::DescriptorPool( aContext.device, pool );
+	ret.set = lut::alloc_desc_set( aContext, ret.pool.handle, ret.setLayout.handle );
+
+	VkBuffer const buffers[7] = {
+		ret.uniforms.buffer,
+		ret.records.buffer,
+		aInstances,
+		ret.visibility.buffer,
+		ret.earlyCommands.buffer,
+		ret.lateCommands.buffer,
+		ret.counters.buffer
+	};
+
+	VkDescriptorBufferInfo bufferInfos[7]{};
+	VkWriteDescriptorSet desc[7]{};
+	for( std::uint32_t i = 0; i < 7; ++i )
+	{
+		bufferInfos[i].buffer = buffers[i];
+		bufferInfos[i].offset = 0;
+		bufferInfos[i].range = VK_WHOLE_SIZE;
+
+		desc[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		desc[i].dstSet = ret.set;
+		desc[i].dstBinding = i;
+		desc[i].descriptorType = bindings[i].descriptorType;
+		desc[i].descriptorCount = 1;
+		desc[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	vkUpdateDescriptorSets( aContext.device, sizeof(desc) / sizeof(desc[0]), desc, 0, nullptr );
+
+	return ret;
+}
+
+void set_occlusion_pyramid( lut::VulkanContext const& aContext, OcclusionCuller& aCuller, lut::DepthPyramid const& aPyramid )
+{
+	VkDescriptorImageInfo pyramid{};
+	pyramid.imageView = aPyramid.view.handle;
+	pyramid.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkWriteDescriptorSet desc{};
+	desc.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	desc.dstSet = aCuller.set;
+	desc.dstBinding = 7;
+	desc.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	desc.descriptorCount = 1;
+	desc.pImageInfo = &pyramid;
+
+	vkUpdateDescriptorSets( aContext.device, 1, &desc, 0, nullptr );
+}
+
+void record_occlusion_cull( VkCommandBuffer aCmdBuff, OcclusionCuller& aCuller, lut::DepthPyramid const& aPyramid, OcclusionPhase aPhase, OcclusionCullView const& aView, std::uint32_t aFrameSlot )
+{
+	assert( aFrameSlot < aCuller.readback.size() );
+
+	if( OcclusionPhase::early == aPhase )
+	{
+		// Previous frames' culling, draws and readback must be done with the
+		// buffers that this frame overwrites
+		memory_barrier_( aCmdBuff,
+			VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+		);
+
+		// The view frustum, from the same planes as the CPU culling in
+		// meshlet.cpp (in world space, with an identity model matrix)
+		MeshletCullView const frustum = make_meshlet_cull_view( aView.projCam, glm::mat4( 1.f ), aView.position );
+
+		CullUniform_ uniforms{};
+		uniforms.camera = aView.camera;
+		for( int i = 0; i < 6; ++i )
+			uniforms.planes[i] = frustum.planes[i];
+		uniforms.position = glm::vec4( aView.position, 1.f );
+		uniforms.projection = glm::vec4( aView.projection[0][0], std::abs( aView.projection[1][1] ), aView.projection[2][2], aView.projection[3][2] );
+		uniforms.depth = glm::vec4( float(aPyramid.depthExtent.width), float(aPyramid.depthExtent.height), aView.near, 0.f );
+		uniforms.pyramid = glm::uvec4( aPyramid.width, aPyramid.height, aPyramid.levels, aCuller.recordCount );
+
+		vkCmdUpdateBuffer( aCmdBuff, aCuller.uniforms.buffer, 0, sizeof(uniforms), &uniforms );
+		vkCmdFillBuffer( aCmdBuff, aCuller.counters.buffer, 0, VK_WHOLE_SIZE, 0 );
+
+		// Nothing was visible before the first frame
+		if( !aCuller.visibilityValid )
+		{
+			vkCmdFillBuffer( aCmdBuff, aCuller.visibility.buffer, 0, VK_WHOLE_SIZE, 0 );
+			aCuller.visibilityValid = true;
+		}
+
+		memory_barrier_( aCmdBuff,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+		);
+	}
+
+	std::uint32_t const phase = std::uint32_t(aPhase);
+
+	vkCmdBindPipeline( aCmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, aCuller.pipeline.handle );
+	vkCmdBindDescriptorSets( aCmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, aCuller.pipelineLayout.handle, 0, 1, &aCuller.set, 0, nullptr );
+	vkCmdPushConstants( aCmdBuff, aCuller.pipelineLayout.handle, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(phase), &phase );
+	vkCmdDispatch( aCmdBuff, (aCuller.recordCount + kWorkGroupSize - 1) / kWorkGroupSize, 1, 1 );
+
+	// Commands to the draws; counters and visibility to the next phase (or
+	// the readback)
+	memory_barrier_( aCmdBuff,
+		VK_ACCESS_SHADER_WRITE_BIT,
+		VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT
+	);
+
+	if( OcclusionPhase::late == aPhase )
+	{
+		VkBufferCopy copy{};
+		copy.size = kCounterCount_ * sizeof(std::uint32_t);
+		vkCmdCopyBuffer( aCmdBuff, aCuller.counters.buffer, aCuller.readback[aFrameSlot].buffer, 1, &copy );
+
+		lut::buffer_barrier( aCmdBuff,
+			aCuller.readback[aFrameSlot].buffer,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_ACCESS_HOST_READ_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_HOST_BIT
+		);
+
+		aCuller.readbackPending[aFrameSlot] = 1;
+	}
+}
+
+OcclusionCullStats read_occlusion_stats( lut::Allocator const& aAllocator, OcclusionCuller& aCuller, std::uint32_t aFrameSlot )
+{
+	assert( aFrameSlot < aCuller.readback.size() );
+
+	OcclusionCullStats ret;
+	if( !aCuller.readbackPending[aFrameSlot] )
+		return ret;
+
+	aCuller.readbackPending[aFrameSlot] = 0;
+
+	auto const& buffer = aCuller.readback[aFrameSlot];
+
+	void* ptr = nullptr;
+	if( auto const res = vmaMapMemory( aAllocator.allocator, buffer.allocation, &ptr ); VK_SUCCESS != res )
+	{
+		throw lut::Error( "Mapping memory for reading\n" "vmaMapMemory() returned %s", lut::to_string(res).c_str() );
+	}
+
+	// No-op for HOST_COHERENT memory
+	vmaInvalidateAllocation( aAllocator.allocator, buffer.allocation, 0, VK_WHOLE_SIZE );
+
+	std::uint32_t counters[kCounterCount_];
+	std::memcpy( counters, ptr, sizeof(counters) );
+
+	vmaUnmapMemory( aAllocator.allocator, buffer.allocation );
+
+	ret.records = aCuller.recordCount;
+	ret.triangles = aCuller.triangleCount;
+	ret.frustumCulled = counters[kFrustumCulled_];
+	ret.coneCulled = counters[kConeCulled_];
+	ret.occluded = counters[kOccluded_];
+	ret.earlyTriangles = counters[kEarlyTriangles_];
+	ret.lateTriangles = counters[kLateTriangles_];
+	ret.earlyDraws = counters[kEarlyDraws_];
+	ret.lateDraws = counters[kLateDraws_];
+	return ret;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <vector>
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "meshlet.hpp"
+
+#include "../labutils/hzb.hpp"
+#include "../labutils/vkobject.hpp"
+#include "../labutils/vkbuffer.hpp"
+#include "../labutils/allocator.hpp"
+#include "../labutils/staging_ring.hpp"
+#include "../labutils/vulkan_context.hpp"
+
+/* Two-phase occlusion culling of meshlets on the GPU (see
+ * --occlusion-culling in main.cpp), with a compute shader
+ * (meshlet_cull.comp).
+ *
+ * Each meshlet of each instance is a record, with one indexed indirect draw
+ * in each of two command buffers at the record's index. Draws of culled
+ * records get an instanceCount of zero, so the commands of a mesh always
+ * form the same range and can be drawn with one multi-draw call. The
+ * visibility of each record from the previous frame is kept in a buffer on
+ * the GPU.
+ *
+ *  - Early phase: records that were visible in the previous frame, and are
+ *    still inside the view frustum and not back-facing (see the cone test in
+ *    meshlet.hpp), go into the early commands. These are drawn first.
+ *  - The depth buffer that this leaves behind is reduced to a depth pyramid
+ *    (labutils/hzb.hpp).
+ *  - Late phase: all records are tested again, now also against the
+ *    pyramid. Visible ones that weren't drawn in the early phase go into the
+ *    late commands, which are drawn on top. The result of the test is the
+ *    visibility for the next frame.
+ *
+ * The pyramid thus holds the depth of the objects that were visible in the
+ * previous frame, from the current camera, rather than last frame's depth
+ * buffer itself, so it needs no reprojection. Anything that becomes visible
+ * is drawn in the late phase of the same frame, so there is no popping.
+ *
+ * A record is occluded if the nearest point of its bounding sphere is behind
+ * the farthest depth in the pyramid texels that cover the sphere's screen
+ * space bounds (from "2D Polyhedral Bounds of a Clipped, Perspective-Projected
+ * 3D Sphere", Mara and McGuire 2013). Bounds are transformed by the
+ * instances' model matrices, which must be rigid, with at most a uniform
+ * scale.
+ */
+struct OcclusionRecord // std430, see meshlet_cull.comp
+{
+	glm::vec4 sphere; // center, radius; in mesh space
+	glm::vec4 cone; // axis, cutoff
+
+	std::uint32_t firstIndex, indexCount;
+	std::uint32_t instance;
+	std::uint32_t pad_;
+};
+
+// Appends one record per meshlet for each instance in [aFirstInstance,
+// aFirstInstance+aInstanceCount), by instance
+void append_occlusion_records( std::vector<OcclusionRecord>&, MeshletMesh const&, std::uint32_t aFirstInstance, std::uint32_t aInstanceCount );
+
+enum class OcclusionPhase : std::uint32_t
+{
+	early = 0,
+	late = 1
+};
+
+struct OcclusionCullView
+{
+	glm::mat4 camera; // world to view
+	glm::mat4 projection; // perspectiveRH_ZO, with Y mirrored
+	glm::mat4 projCam;
+	glm::vec3 position; // of the camera
+	float near;
+};
+
+struct OcclusionCullStats
+{
+	std::uint64_t records = 0; // tested in each phase
+	std::uint64_t frustumCulled = 0; // in the late phase
+	std::uint64_t coneCulled = 0; // of the ones in the frustum
+	std::uint64_t occluded = 0; // of the ones that passed both
+
+	std::uint64_t triangles = 0; // of all records
+	std::uint64_t earlyTriangles = 0, lateTriangles = 0; // drawn
+
+	std::uint64_t earlyDraws = 0, lateDraws = 0; // non-empty commands
+
+	OcclusionCullStats& operator+= ( OcclusionCullStats const& ) noexcept;
+};
+
+struct OcclusionCuller
+{
+	labutils::DescriptorSetLayout setLayout;
+	labutils::PipelineLayout pipelineLayout;
+	labutils::Pipeline pipeline;
+
+	labutils::DescriptorPool pool;
+	VkDescriptorSet set = VK_NULL_HANDLE;
+
+	labutils::Buffer uniforms;
+	labutils::Buffer records;
+	labutils::Buffer visibility; // one uint per record
+	labutils::Buffer earlyCommands, lateCommands; // VkDrawIndexedIndirectCommand per record
+	labutils::Buffer counters;
+
+	std::vector<labutils::Buffer> readback; // counters, one per frame slot
+	std::vector<std::uint8_t> readbackPending;
+
+	std::uint32_t recordCount = 0;
+	std::uint64_t triangleCount = 0; // of all records
+
+	bool visibilityValid = false; // cleared on the first use
+};
+
+// aInstances holds the model matrices (as glm::mat4) that the records refer
+// to, and must have VK_BUFFER_USAGE_STORAGE_BUFFER_BIT. The records are
+// uploaded through aStaging.
+OcclusionCuller create_occlusion_culler( labutils::VulkanContext const&, labutils::Allocator const&, labutils::StagingRing& aStaging, char const* aSpirvPath, std::vector<OcclusionRecord> const&, VkBuffer aInstances, std::uint32_t aFrameSlotCount );
+
+// Must be called before the first use, and again whenever the pyramid is
+// recreated (while the culler is not in use)
+void set_occlusion_pyramid( labutils::VulkanContext const&, OcclusionCuller&, labutils::DepthPyramid const& );
+
+// Records the culling phase, and a barrier that makes its commands
+// available to vkCmdDrawIndexedIndirect(). The early phase also updates
+// the culler's uniforms from aView (keep it the same for both phases). The
+// late phase reads the pyramid (see record_depth_pyramid()), and copies the
+// statistics to the frame slot's readback buffer.
+void record_occlusion_cull( VkCommandBuffer, OcclusionCuller&, labutils::DepthPyramid const&, OcclusionPhase, OcclusionCullView const&, std::uint32_t aFrameSlot );
+
+// Statistics of the frame slot's last frame, which must have completed.
+// Returns zeroes if the slot hasn't been used since the last call.
+OcclusionCullStats read_occlusion_stats( labutils::Allocator const&, OcclusionCuller&, std::uint32_t aFrameSlot );
@@ -0,0 +1,83 @@
+#include "scene_file.hpp"
+
+#include <algorithm>
+
+#include <cstdio>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../labutils/error.hpp"
+namespace lut = labutils;
+
+std::vector<glm::mat4> SceneDescription::transforms( char const* aModel ) const
+{
+	std::vector<glm::mat4> ret;
+	for( auto const& instance : instances )
+	{
+		if( aModel == instance.model )
+			ret.emplace_back( instance.transform );
+	}
+
+	return ret;
+}
+
+SceneDescription load_scene_description( char const* aPath, std::vector<std::string> const& aModels )
+{
+	std::FILE* fin = std::fopen( aPath, "r" );
+	if( !fin )
+		throw lut::Error( "Unable to open scene description '%s'", aPath );
+
+	SceneDescription ret;
+
+	char line[512];
+	std::size_t lineNo = 0;
+	while( std::fgets( line, sizeof(line), fin ) )
+	{
+		++lineNo;
+
+		char const* str = line;
+		while( ' ' == *str || '\t' == *str )
+			++str;
+
+		if( '#' == *str || '\n' == *str || '\r' == *str || '\0' == *str )
+			continue;
+
+		char model[128]{};
+		float x = 0.f, y = 0.f, z = 0.f, yaw = 0.f, scale = 1.f;
+
+		int const fields = std::sscanf( str, "%127s %f %f %f %f %f", model, &x, &y, &z, &yaw, &scale );
+		if( fields < 4 )
+		{
+			std::fclose( fin );
+			throw lut::Error( "%s:%zu: expected 'model x y z [yaw [scale]]'", aPath, lineNo );
+		}
+
+		if( aModels.end() == std::find( aModels.begin(), aModels.end(), model ) )
+		{
+			std::fclose( fin );
+			throw lut::Error( "%s:%zu: unknown model '%s'", aPath, lineNo, model );
+		}
+
+		glm::mat4 transform = glm::translate( glm::mat4( 1.f ), glm::vec3( x, y, z ) );
+		transform = glm::rotate( transform, glm::radians( yaw ), glm::vec3( 0.f, 1.f, 0.f ) );
+		transform = glm::scale( transform, glm::vec3( scale ) );
+
+		ret.instances.emplace_back( SceneInstance{ model, transform } );
+	}
+
+	std::fclose( fin );
+
+	if( ret.instances.empty() )
+		throw lut::Error( "Scene description '%s' contains no instances", aPath );
+
+	return ret;
+}
+
+SceneDescription make_default_scene_description( std::vector<std::string> const& aModels )
+{
+	SceneDescription ret;
+	for( auto const& model : aModels )
+		ret.instances.emplace_back( SceneInstance{ model, glm::mat4( 1.f ) } );
+
+	return ret;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+/* Scene descriptions for cw1 (see --scene in main.cpp).
+ *
+ * A scene places the loaded models any number of times. All instances of a
+ * mesh are drawn with one instanced draw call, using a per-instance model
+ * matrix (see the vertex shaders).
+ *
+ * The text format is one instance per line:
+ *
+ *   # model x y z [yaw [scale]]
+ *   city   0.0 0.0 0.0
+ *   car    4.0 0.0 2.0   90
+ *   car   -3.0 0.0 8.5  180 1.5
+ *
+ * The yaw is a rotation about the y axis, in degrees; the scale is uniform.
+ * Lines starting with '#' are ignored.
+ */
+struct SceneInstance
+{
+	std::string model;
+	glm::mat4 transform;
+};
+
+struct SceneDescription
+{
+	std::vector<SceneInstance> instances;
+
+	// In file order
+	std::vector<glm::mat4> transforms( char const* aModel ) const;
+};
+
+// aModels lists the valid model names
+SceneDescription load_scene_description( char const* aPath, std::vector<std::string> const& aModels );
+
+// One instance of each model, at its authored position (as without a scene
+// description)
+SceneDescription make_default_scene_description( std::vector<std::string> const& aModels );
@@ -0,0 +1,284 @@
+#include "scene_graph.hpp"
+
+#include <algorithm>
+
+#include <cassert>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#	define SCENE_GRAPH_SSE2_ 1
+#	include <emmintrin.h>
+#else
+#	define SCENE_GRAPH_SSE2_ 0
+#endif
+
+namespace
+{
+	struct Components_
+	{
+		float const* tx; float const* ty; float const* tz;
+		float const* rx; float const* ry; float const* rz; float const* rw;
+		float const* sx; float const* sy; float const* sz;
+	};
+
+	// Local matrices (translation * rotation * scale) of the nodes in
+	// aNodes[0..aCount), as glm::translate(), glm::mat4_cast() and
+	// glm::scale() would produce them.
+#	if SCENE_GRAPH_SSE2_
+	void compose_locals_( Components_ const& aC, SceneNode const* aNodes, std::size_t aCount, glm::mat4* aOut )
+	{
+		static_assert( sizeof(glm::mat4) == 16*sizeof(float) );
+
+		for( std::size_t i = 0; i < aCount; i += 4 )
+		{
+			// Four nodes per iteration, one per lane. The last iteration
+			// repeats the last node to fill the lanes.
+			std::size_t const last = aCount - 1;
+			SceneNode const n0 = aNodes[i];
+			SceneNode const n1 = aNodes[std::min( i+1, last )];
+			SceneNode const n2 = aNodes[std::min( i+2, last )];
+			SceneNode const n3 = aNodes[std::min( i+3, last )];
+
+			auto const gather = [&] (float const* aArray) {
+				return _mm_setr_ps( aArray[n0], aArray[n1], aArray[n2], aArray[n3] );
+			};
+
+			__m128 const x = gather( aC.rx ), y = gather( aC.ry ), z = gather( aC.rz ), w = gather( aC.rw );
+			__m128 const sx = gather( aC.sx ), sy = gather( aC.sy ), sz = gather( aC.sz );
+
+			__m128 const one = _mm_set1_ps( 1.f ), two = _mm_set1_ps( 2.f );
+			__m128 const x2 = _mm_mul_ps( x, two ), y2 = _mm_mul_ps( y, two ), z2 = _mm_mul_ps( z, two );
+			__m128 const xx = _mm_mul_ps( x, x2 ), yy = _mm_mul_ps( y, y2 ), zz = _mm_mul_ps( z, z2 );
+			__m128 const xy = _mm_mul_ps( x, y2 ), xz = _mm_mul_ps( x, z2 ), yz = _mm_mul_ps( y, z2 );
+			__m128 const wx = _mm_mul_ps( w, x2 ), wy = _mm_mul_ps( w, y2 ), wz = _mm_mul_ps( w, z2 );
+
+			// Rows of the 3x3 part are the lanes' (column, row) elements
+			__m128 c0x = _mm_mul_ps( _mm_sub_ps( one, _mm_add_ps( yy, zz ) ), sx );
+			__m128 c0y = _mm_mul_ps( _mm_add_ps( xy, wz ), sx );
+			__m128 c0z = _mm_mul_ps( _mm_sub_ps( xz, wy ), sx );
+			__m128 c0w = _mm_setzero_ps();
+
+			__m128 c1x = _mm_mul_ps( _mm_sub_ps( xy, wz ), sy );
+			__m128 c1y = _mm_mul_ps( _mm_sub_ps( one, _mm_add_ps( xx, zz ) ), sy );
+			__m128 c1z = _mm_mul_ps( _mm_add_ps( yz, wx ), sy );
+			__m128 c1w = _mm_setzero_ps();
+
+			__m128 c2x = _mm_mul_ps( _mm_add_ps( xz, wy ), sz );
+			__m128 c2y = _mm_mul_ps( _mm_sub_ps( yz, wx ), sz );
+			__m128 c2z = _mm_mul_ps( _mm_sub_ps( one, _mm_add_ps( xx, yy ) ), sz );
+			__m128 c2w = _mm_setzero_ps();
+
+			__m128 c3x = gather( aC.tx ), c3y = gather( aC.ty ), c3z = gather( aC.tz );
+			__m128 c3w = one;
+
+			// Transposing turns (element of four nodes) into (column of one
+			// node)
+			_MM_TRANSPOSE4_PS( c0x, c0y, c0z, c0w );
+			_MM_TRANSPOSE4_PS( c1x, c1y, c1z, c1w );
+			_MM_TRANSPOSE4_PS( c2x, c2y, c2z, c2w );
+			_MM_TRANSPOSE4_PS( c3x, c3y, c3z, c3w );
+
+			__m128 const cols[4][4] = {
+				{ c0x, c1x, c2x, c3x },
+				{ c0y, c1y, c2y, c3y },
+				{ c0z, c1z, c2z, c3z },
+				{ c0w, c1w, c2w, c3w }
+			};
+
+			for( std::size_t j = 0; j < 4 && i + j < aCount; ++j )
+			{
+				float* out = &aOut[i+j][0][0];
+				for( int c = 0; c < 4; ++c )
+					_mm_storeu_ps( out + 4*c, cols[j][c] );
+			}
+		}
+	}
+
+	// aOut = aParent * aLocal. aOut may alias aLocal.
+	void multiply_( glm::mat4 const& aParent, glm::mat4 const& aLocal, glm::mat4& aOut ) noexcept
+	{
+		float const* p = &aParent[0][0];
+		__m128 const p0 = _mm_loadu_ps( p ), p1 = _mm_loadu_ps( p+4 ), p2 = _mm_loadu_ps( p+8 ), p3 = _mm_loadu_ps( p+12 );
+
+		float const* l = &aLocal[0][0];
+		__m128 res[4];
+		for( int c = 0; c < 4; ++c )
+		{
+			__m128 acc = _mm_mul_ps( p0, _mm_set1_ps( l[4*c+0] ) );
+			acc = _mm_add_ps( acc, _mm_mul_ps( p1, _mm_set1_ps( l[4*c+1] ) ) );
+			acc = _mm_add_ps( acc, _mm_mul_ps( p2, _mm_set1_ps( l[4*c+2] ) ) );
+			acc = _mm_add_ps( acc, _mm_mul_ps( p3, _mm_set1_ps( l[4*c+3] ) ) );
+			res[c] = acc;
+		}
+
+		float* out = &aOut[0][0];
+		for( int c = 0; c < 4; ++c )
+			_mm_storeu_ps( out + 4*c, res[c] );
+	}
+#	else // !SSE2
+	void compose_locals_( Components_ const& aC, SceneNode const* aNodes, std::size_t aCount, glm::mat4* aOut )
+	{
+		for( std::size_t i = 0; i < aCount; ++i )
+		{
+			SceneNode const n = aNodes[i];
+			glm::mat3 const rot = glm::mat3_cast( glm::quat( aC.rw[n], aC.rx[n], aC.ry[n], aC.rz[n] ) );
+
+			aOut[i] = glm::mat4(
+				glm::vec4( rot[0] * aC.sx[n], 0.f ),
+				glm::vec4( rot[1] * aC.sy[n], 0.f ),
+				glm::vec4( rot[2] * aC.sz[n], 0.f ),
+				glm::vec4( aC.tx[n], aC.ty[n], aC.tz[n], 1.f )
+			);
+		}
+	}
+
+	void multiply_( glm::mat4 const& aParent, glm::mat4 const& aLocal, glm::mat4& aOut ) noexcept
+	{
+		aOut = aParent * aLocal;
+	}
+#	endif // ~ SSE2
+}
+
+SceneNode SceneGraph::add_node( SceneNode aParent, glm::vec3 aTranslation, glm::quat aRotation, glm::vec3 aScale )
+{
+	assert( kNoSceneNode == aParent || aParent < size() );
+
+	auto const ret = SceneNode(size());
+
+	mParent.emplace_back( aParent );
+	mTx.emplace_back( aTranslation.x ); mTy.emplace_back( aTranslation.y ); mTz.emplace_back( aTranslation.z );
+	mRx.emplace_back( aRotation.x ); mRy.emplace_back( aRotation.y ); mRz.emplace_back( aRotation.z ); mRw.emplace_back( aRotation.w );
+	mSx.emplace_back( aScale.x ); mSy.emplace_back( aScale.y ); mSz.emplace_back( aScale.z );
+	mWorld.emplace_back( 1.f );
+	mDirty.emplace_back( std::uint8_t(0) );
+
+	mark_dirty_( ret );
+	return ret;
+}
+
+void SceneGraph::reserve( std::size_t aCount )
+{
+	for( auto* array : { &mTx, &mTy, &mTz, &mRx, &mRy, &mRz, &mRw, &mSx, &mSy, &mSz } )
+		array->reserve( aCount );
+
+	mParent.reserve( aCount );
+	mWorld.reserve( aCount );
+	mDirty.reserve( aCount );
+}
+
+std::size_t SceneGraph::size() const noexcept
+{
+	return mParent.size();
+}
+SceneNode SceneGraph::parent( SceneNode aNode ) const noexcept
+{
+	assert( aNode < size() );
+	return mParent[aNode];
+}
+
+void SceneGraph::set_translation( SceneNode aNode, glm::vec3 aTranslation )
+{
+	assert( aNode < size() );
+	mTx[aNode] = aTranslation.x; mTy[aNode] = aTranslation.y; mTz[aNode] = aTranslation.z;
+	mark_dirty_( aNode );
+}
+void SceneGraph::set_rotation( SceneNode aNode, glm::quat aRotation )
+{
+	assert( aNode < size() );
+	mRx[aNode] = aRotation.x; mRy[aNode] = aRotation.y; mRz[aNode] = aRotation.z; mRw[aNode] = aRotation.w;
+	mark_dirty_( aNode );
+}
+void SceneGraph::set_scale( SceneNode aNode, glm::vec3 aScale )
+{
+	assert( aNode < size() );
+	mSx[aNode] = aScale.x; mSy[aNode] = aScale.y; mSz[aNode] = aScale.z;
+	mark_dirty_( aNode );
+}
+
+glm::vec3 SceneGraph::translation( SceneNode aNode ) const noexcept
+{
+	assert( aNode < size() );
+	return glm::vec3( mTx[aNode], mTy[aNode], mTz[aNode] );
+}
+glm::quat SceneGraph::rotation( SceneNode aNode ) const noexcept
+{
+	assert( aNode < size() );
+	return glm::quat( mRw[aNode], mRx[aNode], mRy[aNode], mRz[aNode] );
+}
+glm::vec3 SceneGraph::scale( SceneNode aNode ) const noexcept
+{
+	assert( aNode < size() );
+	return glm::vec3( mSx[aNode], mSy[aNode], mSz[aNode] );
+}
+
+glm::mat4 const& SceneGraph::world( SceneNode aNode ) const noexcept
+{
+	assert( aNode < size() );
+	return mWorld[aNode];
+}
+glm::mat4 const* SceneGraph::world_matrices() const noexcept
+{
+	return mWorld.data();
+}
+
+std::size_t SceneGraph::update()
+{
+	std::size_t const count = size();
+	if( mFirstDirty >= count )
+		return 0;
+
+	// Collect the nodes to recompute. A node is outdated if it was changed
+	// or if its parent is outdated; parents come first, so one pass sees
+	// the final state of each parent.
+	mBatch.clear();
+	for( std::size_t i = mFirstDirty; i < count; ++i )
+	{
+		SceneNode const parent = mParent[i];
+		if( kNoSceneNode != parent && mDirty[parent] )
+			mDirty[i] = 1;
+
+		if( mDirty[i] )
+			mBatch.emplace_back( SceneNode(i) );
+	}
+
+	Components_ const components{
+		mTx.data(), mTy.data(), mTz.data(),
+		mRx.data(), mRy.data(), mRz.data(), mRw.data(),
+		mSx.data(), mSy.data(), mSz.data()
+	};
+
+	mLocal.resize( mBatch.size() );
+	compose_locals_( components, mBatch.data(), mBatch.size(), mLocal.data() );
+
+	// In index order, so that parents are done before their children
+	for( std::size_t i = 0; i < mBatch.size(); ++i )
+	{
+		SceneNode const node = mBatch[i];
+		SceneNode const parent = mParent[node];
+
+		if( kNoSceneNode == parent )
+			mWorld[node] = mLocal[i];
+		else
+			multiply_( mWorld[parent], mLocal[i], mWorld[node] );
+	}
+
+	for( auto const node : mBatch )
+		mDirty[node] = 0;
+
+	mFirstDirty = count;
+	return mBatch.size();
+}
+
+void SceneGraph::mark_dirty_( SceneNode aNode ) noexcept
+{
+	mDirty[aNode] = 1;
+	mFirstDirty = std::min( mFirstDirty, std::size_t(aNode) );
+}
+
+char const* scene_graph_simd_isa() noexcept
+{
+#	if SCENE_GRAPH_SSE2_
+	return "sse2";
+#	else
+	return "scalar";
+#	endif
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+/* Transform hierarchy for objects that move (e.g., vehicles and their parts).
+ *
+ * Nodes are stored flat, in structure-of-arrays form: one array per
+ * component of the local transforms (translation, rotation, scale), plus the
+ * parent indices and the resulting world matrices. A node's parent always
+ * comes before it, since nodes can only be added below existing ones. A
+ * single pass in index order therefore sees every parent before its
+ * children.
+ *
+ * Changing a node's local transform marks it dirty. update() recomputes the
+ * world matrices of the dirty nodes and of everything below them, and
+ * leaves the rest alone: the pass starts at the first dirty node, and a node
+ * is recomputed if it or its parent was. Local matrices are built four
+ * nodes at a time from the SoA components, and multiplied with the parents'
+ * world matrices, with SSE where available (see scene_graph_simd_isa()).
+ *
+ * Rotations are expected to be unit quaternions.
+ */
+using SceneNode = std::uint32_t;
+constexpr SceneNode kNoSceneNode = ~SceneNode(0);
+
+class SceneGraph
+{
+	public:
+		// Returns the new node's index, which is size() before the call.
+		// aParent must be an existing node, or kNoSceneNode for a root.
+		SceneNode add_node( SceneNode aParent, glm::vec3 aTranslation = glm::vec3( 0.f ), glm::quat aRotation = glm::quat( 1.f, 0.f, 0.f, 0.f ), glm::vec3 aScale = glm::vec3( 1.f ) );
+
+		void reserve( std::size_t );
+
+		std::size_t size() const noexcept;
+		SceneNode parent( SceneNode ) const noexcept;
+
+		void set_translation( SceneNode, glm::vec3 );
+		void set_rotation( SceneNode, glm::quat );
+		void set_scale( SceneNode, glm::vec3 );
+
+		glm::vec3 translation( SceneNode ) const noexcept;
+		glm::quat rotation( SceneNode ) const noexcept;
+		glm::vec3 scale( SceneNode ) const noexcept;
+
+		// As of the last update()
+		glm::mat4 const& world( SceneNode ) const noexcept;
+		glm::mat4 const* world_matrices() const noexcept; // size() elements
+
+		// Recomputes outdated world matrices. Returns the number of nodes
+		// that were recomputed.
+		std::size_t update();
+
+	private:
+		void mark_dirty_( SceneNode ) noexcept;
+
+	private:
+		std::vector<SceneNode> mParent;
+
+		std::vector<float> mTx, mTy, mTz;
+		std::vector<float> mRx, mRy, mRz, mRw;
+		std::vector<float> mSx, mSy, mSz;
+
+		std::vector<glm::mat4> mWorld;
+
+		std::vector<std::uint8_t> mDirty;
+		std::size_t mFirstDirty = 0; // size() if nothing is dirty
+
+		// Scratch space of update()
+		std::vector<SceneNode> mBatch;
+		std::vector<glm::mat4> mLocal;
+};
+
+// "sse2" or "scalar", depending on which code path was compiled in
+char const* scene_graph_simd_isa() noexcept;
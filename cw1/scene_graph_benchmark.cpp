@@ -0,0 +1,107 @@
+#include "scene_graph_benchmark.hpp"
+
+#include <chrono>
+#include <vector>
+#include <functional>
+
+#include <cstdio>
+#include <cstdint>
+
+#include "benchmark.hpp"
+#include "scene_graph.hpp"
+
+#include "../labutils/trace.hpp"
+
+namespace
+{
+	constexpr std::size_t kVehicles = 1000;
+	constexpr std::size_t kParts = 9; // per vehicle
+	constexpr std::size_t kSubParts = 10; // per part
+
+	constexpr std::size_t kFrames = 200;
+
+	struct Scene_
+	{
+		SceneGraph graph;
+
+		std::vector<SceneNode> vehicles;
+		std::vector<SceneNode> subParts;
+	};
+
+	Scene_ make_scene_()
+	{
+		Scene_ ret;
+		ret.graph.reserve( kVehicles * (1 + kParts * (1 + kSubParts)) );
+
+		for( std::size_t v = 0; v < kVehicles; ++v )
+		{
+			auto const vehicle = ret.graph.add_node( kNoSceneNode, glm::vec3( float(v % 32) * 4.f, 0.f, float(v / 32) * 4.f ) );
+			ret.vehicles.emplace_back( vehicle );
+
+			for( std::size_t p = 0; p < kParts; ++p )
+			{
+				auto const rot = glm::angleAxis( float(p) * 0.7f, glm::vec3( 0.f, 1.f, 0.f ) );
+				auto const part = ret.graph.add_node( vehicle, glm::vec3( 0.f, 0.5f, float(p) * 0.2f ), rot );
+
+				for( std::size_t s = 0; s < kSubParts; ++s )
+					ret.subParts.emplace_back( ret.graph.add_node( part, glm::vec3( float(s) * 0.1f, 0.f, 0.f ), glm::quat( 1.f, 0.f, 0.f, 0.f ), glm::vec3( 0.5f ) ) );
+			}
+		}
+
+		ret.graph.update();
+		return ret;
+	}
+
+	// aChange is called at the start of each frame, with the frame index
+	void measure_( char const* aName, Scene_& aScene, std::function<void(Scene_&,std::size_t)> const& aChange )
+	{
+		using Clock_ = std::chrono::steady_clock;
+
+		std::vector<double> samples;
+		std::size_t nodes = 0;
+
+		for( std::size_t frame = 0; frame < kFrames; ++frame )
+		{
+			aChange( aScene, frame );
+
+			auto const start = Clock_::now();
+			nodes = aScene.graph.update();
+			samples.emplace_back( std::chrono::duration<double, std::milli>( Clock_::now() - start ).count() );
+		}
+
+		auto const stats = compute_timing_stats( std::move(samples) );
+		double const mnodes = stats.p50 > 0.0 ? double(nodes) / (stats.p50 * 1000.0) : 0.0;
+		std::printf( "  %-24s %8zu %10.3f %10.3f %10.1f\n", aName, nodes, stats.p50, stats.p95, mnodes );
+	}
+}
+
+void run_scene_graph_benchmark()
+{
+	LUT_TRACE_SCOPE( "run_scene_graph_benchmark" );
+
+	Scene_ scene = make_scene_();
+
+	std::printf( "Scene graph benchmark, %zu nodes, %zu frames (%s):\n", scene.graph.size(), kFrames, scene_graph_simd_isa() );
+	std::printf( "  %-24s %8s %10s %10s %10s\n", "case", "nodes", "p50 ms", "p95 ms", "Mnodes/s" );
+
+	auto const angle = [] (std::size_t aFrame) {
+		return float(aFrame) * 0.01f;
+	};
+
+	measure_( "all vehicles move", scene, [&] (Scene_& aScene, std::size_t aFrame) {
+		for( auto const vehicle : aScene.vehicles )
+			aScene.graph.set_rotation( vehicle, glm::angleAxis( angle(aFrame), glm::vec3( 0.f, 1.f, 0.f ) ) );
+	} );
+
+	measure_( "10% of vehicles move", scene, [&] (Scene_& aScene, std::size_t aFrame) {
+		for( std::size_t i = aFrame % 10; i < aScene.vehicles.size(); i += 10 )
+			aScene.graph.set_rotation( aScene.vehicles[i], glm::angleAxis( angle(aFrame), glm::vec3( 0.f, 1.f, 0.f ) ) );
+	} );
+
+	measure_( "10% of leaves move", scene, [&] (Scene_& aScene, std::size_t aFrame) {
+		for( std::size_t i = aFrame % 10; i < aScene.subParts.size(); i += 10 )
+			aScene.graph.set_rotation( aScene.subParts[i], glm::angleAxis( angle(aFrame), glm::vec3( 1.f, 0.f, 0.f ) ) );
+	} );
+
+	measure_( "static", scene, [] (Scene_&, std::size_t) {} );
+}
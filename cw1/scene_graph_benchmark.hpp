@@ -0,0 +1,12 @@
+#pragma once
+
+/* Scene graph update benchmark (see --scene-graph-benchmark in main.cpp).
+ *
+ * Builds a SceneGraph (see scene_graph.hpp) of 100k nodes: 1000 vehicles,
+ * each a root with 9 parts that have 10 sub-parts each. Every frame, a
+ * subset of the nodes is changed and update() is timed. The cases range
+ * from moving every vehicle (all nodes are recomputed) to changing nothing.
+ * The median and 95th percentile times per frame are printed, along with
+ * the number of recomputed nodes.
+ */
+void run_scene_graph_benchmark();
@@ -3,6 +3,9 @@
 layout( location = 0 ) in vec3 iPosition; 
 layout( location = 1 ) in vec3 iColor; 
 
+// Per instance (see SceneDescription in scene_file.hpp); uses locations 2-5
+layout( location = 2 ) in mat4 iModel;
+
 layout( set = 0, binding = 0 ) uniform UScene 
 { 
 	mat4 camera; 
@@ -12,10 +15,13 @@ layout( set = 0, binding = 0 ) uniform UScene
 
 layout( location = 0 ) out vec3 v2fColor; 
 
+// Positions must match depth.vert exactly for the depth pre-pass
+invariant gl_Position;
+
 void main() 
 { 
 	v2fColor = iColor; 
 
-	gl_Position = uScene.projCam * vec4( iPosition, 1.f ); 
+	gl_Position = uScene.projCam * iModel * vec4( iPosition, 1.f ); 
 
 }
\ No newline at end of file
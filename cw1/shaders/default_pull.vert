@@ -0,0 +1,44 @@
+#version 450 
+
+// As default.vert, but with vertex pulling: the vertex and the model matrix
+// are read from storage buffers (see --vertex-pulling)
+
+layout( set = 0, binding = 0 ) uniform UScene 
+{ 
+	mat4 camera; 
+	mat4 projection; 
+	mat4 projCam; 
+} uScene; 
+
+// Scene geometry, see cw1/vertex_pulling.hpp
+layout( std430, set = 2, binding = 0 ) readonly buffer UPositions
+{
+	vec4 origin;
+	vec4 scale;
+	uint positions[]; // two per vertex: x | y << 16, z
+} uPositions;
+
+layout( std430, set = 2, binding = 1 ) readonly buffer UAttributes { uvec2 attributes[]; } uAttributes;
+layout( std430, set = 2, binding = 2 ) readonly buffer UIndices { uint indices[]; } uIndices;
+layout( std430, set = 2, binding = 3 ) readonly buffer UInstances { mat4 models[]; } uInstances;
+
+vec3 pull_position( uint aVertex )
+{
+	uint xy = uPositions.positions[2*aVertex+0];
+	uint z = uPositions.positions[2*aVertex+1];
+	return uPositions.origin.xyz + uPositions.scale.xyz * vec3( xy & 0xffffu, xy >> 16, z & 0xffffu );
+}
+
+layout( location = 0 ) out vec3 v2fColor; 
+
+// Positions must match depth_pull.vert exactly for the depth pre-pass
+invariant gl_Position;
+
+void main() 
+{ 
+	uint vertex = uIndices.indices[gl_VertexIndex];
+
+	v2fColor = unpackUnorm4x8( uAttributes.attributes[vertex].x ).rgb;
+
+	gl_Position = uScene.projCam * uInstances.models[gl_InstanceIndex] * vec4( pull_position( vertex ), 1.f ); 
+}
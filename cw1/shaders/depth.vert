@@ -0,0 +1,24 @@
+#version 450 
+
+// Depth pre-pass: positions only, and no fragment shader. The shading pass
+// then draws the same geometry with an equal depth test, so its positions
+// must match exactly (see invariant in default.vert and texture.vert).
+
+layout( location = 0 ) in vec3 iPosition; 
+
+// Per instance (see SceneDescription in scene_file.hpp); uses locations 2-5
+layout( location = 2 ) in mat4 iModel;
+
+layout( set = 0, binding = 0 ) uniform UScene 
+{ 
+	mat4 camera; 
+	mat4 projection; 
+	mat4 projCam; 
+} uScene; 
+
+invariant gl_Position;
+
+void main() 
+{ 
+	gl_Position = uScene.projCam * iModel * vec4( iPosition, 1.f ); 
+}
@@ -0,0 +1,20 @@
+#version 450 
+
+layout( location = 0 ) in vec2 v2fTexCoord;
+layout( location = 1 ) flat in uint v2fLayer;
+
+// The impostor atlas, one layer per building and view
+layout( set = 1, binding = 0 ) uniform sampler2DArray uImpostors;
+
+layout( location = 0 ) out vec4 oColor; 
+
+void main() 
+{ 
+	// Texels outside of the building are transparent black, so filtered
+	// colors are premultiplied by their coverage
+	vec4 color = texture( uImpostors, vec3( v2fTexCoord, float( v2fLayer ) ) );
+	if( color.a < 0.5f )
+		discard;
+
+	oColor = vec4( color.rgb / color.a, 1.f );
+}
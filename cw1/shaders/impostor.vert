@@ -0,0 +1,50 @@
+#version 450 
+
+// Billboard impostors (see impostor.hpp). Each instance is one quad, drawn
+// as two triangles without vertex buffers.
+
+// Per instance (see ImpostorInstance)
+layout( location = 0 ) in vec4 iCenter; // world space; w = half width
+layout( location = 1 ) in vec2 iHeightYaw; // half height, yaw of the model instance
+layout( location = 2 ) in uvec2 iLayers; // first layer, view count
+
+layout( set = 0, binding = 0 ) uniform UScene 
+{ 
+	mat4 camera; 
+	mat4 projection; 
+	mat4 projCam; 
+} uScene; 
+
+layout( location = 0 ) out vec2 v2fTexCoord;
+layout( location = 1 ) flat out uint v2fLayer;
+
+const vec2 kCorners[6] = vec2[](
+	vec2( -1.f, -1.f ), vec2( 1.f, -1.f ), vec2( 1.f, 1.f ),
+	vec2( -1.f, -1.f ), vec2( 1.f, 1.f ), vec2( -1.f, 1.f )
+);
+
+void main() 
+{ 
+	// Camera position, from the (rigid) view transform
+	vec3 eye = -transpose( mat3( uScene.camera ) ) * uScene.camera[3].xyz;
+
+	vec2 toEye = eye.xz - iCenter.xz;
+	toEye = dot( toEye, toEye ) > 1e-8f ? normalize( toEye ) : vec2( 0.f, 1.f );
+
+	// View baked from the direction closest to the camera's. Views were
+	// baked in model space, at angles atan(x, z) = 2 pi view / count.
+	float step = 6.28318530718f / float( iLayers.y );
+	float view = mod( round( (atan( toEye.x, toEye.y ) - iHeightYaw.y) / step ), float( iLayers.y ) );
+	v2fLayer = iLayers.x + min( uint( view ), iLayers.y - 1u );
+
+	// The quad turns about the vertical axis to face the camera; its right
+	// is the baked view's right
+	vec2 corner = kCorners[gl_VertexIndex];
+	vec3 right = vec3( toEye.y, 0.f, -toEye.x );
+	vec3 position = iCenter.xyz + right * (corner.x * iCenter.w) + vec3( 0.f, corner.y * iHeightYaw.x, 0.f );
+
+	// The top of the building is in the first row of its tiles
+	v2fTexCoord = vec2( 0.5f + 0.5f * corner.x, 0.5f - 0.5f * corner.y );
+
+	gl_Position = uScene.projCam * vec4( position, 1.f ); 
+} 
@@ -2,11 +2,18 @@
 
 layout( location = 0 ) in vec2 v2fTexCoord;
 
-layout( set = 1, binding = 0 ) uniform sampler2D uTexColor;
+// Textures are bound as arrays: meshes whose textures share an array (or
+// atlas) are drawn without rebinding, and select their layer per draw
+layout( set = 1, binding = 0 ) uniform sampler2DArray uTexColor;
+
+layout( push_constant ) uniform UTexLayer
+{
+	uint layer;
+} uTexLayer;
 
 layout( location = 0 ) out vec4 oColor; 
 
 void main() 
 { 
-	oColor = vec4( texture( uTexColor, v2fTexCoord ).rgb, 1.f );
-} 
\ No newline at end of file
+	oColor = vec4( texture( uTexColor, vec3( v2fTexCoord, float(uTexLayer.layer) ) ).rgb, 1.f );
+} 
@@ -3,6 +3,9 @@
 layout( location = 0 ) in vec3 iPosition; 
 layout( location = 1 ) in vec2 iTexCoord; 
 
+// Per instance (see SceneDescription in scene_file.hpp); uses locations 2-5
+layout( location = 2 ) in mat4 iModel;
+
 layout( set = 0, binding = 0 ) uniform UScene 
 { 
 	mat4 camera; 
@@ -12,8 +15,11 @@ layout( set = 0, binding = 0 ) uniform UScene
 
 layout( location = 0 ) out vec2 v2fTexCoord;
 
+// Positions must match depth.vert exactly for the depth pre-pass
+invariant gl_Position;
+
 void main() 
 { 
 	v2fTexCoord = iTexCoord;
-	gl_Position = uScene.projCam * vec4( iPosition, 1.f ); 
+	gl_Position = uScene.projCam * iModel * vec4( iPosition, 1.f ); 
 } 
@@ -0,0 +1,750 @@
+#include "soft_occlusion.hpp"
+
+#include <map>
+#include <tuple>
+#include <limits>
+#include <algorithm>
+
+#include <cmath>
+#include <cassert>
+#include <cstddef>
+
+#include "../labutils/parallel.hpp"
+namespace lut = labutils;
+
+#if defined(__AVX2__)
+#	define SOFT_AVX2_ 1
+#	include <immintrin.h>
+#else
+#	define SOFT_AVX2_ 0
+#endif
+
+namespace
+{
+	// Clipping happens against the near plane and a guard band around the
+	// view, which keeps the edge functions' coordinates small enough for
+	// float precision. Polygons beyond the far plane need no clipping; their
+	// depth never goes below the cleared value.
+	constexpr float kGuardBand = 2.f; // times the view's extent
+
+	constexpr std::size_t kMaxClipVertices = kSoftMaxEdges;
+
+	// Polygons per binning job, at least
+	constexpr std::size_t kMinJobPolygons = 512;
+
+	// Polygons are merged if their normals are this close, and their planes
+	// this close together (in metres)
+	constexpr float kMinMergeNormalDot = 0.9999f;
+	constexpr float kMaxMergePlaneDistance = 1e-3f;
+
+	struct MergePolygon_
+	{
+		std::vector<glm::vec3> verts;
+		glm::vec3 normal; // unit length
+		bool alive;
+	};
+
+	struct EdgeKey_
+	{
+		glm::vec3 a, b; // ordered, so that both directions have the same key
+
+		bool operator< ( EdgeKey_ const& aOther ) const noexcept
+		{
+			auto const key = [] (EdgeKey_ const& aKey) {
+				return std::make_tuple( aKey.a.x, aKey.a.y, aKey.a.z, aKey.b.x, aKey.b.y, aKey.b.z );
+			};
+			return key( *this ) < key( aOther );
+		}
+	};
+
+	EdgeKey_ make_edge_key_( glm::vec3 const& aA, glm::vec3 const& aB ) noexcept
+	{
+		bool const less = std::make_tuple( aA.x, aA.y, aA.z ) < std::make_tuple( aB.x, aB.y, aB.z );
+		return less ? EdgeKey_{ aA, aB } : EdgeKey_{ aB, aA };
+	}
+
+	// Removes vertices on a straight line. Returns false if the polygon isn't
+	// convex (around aNormal).
+	bool simplify_convex_( std::vector<glm::vec3>& aVerts, glm::vec3 const& aNormal )
+	{
+		for( std::size_t i = 0; i < aVerts.size() && aVerts.size() > 3; )
+		{
+			glm::vec3 const& prev = aVerts[(i + aVerts.size() - 1) % aVerts.size()];
+			glm::vec3 const& next = aVerts[(i + 1) % aVerts.size()];
+
+			glm::vec3 const in = aVerts[i] - prev, out = next - aVerts[i];
+			float const turn = glm::dot( glm::cross( in, out ), aNormal );
+
+			if( std::abs( turn ) <= 1e-6f * glm::length( in ) * glm::length( out ) )
+				aVerts.erase( aVerts.begin() + std::ptrdiff_t(i) );
+			else if( turn < 0.f )
+				return false;
+			else
+				++i;
+		}
+
+		return aVerts.size() >= 3;
+	}
+
+	// Merges aB into aA along their shared edge aA[i] -> aA[i+1], which aB
+	// has as aB[j+1] -> aB[j]
+	bool try_merge_( MergePolygon_& aA, std::size_t aI, MergePolygon_ const& aB, std::size_t aJ )
+	{
+		if( glm::dot( aA.normal, aB.normal ) < kMinMergeNormalDot )
+			return false;
+
+		if( std::abs( glm::dot( aA.normal, aB.verts[(aJ + 2) % aB.verts.size()] - aA.verts[0] ) ) > kMaxMergePlaneDistance )
+			return false;
+
+		std::size_t const na = aA.verts.size(), nb = aB.verts.size();
+
+		std::vector<glm::vec3> merged;
+		merged.reserve( na + nb - 2 );
+		for( std::size_t k = 0; k < na; ++k )
+			merged.emplace_back( aA.verts[(aI + 1 + k) % na] ); // ends with aA[i]
+		for( std::size_t k = 2; k < nb; ++k )
+			merged.emplace_back( aB.verts[(aJ + k) % nb] );
+
+		if( !simplify_convex_( merged, aA.normal ) || merged.size() > kSoftMaxPolygonVertices )
+			return false;
+
+		aA.verts = std::move(merged);
+		return true;
+	}
+
+	// Clips the polygon against dot(aPlane, v) >= 0, in place
+	std::size_t clip_polygon_( glm::vec4* aVerts, std::size_t aCount, glm::vec4 const& aPlane )
+	{
+		glm::vec4 out[kMaxClipVertices+1];
+		std::size_t count = 0;
+
+		for( std::size_t i = 0; i < aCount; ++i )
+		{
+			glm::vec4 const& a = aVerts[i];
+			glm::vec4 const& b = aVerts[(i+1) % aCount];
+
+			float const da = glm::dot( aPlane, a );
+			float const db = glm::dot( aPlane, b );
+
+			if( da >= 0.f )
+				out[count++] = a;
+
+			if( (da >= 0.f) != (db >= 0.f) )
+				out[count++] = a + (b - a) * (da / (da - db));
+		}
+
+		assert( count <= kMaxClipVertices );
+		std::copy( out, out + count, aVerts );
+		return count;
+	}
+
+	// Returns false if the polygon covers no pixel. aVerts are in pixels,
+	// with depth in z, and form a convex polygon.
+	bool setup_polygon_( SoftPolygon& aPoly, glm::vec3 const* aVerts, std::size_t aCount, std::uint32_t aWidth, std::uint32_t aHeight, bool aConservative )
+	{
+		// Twice the signed area, and the triangle of the largest area for
+		// the depth gradients
+		double area2 = 0.0, best = 0.0;
+		std::size_t bestIndex = 0;
+		for( std::size_t i = 0; i < aCount; ++i )
+		{
+			glm::vec3 const& p = aVerts[i];
+			glm::vec3 const& q = aVerts[(i+1) % aCount];
+			area2 += double(p.x) * double(q.y) - double(q.x) * double(p.y);
+
+			if( i > 0 && i + 1 < aCount )
+			{
+				double const tri = double(p.x - aVerts[0].x) * double(q.y - aVerts[0].y) - double(q.x - aVerts[0].x) * double(p.y - aVerts[0].y);
+				if( std::abs( tri ) > std::abs( best ) )
+				{
+					best = tri;
+					bestIndex = i;
+				}
+			}
+		}
+
+		if( std::abs( area2 ) < 1e-6 || std::abs( best ) < 1e-6 )
+			return false;
+
+		float minX = aVerts[0].x, maxX = aVerts[0].x, minY = aVerts[0].y, maxY = aVerts[0].y;
+		for( std::size_t i = 1; i < aCount; ++i )
+		{
+			minX = std::min( minX, aVerts[i].x );
+			maxX = std::max( maxX, aVerts[i].x );
+			minY = std::min( minY, aVerts[i].y );
+			maxY = std::max( maxY, aVerts[i].y );
+		}
+
+		// Pixels that lie completely inside the bounds, or whose centers do
+		float const inset = aConservative ? 0.f : 0.5f;
+		aPoly.minX = std::max( std::int32_t(std::ceil( minX - inset )), 0 );
+		aPoly.minY = std::max( std::int32_t(std::ceil( minY - inset )), 0 );
+		aPoly.maxX = std::min( std::int32_t(std::floor( maxX + inset )) - 1, std::int32_t(aWidth) - 1 );
+		aPoly.maxY = std::min( std::int32_t(std::floor( maxY + inset )) - 1, std::int32_t(aHeight) - 1 );
+
+		if( aPoly.minX > aPoly.maxX || aPoly.minY > aPoly.maxY )
+			return false;
+
+		// Edge functions, evaluated at pixel centers. Conservatively, at the
+		// pixel's corner that is least inside the edge, so that only pixels
+		// the polygon covers completely pass. Occluders are two-sided, so
+		// clockwise polygons have their edges flipped.
+		double const flip = area2 < 0.0 ? -1.0 : 1.0;
+
+		aPoly.edgeCount = 0;
+		for( std::size_t i = 0; i < aCount; ++i )
+		{
+			glm::vec3 const& p = aVerts[i];
+			glm::vec3 const& q = aVerts[(i+1) % aCount];
+
+			double const a = flip * (double(p.y) - double(q.y));
+			double const b = flip * (double(q.x) - double(p.x));
+			if( 0.0 == a && 0.0 == b )
+				continue;
+
+			double c = flip * (double(p.x) * double(q.y) - double(p.y) * double(q.x));
+
+			c += 0.5 * (a + b);
+			if( aConservative )
+				c -= 0.5 * (std::abs( a ) + std::abs( b ));
+
+			auto const e = aPoly.edgeCount++;
+			aPoly.a[e] = float(a);
+			aPoly.b[e] = float(b);
+			aPoly.c[e] = float(c);
+		}
+
+		// Depth is linear in screen space. The plane is raised to the
+		// farthest vertex, in case the polygon isn't quite flat. It is then
+		// conservatively evaluated at the farthest point within the pixel,
+		// which can't exceed the vertices' depth.
+		glm::vec3 const& v0 = aVerts[0];
+		glm::vec3 const& v1 = aVerts[bestIndex];
+		glm::vec3 const& v2 = aVerts[bestIndex+1];
+
+		double const dzdx = (double(v1.z - v0.z) * double(v2.y - v0.y) - double(v2.z - v0.z) * double(v1.y - v0.y)) / best;
+		double const dzdy = (double(v2.z - v0.z) * double(v1.x - v0.x) - double(v1.z - v0.z) * double(v2.x - v0.x)) / best;
+
+		double z0 = double(v0.z) - dzdx * double(v0.x) - dzdy * double(v0.y);
+
+		double raise = 0.0;
+		float zmax = aVerts[0].z;
+		for( std::size_t i = 0; i < aCount; ++i )
+		{
+			raise = std::max( raise, double(aVerts[i].z) - (z0 + dzdx * double(aVerts[i].x) + dzdy * double(aVerts[i].y)) );
+			zmax = std::max( zmax, aVerts[i].z );
+		}
+
+		z0 += raise + 0.5 * (dzdx + dzdy);
+		if( aConservative )
+			z0 += 0.5 * (std::abs( dzdx ) + std::abs( dzdy ));
+
+		aPoly.z0 = float(z0);
+		aPoly.dzdx = float(dzdx);
+		aPoly.dzdy = float(dzdy);
+		aPoly.zmax = zmax;
+
+		return true;
+	}
+
+	void rasterize_tile_scalar_( float* aTile, std::int32_t aX0, std::int32_t aY0, SoftPolygon const& aPoly )
+	{
+		std::int32_t const x0 = std::max( aPoly.minX, aX0 ), x1 = std::min( aPoly.maxX, aX0 + std::int32_t(kSoftTileWidth) - 1 );
+		std::int32_t const y0 = std::max( aPoly.minY, aY0 ), y1 = std::min( aPoly.maxY, aY0 + std::int32_t(kSoftTileHeight) - 1 );
+
+		for( std::int32_t y = y0; y <= y1; ++y )
+		{
+			float* row = aTile + (y - aY0) * kSoftTileWidth;
+			float const fy = float(y);
+
+			for( std::int32_t x = x0; x <= x1; ++x )
+			{
+				float const fx = float(x);
+
+				bool inside = true;
+				for( std::uint32_t i = 0; i < aPoly.edgeCount; ++i )
+					inside = inside && aPoly.a[i] * fx + aPoly.b[i] * fy + aPoly.c[i] >= 0.f;
+
+				if( !inside )
+					continue;
+
+				float const z = std::min( aPoly.z0 + aPoly.dzdx * fx + aPoly.dzdy * fy, aPoly.zmax );
+				row[x - aX0] = std::min( row[x - aX0], z );
+			}
+		}
+	}
+
+#	if SOFT_AVX2_
+	void rasterize_tile_avx2_( float* aTile, std::int32_t aX0, std::int32_t aY0, SoftPolygon const& aPoly )
+	{
+		std::int32_t const x0 = std::max( aPoly.minX, aX0 ), x1 = std::min( aPoly.maxX, aX0 + std::int32_t(kSoftTileWidth) - 1 );
+		std::int32_t const y0 = std::max( aPoly.minY, aY0 ), y1 = std::min( aPoly.maxY, aY0 + std::int32_t(kSoftTileHeight) - 1 );
+
+		// Blocks of eight pixels, aligned to the tile. Pixels outside of the
+		// polygon's bounds fail the edge tests.
+		std::int32_t const bx0 = (x0 - aX0) & ~7, bx1 = x1 - aX0;
+
+		__m256 const lanes = _mm256_setr_ps( 0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f );
+		__m256 const zero = _mm256_setzero_ps();
+		__m256 const zmax = _mm256_set1_ps( aPoly.zmax );
+		__m256 const dzdx = _mm256_set1_ps( aPoly.dzdx );
+
+		__m256 a[kSoftMaxEdges], c[kSoftMaxEdges];
+		for( std::uint32_t i = 0; i < aPoly.edgeCount; ++i )
+			a[i] = _mm256_set1_ps( aPoly.a[i] );
+
+		for( std::int32_t y = y0; y <= y1; ++y )
+		{
+			float* row = aTile + (y - aY0) * kSoftTileWidth;
+			float const fy = float(y);
+
+			for( std::uint32_t i = 0; i < aPoly.edgeCount; ++i )
+				c[i] = _mm256_set1_ps( aPoly.b[i] * fy + aPoly.c[i] );
+
+			__m256 const zrow = _mm256_set1_ps( aPoly.z0 + aPoly.dzdy * fy );
+
+			for( std::int32_t bx = bx0; bx <= bx1; bx += 8 )
+			{
+				__m256 const fx = _mm256_add_ps( _mm256_set1_ps( float(aX0 + bx) ), lanes );
+
+				__m256 inside = _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) );
+				for( std::uint32_t i = 0; i < aPoly.edgeCount; ++i )
+				{
+					__m256 const e = _mm256_add_ps( _mm256_mul_ps( a[i], fx ), c[i] );
+					inside = _mm256_and_ps( inside, _mm256_cmp_ps( e, zero, _CMP_GE_OQ ) );
+				}
+
+				if( 0 == _mm256_movemask_ps( inside ) )
+					continue;
+
+				__m256 const z = _mm256_min_ps( _mm256_add_ps( _mm256_mul_ps( dzdx, fx ), zrow ), zmax );
+				__m256 const d = _mm256_loadu_ps( row + bx );
+				_mm256_storeu_ps( row + bx, _mm256_blendv_ps( d, _mm256_min_ps( d, z ), inside ) );
+			}
+		}
+	}
+#	endif // ~ AVX2
+
+	// True if any pixel in the rectangle (inclusive, within the tile) is at
+	// or behind aDepth
+	bool any_visible_scalar_( float const* aTile, std::int32_t aX0, std::int32_t aY0, std::int32_t aX1, std::int32_t aY1, float aDepth )
+	{
+		for( std::int32_t y = aY0; y <= aY1; ++y )
+		{
+			float const* row = aTile + y * kSoftTileWidth;
+			for( std::int32_t x = aX0; x <= aX1; ++x )
+			{
+				if( row[x] >= aDepth )
+					return true;
+			}
+		}
+
+		return false;
+	}
+
+#	if SOFT_AVX2_
+	bool any_visible_avx2_( float const* aTile, std::int32_t aX0, std::int32_t aY0, std::int32_t aX1, std::int32_t aY1, float aDepth )
+	{
+		__m256i const lanes = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+		__m256 const depth = _mm256_set1_ps( aDepth );
+
+		std::int32_t const bx0 = aX0 & ~7;
+		for( std::int32_t bx = bx0; bx <= aX1; bx += 8 )
+		{
+			// Lanes within [aX0, aX1]
+			__m256i const x = _mm256_add_epi32( _mm256_set1_epi32( bx ), lanes );
+			__m256i const outside = _mm256_or_si256(
+				_mm256_cmpgt_epi32( _mm256_set1_epi32( aX0 ), x ),
+				_mm256_cmpgt_epi32( x, _mm256_set1_epi32( aX1 ) )
+			);
+			__m256 const mask = _mm256_castsi256_ps( _mm256_andnot_si256( outside, _mm256_set1_epi32( -1 ) ) );
+
+			for( std::int32_t y = aY0; y <= aY1; ++y )
+			{
+				__m256 const d = _mm256_loadu_ps( aTile + y * kSoftTileWidth + bx );
+				if( 0 != _mm256_movemask_ps( _mm256_and_ps( _mm256_cmp_ps( d, depth, _CMP_GE_OQ ), mask ) ) )
+					return true;
+			}
+		}
+
+		return false;
+	}
+#	endif // ~ AVX2
+}
+
+std::size_t append_soft_occluders( SoftOccluders& aOccluders, ModelData const& aModel, glm::mat4 const& aTransform, float aMinArea )
+{
+	// Triangles, in world space. Shared vertices are bit-for-bit identical.
+	std::vector<MergePolygon_> polys;
+	for( auto const& mesh : aModel.meshes )
+	{
+		auto const* positions = aModel.vertexPositions.data() + mesh.vertexStartIndex;
+		for( std::size_t i = 0; i + 2 < mesh.numberOfVertices; i += 3 )
+		{
+			MergePolygon_ poly;
+			for( std::size_t j = 0; j < 3; ++j )
+				poly.verts.emplace_back( glm::vec3( aTransform * glm::vec4( positions[i+j], 1.f ) ) );
+
+			glm::vec3 const n = glm::cross( poly.verts[1] - poly.verts[0], poly.verts[2] - poly.verts[0] );
+			float const len = glm::length( n );
+			if( len <= 0.f )
+				continue;
+
+			poly.normal = n / len;
+			poly.alive = true;
+			polys.emplace_back( std::move(poly) );
+		}
+	}
+
+	// Merge neighbours until nothing changes. Each pass merges a polygon at
+	// most once, since its edges change.
+	for( bool changed = true; changed; )
+	{
+		changed = false;
+
+		std::map<EdgeKey_, std::vector<std::pair<std::uint32_t, std::uint32_t>>> edges; // polygon, edge
+		for( std::size_t p = 0; p < polys.size(); ++p )
+		{
+			if( !polys[p].alive )
+				continue;
+
+			auto const& verts = polys[p].verts;
+			for( std::size_t i = 0; i < verts.size(); ++i )
+				edges[make_edge_key_( verts[i], verts[(i+1) % verts.size()] )].emplace_back( std::uint32_t(p), std::uint32_t(i) );
+		}
+
+		std::vector<bool> touched( polys.size(), false );
+		for( auto const& [key, users] : edges )
+		{
+			if( 2 != users.size() )
+				continue;
+
+			auto const [p, i] = users[0];
+			auto const [q, j] = users[1];
+			if( p == q || touched[p] || touched[q] )
+				continue;
+
+			// The shared edge must run in opposite directions (same winding)
+			auto const& a = polys[p].verts;
+			auto const& b = polys[q].verts;
+			if( a[i] != b[(j+1) % b.size()] )
+				continue;
+
+			if( try_merge_( polys[p], i, polys[q], j ) )
+			{
+				polys[q].alive = false;
+				touched[p] = touched[q] = true;
+				changed = true;
+			}
+		}
+	}
+
+	std::size_t added = 0;
+	for( auto const& poly : polys )
+	{
+		if( !poly.alive )
+			continue;
+
+		glm::vec3 sum( 0.f );
+		for( std::size_t i = 1; i + 1 < poly.verts.size(); ++i )
+			sum += glm::cross( poly.verts[i] - poly.verts[0], poly.verts[i+1] - poly.verts[0] );
+
+		if( 0.5f * glm::length( sum ) < aMinArea )
+			continue;
+
+		aOccluders.polygons.emplace_back( std::uint32_t(aOccluders.vertices.size()) );
+		aOccluders.vertices.insert( aOccluders.vertices.end(), poly.verts.begin(), poly.verts.end() );
+		++added;
+	}
+
+	return added;
+}
+
+std::vector<SoftBox> compute_mesh_boxes( ModelData const& aModel )
+{
+	std::vector<SoftBox> ret;
+	ret.reserve( aModel.meshes.size() );
+
+	for( auto const& mesh : aModel.meshes )
+	{
+		SoftBox box{ glm::vec3( std::numeric_limits<float>::max() ), glm::vec3( -std::numeric_limits<float>::max() ) };
+
+		auto const* positions = aModel.vertexPositions.data() + mesh.vertexStartIndex;
+		for( std::size_t i = 0; i < mesh.numberOfVertices; ++i )
+		{
+			box.min = glm::min( box.min, positions[i] );
+			box.max = glm::max( box.max, positions[i] );
+		}
+
+		if( 0 == mesh.numberOfVertices )
+			box = SoftBox{ glm::vec3( 0.f ), glm::vec3( 0.f ) };
+
+		ret.emplace_back( box );
+	}
+
+	return ret;
+}
+
+SoftDepthBuffer create_soft_depth_buffer( std::uint32_t aWidth, std::uint32_t aHeight )
+{
+	SoftDepthBuffer ret;
+	ret.tilesX = std::max( (aWidth + kSoftTileWidth - 1) / kSoftTileWidth, 1u );
+	ret.tilesY = std::max( (aHeight + kSoftTileHeight - 1) / kSoftTileHeight, 1u );
+	ret.width = ret.tilesX * kSoftTileWidth;
+	ret.height = ret.tilesY * kSoftTileHeight;
+
+	ret.depth.assign( std::size_t(ret.width) * ret.height, 1.f );
+	ret.tileMax.assign( std::size_t(ret.tilesX) * ret.tilesY, 1.f );
+
+	return ret;
+}
+
+SoftRasterStats& SoftRasterStats::operator+= ( SoftRasterStats const& aOther ) noexcept
+{
+	polygons += aOther.polygons;
+	rasterized += aOther.rasterized;
+	binned += aOther.binned;
+	return *this;
+}
+
+SoftRasterStats rasterize_soft_occluders( SoftDepthBuffer& aBuffer, SoftOccluders const& aOccluders, glm::mat4 const& aProjCam, SoftRasterOptions const& aOptions )
+{
+	std::size_t const polygonCount = aOccluders.polygon_count();
+	std::size_t const tileCount = std::size_t(aBuffer.tilesX) * aBuffer.tilesY;
+
+	std::uint32_t const threads = 0 != aOptions.threadCount ? aOptions.threadCount : lut::default_thread_count();
+	if( aBuffer.workers.thread_count() != threads )
+		aBuffer.workers = lut::create_worker_pool( threads );
+
+	// Binning jobs have a fixed range of polygons each, so that tiles see
+	// the polygons in the same order regardless of the thread count
+	std::size_t const jobs = std::clamp<std::size_t>( polygonCount / kMinJobPolygons, 1, 4 * std::size_t(threads) );
+	std::size_t const grain = std::max<std::size_t>( (polygonCount + jobs - 1) / jobs, 1 );
+
+	aBuffer.polygons.resize( jobs );
+	aBuffer.bins.resize( jobs * tileCount );
+
+	for( auto& polys : aBuffer.polygons )
+		polys.clear();
+	for( auto& bin : aBuffer.bins )
+		bin.clear();
+
+	float const width = float(aBuffer.width), height = float(aBuffer.height);
+
+	glm::vec4 const planes[] = {
+		glm::vec4( 0.f, 0.f, 1.f, 0.f ), // near
+		glm::vec4( 1.f, 0.f, 0.f, kGuardBand ),
+		glm::vec4( -1.f, 0.f, 0.f, kGuardBand ),
+		glm::vec4( 0.f, 1.f, 0.f, kGuardBand ),
+		glm::vec4( 0.f, -1.f, 0.f, kGuardBand )
+	};
+
+	// Transform, clip, set up and bin
+	aBuffer.workers.parallel_for( polygonCount, [&] (std::size_t aBegin, std::size_t aEnd) {
+		std::size_t const job = aBegin / grain;
+		auto& polys = aBuffer.polygons[job];
+		auto* bins = aBuffer.bins.data() + job * tileCount;
+
+		for( std::size_t p = aBegin; p < aEnd; ++p )
+		{
+			std::size_t const first = aOccluders.polygons[p];
+			std::size_t const last = p + 1 < polygonCount ? aOccluders.polygons[p+1] : aOccluders.vertices.size();
+
+			glm::vec3 const* src = aOccluders.vertices.data() + first;
+			std::size_t count = last - first;
+			assert( count >= 3 && count <= kSoftMaxPolygonVertices );
+
+			glm::vec4 verts[kMaxClipVertices];
+			for( std::size_t i = 0; i < count; ++i )
+				verts[i] = aProjCam * glm::vec4( src[i], 1.f );
+
+			// Trivially outside of one of the planes?
+			bool rejected = false;
+			bool clipped = false;
+			for( auto const& plane : planes )
+			{
+				std::size_t outside = 0;
+				for( std::size_t i = 0; i < count; ++i )
+					outside += glm::dot( plane, verts[i] ) < 0.f ? 1 : 0;
+
+				rejected = rejected || count == outside;
+				clipped = clipped || 0 != outside;
+			}
+
+			if( rejected )
+				continue;
+
+			if( clipped )
+			{
+				for( auto const& plane : planes )
+				{
+					count = clip_polygon_( verts, count, plane );
+					if( count < 3 )
+						break;
+				}
+			}
+
+			if( count < 3 )
+				continue;
+
+			glm::vec3 screen[kMaxClipVertices];
+			for( std::size_t i = 0; i < count; ++i )
+			{
+				float const rw = 1.f / verts[i].w;
+				screen[i] = glm::vec3( (verts[i].x * rw * 0.5f + 0.5f) * width, (verts[i].y * rw * 0.5f + 0.5f) * height, verts[i].z * rw );
+			}
+
+			SoftPolygon poly;
+			if( !setup_polygon_( poly, screen, count, aBuffer.width, aBuffer.height, aOptions.conservative ) )
+				continue;
+
+			auto const index = std::uint32_t(polys.size());
+			polys.emplace_back( poly );
+
+			for( std::int32_t ty = poly.minY / std::int32_t(kSoftTileHeight); ty <= poly.maxY / std::int32_t(kSoftTileHeight); ++ty )
+			{
+				for( std::int32_t tx = poly.minX / std::int32_t(kSoftTileWidth); tx <= poly.maxX / std::int32_t(kSoftTileWidth); ++tx )
+					bins[ty * aBuffer.tilesX + tx].emplace_back( index );
+			}
+		}
+	}, grain );
+
+	// Rasterize each tile
+	aBuffer.workers.parallel_for( tileCount, [&] (std::size_t aBegin, std::size_t aEnd) {
+		for( std::size_t tile = aBegin; tile < aEnd; ++tile )
+		{
+			float* depth = aBuffer.depth.data() + tile * kSoftTileWidth * kSoftTileHeight;
+			std::fill_n( depth, kSoftTileWidth * kSoftTileHeight, 1.f );
+
+			auto const x0 = std::int32_t((tile % aBuffer.tilesX) * kSoftTileWidth);
+			auto const y0 = std::int32_t((tile / aBuffer.tilesX) * kSoftTileHeight);
+
+			for( std::size_t job = 0; job < jobs; ++job )
+			{
+				auto const& polys = aBuffer.polygons[job];
+				for( auto const index : aBuffer.bins[job * tileCount + tile] )
+				{
+#					if SOFT_AVX2_
+					if( aOptions.simd )
+					{
+						rasterize_tile_avx2_( depth, x0, y0, polys[index] );
+						continue;
+					}
+#					endif // ~ AVX2
+
+					rasterize_tile_scalar_( depth, x0, y0, polys[index] );
+				}
+			}
+
+			aBuffer.tileMax[tile] = *std::max_element( depth, depth + kSoftTileWidth * kSoftTileHeight );
+		}
+	}, 1 );
+
+	SoftRasterStats stats;
+	stats.polygons = polygonCount;
+	for( auto const& polys : aBuffer.polygons )
+		stats.rasterized += polys.size();
+	for( auto const& bin : aBuffer.bins )
+		stats.binned += bin.size();
+
+	return stats;
+}
+
+SoftVisibility test_soft_box( SoftDepthBuffer const& aBuffer, glm::mat4 const& aProjCamModel, SoftBox const& aBox, bool aSimd )
+{
+	// Outside of a frustum plane if all corners are
+	int outside[6]{};
+	bool crossesNear = false;
+
+	float minX = std::numeric_limits<float>::max(), maxX = -minX;
+	float minY = minX, maxY = -minX;
+	float nearest = minX;
+
+	for( int i = 0; i < 8; ++i )
+	{
+		glm::vec3 const corner(
+			(i & 1) ? aBox.max.x : aBox.min.x,
+			(i & 2) ? aBox.max.y : aBox.min.y,
+			(i & 4) ? aBox.max.z : aBox.min.z
+		);
+
+		glm::vec4 const clip = aProjCamModel * glm::vec4( corner, 1.f );
+
+		outside[0] += clip.x < -clip.w ? 1 : 0;
+		outside[1] += clip.x > clip.w ? 1 : 0;
+		outside[2] += clip.y < -clip.w ? 1 : 0;
+		outside[3] += clip.y > clip.w ? 1 : 0;
+		outside[4] += clip.z < 0.f ? 1 : 0;
+		outside[5] += clip.z > clip.w ? 1 : 0;
+
+		if( clip.z < 0.f )
+		{
+			crossesNear = true;
+			continue;
+		}
+
+		float const rw = 1.f / clip.w;
+		minX = std::min( minX, clip.x * rw );
+		maxX = std::max( maxX, clip.x * rw );
+		minY = std::min( minY, clip.y * rw );
+		maxY = std::max( maxY, clip.y * rw );
+		nearest = std::min( nearest, clip.z * rw );
+	}
+
+	for( auto const count : outside )
+	{
+		if( 8 == count )
+			return SoftVisibility::outside;
+	}
+
+	if( crossesNear )
+		return SoftVisibility::visible;
+
+	// Pixels touched by the bounds
+	float const width = float(aBuffer.width), height = float(aBuffer.height);
+	std::int32_t const x0 = std::max( std::int32_t(std::floor( (minX * 0.5f + 0.5f) * width )), 0 );
+	std::int32_t const y0 = std::max( std::int32_t(std::floor( (minY * 0.5f + 0.5f) * height )), 0 );
+	std::int32_t const x1 = std::min( std::int32_t(std::floor( (maxX * 0.5f + 0.5f) * width )), std::int32_t(aBuffer.width) - 1 );
+	std::int32_t const y1 = std::min( std::int32_t(std::floor( (maxY * 0.5f + 0.5f) * height )), std::int32_t(aBuffer.height) - 1 );
+
+	if( x0 > x1 || y0 > y1 )
+		return SoftVisibility::outside;
+
+	auto const tw = std::int32_t(kSoftTileWidth), th = std::int32_t(kSoftTileHeight);
+	for( std::int32_t ty = y0 / th; ty <= y1 / th; ++ty )
+	{
+		for( std::int32_t tx = x0 / tw; tx <= x1 / tw; ++tx )
+		{
+			std::size_t const tile = std::size_t(ty) * aBuffer.tilesX + tx;
+			if( aBuffer.tileMax[tile] < nearest )
+				continue;
+
+			float const* depth = aBuffer.depth.data() + tile * kSoftTileWidth * kSoftTileHeight;
+
+			std::int32_t const rx0 = std::max( x0 - tx * tw, 0 ), rx1 = std::min( x1 - tx * tw, tw - 1 );
+			std::int32_t const ry0 = std::max( y0 - ty * th, 0 ), ry1 = std::min( y1 - ty * th, th - 1 );
+
+			bool visible;
+#			if SOFT_AVX2_
+			if( aSimd )
+				visible = any_visible_avx2_( depth, rx0, ry0, rx1, ry1, nearest );
+			else
+#			endif // ~ AVX2
+				visible = any_visible_scalar_( depth, rx0, ry0, rx1, ry1, nearest );
+
+			if( visible )
+				return SoftVisibility::visible;
+		}
+	}
+
+	return SoftVisibility::occluded;
+}
+
+char const* soft_occlusion_isa() noexcept
+{
+#	if SOFT_AVX2_
+	return "avx2";
+#	else
+	return "scalar";
+#	endif
+}
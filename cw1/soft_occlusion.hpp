@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "model.hpp"
+
+#include "../labutils/parallel.hpp"
+
+/* Software occlusion culling on the CPU (see --soft-occlusion in main.cpp),
+ * which needs no GPU support and no readback.
+ *
+ * A small set of large occluders (the biggest polygons of the city, such as
+ * building walls and roofs) is rasterized into a low resolution depth
+ * buffer. Bounding boxes of mesh instances are then tested against it before
+ * their draws are recorded.
+ *
+ * The buffer is split into tiles of kSoftTileWidth x kSoftTileHeight pixels.
+ * Polygons are transformed, clipped and binned to the tiles they overlap in
+ * parallel, and the tiles are then rasterized in parallel, each by one
+ * thread. The threads are kept with the depth buffer between frames (see
+ * labutils::WorkerPool). With AVX2, eight pixels of a row are rasterized and
+ * tested at once.
+ *
+ * Rasterization is conservative for culling: a pixel is only written if the
+ * polygon covers all of it, and then with the farthest depth of the polygon
+ * within the pixel. A box is occluded if the nearest depth of its corners is
+ * behind the depth of every pixel its screen space bounds touch, so a box is
+ * never culled unless the occluders hide it completely. Boxes that cross the
+ * near plane are always visible.
+ *
+ * Pixels along the shared edge of two polygons are covered by neither, so
+ * neighbouring triangles that lie in the same plane are first merged into
+ * larger convex polygons (of up to kSoftMaxPolygonVertices vertices).
+ * Otherwise, walls that are made of many small quads would be full of gaps.
+ *
+ * Depth follows the projection (0 at the near plane, 1 at the far plane,
+ * see glm::perspectiveRH_ZO()).
+ */
+constexpr std::uint32_t kSoftTileWidth = 32; // multiple of 8
+constexpr std::uint32_t kSoftTileHeight = 16;
+
+constexpr std::uint32_t kSoftMaxPolygonVertices = 8;
+
+// Occluder polygons (convex), in world space
+struct SoftOccluders
+{
+	std::vector<glm::vec3> vertices;
+	std::vector<std::uint32_t> polygons; // first vertex of each
+
+	std::size_t polygon_count() const noexcept { return polygons.size(); }
+};
+
+// Appends the polygons of aModel, as placed by aTransform, whose area is at
+// least aMinArea (in world space), after merging its triangles. Returns the
+// number of polygons added.
+std::size_t append_soft_occluders( SoftOccluders&, ModelData const&, glm::mat4 const& aTransform, float aMinArea );
+
+// Axis-aligned bounding box of a mesh, in model space
+struct SoftBox
+{
+	glm::vec3 min, max;
+};
+
+// One box per mesh of aModel
+std::vector<SoftBox> compute_mesh_boxes( ModelData const& );
+
+
+// Edges of a clipped polygon, at most
+constexpr std::uint32_t kSoftMaxEdges = kSoftMaxPolygonVertices + 5;
+
+// A convex polygon set up for rasterization (see rasterize_soft_occluders()).
+// Pixel x,y is covered if all edge functions a*x + b*y + c are non-negative,
+// and then gets the depth min(z0 + dzdx*x + dzdy*y, zmax).
+struct SoftPolygon
+{
+	std::uint32_t edgeCount;
+	float a[kSoftMaxEdges], b[kSoftMaxEdges], c[kSoftMaxEdges];
+	float z0, dzdx, dzdy, zmax;
+	std::int32_t minX, minY, maxX, maxY; // candidate pixels, inclusive
+};
+
+struct SoftDepthBuffer
+{
+	std::uint32_t width = 0, height = 0; // pixels, multiples of the tile size
+	std::uint32_t tilesX = 0, tilesY = 0;
+
+	// Tile by tile, rows of kSoftTileWidth pixels within each tile
+	std::vector<float> depth;
+
+	// Farthest depth of each tile, for quick tests
+	std::vector<float> tileMax;
+
+	// Scratch space of the rasterizer, kept between frames
+	std::vector<std::vector<SoftPolygon>> polygons; // per binning job
+	std::vector<std::vector<std::uint32_t>> bins; // per binning job and tile
+
+	// Started by the first rasterize_soft_occluders(), and again whenever
+	// the thread count changes
+	labutils::WorkerPool workers;
+};
+
+// The size is rounded up to whole tiles
+SoftDepthBuffer create_soft_depth_buffer( std::uint32_t aWidth, std::uint32_t aHeight );
+
+struct SoftRasterOptions
+{
+	std::uint32_t threadCount = 0; // zero: labutils::default_thread_count()
+	bool simd = true; // use AVX2 where compiled in, see soft_occlusion_isa()
+
+	// Sample pixel centers instead, as a GPU would. Not safe for culling,
+	// but used as the reference in the benchmark.
+	bool conservative = true;
+};
+
+struct SoftRasterStats
+{
+	std::uint64_t polygons = 0; // submitted
+	std::uint64_t rasterized = 0; // that cover any pixel
+	std::uint64_t binned = 0; // polygon and tile pairs
+
+	SoftRasterStats& operator+= ( SoftRasterStats const& ) noexcept;
+};
+
+// Clears aBuffer, and rasterizes aOccluders as seen through aProjCam
+SoftRasterStats rasterize_soft_occluders( SoftDepthBuffer&, SoftOccluders const&, glm::mat4 const& aProjCam, SoftRasterOptions const& = SoftRasterOptions{} );
+
+enum class SoftVisibility
+{
+	visible,
+	occluded,
+	outside // of the view frustum
+};
+
+// Tests the box aBox, in model space, with aProjCamModel = projection *
+// camera * model
+SoftVisibility test_soft_box( SoftDepthBuffer const&, glm::mat4 const& aProjCamModel, SoftBox const& aBox, bool aSimd = true );
+
+// "avx2" or "scalar", depending on which code path was compiled in
+char const* soft_occlusion_isa() noexcept;
@@ -0,0 +1,237 @@
+#include "soft_occlusion_benchmark.hpp"
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "benchmark.hpp"
+#include "soft_occlusion.hpp"
+
+#include "../labutils/trace.hpp"
+#include "../labutils/parallel.hpp"
+namespace lut = labutils;
+
+namespace
+{
+	constexpr std::size_t kViews = 16; // along the default camera path
+	constexpr std::size_t kFramesPerView = 8;
+
+	constexpr std::uint32_t kReferenceScale = 4;
+
+	// Car-sized boxes, on a grid over the city
+	constexpr int kGridSize = 24;
+	constexpr float kGridExtent = 45.f; // half, in metres
+	glm::vec3 const kCarExtent( 1.f, 0.75f, 2.f ); // half
+
+	// As in main.cpp
+	constexpr float kFovY = 1.0471976f; // 60 degrees
+	constexpr float kAspect = 16.f / 9.f;
+	constexpr float kNear = 0.1f, kFar = 100.f;
+
+	struct Box_
+	{
+		glm::mat4 model;
+		SoftBox box;
+	};
+
+	std::vector<glm::mat4> make_views_()
+	{
+		CameraPath const path = make_default_camera_path();
+
+		glm::mat4 projection = glm::perspectiveRH_ZO( kFovY, kAspect, kNear, kFar );
+		projection[1][1] *= -1.f;
+
+		std::vector<glm::mat4> ret;
+		for( std::size_t i = 0; i < kViews; ++i )
+		{
+			auto const key = path.sample( path.duration() * float(i) / float(kViews - 1) );
+
+			glm::vec3 const dir( std::cos( key.pitch ) * std::sin( key.yaw ), std::sin( key.pitch ), std::cos( key.pitch ) * std::cos( key.yaw ) );
+			ret.emplace_back( projection * glm::lookAt( key.position, key.position + dir, glm::vec3( 0.f, 1.f, 0.f ) ) );
+		}
+
+		return ret;
+	}
+
+	std::vector<Box_> make_boxes_( ModelData const& aCity )
+	{
+		std::vector<Box_> ret;
+		for( auto const& box : compute_mesh_boxes( aCity ) )
+			ret.emplace_back( Box_{ glm::mat4( 1.f ), box } );
+
+		for( int z = 0; z < kGridSize; ++z )
+		{
+			for( int x = 0; x < kGridSize; ++x )
+			{
+				glm::vec3 const pos(
+					-kGridExtent + 2.f * kGridExtent * float(x) / float(kGridSize - 1),
+					kCarExtent.y,
+					-kGridExtent + 2.f * kGridExtent * float(z) / float(kGridSize - 1)
+				);
+				ret.emplace_back( Box_{ glm::translate( glm::mat4( 1.f ), pos ), SoftBox{ -kCarExtent, kCarExtent } } );
+			}
+		}
+
+		return ret;
+	}
+
+	struct Counts_
+	{
+		std::size_t inside = 0, occluded = 0;
+	};
+
+	Counts_ test_boxes_( SoftDepthBuffer const& aBuffer, glm::mat4 const& aProjCam, std::vector<Box_> const& aBoxes, bool aSimd, std::vector<SoftVisibility>* aOut = nullptr )
+	{
+		Counts_ ret;
+		for( auto const& box : aBoxes )
+		{
+			auto const vis = test_soft_box( aBuffer, aProjCam * box.model, box.box, aSimd );
+			ret.inside += SoftVisibility::outside != vis ? 1 : 0;
+			ret.occluded += SoftVisibility::occluded == vis ? 1 : 0;
+
+			if( aOut )
+				aOut->emplace_back( vis );
+		}
+
+		return ret;
+	}
+
+	void measure_throughput_( SoftOccluders const& aOccluders, std::vector<glm::mat4> const& aViews, std::vector<Box_> const& aBoxes, SoftDepthBuffer& aBuffer, bool aSimd, std::uint32_t aThreads )
+	{
+		using Clock_ = std::chrono::steady_clock;
+
+		SoftRasterOptions options;
+		options.threadCount = aThreads;
+		options.simd = aSimd;
+
+		// Starts the buffer's worker threads outside of the timings
+		rasterize_soft_occluders( aBuffer, aOccluders, aViews[0], options );
+
+		std::vector<double> raster, test;
+		std::uint64_t binned = 0;
+
+		for( std::size_t frame = 0; frame < kViews * kFramesPerView; ++frame )
+		{
+			auto const& view = aViews[frame % kViews];
+
+			auto const start = Clock_::now();
+			binned += rasterize_soft_occluders( aBuffer, aOccluders, view, options ).binned;
+			auto const mid = Clock_::now();
+			test_boxes_( aBuffer, view, aBoxes, aSimd );
+			auto const end = Clock_::now();
+
+			raster.emplace_back( std::chrono::duration<double, std::milli>( mid - start ).count() );
+			test.emplace_back( std::chrono::duration<double, std::milli>( end - mid ).count() );
+		}
+
+		auto const rs = compute_timing_stats( std::move(raster) );
+		auto const ts = compute_timing_stats( std::move(test) );
+
+		double const mpolys = rs.p50 > 0.0 ? double(aOccluders.polygon_count()) / (rs.p50 * 1000.0) : 0.0;
+		double const mboxes = ts.p50 > 0.0 ? double(aBoxes.size()) / (ts.p50 * 1000.0) : 0.0;
+
+		std::printf( "  %-8s %7u %10.3f %10.3f %10.1f %10.3f %10.1f %9.1f\n", aSimd ? soft_occlusion_isa() : "scalar", aThreads, rs.p50, rs.p95, mpolys, ts.p50, mboxes, double(binned) / double(kViews * kFramesPerView) );
+	}
+}
+
+void run_soft_occlusion_benchmark( ModelData const& aCity, float aMinArea, std::uint32_t aWidth, std::uint32_t aHeight )
+{
+	LUT_TRACE_SCOPE( "run_soft_occlusion_benchmark" );
+
+	SoftOccluders occluders;
+	append_soft_occluders( occluders, aCity, glm::mat4( 1.f ), aMinArea );
+
+	auto const views = make_views_();
+	auto const boxes = make_boxes_( aCity );
+
+	SoftDepthBuffer buffer = create_soft_depth_buffer( aWidth, aHeight );
+
+	std::printf( "Software occlusion benchmark, %zu occluder polygons (area >= %.1f), %zu boxes, %ux%u pixels, %zu views (%s):\n", occluders.polygon_count(), aMinArea, boxes.size(), buffer.width, buffer.height, kViews, soft_occlusion_isa() );
+
+	// Throughput
+	std::vector<std::uint32_t> threadCounts{ 1, 2, 4, lut::default_thread_count() };
+	std::sort( threadCounts.begin(), threadCounts.end() );
+	threadCounts.erase( std::unique( threadCounts.begin(), threadCounts.end() ), threadCounts.end() );
+
+	std::printf( "  %-8s %7s %10s %10s %10s %10s %10s %9s\n", "path", "threads", "p50 ms", "p95 ms", "Mpolys/s", "test ms", "Mboxes/s", "binned" );
+
+	std::vector<bool> paths{ false };
+	if( 0 != std::strcmp( soft_occlusion_isa(), "scalar" ) )
+		paths.emplace_back( true );
+
+	for( bool const simd : paths )
+	{
+		for( auto const threads : threadCounts )
+			measure_throughput_( occluders, views, boxes, buffer, simd, threads );
+	}
+
+	// The code paths must agree (up to rounding)
+	if( paths.size() > 1 )
+	{
+		SoftDepthBuffer scalar = create_soft_depth_buffer( aWidth, aHeight );
+
+		SoftRasterOptions scalarOptions;
+		scalarOptions.simd = false;
+
+		float maxDifference = 0.f;
+		std::size_t mismatches = 0;
+		for( auto const& view : views )
+		{
+			rasterize_soft_occluders( buffer, occluders, view );
+			rasterize_soft_occluders( scalar, occluders, view, scalarOptions );
+
+			for( std::size_t i = 0; i < buffer.depth.size(); ++i )
+				maxDifference = std::max( maxDifference, std::abs( buffer.depth[i] - scalar.depth[i] ) );
+
+			std::vector<SoftVisibility> a, b;
+			test_boxes_( buffer, view, boxes, true, &a );
+			test_boxes_( scalar, view, boxes, false, &b );
+			for( std::size_t i = 0; i < a.size(); ++i )
+				mismatches += a[i] != b[i] ? 1 : 0;
+		}
+
+		std::printf( "  %s vs scalar: max depth difference %g, %zu different box results\n", soft_occlusion_isa(), double(maxDifference), mismatches );
+	}
+
+	// Accuracy
+	SoftDepthBuffer reference = create_soft_depth_buffer( buffer.width * kReferenceScale, buffer.height * kReferenceScale );
+
+	SoftRasterOptions referenceOptions;
+	referenceOptions.conservative = false;
+
+	std::printf( "  %-6s %8s %10s %10s %8s %8s\n", "view", "in view", "culled", "reference", "found", "wrong" );
+
+	Counts_ total, totalReference;
+	std::size_t totalWrong = 0;
+	for( std::size_t v = 0; v < views.size(); ++v )
+	{
+		rasterize_soft_occluders( buffer, occluders, views[v] );
+		rasterize_soft_occluders( reference, occluders, views[v], referenceOptions );
+
+		std::vector<SoftVisibility> culled, expected;
+		auto const counts = test_boxes_( buffer, views[v], boxes, true, &culled );
+		auto const refCounts = test_boxes_( reference, views[v], boxes, true, &expected );
+
+		std::size_t wrong = 0;
+		for( std::size_t i = 0; i < culled.size(); ++i )
+			wrong += SoftVisibility::occluded == culled[i] && SoftVisibility::visible == expected[i] ? 1 : 0;
+
+		double const found = refCounts.occluded ? 100.0 * double(counts.occluded) / double(refCounts.occluded) : 100.0;
+		std::printf( "  %-6zu %8zu %10zu %10zu %7.1f%% %8zu\n", v, counts.inside, counts.occluded, refCounts.occluded, found, wrong );
+
+		total.inside += counts.inside;
+		total.occluded += counts.occluded;
+		totalReference.occluded += refCounts.occluded;
+		totalWrong += wrong;
+	}
+
+	double const found = totalReference.occluded ? 100.0 * double(total.occluded) / double(totalReference.occluded) : 100.0;
+	std::printf( "  %-6s %8zu %10zu %10zu %7.1f%% %8zu\n", "all", total.inside, total.occluded, totalReference.occluded, found, totalWrong );
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+#include "model.hpp"
+
+/* Software occlusion culling benchmark (see --soft-occlusion-benchmark in
+ * main.cpp). Needs no GPU.
+ *
+ * The city's polygons of at least aMinArea are the occluders. The boxes
+ * tested are those of the city's meshes, and a grid of car-sized boxes on
+ * the ground. Views are taken from the default benchmark camera path (see
+ * benchmark.hpp).
+ *
+ * Throughput: the median and 95th percentile times to rasterize the
+ * occluders and to test all boxes, for each code path (scalar and, if
+ * compiled in, AVX2) and several thread counts.
+ *
+ * Accuracy: per view, the boxes culled with the aWidth x aHeight
+ * conservative buffer are compared to those culled with a reference buffer
+ * of four times the resolution that samples pixel centers. Boxes that are
+ * culled but visible in the reference would be errors; the share of the
+ * reference's culled boxes that are found shows what the low resolution and
+ * conservative rasterization cost.
+ */
+void run_soft_occlusion_benchmark( ModelData const& aCity, float aMinArea, std::uint32_t aWidth, std::uint32_t aHeight );
@@ -0,0 +1,112 @@
+#include "upload_benchmark.hpp"
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include <cstdio>
+#include <cstdint>
+
+#include "benchmark.hpp"
+
+#include "../labutils/trace.hpp"
+#include "../labutils/vkbuffer.hpp"
+#include "../labutils/staging_ring.hpp"
+namespace lut = labutils;
+
+namespace
+{
+	constexpr std::size_t kSamples = 9;
+
+	// Each sample uploads about this much in total, in as many buffers as
+	// that takes (up to kMaxBuffersPerSample)
+	constexpr VkDeviceSize kBytesPerSample = VkDeviceSize(64) << 20;
+	constexpr VkDeviceSize kMaxBuffersPerSample = 256;
+
+	// Median throughput in MiB/s
+	double measure_( lut::StagingRing& aRing, std::vector<std::uint8_t> const& aData, std::size_t aBuffers )
+	{
+		using Clock_ = std::chrono::steady_clock;
+
+		std::vector<double> samples;
+		for( std::size_t i = 0; i < kSamples + 1; ++i )
+		{
+			std::vector<lut::Buffer> buffers;
+			buffers.reserve( aBuffers );
+
+			auto const start = Clock_::now();
+
+			for( std::size_t j = 0; j < aBuffers; ++j )
+			{
+				buffers.emplace_back( aRing.create_device_buffer(
+					aData.data(),
+					aData.size(),
+					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+					VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+					VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+					lut::MemoryCategory::geometry
+				) );
+			}
+
+			aRing.finish();
+
+			auto const ms = std::chrono::duration<double, std::milli>( Clock_::now() - start ).count();
+
+			// First sample is a warm-up
+			if( 0 != i )
+				samples.emplace_back( ms );
+		}
+
+		auto const stats = compute_timing_stats( std::move(samples) );
+		double const mib = double(aData.size()) * double(aBuffers) / (1024.0*1024.0);
+		return mib / (stats.p50 / 1000.0);
+	}
+}
+
+void run_upload_benchmark( lut::VulkanContext const& aContext, lut::Allocator const& aAllocator )
+{
+	LUT_TRACE_SCOPE( "run_upload_benchmark" );
+
+	VkPhysicalDeviceProperties props{};
+	vkGetPhysicalDeviceProperties( aContext.physicalDevice, &props );
+
+	bool const direct = lut::is_device_memory_host_visible( aAllocator );
+
+	lut::StagingRing staged = lut::create_staging_ring( aContext, aAllocator, lut::kDefaultStagingRingSize, false );
+	lut::StagingRing written = lut::create_staging_ring( aContext, aAllocator, lut::kDefaultStagingRingSize, true );
+
+	std::printf( "Upload benchmark on %s, %zu samples (median):\n", props.deviceName, kSamples );
+	if( !direct )
+		std::printf( "  Device memory is not host visible; only the staging path is measured.\n" );
+
+	std::printf( "  %10s %8s %16s %16s\n", "size", "buffers", "staging MiB/s", "direct MiB/s" );
+
+	for( VkDeviceSize const size : { VkDeviceSize(4) << 10, VkDeviceSize(64) << 10, VkDeviceSize(1) << 20, VkDeviceSize(16) << 20, VkDeviceSize(64) << 20, VkDeviceSize(256) << 20 } )
+	{
+		std::vector<std::uint8_t> data( std::size_t(size), std::uint8_t(0) );
+		for( std::size_t i = 0; i < data.size(); ++i )
+			data[i] = std::uint8_t(i * 2654435761u >> 24);
+
+		auto const buffers = std::size_t(std::clamp( kBytesPerSample / size, VkDeviceSize(1), kMaxBuffersPerSample ));
+
+		double const stagingRate = measure_( staged, data, buffers );
+
+		if( direct )
+		{
+			double const directRate = measure_( written, data, buffers );
+			std::printf( "  %7.0f KiB %8zu %16.1f %16.1f\n", size / 1024.0, buffers, stagingRate, directRate );
+		}
+		else
+		{
+			std::printf( "  %7.0f KiB %8zu %16.1f %16s\n", size / 1024.0, buffers, stagingRate, "-" );
+		}
+	}
+
+	auto const report = [] (char const* aName, lut::StagingRing const& aRing) {
+		std::printf( "  %s: ", aName );
+		aRing.print_stats();
+	};
+	report( "staging", staged );
+	if( direct )
+		report( "direct", written );
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "../labutils/allocator.hpp"
+#include "../labutils/vulkan_context.hpp"
+
+/* Upload throughput benchmark (see --upload-benchmark in main.cpp).
+ *
+ * Creates vertex buffers of several sizes with
+ * StagingRing::create_device_buffer(), once through the staging ring and
+ * once with direct writes to host visible device local memory (if the device
+ * has it, see labutils/vkbuffer.hpp). Each sample runs from the creation of
+ * the buffers until the GPU has completed the upload, and the median
+ * throughput of each path is printed.
+ */
+void run_upload_benchmark( labutils::VulkanContext const&, labutils::Allocator const& );
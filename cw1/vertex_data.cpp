@@ -1,18 +1,39 @@
 #include "vertex_data.hpp"
 
-#include <limits>
-
-#include <cstring> // for std::memcpy()
-
 #include "../labutils/error.hpp"
+#include "../labutils/trace.hpp"
 #include "../labutils/vkutil.hpp"
-#include "../labutils/to_string.hpp"
 namespace lut = labutils;
 
-std::vector<ColorizedMesh> create_triangle_mesh( labutils::VulkanContext const& aContext, labutils::Allocator const& aAllocator, ModelData& data )
+std::vector<ColorizedMesh> create_triangle_mesh( labutils::VulkanContext const&, labutils::Allocator const& aAllocator, labutils::StagingRing& aRing, ModelData& data, labutils::GpuProfiler* aProfiler, MeshletLimits const* aMeshlets )
 {
+	LUT_TRACE_SCOPE( "create_triangle_mesh" );
+
+	// The uploads of all meshes are timed as one "frame" if a profiler is
+	// given
+	lut::GpuProfiler noProfiler;
+	lut::GpuProfiler& profiler = aProfiler ? *aProfiler : noProfiler;
+
+	profiler.begin_frame(aRing.command_buffer());
+	auto const uploadScope = profiler.begin_scope(aRing.command_buffer(), "mesh upload");
+
 	std::vector<ColorizedMesh> return_mesh;
 	for (int j = 0; j < data.meshes.size(); j++) {
+		// With meshlets, only the unique vertices of the mesh are kept, in
+		// the order of meshlets.vertices
+		bool const textured = data.materials[data.meshes[j].materialIndex].colorTexturePath.compare("") != 0;
+
+		MeshletMesh meshlets;
+		if (aMeshlets) {
+			glm::vec2 const* texCoords = textured ? &data.vertexTextureCoords[data.meshes[j].vertexStartIndex] : nullptr;
+			meshlets = build_meshlets(&data.vertexPositions[data.meshes[j].vertexStartIndex], texCoords, data.meshes[j].numberOfVertices, *aMeshlets);
+		}
+
+		std::size_t const vertexCount = aMeshlets ? meshlets.vertices.size() : data.meshes[j].numberOfVertices;
+		auto const source = [&](std::size_t aVertex) {
+			return data.meshes[j].vertexStartIndex + (aMeshlets ? meshlets.vertices[aVertex] : aVertex);
+		};
+
 		// Vertex data
 		std::vector<float> positions;
 		std::vector<float> colors;
@@ -22,187 +43,64 @@ std::vector<ColorizedMesh> create_triangle_mesh( labutils::VulkanContext const&
 		//Else, set its texture coordinates
 		//This same if/else is used multiple times throughout this function
 		if (data.materials[data.meshes[j].materialIndex].colorTexturePath.compare("") == 0) {
-			for (int i = 0; i < data.meshes[j].numberOfVertices; i++) {
-				positions.push_back(data.vertexPositions[data.meshes[j].vertexStartIndex + i].x);
-				positions.push_back(data.vertexPositions[data.meshes[j].vertexStartIndex + i].y);
-				positions.push_back(data.vertexPositions[data.meshes[j].vertexStartIndex + i].z);
+			for (std::size_t i = 0; i < vertexCount; i++) {
+				positions.push_back(data.vertexPositions[source(i)].x);
+				positions.push_back(data.vertexPositions[source(i)].y);
+				positions.push_back(data.vertexPositions[source(i)].z);
 				colors.push_back(data.materials[data.meshes[j].materialIndex].color.x);
 				colors.push_back(data.materials[data.meshes[j].materialIndex].color.y);
 				colors.push_back(data.materials[data.meshes[j].materialIndex].color.z);
 			}
 		}
 		else {
-			for (int i = 0; i < data.meshes[j].numberOfVertices; i++) {
-				positions.push_back(data.vertexPositions[data.meshes[j].vertexStartIndex + i].x);
-				positions.push_back(data.vertexPositions[data.meshes[j].vertexStartIndex + i].y);
-				positions.push_back(data.vertexPositions[data.meshes[j].vertexStartIndex + i].z);
-				texCoords.push_back(data.vertexTextureCoords[data.meshes[j].vertexStartIndex + i].x);
-				texCoords.push_back(data.vertexTextureCoords[data.meshes[j].vertexStartIndex + i].y);
+			for (std::size_t i = 0; i < vertexCount; i++) {
+				positions.push_back(data.vertexPositions[source(i)].x);
+				positions.push_back(data.vertexPositions[source(i)].y);
+				positions.push_back(data.vertexPositions[source(i)].z);
+				texCoords.push_back(data.vertexTextureCoords[source(i)].x);
+				texCoords.push_back(data.vertexTextureCoords[source(i)].y);
 			}
 		}
 
 		//printf("%d", sizeof(colors));
 
-		lut::Buffer vertexPosGPU = lut::create_buffer(
-			aAllocator,
-			positions.size() * sizeof(float),
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-			VMA_MEMORY_USAGE_GPU_ONLY
-		);
-
-		lut::Buffer posStaging = lut::create_buffer(
-			aAllocator,
+		// The ring writes the buffers directly where device memory is host
+		// visible. Otherwise it copies through staging memory, and submits
+		// the copies once it is full; recording can therefore continue in a
+		// different command buffer after each buffer.
+		lut::Buffer vertexPosGPU = aRing.create_device_buffer(
+			positions.data(),
 			positions.size() * sizeof(float),
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-			VMA_MEMORY_USAGE_CPU_TO_GPU
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+			lut::MemoryCategory::geometry
 		);
 
 		lut::Buffer vertexColGPU;
-		lut::Buffer colStaging;
 		lut::Buffer vertexTexGPU;
-		lut::Buffer texStaging;
-
-		void* posPtr = nullptr;
-		if (auto const res = vmaMapMemory(aAllocator.allocator, posStaging.allocation, &posPtr); VK_SUCCESS != res)
-		{
-			throw lut::Error("Mapping memory for writing\n" "vmaMapMemory() returned %s", lut::to_string(res).c_str());
-
-		}
-
-		std::memcpy(posPtr, positions.data(), positions.size() * sizeof(float));
-		vmaUnmapMemory(aAllocator.allocator, posStaging.allocation);
 
 		if (data.materials[data.meshes[j].materialIndex].colorTexturePath.compare("") == 0) {
-			vertexColGPU = lut::create_buffer(
-				aAllocator,
+			vertexColGPU = aRing.create_device_buffer(
+				colors.data(),
 				colors.size() * sizeof(float),
-				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-				VMA_MEMORY_USAGE_GPU_ONLY
-			);
-
-			colStaging = lut::create_buffer(
-				aAllocator,
-				colors.size() * sizeof(float),
-				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-				VMA_MEMORY_USAGE_CPU_TO_GPU
-			);
-
-			void* colPtr = nullptr;
-			if (auto const res = vmaMapMemory(aAllocator.allocator, colStaging.allocation, &colPtr); VK_SUCCESS != res)
-			{
-				throw lut::Error("Mapping memory for writing\n" "vmaMapMemory() returned %s", lut::to_string(res).c_str());
-
-			}
-
-			std::memcpy(colPtr, colors.data(), colors.size() * sizeof(float));
-			vmaUnmapMemory(aAllocator.allocator, colStaging.allocation);
-		}
-		else {
-			vertexTexGPU = lut::create_buffer(
-				aAllocator,
-				texCoords.size() * sizeof(float),
-				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-				VMA_MEMORY_USAGE_GPU_ONLY
-			);
-
-			texStaging = lut::create_buffer(
-				aAllocator,
-				texCoords.size() * sizeof(float),
-				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-				VMA_MEMORY_USAGE_CPU_TO_GPU
-			);
-
-			void* texPtr = nullptr;
-			if (auto const res = vmaMapMemory(aAllocator.allocator, texStaging.allocation, &texPtr); VK_SUCCESS != res)
-			{
-				throw lut::Error("Mapping memory for writing\n" "vmaMapMemory() returned %s", lut::to_string(res).c_str());
-
-			}
-
-			std::memcpy(texPtr, texCoords.data(), texCoords.size() * sizeof(float));
-			vmaUnmapMemory(aAllocator.allocator, texStaging.allocation);
-		}
-
-		lut::Fence uploadComplete = create_fence(aContext);
-
-		lut::CommandPool uploadPool = create_command_pool(aContext);
-		VkCommandBuffer uploadCmd = alloc_command_buffer(aContext, uploadPool.handle);
-
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = 0;
-		beginInfo.pInheritanceInfo = nullptr;
-
-		if (auto const res = vkBeginCommandBuffer(uploadCmd, &beginInfo); VK_SUCCESS != res)
-		{
-			throw lut::Error("Beginning command buffer recording\n" "vkBeginCommandBuffer() returned %s", lut::to_string(res).c_str());
-
-		}
-
-		VkBufferCopy pcopy{};
-		pcopy.size = positions.size() * sizeof(float);
-
-		vkCmdCopyBuffer(uploadCmd, posStaging.buffer, vertexPosGPU.buffer, 1, &pcopy);
-
-		lut::buffer_barrier(uploadCmd,
-			vertexPosGPU.buffer,
-			VK_ACCESS_TRANSFER_WRITE_BIT,
-			VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
-		);
-
-		VkBufferCopy ccopy{};
-		if (data.materials[data.meshes[j].materialIndex].colorTexturePath.compare("") == 0) {
-			ccopy.size = colors.size() * sizeof(float);
-
-			vkCmdCopyBuffer(uploadCmd, colStaging.buffer, vertexColGPU.buffer, 1, &ccopy);
-
-			lut::buffer_barrier(uploadCmd,
-				vertexColGPU.buffer,
-				VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
 				VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
-				VK_PIPELINE_STAGE_TRANSFER_BIT,
-				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
+				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+				lut::MemoryCategory::geometry
 			);
 		}
 		else {
-			ccopy.size = texCoords.size() * sizeof(float);
-
-			vkCmdCopyBuffer(uploadCmd, texStaging.buffer, vertexTexGPU.buffer, 1, &ccopy);
-
-			lut::buffer_barrier(uploadCmd,
-				vertexTexGPU.buffer,
-				VK_ACCESS_TRANSFER_WRITE_BIT,
+			vertexTexGPU = aRing.create_device_buffer(
+				texCoords.data(),
+				texCoords.size() * sizeof(float),
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
 				VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
-				VK_PIPELINE_STAGE_TRANSFER_BIT,
-				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
+				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+				lut::MemoryCategory::geometry
 			);
 		}
 
-		if (auto const res = vkEndCommandBuffer(uploadCmd); VK_SUCCESS != res)
-		{
-			throw lut::Error("Ending command buffer recording\n" "vkEndCommandBuffer() returned %s", lut::to_string(res).c_str());
-		}
-
-		// Submit transfer commands 
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &uploadCmd;
-
-		if (auto const res = vkQueueSubmit(aContext.graphicsQueue, 1, &submitInfo, uploadComplete.handle); VK_SUCCESS != res)
-		{
-			throw lut::Error("Submitting commands\n" "vkQueueSubmit() returned %s", lut::to_string(res).c_str());
-
-		}
-
-
-		if (auto const res = vkWaitForFences(aContext.device, 1, &uploadComplete.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max()); VK_SUCCESS != res)
-		{
-			throw lut::Error("Waiting for upload to complete\n" "vkWaitForFences() returned %s", lut::to_string(res).c_str());
-		}
-
 		if (data.materials[data.meshes[j].materialIndex].colorTexturePath.compare("") == 0) {
 			return_mesh.push_back(ColorizedMesh{
 			std::move(vertexPosGPU),
@@ -218,8 +116,33 @@ std::vector<ColorizedMesh> create_triangle_mesh( labutils::VulkanContext const&
 				});
 		}
 
+		if (aMeshlets) {
+			auto& mesh = return_mesh.back();
+
+			mesh.indices = aRing.create_device_buffer(
+				meshlets.indices.data(),
+				meshlets.indices.size() * sizeof(std::uint32_t),
+				VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+				VK_ACCESS_INDEX_READ_BIT,
+				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+				lut::MemoryCategory::geometry
+			);
+			mesh.indexCount = std::uint32_t(meshlets.indices.size());
+
+			std::vector<std::uint32_t>().swap(meshlets.vertices);
+			std::vector<std::uint32_t>().swap(meshlets.indices);
+			mesh.meshlets = std::move(meshlets);
+		}
+
 	}
 
+	profiler.end_scope(aRing.command_buffer(), uploadScope);
+
+	// Timed uploads are waited for, so that the results are available by the
+	// time the profiler reuses its query slot
+	if (profiler.enabled())
+		aRing.finish();
+
 	return return_mesh;
 	
 }
\ No newline at end of file
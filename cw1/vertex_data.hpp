@@ -2,10 +2,13 @@
 
 #include <cstdint>
 #include "model.hpp"
+#include "meshlet.hpp"
 #include "../labutils/vulkan_context.hpp"
 
 #include "../labutils/vkbuffer.hpp"
 #include "../labutils/allocator.hpp" 
+#include "../labutils/staging_ring.hpp"
+#include "../labutils/gpu_profiler.hpp"
 
 struct ColorizedMesh
 {
@@ -13,10 +16,20 @@ struct ColorizedMesh
 	labutils::Buffer colors;
 
 	std::uint32_t vertexCount;
+
+	// Only with meshlets: the vertices are indexed, and the indices are
+	// grouped by meshlet (see meshlet.hpp). The CPU copy of the indices is
+	// dropped after the upload.
+	labutils::Buffer indices;
+	std::uint32_t indexCount = 0;
+	MeshletMesh meshlets;
 };
 
 
-std::vector<ColorizedMesh> create_triangle_mesh( labutils::VulkanContext const&, labutils::Allocator const&, ModelData& data );
+// Uploads are recorded into aRing, and are submitted when it fills up or
+// by its flush()/finish() (see staging_ring.hpp). With aMeshlets, each mesh
+// is indexed and split into meshlets of (at most) the given size.
+std::vector<ColorizedMesh> create_triangle_mesh( labutils::VulkanContext const&, labutils::Allocator const&, labutils::StagingRing& aRing, ModelData& data, labutils::GpuProfiler* = nullptr, MeshletLimits const* aMeshlets = nullptr );
 
 
 
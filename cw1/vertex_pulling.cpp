@@ -0,0 +1,265 @@
+#include "vertex_pulling.hpp"
+
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+
+#include <cmath>
+#include <cstring>
+
+#include "../labutils/error.hpp"
+#include "../labutils/trace.hpp"
+#include "../labutils/vkutil.hpp"
+#include "../labutils/to_string.hpp"
+namespace lut = labutils;
+
+namespace
+{
+	// Vertices are merged if their packed data is identical
+	struct PackedVertex_
+	{
+		std::uint16_t position[4];
+		std::uint32_t attributes[2];
+
+		bool operator== ( PackedVertex_ const& aOther ) const noexcept
+		{
+			return 0 == std::memcmp( this, &aOther, sizeof(PackedVertex_) );
+		}
+	};
+
+	static_assert( 16 == sizeof(PackedVertex_) );
+
+	struct PackedVertexHash_
+	{
+		std::size_t operator() ( PackedVertex_ const& aVertex ) const noexcept
+		{
+			std::uint32_t words[4];
+			std::memcpy( words, &aVertex, sizeof(words) );
+
+			std::uint64_t hash = 14695981039346656037ull;
+			for( auto const word : words )
+				hash = (hash ^ word) * 1099511628211ull;
+			return std::size_t(hash);
+		}
+	};
+
+	std::uint16_t quantize_( float aValue, float aOrigin, float aScale ) noexcept
+	{
+		if( aScale <= 0.f )
+			return 0;
+
+		float const q = std::round( (aValue - aOrigin) / aScale );
+		return std::uint16_t(std::clamp( q, 0.f, 65535.f ));
+	}
+
+	// As GLSL's packUnorm4x8()
+	std::uint32_t pack_unorm4x8_( glm::vec4 const& aValue ) noexcept
+	{
+		std::uint32_t ret = 0;
+		for( int i = 0; i < 4; ++i )
+		{
+			float const c = std::round( std::clamp( aValue[i], 0.f, 1.f ) * 255.f );
+			ret |= std::uint32_t(c) << (8 * i);
+		}
+		return ret;
+	}
+
+	bool is_textured_( ModelData const& aModel, MeshInfo const& aMesh )
+	{
+		return !aModel.materials[aMesh.materialIndex].colorTexturePath.empty();
+	}
+}
+
+PulledGeometryData pack_pulled_geometry( std::vector<ModelData const*> const& aModels )
+{
+	LUT_TRACE_SCOPE( "pack_pulled_geometry" );
+
+	PulledGeometryData ret;
+
+	// Bounds of all models
+	glm::vec3 lo( std::numeric_limits<float>::max() ), hi( std::numeric_limits<float>::lowest() );
+	for( auto const* model : aModels )
+	{
+		for( auto const& mesh : model->meshes )
+		{
+			for( std::size_t i = 0; i < mesh.numberOfVertices; ++i )
+			{
+				lo = glm::min( lo, model->vertexPositions[mesh.vertexStartIndex + i] );
+				hi = glm::max( hi, model->vertexPositions[mesh.vertexStartIndex + i] );
+			}
+		}
+	}
+
+	if( lo.x > hi.x )
+		return ret;
+
+	ret.origin = glm::vec4( lo, 0.f );
+	ret.scale = glm::vec4( (hi - lo) / 65535.f, 0.f );
+
+	std::unordered_map<PackedVertex_, std::uint32_t, PackedVertexHash_> unique;
+	for( auto const* model : aModels )
+	{
+		for( auto const& mesh : model->meshes )
+		{
+			bool const textured = is_textured_( *model, mesh );
+			glm::vec3 const color = model->materials[mesh.materialIndex].color;
+
+			// Indices don't refer to other meshes' vertices, so that each
+			// mesh's vertices stay contiguous
+			unique.clear();
+			unique.reserve( mesh.numberOfVertices );
+
+			ret.meshes.emplace_back( PulledMesh{ std::uint32_t(ret.indices.size()), std::uint32_t(mesh.numberOfVertices) } );
+
+			for( std::size_t i = 0; i < mesh.numberOfVertices; ++i )
+			{
+				std::size_t const src = mesh.vertexStartIndex + i;
+				glm::vec3 const& pos = model->vertexPositions[src];
+
+				PackedVertex_ v{};
+				for( int c = 0; c < 3; ++c )
+					v.position[c] = quantize_( pos[c], ret.origin[c], ret.scale[c] );
+
+				if( textured )
+				{
+					std::memcpy( &v.attributes[0], &model->vertexTextureCoords[src].x, sizeof(float) );
+					std::memcpy( &v.attributes[1], &model->vertexTextureCoords[src].y, sizeof(float) );
+				}
+				else
+				{
+					v.attributes[0] = pack_unorm4x8_( glm::vec4( color, 1.f ) );
+				}
+
+				std::uint32_t const next = std::uint32_t(ret.positions.size() / 4);
+				auto const [it, added] = unique.emplace( v, next );
+				if( added )
+				{
+					ret.positions.insert( ret.positions.end(), v.position, v.position + 4 );
+					ret.attributes.insert( ret.attributes.end(), v.attributes, v.attributes + 2 );
+				}
+
+				ret.indices.emplace_back( it->second );
+			}
+		}
+	}
+
+	return ret;
+}
+
+lut::DescriptorSetLayout create_pulled_geometry_layout( lut::VulkanContext const& aContext )
+{
+	VkDescriptorSetLayoutBinding bindings[4]{};
+	for( std::uint32_t i = 0; i < 4; ++i )
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 4;
+	layoutInfo.pBindings = bindings;
+
+	VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+	if( auto const res = vkCreateDescriptorSetLayout( aContext.device, &layoutInfo, nullptr, &layout ); VK_SUCCESS != res )
+	{
+		throw lut::Error( "Unable to create vertex pulling descriptor set layout\n"
+			"vkCreateDescriptorSetLayout() returned %s", lut::to_string(res).c_str()
+		);
+	}
+
+	return lut::DescriptorSetLayout( aContext.device, layout );
+}
+
+PulledGeometry create_pulled_geometry( lut::VulkanContext const& aContext, lut::StagingRing& aRing, PulledGeometryData const& aData, VkDescriptorSetLayout aLayout, VkBuffer aInstances )
+{
+	LUT_TRACE_SCOPE( "create_pulled_geometry" );
+
+	// Storage buffers must not be empty
+	auto const upload = [&]( void const* aSrc, std::size_t aBytes ) {
+		static std::uint32_t const kEmpty = 0;
+		return aRing.create_device_buffer(
+			aBytes ? aSrc : &kEmpty,
+			aBytes ? aBytes : sizeof(kEmpty),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_ACCESS_SHADER_READ_BIT,
+			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+			lut::MemoryCategory::geometry
+		);
+	};
+
+	// The quantization parameters come first, see UPositions in the shaders
+	std::vector<std::uint8_t> positions( 2 * sizeof(glm::vec4) + aData.positions.size() * sizeof(std::uint16_t) );
+	std::memcpy( positions.data(), &aData.origin, sizeof(glm::vec4) );
+	std::memcpy( positions.data() + sizeof(glm::vec4), &aData.scale, sizeof(glm::vec4) );
+	if( !aData.positions.empty() )
+		std::memcpy( positions.data() + 2 * sizeof(glm::vec4), aData.positions.data(), aData.positions.size() * sizeof(std::uint16_t) );
+
+	PulledGeometry ret;
+	ret.positions = upload( positions.data(), positions.size() );
+	ret.attributes = upload( aData.attributes.data(), aData.attributes.size() * sizeof(std::uint32_t) );
+	ret.indices = upload( aData.indices.data(), aData.indices.size() * sizeof(std::uint32_t) );
+
+	ret.meshes = aData.meshes;
+	ret.vertexCount = aData.positions.size() / 4;
+	ret.indexCount = aData.indices.size();
+	ret.bytes = positions.size() + (aData.attributes.size() + aData.indices.size()) * sizeof(std::uint32_t);
+
+	// One set, bound once per frame
+	VkDescriptorPoolSize const poolSize{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 };
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	if( auto const res = vkCreateDescriptorPool( aContext.device, &poolInfo, nullptr, &pool ); VK_SUCCESS != res )
+	{
+		throw lut::Error( "Unable to create vertex pulling descriptor pool\n"
+			"vkCreateDescriptorPool() returned %s", lut::to_string(res).c_str()
+		);
+	}
+
+	ret.pool = lut::DescriptorPool( aContext.device, pool );
+	ret.descriptors = lut::alloc_desc_set( aContext, ret.pool.handle, aLayout );
+
+	VkDescriptorBufferInfo buffers[4]{};
+	buffers[0].buffer = ret.positions.buffer;
+	buffers[1].buffer = ret.attributes.buffer;
+	buffers[2].buffer = ret.indices.buffer;
+	buffers[3].buffer = aInstances;
+
+	VkWriteDescriptorSet writes[4]{};
+	for( std::uint32_t i = 0; i < 4; ++i )
+	{
+		buffers[i].range = VK_WHOLE_SIZE;
+
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = ret.descriptors;
+		writes[i].dstBinding = i;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[i].descriptorCount = 1;
+		writes[i].pBufferInfo = &buffers[i];
+	}
+
+	vkUpdateDescriptorSets( aContext.device, 4, writes, 0, nullptr );
+
+	return ret;
+}
+
+VkDeviceSize fixed_function_geometry_bytes( std::vector<ModelData const*> const& aModels )
+{
+	// Three floats of position, and three of color or two of texture
+	// coordinates
+	VkDeviceSize ret = 0;
+	for( auto const* model : aModels )
+	{
+		for( auto const& mesh : model->meshes )
+			ret += mesh.numberOfVertices * sizeof(float) * (is_textured_( *model, mesh ) ? 5 : 6);
+	}
+	return ret;
+}
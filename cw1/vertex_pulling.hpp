@@ -0,0 +1,90 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "model.hpp"
+
+#include "../labutils/vkobject.hpp"
+#include "../labutils/vkbuffer.hpp"
+#include "../labutils/vulkan_context.hpp"
+#include "../labutils/allocator.hpp"
+#include "../labutils/staging_ring.hpp"
+
+/* Programmable vertex pulling (see --vertex-pulling in main.cpp).
+ *
+ * The vertices of all meshes of all models are packed into shared storage
+ * buffers, which the vertex shaders (shaders/ *_pull.vert) read themselves,
+ * instead of having fixed-function vertex input fetch them. A frame binds
+ * the buffers once, as one descriptor set, where the fixed-function path
+ * binds vertex buffers for every mesh.
+ *
+ * Each mesh is indexed (vertices with identical packed data are merged),
+ * and drawn with a non-indexed draw over its range of the index buffer
+ * (firstVertex = PulledMesh::firstIndex). The shader reads the index at
+ * gl_VertexIndex, and then the vertex. Indices are absolute, so draws need
+ * no base vertex. Model matrices are read at gl_InstanceIndex. The buffers
+ * are set 2 of the pipelines (see create_pulled_geometry_layout()).
+ *
+ * Since the shaders decode the vertices, any format works. Here:
+ *  - positions are quantized to 16 bits per component, relative to the
+ *    bounds of all models (kept at the start of the position buffer);
+ *  - colors are RGBA8, and texture coordinates stay 32-bit floats (the city
+ *    repeats textures up to ~24 times, too many for half floats).
+ * Each vertex takes 16 bytes, down from 24 (colored) or 20 (textured).
+ */
+struct PulledMesh
+{
+	std::uint32_t firstIndex;
+	std::uint32_t indexCount;
+};
+
+// Packed on the CPU, see pack_pulled_geometry()
+struct PulledGeometryData
+{
+	glm::vec4 origin{ 0.f }, scale{ 0.f }; // position = origin + scale * unorm16
+
+	std::vector<std::uint16_t> positions; // four per vertex (x, y, z, unused)
+	std::vector<std::uint32_t> attributes; // two per vertex: RGBA8 color, or texture coordinates
+	std::vector<std::uint32_t> indices;
+
+	std::vector<PulledMesh> meshes; // of each model in turn
+};
+
+// Packs the meshes of aModels, in order. Textured meshes (see MaterialInfo)
+// keep their texture coordinates, the others their material's color.
+PulledGeometryData pack_pulled_geometry( std::vector<ModelData const*> const& aModels );
+
+// Bindings 0-3: positions, attributes, indices and model matrices, read
+// by the vertex shader
+labutils::DescriptorSetLayout create_pulled_geometry_layout( labutils::VulkanContext const& );
+
+struct PulledGeometry
+{
+	labutils::Buffer positions; // origin and scale, then the positions
+	labutils::Buffer attributes;
+	labutils::Buffer indices;
+
+	labutils::DescriptorPool pool;
+	VkDescriptorSet descriptors = VK_NULL_HANDLE; // the buffers and the instances
+
+	std::vector<PulledMesh> meshes;
+
+	std::size_t vertexCount = 0, indexCount = 0;
+	VkDeviceSize bytes = 0; // all three buffers
+};
+
+// Uploads the packed geometry into storage buffers, and creates their
+// descriptor set. aInstances holds the model matrices (one glm::mat4 per
+// instance), and needs VK_BUFFER_USAGE_STORAGE_BUFFER_BIT.
+PulledGeometry create_pulled_geometry( labutils::VulkanContext const&, labutils::StagingRing&, PulledGeometryData const&, VkDescriptorSetLayout, VkBuffer aInstances );
+
+// Size of the same meshes in separate, non-indexed vertex buffers (as
+// create_triangle_mesh() creates them without meshlets)
+VkDeviceSize fixed_function_geometry_bytes( std::vector<ModelData const*> const& aModels );
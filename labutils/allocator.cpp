@@ -1,5 +1,6 @@
 #include "allocator.hpp"
 
+#include <atomic>
 #include <utility>
 
 #include <cassert>
@@ -7,6 +8,25 @@
 #include "error.hpp"
 #include "to_string.hpp"
 
+namespace
+{
+	constexpr std::size_t kCategoryCount_ = std::size_t(labutils::MemoryCategory::count_);
+
+	// The user data of a tracked allocation points into this table.
+	constexpr char const* kCategoryNames_[kCategoryCount_] = {
+		"other",
+		"geometry",
+		"texture",
+		"staging",
+		"uniform",
+		"attachment",
+		"readback"
+	};
+
+	std::atomic<std::uint64_t> gCategoryCount_[kCategoryCount_]{};
+	std::atomic<std::uint64_t> gCategoryBytes_[kCategoryCount_]{};
+}
+
 namespace labutils
 {
 	Allocator::Allocator() noexcept = default;
@@ -45,6 +65,7 @@ namespace labutils
 		functions.vkGetDeviceProcAddr     = vkGetDeviceProcAddr;
 
 		VmaAllocatorCreateInfo allocInfo{};
+		allocInfo.flags             = aContext.haveMemoryBudget ? VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT : 0;
 		allocInfo.vulkanApiVersion  = props.apiVersion;
 		allocInfo.physicalDevice    = aContext.physicalDevice;
 		allocInfo.device            = aContext.device;
@@ -63,3 +84,147 @@ namespace labutils
 	}
 }
 
+namespace labutils
+{
+	char const* to_string( MemoryCategory aCategory )
+	{
+		auto const index = std::size_t(aCategory);
+		return index < kCategoryCount_ ? kCategoryNames_[index] : "unknown";
+	}
+
+	void track_allocation( Allocator const& aAllocator, VmaAllocation aAllocation, MemoryCategory aCategory )
+	{
+		auto const index = std::size_t(aCategory);
+		assert( index < kCategoryCount_ );
+
+		VmaAllocationInfo info{};
+		vmaGetAllocationInfo( aAllocator.allocator, aAllocation, &info );
+		assert( !info.pUserData ); // already tracked?
+
+		vmaSetAllocationUserData( aAllocator.allocator, aAllocation, const_cast<char const**>(&kCategoryNames_[index]) );
+
+		gCategoryCount_[index].fetch_add( 1, std::memory_order_relaxed );
+		gCategoryBytes_[index].fetch_add( info.size, std::memory_order_relaxed );
+	}
+
+	namespace detail
+	{
+		void untrack_allocation( VmaAllocator aAllocator, VmaAllocation aAllocation ) noexcept
+		{
+			VmaAllocationInfo info{};
+			vmaGetAllocationInfo( aAllocator, aAllocation, &info );
+
+			auto const* tag = static_cast<char const* const*>(info.pUserData);
+			if( tag < kCategoryNames_ || tag >= kCategoryNames_ + kCategoryCount_ )
+				return; // not tracked
+
+			auto const index = std::size_t(tag - kCategoryNames_);
+			gCategoryCount_[index].fetch_sub( 1, std::memory_order_relaxed );
+			gCategoryBytes_[index].fetch_sub( info.size, std::memory_order_relaxed );
+		}
+	}
+
+	MemoryStats query_memory_stats( Allocator const& aAllocator )
+	{
+		VkPhysicalDeviceMemoryProperties const* memProps = nullptr;
+		vmaGetMemoryProperties( aAllocator.allocator, &memProps );
+		assert( memProps );
+
+		VmaBudget budgets[VK_MAX_MEMORY_HEAPS]{};
+		vmaGetHeapBudgets( aAllocator.allocator, budgets );
+
+		VmaStats stats{};
+		vmaCalculateStats( aAllocator.allocator, &stats );
+
+		MemoryStats ret;
+		for( std::uint32_t i = 0; i < memProps->memoryHeapCount; ++i )
+		{
+			auto const& info = stats.memoryHeap[i];
+
+			MemoryHeapStats heap{};
+			heap.size = memProps->memoryHeaps[i].size;
+			heap.flags = memProps->memoryHeaps[i].flags;
+			heap.usage = budgets[i].usage;
+			heap.budget = budgets[i].budget;
+			heap.blockBytes = budgets[i].blockBytes;
+			heap.allocationBytes = budgets[i].allocationBytes;
+			heap.blockCount = info.blockCount;
+			heap.allocationCount = info.allocationCount;
+			heap.unusedRangeCount = info.unusedRangeCount;
+			heap.fragmentation = info.unusedBytes > 0 ? 1.f - float(info.unusedRangeSizeMax) / float(info.unusedBytes) : 0.f;
+
+			ret.heaps.emplace_back( heap );
+		}
+
+		for( std::size_t i = 0; i < kCategoryCount_; ++i )
+		{
+			ret.categories[i].allocationCount = gCategoryCount_[i].load( std::memory_order_relaxed );
+			ret.categories[i].bytes = gCategoryBytes_[i].load( std::memory_order_relaxed );
+		}
+
+		return ret;
+	}
+
+	void print_memory_stats( MemoryStats const& aStats, std::FILE* aOut )
+	{
+		constexpr double kMiB = 1024.0 * 1024.0;
+
+		std::fprintf( aOut, "Memory heaps:\n" );
+		for( std::size_t i = 0; i < aStats.heaps.size(); ++i )
+		{
+			auto const& heap = aStats.heaps[i];
+			std::fprintf( aOut, "  heap %zu%s: %.1f MiB used of %.1f MiB budget (heap size %.1f MiB)\n",
+				i, (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device local)" : "",
+				heap.usage / kMiB, heap.budget / kMiB, heap.size / kMiB
+			);
+			std::fprintf( aOut, "    %u blocks, %.1f MiB; %u allocations, %.1f MiB; %u free ranges, fragmentation %.2f\n",
+				heap.blockCount, heap.blockBytes / kMiB,
+				heap.allocationCount, heap.allocationBytes / kMiB,
+				heap.unusedRangeCount, heap.fragmentation
+			);
+		}
+
+		std::fprintf( aOut, "Memory by category:\n" );
+		for( std::size_t i = 0; i < kCategoryCount_; ++i )
+		{
+			auto const& cat = aStats.categories[i];
+			if( 0 == cat.allocationCount )
+				continue;
+
+			std::fprintf( aOut, "  %-10s %6llu allocations, %9.2f MiB\n", kCategoryNames_[i], static_cast<unsigned long long>(cat.allocationCount), cat.bytes / kMiB );
+		}
+	}
+
+	void write_memory_stats_json( Allocator const& aAllocator, char const* aPath, bool aDetailedMap )
+	{
+		std::FILE* fout = std::fopen( aPath, "w" );
+		if( !fout )
+			throw Error( "Unable to open '%s' for writing", aPath );
+
+		char* vmaStats = nullptr;
+		vmaBuildStatsString( aAllocator.allocator, &vmaStats, aDetailedMap ? VK_TRUE : VK_FALSE );
+
+		auto const stats = query_memory_stats( aAllocator );
+
+		std::fprintf( fout, "{\n\"categories\": {" );
+		for( std::size_t i = 0; i < kCategoryCount_; ++i )
+		{
+			std::fprintf( fout, "%s\n  \"%s\": { \"allocations\": %llu, \"bytes\": %llu }",
+				i ? "," : "", kCategoryNames_[i],
+				static_cast<unsigned long long>(stats.categories[i].allocationCount),
+				static_cast<unsigned long long>(stats.categories[i].bytes)
+			);
+		}
+		std::fprintf( fout, "\n},\n\"vma\": %s\n}\n", vmaStats ? vmaStats : "null" );
+
+		vmaFreeStatsString( aAllocator.allocator, vmaStats );
+
+		bool const ok = (0 == std::ferror( fout ));
+		std::fclose( fout );
+
+		if( !ok )
+			throw Error( "Error while writing memory statistics '%s'", aPath );
+
+		std::printf( "Wrote '%s'\n", aPath );
+	}
+}
@@ -3,9 +3,12 @@
 #include <volk/volk.h>
 #include <vk_mem_alloc.h>
 
+#include <vector>
 #include <utility>
 
+#include <cstdio>
 #include <cassert>
+#include <cstdint>
 
 #include "vulkan_context.hpp"
 
@@ -29,4 +32,74 @@ namespace labutils
 	};
 
 	Allocator create_allocator( VulkanContext const& );
+
+
+	// Memory statistics
+	// Allocations made through labutils (create_buffer(), create_image_*())
+	// are tagged with a category, so that memory use can be broken down by
+	// what it is used for. Other allocations can be tagged with
+	// track_allocation(). Tags are stored in the allocation's user data
+	// (VmaAllocationInfo::pUserData). The per-category totals are
+	// process-wide.
+	enum class MemoryCategory : std::uint32_t
+	{
+		other,
+		geometry,
+		texture,
+		staging,
+		uniform,
+		attachment,
+		readback,
+
+		count_
+	};
+
+	char const* to_string( MemoryCategory );
+
+	void track_allocation( Allocator const&, VmaAllocation, MemoryCategory );
+
+	namespace detail
+	{
+		// Called by Buffer/Image before destroying their allocation
+		void untrack_allocation( VmaAllocator, VmaAllocation ) noexcept;
+	}
+
+	struct MemoryCategoryStats
+	{
+		std::uint64_t allocationCount = 0;
+		VkDeviceSize bytes = 0;
+	};
+
+	struct MemoryHeapStats
+	{
+		VkDeviceSize size;
+		VkMemoryHeapFlags flags;
+
+		// Usage and budget are reported by the driver if VK_EXT_memory_budget
+		// is enabled (see VulkanContext::haveMemoryBudget). Otherwise, VMA
+		// estimates them.
+		VkDeviceSize usage, budget;
+
+		VkDeviceSize blockBytes; // VkDeviceMemory allocated by VMA
+		VkDeviceSize allocationBytes; // used by allocations within the blocks
+
+		std::uint32_t blockCount, allocationCount, unusedRangeCount;
+
+		// 1 - (largest free range / total free bytes). Zero means that all free
+		// space within the blocks is in a single range.
+		float fragmentation;
+	};
+
+	struct MemoryStats
+	{
+		std::vector<MemoryHeapStats> heaps;
+		MemoryCategoryStats categories[std::size_t(MemoryCategory::count_)];
+	};
+
+	MemoryStats query_memory_stats( Allocator const& );
+	void print_memory_stats( MemoryStats const&, std::FILE* = stdout );
+
+	// Writes VMA's JSON statistics (vmaBuildStatsString()) together with the
+	// per-category totals.
+	void write_memory_stats_json( Allocator const&, char const* aPath, bool aDetailedMap = true );
 }
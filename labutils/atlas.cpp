@@ -0,0 +1,271 @@
+#include "atlas.hpp"
+
+#include <utility>
+#include <algorithm>
+
+#include <cassert>
+#include <cstring>
+
+#include "error.hpp"
+#include "trace.hpp"
+#include "image_decode.hpp"
+#include "vkutil.hpp"
+#include "staging_ring.hpp"
+
+namespace
+{
+	std::uint32_t round_up_( std::uint32_t aValue, std::uint32_t aMultiple ) noexcept
+	{
+		return (aValue + aMultiple - 1) / aMultiple * aMultiple;
+	}
+
+	struct Shelf_
+	{
+		std::uint32_t layer;
+		std::uint32_t y, height;
+		std::uint32_t used; // width
+	};
+
+	// Copies a texture into a page, and fills the rest of its cell (the
+	// gutter and the alignment padding) with copies of the nearest edge
+	// texel
+	void blit_with_gutter_( std::uint8_t* aPage, std::uint32_t aPageWidth, std::uint8_t const* aSrc, labutils::AtlasPlacement const& aPlace, std::uint32_t aCellX, std::uint32_t aCellY, std::uint32_t aCellWidth, std::uint32_t aCellHeight )
+	{
+		for( std::uint32_t cy = aCellY; cy < aCellY + aCellHeight; ++cy )
+		{
+			std::uint32_t const sy = std::uint32_t(std::clamp<std::int64_t>( std::int64_t(cy) - aPlace.y, 0, aPlace.height - 1 ));
+			std::uint8_t const* srcRow = aSrc + std::size_t(sy) * aPlace.width * 4;
+			std::uint8_t* dstRow = aPage + (std::size_t(cy) * aPageWidth) * 4;
+
+			for( std::uint32_t cx = aCellX; cx < aPlace.x; ++cx )
+				std::memcpy( dstRow + std::size_t(cx) * 4, srcRow, 4 );
+
+			std::memcpy( dstRow + std::size_t(aPlace.x) * 4, srcRow, std::size_t(aPlace.width) * 4 );
+
+			for( std::uint32_t cx = aPlace.x + aPlace.width; cx < aCellX + aCellWidth; ++cx )
+				std::memcpy( dstRow + std::size_t(cx) * 4, srcRow + std::size_t(aPlace.width - 1) * 4, 4 );
+		}
+	}
+}
+
+namespace labutils
+{
+	AtlasUvTransform TextureAtlas::uv_transform( std::uint32_t aTexture ) const noexcept
+	{
+		assert( aTexture < layout.placements.size() );
+		auto const& place = layout.placements[aTexture];
+
+		AtlasUvTransform ret{};
+		ret.offset[0] = float(place.x) / layout.width;
+		ret.offset[1] = float(place.y) / layout.height;
+		ret.scale[0] = float(place.width) / layout.width;
+		ret.scale[1] = float(place.height) / layout.height;
+		return ret;
+	}
+
+	AtlasLayout pack_atlas( std::vector<VkExtent2D> const& aSizes, AtlasConfig const& aConfig )
+	{
+		assert( aConfig.mipLevels >= 1 && aConfig.mipLevels <= 16 );
+
+		// Cells start (and end) on multiples of the size that one texel of
+		// the last level covers
+		std::uint32_t const align = 1u << (aConfig.mipLevels - 1);
+		std::uint32_t const gutter = align;
+		std::uint32_t const pageExtent = aConfig.pageExtent / align * align;
+
+		AtlasLayout ret;
+		ret.placements.resize( aSizes.size(), AtlasPlacement{} );
+
+		auto const cell_width = [&] (std::size_t aIdx) { return round_up_( aSizes[aIdx].width + 2*gutter, align ); };
+		auto const cell_height = [&] (std::size_t aIdx) { return round_up_( aSizes[aIdx].height + 2*gutter, align ); };
+
+		std::vector<std::size_t> order;
+		for( std::size_t i = 0; i < aSizes.size(); ++i )
+		{
+			auto const& size = aSizes[i];
+			if( 0 == size.width || 0 == size.height )
+				continue;
+			if( size.width > aConfig.maxTextureExtent || size.height > aConfig.maxTextureExtent )
+				continue;
+			if( cell_width(i) > pageExtent || cell_height(i) > pageExtent )
+				continue;
+
+			order.push_back( i );
+		}
+
+		std::stable_sort( order.begin(), order.end(), [&] (std::size_t aX, std::size_t aY) {
+			if( cell_height(aX) != cell_height(aY) )
+				return cell_height(aX) > cell_height(aY);
+			return cell_width(aX) > cell_width(aY);
+		} );
+
+		// Each texture goes onto the first shelf with room for it. Otherwise
+		// a new shelf (of the texture's height, as it is the tallest of the
+		// remaining ones) is opened on the first page with room, or on a
+		// new page.
+		std::vector<Shelf_> shelves;
+		std::vector<std::uint32_t> pageTops;
+
+		for( auto const idx : order )
+		{
+			std::uint32_t const cw = cell_width(idx), ch = cell_height(idx);
+
+			Shelf_* shelf = nullptr;
+			for( auto& candidate : shelves )
+			{
+				if( candidate.height >= ch && candidate.used + cw <= pageExtent )
+				{
+					shelf = &candidate;
+					break;
+				}
+			}
+
+			if( !shelf )
+			{
+				std::uint32_t layer = 0;
+				while( layer < pageTops.size() && pageTops[layer] + ch > pageExtent )
+					++layer;
+
+				if( layer == pageTops.size() )
+					pageTops.push_back( 0 );
+
+				shelves.emplace_back( Shelf_{ layer, pageTops[layer], ch, 0 } );
+				pageTops[layer] += ch;
+				shelf = &shelves.back();
+			}
+
+			auto& place = ret.placements[idx];
+			place.packed = true;
+			place.layer = shelf->layer;
+			place.x = shelf->used + gutter;
+			place.y = shelf->y + gutter;
+			place.width = aSizes[idx].width;
+			place.height = aSizes[idx].height;
+
+			shelf->used += cw;
+
+			ret.width = std::max( ret.width, shelf->used );
+			ret.height = std::max( ret.height, shelf->y + ch );
+		}
+
+		ret.layers = std::uint32_t(pageTops.size());
+		return ret;
+	}
+
+	TextureAtlas load_texture_atlas( std::vector<std::string> const& aPaths, VulkanContext const&, StagingRing& aRing, Allocator const& aAllocator, AtlasConfig const& aConfig, GpuProfiler* aProfiler )
+	{
+		LUT_TRACE_SCOPE( "load_texture_atlas" );
+
+		// Sizes come from the file headers. Files of textures that are
+		// packed are kept for decoding.
+		std::vector<std::vector<std::uint8_t>> files( aPaths.size() );
+		std::vector<ImageFileInfo> infos( aPaths.size() );
+		std::vector<VkExtent2D> sizes( aPaths.size() );
+
+		for( std::size_t i = 0; i < aPaths.size(); ++i )
+		{
+			files[i] = read_file_bytes( aPaths[i].c_str() );
+			infos[i] = image_file_info( files[i], aPaths[i].c_str() );
+			sizes[i] = VkExtent2D{ infos[i].width, infos[i].height };
+		}
+
+		TextureAtlas ret;
+		ret.layout = pack_atlas( sizes, aConfig );
+		ret.mipLevels = aConfig.mipLevels;
+
+		for( std::size_t i = 0; i < aPaths.size(); ++i )
+		{
+			if( !ret.layout.placements[i].packed )
+				std::vector<std::uint8_t>().swap( files[i] );
+		}
+
+		if( 0 == ret.layout.layers )
+			return ret;
+
+		auto const width = ret.layout.width, height = ret.layout.height;
+		auto const layers = ret.layout.layers;
+		auto const levels = ret.mipLevels;
+
+		ret.image = create_image_texture2d( aAllocator, width, height, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, MemoryCategory::texture, levels, 0, layers );
+
+		GpuProfiler noProfiler;
+		GpuProfiler& profiler = aProfiler ? *aProfiler : noProfiler;
+
+		profiler.begin_frame( aRing.command_buffer() );
+		auto const uploadScope = profiler.begin_scope( aRing.command_buffer(), "atlas upload" );
+
+		image_barrier( aRing.command_buffer(), ret.image.image,
+			0,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, layers }
+		);
+
+		// Pages are composed in host memory one at a time. Texels outside of
+		// the cells are never sampled, and are left black.
+		std::uint32_t const gutter = 1u << (levels - 1);
+
+		std::vector<std::uint8_t> page;
+		std::vector<std::uint8_t> decoded;
+
+		for( std::uint32_t layer = 0; layer < layers; ++layer )
+		{
+			page.assign( std::size_t(width) * height * 4, 0 );
+
+			for( std::size_t i = 0; i < aPaths.size(); ++i )
+			{
+				auto const& place = ret.layout.placements[i];
+				if( !place.packed || place.layer != layer )
+					continue;
+
+				decoded.resize( decode_rgba8_capacity( infos[i] ) );
+				decode_rgba8_into( files[i], aPaths[i].c_str(), infos[i], decoded.data() );
+
+				std::uint32_t const cellX = place.x - gutter, cellY = place.y - gutter;
+				std::uint32_t const cellW = round_up_( place.width + 2*gutter, gutter );
+				std::uint32_t const cellH = round_up_( place.height + 2*gutter, gutter );
+
+				blit_with_gutter_( page.data(), width, decoded.data(), place, cellX, cellY, cellW, cellH );
+			}
+
+			aRing.upload_image_level( ret.image.image, 0, width, height, page.data(), 4, 1, layer );
+
+			std::vector<MipLevelRGBA8> mips;
+			{
+				LUT_TRACE_SCOPE( "generate_mip_chain" );
+				mips = generate_mip_chain_rgba8( page.data(), width, height, true, MipFilter::box );
+			}
+
+			assert( mips.size() + 1 >= levels );
+
+			for( std::uint32_t level = 1; level < levels; ++level )
+			{
+				auto const& mip = mips[level-1];
+				aRing.upload_image_level( ret.image.image, level, mip.width, mip.height, mip.texels.data(), 4, 1, layer );
+			}
+		}
+
+		image_barrier( aRing.command_buffer(), ret.image.image,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, layers }
+		);
+
+		profiler.end_scope( aRing.command_buffer(), uploadScope );
+
+		// See the loaders in vkimage.cpp
+		if( profiler.enabled() )
+			aRing.finish();
+
+		return ret;
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include "mipmap.hpp"
+#include "vkimage.hpp"
+#include "allocator.hpp"
+#include "gpu_profiler.hpp"
+#include "vulkan_context.hpp"
+
+namespace labutils
+{
+	class StagingRing;
+
+	// Packs small RGBA8 (sRGB) textures into the pages of a shared atlas, so
+	// that meshes using them share one image (and descriptor set), instead
+	// of one per texture.
+	//
+	// Textures are placed with shelf packing, tallest first. Each page is
+	// one array layer of a single image; a texture that doesn't fit onto the
+	// existing pages opens a new layer. All layers have the same size, which
+	// is trimmed to the space that is actually used.
+	//
+	// Mip levels stay free of bleeding between textures: every texture is
+	// surrounded by a gutter of its replicated edge texels, and placements
+	// are aligned so that each texel of the last atlas level covers only one
+	// texture (and its gutter). The atlas therefore has a limited number of
+	// levels (mipLevels), instead of a chain down to 1x1. Levels are
+	// generated on the CPU with the box filter.
+	//
+	// Atlas coordinates come from remapping the texture's own, which must be
+	// in [0,1]: a texture that repeats across a mesh can't be packed.
+	struct AtlasConfig
+	{
+		// Maximum width and height of a page
+		std::uint32_t pageExtent = 2048;
+
+		// Textures larger than this (in either dimension) are not packed
+		std::uint32_t maxTextureExtent = 256;
+
+		// Levels in the atlas. The gutter is 2^(mipLevels-1) texels wide.
+		std::uint32_t mipLevels = 4;
+	};
+
+	struct AtlasPlacement
+	{
+		bool packed; // false for textures that were too large
+
+		std::uint32_t layer;
+		std::uint32_t x, y; // of texel (0,0), excluding the gutter
+		std::uint32_t width, height;
+	};
+
+	struct AtlasLayout
+	{
+		std::uint32_t width = 0, height = 0; // of each page
+		std::uint32_t layers = 0;
+
+		std::vector<AtlasPlacement> placements; // one per texture
+	};
+
+	struct AtlasUvTransform
+	{
+		// Atlas coordinates are offset + uv * scale
+		float offset[2];
+		float scale[2];
+	};
+
+	struct TextureAtlas
+	{
+		Image image; // mipLevels levels, one array layer per page
+		AtlasLayout layout;
+		std::uint32_t mipLevels = 0;
+
+		AtlasUvTransform uv_transform( std::uint32_t aTexture ) const noexcept;
+	};
+
+	// Computes placements for textures of the given sizes (without building
+	// anything). Textures larger than a page or aConfig.maxTextureExtent are
+	// not packed.
+	AtlasLayout pack_atlas( std::vector<VkExtent2D> const& aSizes, AtlasConfig const& = AtlasConfig{} );
+
+	// Loads the images in aPaths and packs the small ones into an atlas.
+	// The atlas is uploaded through aRing (see the loaders in vkimage.hpp);
+	// its image is empty if no texture was packed. Textures that weren't
+	// packed have to be loaded separately.
+	TextureAtlas load_texture_atlas( std::vector<std::string> const& aPaths, VulkanContext const&, StagingRing&, Allocator const&, AtlasConfig const& = AtlasConfig{}, GpuProfiler* = nullptr );
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
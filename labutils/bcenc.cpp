@@ -0,0 +1,784 @@
+#include "bcenc.hpp"
+
+#include <limits>
+#include <utility>
+#include <algorithm>
+
+#include <cmath>
+#include <cassert>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#	define LUT_BCENC_SSE2_ 1
+#	include <emmintrin.h>
+#else
+#	define LUT_BCENC_SSE2_ 0
+#endif
+
+#include "trace.hpp"
+#include "parallel.hpp"
+
+namespace
+{
+	// One 4x4 block, stored per channel: c[channel][pixel]. Pixels are in
+	// row-major order.
+	struct Block_
+	{
+		alignas(16) float c[4][16];
+	};
+
+	// Unquantized endpoints, in [0,255]
+	struct Endpoints_
+	{
+		float e[2][4];
+	};
+
+	std::uint32_t refine_steps_( labutils::BcQuality aQuality )
+	{
+		switch( aQuality )
+		{
+			case labutils::BcQuality::fast: return 0;
+			case labutils::BcQuality::normal: return 1;
+			case labutils::BcQuality::high: return 4;
+		}
+
+		return 0;
+	}
+
+	void load_block_( std::uint8_t const* aRgba, std::uint32_t aWidth, std::uint32_t aHeight, std::uint32_t aBx, std::uint32_t aBy, Block_& aBlock )
+	{
+		for( std::uint32_t y = 0; y < 4; ++y )
+		{
+			std::uint32_t const sy = std::min( aBy*4 + y, aHeight-1 );
+			for( std::uint32_t x = 0; x < 4; ++x )
+			{
+				std::uint32_t const sx = std::min( aBx*4 + x, aWidth-1 );
+				std::uint8_t const* src = aRgba + (std::size_t(sy) * aWidth + sx) * 4;
+
+				for( std::uint32_t ch = 0; ch < 4; ++ch )
+					aBlock.c[ch][y*4+x] = float(src[ch]);
+			}
+		}
+	}
+
+	// Assigns each pixel the nearest of the aCount palette entries, using a
+	// per-channel weighted squared distance. Returns the total error.
+	float select_indices_( Block_ const& aBlock, float const (*aPalette)[4], std::uint32_t aCount, float const aWeights[4], std::uint8_t aIndices[16] )
+	{
+		assert( aCount > 0 && aCount <= 16 );
+
+#		if LUT_BCENC_SSE2_
+		__m128 const w0 = _mm_set1_ps( aWeights[0] );
+		__m128 const w1 = _mm_set1_ps( aWeights[1] );
+		__m128 const w2 = _mm_set1_ps( aWeights[2] );
+		__m128 const w3 = _mm_set1_ps( aWeights[3] );
+
+		__m128 total = _mm_setzero_ps();
+
+		// Four pixels at a time
+		for( std::uint32_t p = 0; p < 16; p += 4 )
+		{
+			__m128 const r = _mm_load_ps( aBlock.c[0] + p );
+			__m128 const g = _mm_load_ps( aBlock.c[1] + p );
+			__m128 const b = _mm_load_ps( aBlock.c[2] + p );
+			__m128 const a = _mm_load_ps( aBlock.c[3] + p );
+
+			__m128 best = _mm_set1_ps( std::numeric_limits<float>::max() );
+			__m128i bestIndex = _mm_setzero_si128();
+
+			for( std::uint32_t i = 0; i < aCount; ++i )
+			{
+				__m128 const dr = _mm_sub_ps( r, _mm_set1_ps( aPalette[i][0] ) );
+				__m128 const dg = _mm_sub_ps( g, _mm_set1_ps( aPalette[i][1] ) );
+				__m128 const db = _mm_sub_ps( b, _mm_set1_ps( aPalette[i][2] ) );
+				__m128 const da = _mm_sub_ps( a, _mm_set1_ps( aPalette[i][3] ) );
+
+				__m128 d = _mm_mul_ps( w0, _mm_mul_ps( dr, dr ) );
+				d = _mm_add_ps( d, _mm_mul_ps( w1, _mm_mul_ps( dg, dg ) ) );
+				d = _mm_add_ps( d, _mm_mul_ps( w2, _mm_mul_ps( db, db ) ) );
+				d = _mm_add_ps( d, _mm_mul_ps( w3, _mm_mul_ps( da, da ) ) );
+
+				__m128i const closer = _mm_castps_si128( _mm_cmplt_ps( d, best ) );
+				best = _mm_min_ps( d, best );
+				bestIndex = _mm_or_si128(
+					_mm_and_si128( closer, _mm_set1_epi32( int(i) ) ),
+					_mm_andnot_si128( closer, bestIndex )
+				);
+			}
+
+			total = _mm_add_ps( total, best );
+
+			alignas(16) std::int32_t indices[4];
+			_mm_store_si128( reinterpret_cast<__m128i*>(indices), bestIndex );
+
+			for( std::uint32_t k = 0; k < 4; ++k )
+				aIndices[p+k] = std::uint8_t(indices[k]);
+		}
+
+		alignas(16) float sums[4];
+		_mm_store_ps( sums, total );
+		return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+#		else // !SSE2
+		float total = 0.f;
+		for( std::uint32_t p = 0; p < 16; ++p )
+		{
+			float best = std::numeric_limits<float>::max();
+			std::uint8_t bestIndex = 0;
+
+			for( std::uint32_t i = 0; i < aCount; ++i )
+			{
+				float d = 0.f;
+				for( std::uint32_t ch = 0; ch < 4; ++ch )
+				{
+					float const diff = aBlock.c[ch][p] - aPalette[i][ch];
+					d += aWeights[ch] * diff * diff;
+				}
+
+				if( d < best )
+				{
+					best = d;
+					bestIndex = std::uint8_t(i);
+				}
+			}
+
+			aIndices[p] = bestIndex;
+			total += best;
+		}
+
+		return total;
+#		endif // ~ SSE2
+	}
+
+	// Inset bounding box (J.M.P. van Waveren, "Real-Time DXT Compression",
+	// 2006). Cheap, but ignores correlation between channels.
+	Endpoints_ bbox_endpoints_( Block_ const& aBlock, std::uint32_t aChannels )
+	{
+		Endpoints_ ret{};
+		for( std::uint32_t ch = 0; ch < aChannels; ++ch )
+		{
+			auto const [lo, hi] = std::minmax_element( aBlock.c[ch], aBlock.c[ch] + 16 );
+			float const inset = (*hi - *lo) / 16.f;
+
+			ret.e[0][ch] = *lo + inset;
+			ret.e[1][ch] = *hi - inset;
+		}
+
+		return ret;
+	}
+
+	// Endpoints on the principal axis of the block's colors, found by power
+	// iteration on the covariance matrix.
+	Endpoints_ pca_endpoints_( Block_ const& aBlock, std::uint32_t aChannels )
+	{
+		float mean[4]{};
+		for( std::uint32_t ch = 0; ch < aChannels; ++ch )
+		{
+			for( std::uint32_t p = 0; p < 16; ++p )
+				mean[ch] += aBlock.c[ch][p];
+
+			mean[ch] /= 16.f;
+		}
+
+		float cov[4][4]{};
+		for( std::uint32_t p = 0; p < 16; ++p )
+		{
+			float d[4]{};
+			for( std::uint32_t ch = 0; ch < aChannels; ++ch )
+				d[ch] = aBlock.c[ch][p] - mean[ch];
+
+			for( std::uint32_t i = 0; i < aChannels; ++i )
+			{
+				for( std::uint32_t j = 0; j < aChannels; ++j )
+					cov[i][j] += d[i] * d[j];
+			}
+		}
+
+		// Start from the row with the largest variance. This avoids starting
+		// orthogonal to the principal axis in most cases.
+		std::uint32_t start = 0;
+		for( std::uint32_t ch = 1; ch < aChannels; ++ch )
+		{
+			if( cov[ch][ch] > cov[start][start] )
+				start = ch;
+		}
+
+		float axis[4]{};
+		for( std::uint32_t ch = 0; ch < aChannels; ++ch )
+			axis[ch] = cov[start][ch];
+
+		for( std::uint32_t iter = 0; iter < 8; ++iter )
+		{
+			float next[4]{};
+			float largest = 0.f;
+			for( std::uint32_t i = 0; i < aChannels; ++i )
+			{
+				for( std::uint32_t j = 0; j < aChannels; ++j )
+					next[i] += cov[i][j] * axis[j];
+
+				largest = std::max( largest, std::abs( next[i] ) );
+			}
+
+			if( largest < 1e-6f )
+				break;
+
+			for( std::uint32_t ch = 0; ch < aChannels; ++ch )
+				axis[ch] = next[ch] / largest;
+		}
+
+		float length2 = 0.f;
+		for( std::uint32_t ch = 0; ch < aChannels; ++ch )
+			length2 += axis[ch] * axis[ch];
+
+		Endpoints_ ret{};
+		if( length2 < 1e-12f )
+		{
+			// Constant block
+			for( std::uint32_t ch = 0; ch < aChannels; ++ch )
+				ret.e[0][ch] = ret.e[1][ch] = mean[ch];
+
+			return ret;
+		}
+
+		float const invLength = 1.f / std::sqrt( length2 );
+		for( std::uint32_t ch = 0; ch < aChannels; ++ch )
+			axis[ch] *= invLength;
+
+		float tmin = std::numeric_limits<float>::max();
+		float tmax = std::numeric_limits<float>::lowest();
+		for( std::uint32_t p = 0; p < 16; ++p )
+		{
+			float t = 0.f;
+			for( std::uint32_t ch = 0; ch < aChannels; ++ch )
+				t += (aBlock.c[ch][p] - mean[ch]) * axis[ch];
+
+			tmin = std::min( tmin, t );
+			tmax = std::max( tmax, t );
+		}
+
+		for( std::uint32_t ch = 0; ch < aChannels; ++ch )
+		{
+			ret.e[0][ch] = std::clamp( mean[ch] + tmin * axis[ch], 0.f, 255.f );
+			ret.e[1][ch] = std::clamp( mean[ch] + tmax * axis[ch], 0.f, 255.f );
+		}
+
+		return ret;
+	}
+
+	// Least squares fit of the endpoints to the block, keeping the current
+	// indices. aIndexWeights gives the position of each index between e[0]
+	// (0) and e[1] (1). Returns false if the system is degenerate (e.g., all
+	// pixels use the same index).
+	bool refine_endpoints_( Block_ const& aBlock, std::uint32_t aChannels, std::uint8_t const aIndices[16], float const* aIndexWeights, Endpoints_& aOut )
+	{
+		float aa = 0.f, ab = 0.f, bb = 0.f;
+		float ra[4]{}, rb[4]{};
+
+		for( std::uint32_t p = 0; p < 16; ++p )
+		{
+			float const w = aIndexWeights[aIndices[p]];
+			float const a = 1.f - w;
+
+			aa += a * a;
+			ab += a * w;
+			bb += w * w;
+
+			for( std::uint32_t ch = 0; ch < aChannels; ++ch )
+			{
+				ra[ch] += a * aBlock.c[ch][p];
+				rb[ch] += w * aBlock.c[ch][p];
+			}
+		}
+
+		float const det = aa * bb - ab * ab;
+		if( std::abs( det ) < 1e-6f )
+			return false;
+
+		float const invDet = 1.f / det;
+		for( std::uint32_t ch = 0; ch < aChannels; ++ch )
+		{
+			aOut.e[0][ch] = std::clamp( (ra[ch] * bb - rb[ch] * ab) * invDet, 0.f, 255.f );
+			aOut.e[1][ch] = std::clamp( (rb[ch] * aa - ra[ch] * ab) * invDet, 0.f, 255.f );
+		}
+
+		return true;
+	}
+}
+
+// BC1
+namespace
+{
+	constexpr float kBc1ChannelWeights_[4] = { 1.f, 1.f, 1.f, 0.f };
+	constexpr float kBc1IndexWeights_[4] = { 0.f, 1.f, 1.f/3.f, 2.f/3.f };
+
+	struct Bc1Block_
+	{
+		std::uint16_t c0, c1;
+		std::uint8_t indices[16];
+		float error;
+	};
+
+	std::uint16_t pack_565_( float const aColor[4] )
+	{
+		auto const quantize = [] (float aV, float aMax) {
+			return std::uint32_t(std::clamp( aV * aMax / 255.f + 0.5f, 0.f, aMax ));
+		};
+
+		return std::uint16_t((quantize( aColor[0], 31.f ) << 11) | (quantize( aColor[1], 63.f ) << 5) | quantize( aColor[2], 31.f ));
+	}
+
+	void unpack_565_( std::uint16_t aColor, float aOut[4] )
+	{
+		std::uint32_t const r = (aColor >> 11) & 31;
+		std::uint32_t const g = (aColor >> 5) & 63;
+		std::uint32_t const b = aColor & 31;
+
+		aOut[0] = float((r << 3) | (r >> 2));
+		aOut[1] = float((g << 2) | (g >> 4));
+		aOut[2] = float((b << 3) | (b >> 2));
+		aOut[3] = 255.f;
+	}
+
+	Bc1Block_ encode_bc1_candidate_( Block_ const& aBlock, Endpoints_ const& aEndpoints )
+	{
+		Bc1Block_ ret;
+		ret.c0 = pack_565_( aEndpoints.e[0] );
+		ret.c1 = pack_565_( aEndpoints.e[1] );
+
+		// c0 > c1 selects the four color mode. Indices are recomputed below,
+		// so swapping the endpoints is fine.
+		if( ret.c0 < ret.c1 )
+			std::swap( ret.c0, ret.c1 );
+
+		float palette[4][4];
+		unpack_565_( ret.c0, palette[0] );
+		unpack_565_( ret.c1, palette[1] );
+
+		for( std::uint32_t ch = 0; ch < 4; ++ch )
+		{
+			palette[2][ch] = (2.f * palette[0][ch] + palette[1][ch]) / 3.f;
+			palette[3][ch] = (palette[0][ch] + 2.f * palette[1][ch]) / 3.f;
+		}
+
+		// If c0 == c1, the block is in three color mode. Index 0 still
+		// decodes to c0, which is the only color in that case.
+		std::uint32_t const count = ret.c0 == ret.c1 ? 1 : 4;
+		ret.error = select_indices_( aBlock, palette, count, kBc1ChannelWeights_, ret.indices );
+		return ret;
+	}
+
+	void encode_bc1_block_( Block_ const& aBlock, labutils::BcQuality aQuality, std::uint8_t* aOut )
+	{
+		auto ep = labutils::BcQuality::fast == aQuality ? bbox_endpoints_( aBlock, 3 ) : pca_endpoints_( aBlock, 3 );
+		auto best = encode_bc1_candidate_( aBlock, ep );
+
+		for( std::uint32_t i = 0; i < refine_steps_( aQuality ) && best.error > 0.f; ++i )
+		{
+			if( !refine_endpoints_( aBlock, 3, best.indices, kBc1IndexWeights_, ep ) )
+				break;
+
+			auto const candidate = encode_bc1_candidate_( aBlock, ep );
+			if( candidate.error >= best.error )
+				break;
+
+			best = candidate;
+		}
+
+		std::uint32_t indices = 0;
+		for( std::uint32_t p = 0; p < 16; ++p )
+			indices |= std::uint32_t(best.indices[p]) << (2*p);
+
+		aOut[0] = std::uint8_t(best.c0 & 0xff);
+		aOut[1] = std::uint8_t(best.c0 >> 8);
+		aOut[2] = std::uint8_t(best.c1 & 0xff);
+		aOut[3] = std::uint8_t(best.c1 >> 8);
+
+		for( std::uint32_t i = 0; i < 4; ++i )
+			aOut[4+i] = std::uint8_t((indices >> (8*i)) & 0xff);
+	}
+}
+
+// BC4 (and BC5, which is two BC4 blocks)
+namespace
+{
+	constexpr float kBc4IndexWeights8_[8] = { 0.f, 1.f, 1.f/7.f, 2.f/7.f, 3.f/7.f, 4.f/7.f, 5.f/7.f, 6.f/7.f };
+
+	struct Bc4Block_
+	{
+		std::uint8_t r0, r1;
+		std::uint8_t indices[16];
+		float error;
+	};
+
+	Bc4Block_ encode_bc4_candidate_( Block_ const& aBlock, std::uint32_t aChannel, std::uint8_t aR0, std::uint8_t aR1 )
+	{
+		float values[8];
+		values[0] = aR0;
+		values[1] = aR1;
+
+		if( aR0 > aR1 )
+		{
+			for( std::uint32_t i = 1; i <= 6; ++i )
+				values[1+i] = (float(7-i) * aR0 + float(i) * aR1) / 7.f;
+		}
+		else
+		{
+			for( std::uint32_t i = 1; i <= 4; ++i )
+				values[1+i] = (float(5-i) * aR0 + float(i) * aR1) / 5.f;
+
+			values[6] = 0.f;
+			values[7] = 255.f;
+		}
+
+		// Only aChannel is compared; see select_indices_().
+		float palette[8][4]{};
+		float weights[4]{};
+		weights[aChannel] = 1.f;
+
+		for( std::uint32_t i = 0; i < 8; ++i )
+			palette[i][aChannel] = values[i];
+
+		Bc4Block_ ret;
+		ret.r0 = aR0;
+		ret.r1 = aR1;
+		ret.error = select_indices_( aBlock, palette, 8, weights, ret.indices );
+		return ret;
+	}
+
+	// Endpoints for the eight value mode, which requires r0 > r1
+	std::pair<std::uint8_t,std::uint8_t> bc4_endpoints8_( float aHi, float aLo )
+	{
+		int r0 = int(std::clamp( aHi + 0.5f, 0.f, 255.f ));
+		int r1 = int(std::clamp( aLo + 0.5f, 0.f, 255.f ));
+
+		if( r0 < r1 )
+			std::swap( r0, r1 );
+
+		if( r0 == r1 )
+		{
+			if( r0 < 255 ) ++r0;
+			else --r1;
+		}
+
+		return { std::uint8_t(r0), std::uint8_t(r1) };
+	}
+
+	void encode_bc4_block_( Block_ const& aBlock, std::uint32_t aChannel, labutils::BcQuality aQuality, std::uint8_t* aOut )
+	{
+		float const* values = aBlock.c[aChannel];
+		auto const [lo, hi] = std::minmax_element( values, values + 16 );
+
+		Bc4Block_ best;
+		if( *lo == *hi )
+		{
+			best = encode_bc4_candidate_( aBlock, aChannel, std::uint8_t(*lo), std::uint8_t(*lo) );
+		}
+		else
+		{
+			auto const [r0, r1] = bc4_endpoints8_( *hi, *lo );
+			best = encode_bc4_candidate_( aBlock, aChannel, r0, r1 );
+
+			Endpoints_ ep{};
+			for( std::uint32_t i = 0; i < refine_steps_( aQuality ) && best.error > 0.f; ++i )
+			{
+				// Use the current endpoints to give the pixels their weights;
+				// index 0 is r0 (e[0]) and index 1 is r1 (e[1]).
+				if( !refine_endpoints_( aBlock, 4, best.indices, kBc4IndexWeights8_, ep ) )
+					break;
+
+				auto const [c0, c1] = bc4_endpoints8_( ep.e[0][aChannel], ep.e[1][aChannel] );
+				auto const candidate = encode_bc4_candidate_( aBlock, aChannel, c0, c1 );
+				if( candidate.error >= best.error )
+					break;
+
+				best = candidate;
+			}
+
+			// The six value mode has explicit 0 and 255 entries, which helps
+			// blocks that contain a few extreme values.
+			if( labutils::BcQuality::high == aQuality && best.error > 0.f )
+			{
+				float inLo = 255.f, inHi = 0.f;
+				for( std::uint32_t p = 0; p < 16; ++p )
+				{
+					if( values[p] > 0.f && values[p] < 255.f )
+					{
+						inLo = std::min( inLo, values[p] );
+						inHi = std::max( inHi, values[p] );
+					}
+				}
+
+				if( inLo <= inHi )
+				{
+					auto const candidate = encode_bc4_candidate_( aBlock, aChannel, std::uint8_t(inLo), std::uint8_t(inHi) );
+					if( candidate.error < best.error )
+						best = candidate;
+				}
+			}
+		}
+
+		std::uint64_t indices = 0;
+		for( std::uint32_t p = 0; p < 16; ++p )
+			indices |= std::uint64_t(best.indices[p]) << (3*p);
+
+		aOut[0] = best.r0;
+		aOut[1] = best.r1;
+
+		for( std::uint32_t i = 0; i < 6; ++i )
+			aOut[2+i] = std::uint8_t((indices >> (8*i)) & 0xff);
+	}
+}
+
+// BC7 (mode 6)
+namespace
+{
+	constexpr float kBc7ChannelWeights_[4] = { 1.f, 1.f, 1.f, 1.f };
+	constexpr std::uint32_t kBc7Weights4_[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	constexpr float kBc7IndexWeights4_[16] = {
+		0.f/64.f, 4.f/64.f, 9.f/64.f, 13.f/64.f, 17.f/64.f, 21.f/64.f, 26.f/64.f, 30.f/64.f,
+		34.f/64.f, 38.f/64.f, 43.f/64.f, 47.f/64.f, 51.f/64.f, 55.f/64.f, 60.f/64.f, 64.f/64.f
+	};
+
+	struct Bc7Block_
+	{
+		std::uint8_t q[2][4]; // 7-bit endpoints
+		std::uint8_t p[2]; // p-bits
+		std::uint8_t indices[16];
+		float error;
+	};
+
+	std::uint32_t quantize_7p_( float aValue, std::uint32_t aPBit )
+	{
+		return std::uint32_t(std::clamp( std::floor( (aValue - float(aPBit)) * 0.5f + 0.5f ), 0.f, 127.f ));
+	}
+
+	// P-bit that minimizes the quantization error of the endpoint
+	std::uint32_t best_pbit_( float const aEndpoint[4] )
+	{
+		float err[2]{};
+		for( std::uint32_t p = 0; p < 2; ++p )
+		{
+			for( std::uint32_t ch = 0; ch < 4; ++ch )
+			{
+				float const d = aEndpoint[ch] - float((quantize_7p_( aEndpoint[ch], p ) << 1) | p);
+				err[p] += d * d;
+			}
+		}
+
+		return err[1] < err[0] ? 1 : 0;
+	}
+
+	Bc7Block_ encode_bc7_candidate_( Block_ const& aBlock, Endpoints_ const& aEndpoints, std::uint32_t aP0, std::uint32_t aP1 )
+	{
+		Bc7Block_ ret;
+		ret.p[0] = std::uint8_t(aP0);
+		ret.p[1] = std::uint8_t(aP1);
+
+		std::uint32_t ends[2][4];
+		for( std::uint32_t e = 0; e < 2; ++e )
+		{
+			for( std::uint32_t ch = 0; ch < 4; ++ch )
+			{
+				ret.q[e][ch] = std::uint8_t(quantize_7p_( aEndpoints.e[e][ch], ret.p[e] ));
+				ends[e][ch] = (std::uint32_t(ret.q[e][ch]) << 1) | ret.p[e];
+			}
+		}
+
+		float palette[16][4];
+		for( std::uint32_t i = 0; i < 16; ++i )
+		{
+			for( std::uint32_t ch = 0; ch < 4; ++ch )
+				palette[i][ch] = float(((64 - kBc7Weights4_[i]) * ends[0][ch] + kBc7Weights4_[i] * ends[1][ch] + 32) >> 6);
+		}
+
+		ret.error = select_indices_( aBlock, palette, 16, kBc7ChannelWeights_, ret.indices );
+		return ret;
+	}
+
+	Bc7Block_ encode_bc7_endpoints_( Block_ const& aBlock, Endpoints_ const& aEndpoints, labutils::BcQuality aQuality )
+	{
+		if( labutils::BcQuality::high != aQuality )
+			return encode_bc7_candidate_( aBlock, aEndpoints, best_pbit_( aEndpoints.e[0] ), best_pbit_( aEndpoints.e[1] ) );
+
+		// Try all p-bit combinations
+		auto best = encode_bc7_candidate_( aBlock, aEndpoints, 0, 0 );
+		for( std::uint32_t pbits = 1; pbits < 4; ++pbits )
+		{
+			auto const candidate = encode_bc7_candidate_( aBlock, aEndpoints, pbits & 1, pbits >> 1 );
+			if( candidate.error < best.error )
+				best = candidate;
+		}
+
+		return best;
+	}
+
+	struct BitWriter_
+	{
+		std::uint8_t* out;
+		std::uint32_t pos = 0;
+
+		void put( std::uint32_t aValue, std::uint32_t aBits )
+		{
+			for( std::uint32_t i = 0; i < aBits; ++i, ++pos )
+			{
+				if( (aValue >> i) & 1 )
+					out[pos >> 3] |= std::uint8_t(1u << (pos & 7));
+			}
+		}
+	};
+
+	void encode_bc7_block_( Block_ const& aBlock, labutils::BcQuality aQuality, std::uint8_t* aOut )
+	{
+		auto ep = labutils::BcQuality::fast == aQuality ? bbox_endpoints_( aBlock, 4 ) : pca_endpoints_( aBlock, 4 );
+		auto best = encode_bc7_endpoints_( aBlock, ep, aQuality );
+
+		for( std::uint32_t i = 0; i < refine_steps_( aQuality ) && best.error > 0.f; ++i )
+		{
+			if( !refine_endpoints_( aBlock, 4, best.indices, kBc7IndexWeights4_, ep ) )
+				break;
+
+			auto const candidate = encode_bc7_endpoints_( aBlock, ep, aQuality );
+			if( candidate.error >= best.error )
+				break;
+
+			best = candidate;
+		}
+
+		// The anchor index (pixel 0) is stored with its MSB implied to be
+		// zero. Swap the endpoints if necessary.
+		if( best.indices[0] & 8 )
+		{
+			for( std::uint32_t ch = 0; ch < 4; ++ch )
+				std::swap( best.q[0][ch], best.q[1][ch] );
+
+			std::swap( best.p[0], best.p[1] );
+
+			for( auto& index : best.indices )
+				index = std::uint8_t(15 - index);
+		}
+
+		std::memset( aOut, 0, 16 );
+		BitWriter_ bits{ aOut };
+
+		bits.put( 1u << 6, 7 ); // mode 6: six zero bits, followed by a one
+
+		for( std::uint32_t ch = 0; ch < 4; ++ch )
+		{
+			bits.put( best.q[0][ch], 7 );
+			bits.put( best.q[1][ch], 7 );
+		}
+
+		bits.put( best.p[0], 1 );
+		bits.put( best.p[1], 1 );
+
+		bits.put( best.indices[0], 3 );
+		for( std::uint32_t p = 1; p < 16; ++p )
+			bits.put( best.indices[p], 4 );
+
+		assert( 128 == bits.pos );
+	}
+}
+
+namespace
+{
+	void encode_block_( labutils::BcFormat aFormat, labutils::BcQuality aQuality, Block_ const& aBlock, std::uint8_t* aOut )
+	{
+		switch( aFormat )
+		{
+			case labutils::BcFormat::bc1:
+				encode_bc1_block_( aBlock, aQuality, aOut );
+				break;
+			case labutils::BcFormat::bc4:
+				encode_bc4_block_( aBlock, 0, aQuality, aOut );
+				break;
+			case labutils::BcFormat::bc5:
+				encode_bc4_block_( aBlock, 0, aQuality, aOut );
+				encode_bc4_block_( aBlock, 1, aQuality, aOut + 8 );
+				break;
+			case labutils::BcFormat::bc7:
+				encode_bc7_block_( aBlock, aQuality, aOut );
+				break;
+		}
+	}
+}
+
+namespace labutils
+{
+	char const* to_string( BcFormat aFormat )
+	{
+		switch( aFormat )
+		{
+			case BcFormat::bc1: return "BC1";
+			case BcFormat::bc4: return "BC4";
+			case BcFormat::bc5: return "BC5";
+			case BcFormat::bc7: return "BC7";
+		}
+
+		return "unknown";
+	}
+
+	char const* to_string( BcQuality aQuality )
+	{
+		switch( aQuality )
+		{
+			case BcQuality::fast: return "fast";
+			case BcQuality::normal: return "normal";
+			case BcQuality::high: return "high";
+		}
+
+		return "unknown";
+	}
+
+	std::size_t bc_block_bytes( BcFormat aFormat ) noexcept
+	{
+		return (BcFormat::bc1 == aFormat || BcFormat::bc4 == aFormat) ? 8 : 16;
+	}
+
+	std::size_t bc_compressed_size( BcFormat aFormat, std::uint32_t aWidth, std::uint32_t aHeight ) noexcept
+	{
+		std::size_t const blocksX = (aWidth + 3) / 4;
+		std::size_t const blocksY = (aHeight + 3) / 4;
+		return blocksX * blocksY * bc_block_bytes( aFormat );
+	}
+
+	void encode_bc( BcFormat aFormat, BcQuality aQuality, std::uint8_t const* aRgba, std::uint32_t aWidth, std::uint32_t aHeight, void* aOut, std::uint32_t aThreadCount )
+	{
+		LUT_TRACE_SCOPE( "encode_bc" );
+
+		assert( aRgba && aOut );
+		assert( aWidth > 0 && aHeight > 0 );
+
+		std::uint32_t const blocksX = (aWidth + 3) / 4;
+		std::uint32_t const blocksY = (aHeight + 3) / 4;
+		std::size_t const blockBytes = bc_block_bytes( aFormat );
+
+		auto* out = static_cast<std::uint8_t*>(aOut);
+
+		parallel_for( blocksY, [&] (std::size_t aBegin, std::size_t aEnd) {
+			Block_ block;
+			for( std::size_t by = aBegin; by < aEnd; ++by )
+			{
+				for( std::uint32_t bx = 0; bx < blocksX; ++bx )
+				{
+					load_block_( aRgba, aWidth, aHeight, bx, std::uint32_t(by), block );
+
+					// Encode into a local buffer first. aOut may point to
+					// write-combined memory (e.g., a mapped staging buffer),
+					// which must not be read from.
+					std::uint8_t encoded[16];
+					encode_block_( aFormat, aQuality, block, encoded );
+
+					std::memcpy( out + (by * blocksX + bx) * blockBytes, encoded, blockBytes );
+				}
+			}
+		}, aThreadCount );
+	}
+
+	std::vector<std::uint8_t> encode_bc( BcFormat aFormat, BcQuality aQuality, std::uint8_t const* aRgba, std::uint32_t aWidth, std::uint32_t aHeight, std::uint32_t aThreadCount )
+	{
+		std::vector<std::uint8_t> ret( bc_compressed_size( aFormat, aWidth, aHeight ) );
+		encode_bc( aFormat, aQuality, aRgba, aWidth, aHeight, ret.data(), aThreadCount );
+		return ret;
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace labutils
+{
+	// CPU block compression (BCn) encoder.
+	//
+	// Input is a tightly packed RGBA8 image. The image is encoded in 4x4
+	// blocks; blocks that extend past the right or bottom edge are padded by
+	// repeating the last column/row. Which channels are used depends on the
+	// format:
+	//
+	//   bc1  RGB, 8 bytes/block (alpha is ignored; always opaque)
+	//   bc4  R, 8 bytes/block
+	//   bc5  RG, 16 bytes/block
+	//   bc7  RGBA, 16 bytes/block (mode 6 only: one subset, 4-bit indices)
+	//
+	// The encoder does not care about color spaces. sRGB data is encoded as
+	// is and should be uploaded to an _SRGB_BLOCK format.
+	//
+	// Quality presets:
+	//   fast    bounding box endpoints, no refinement
+	//   normal  principal axis endpoints, one least squares refinement step
+	//   high    as normal, with more refinement steps and additional
+	//           candidate encodings (BC7 p-bits, BC4 six-value mode)
+	//
+	// In all presets, indices are chosen as the nearest palette entry. This
+	// is vectorized with SSE2 where available. Rows of blocks are encoded in
+	// parallel (see parallel_for()).
+	enum class BcFormat
+	{
+		bc1,
+		bc4,
+		bc5,
+		bc7
+	};
+
+	enum class BcQuality
+	{
+		fast,
+		normal,
+		high
+	};
+
+	char const* to_string( BcFormat );
+	char const* to_string( BcQuality );
+
+	std::size_t bc_block_bytes( BcFormat ) noexcept;
+	std::size_t bc_compressed_size( BcFormat, std::uint32_t aWidth, std::uint32_t aHeight ) noexcept;
+
+	// aOut must have room for bc_compressed_size() bytes. Blocks are written
+	// in row-major order. aThreadCount = 0 uses default_thread_count().
+	void encode_bc(
+		BcFormat,
+		BcQuality,
+		std::uint8_t const* aRgba,
+		std::uint32_t aWidth, std::uint32_t aHeight,
+		void* aOut,
+		std::uint32_t aThreadCount = 0
+	);
+
+	std::vector<std::uint8_t> encode_bc(
+		BcFormat,
+		BcQuality,
+		std::uint8_t const* aRgba,
+		std::uint32_t aWidth, std::uint32_t aHeight,
+		std::uint32_t aThreadCount = 0
+	);
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,266 @@
+#include "gpu_profiler.hpp"
+
+#include <utility>
+#include <algorithm>
+
+#include <cassert>
+#include <cstring>
+
+#include "error.hpp"
+#include "to_string.hpp"
+
+namespace
+{
+	// Number of results per scope kept for report()
+	constexpr std::size_t kReportWindow = 128;
+
+	constexpr std::uint32_t kInvalidScope = ~std::uint32_t(0);
+}
+
+namespace labutils
+{
+	GpuProfiler::GpuProfiler() noexcept = default;
+	GpuProfiler::~GpuProfiler() = default;
+
+	GpuProfiler::GpuProfiler( GpuProfiler&& ) noexcept = default;
+	GpuProfiler& GpuProfiler::operator=( GpuProfiler&& ) noexcept = default;
+
+
+	bool GpuProfiler::enabled() const noexcept
+	{
+		return VK_NULL_HANDLE != mPool.handle;
+	}
+
+	std::uint64_t GpuProfiler::frame_count() const noexcept
+	{
+		return mFrame;
+	}
+
+	void GpuProfiler::begin_frame( VkCommandBuffer aCmdBuff )
+	{
+		if( !enabled() )
+			return;
+
+		auto const slot = std::uint32_t(mFrame % mSlots.size());
+
+		// Results from the last use of this slot should be available by now.
+		// The reset below is recorded into the command buffer, so it takes
+		// effect only after any earlier submissions.
+		resolve_slot_( slot );
+
+		vkCmdResetQueryPool( aCmdBuff, mPool.handle, slot * mMaxScopes * 2, mMaxScopes * 2 );
+
+		mSlots[slot].frame = mFrame;
+		mFrameOpen = true;
+		++mFrame;
+	}
+
+	std::uint32_t GpuProfiler::begin_scope( VkCommandBuffer aCmdBuff, char const* aName, VkPipelineStageFlagBits aStage )
+	{
+		if( !enabled() || !mFrameOpen )
+			return kInvalidScope;
+
+		auto const slot = std::uint32_t((mFrame-1) % mSlots.size());
+		auto& scopes = mSlots[slot].scopes;
+
+		if( scopes.size() >= mMaxScopes )
+			return kInvalidScope;
+
+		auto const scope = std::uint32_t(scopes.size());
+		scopes.emplace_back( Scope_{ find_stat_( aName ) } );
+
+		vkCmdWriteTimestamp( aCmdBuff, aStage, mPool.handle, (slot * mMaxScopes + scope) * 2 );
+		return scope;
+	}
+
+	void GpuProfiler::end_scope( VkCommandBuffer aCmdBuff, std::uint32_t aScope, VkPipelineStageFlagBits aStage )
+	{
+		if( !enabled() || !mFrameOpen || kInvalidScope == aScope )
+			return;
+
+		auto const slot = std::uint32_t((mFrame-1) % mSlots.size());
+		assert( aScope < mSlots[slot].scopes.size() );
+
+		vkCmdWriteTimestamp( aCmdBuff, aStage, mPool.handle, (slot * mMaxScopes + aScope) * 2 + 1 );
+	}
+
+	void GpuProfiler::resolve_all()
+	{
+		if( !enabled() )
+			return;
+
+		// Oldest frame first, so that onResolve sees results in order
+		auto const slotCount = std::uint32_t(mSlots.size());
+		for( std::uint32_t i = 0; i < slotCount; ++i )
+			resolve_slot_( std::uint32_t((mFrame + i) % slotCount) );
+	}
+
+	std::vector<GpuProfiler::ScopeReport> GpuProfiler::report() const
+	{
+		std::vector<ScopeReport> ret;
+		for( auto const& stat : mStats )
+		{
+			ScopeReport rep{};
+			rep.name = stat.name;
+			rep.samples = stat.window.size();
+			rep.lastMs = stat.last;
+
+			if( !stat.window.empty() )
+			{
+				double sum = 0.0;
+				rep.minMs = rep.maxMs = stat.window.front();
+				for( auto const ms : stat.window )
+				{
+					sum += ms;
+					rep.minMs = std::min( rep.minMs, ms );
+					rep.maxMs = std::max( rep.maxMs, ms );
+				}
+
+				rep.avgMs = sum / double(stat.window.size());
+			}
+
+			ret.emplace_back( std::move(rep) );
+		}
+
+		return ret;
+	}
+
+	void GpuProfiler::print_report( std::FILE* aOut ) const
+	{
+		if( !enabled() )
+			return;
+
+		std::fprintf( aOut, "GPU scope            last ms   avg ms   min ms   max ms  (samples)\n" );
+		for( auto const& rep : report() )
+		{
+			std::fprintf( aOut, "  %-18s %8.3f %8.3f %8.3f %8.3f  (%zu)\n", rep.name.c_str(), rep.lastMs, rep.avgMs, rep.minMs, rep.maxMs, rep.samples );
+		}
+	}
+
+	void GpuProfiler::resolve_slot_( std::uint32_t aSlot )
+	{
+		auto& slot = mSlots[aSlot];
+		if( slot.scopes.empty() )
+			return;
+
+		// Each query produces a (value, availability) pair. Not waiting means
+		// that the call may return VK_NOT_READY; available results are still
+		// written in that case.
+		auto const queryCount = std::uint32_t(slot.scopes.size() * 2);
+		std::vector<std::uint64_t> results( queryCount * 2 );
+
+		auto const res = vkGetQueryPoolResults( mDevice, mPool.handle,
+			aSlot * mMaxScopes * 2, queryCount,
+			results.size() * sizeof(std::uint64_t), results.data(), 2 * sizeof(std::uint64_t),
+			VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+		);
+
+		if( VK_SUCCESS != res && VK_NOT_READY != res )
+		{
+			throw Error( "Unable to get timestamp query results\n"
+				"vkGetQueryPoolResults() returned %s", to_string(res).c_str()
+			);
+		}
+
+		for( std::size_t i = 0; i < slot.scopes.size(); ++i )
+		{
+			std::uint64_t const* begin = &results[i*4];
+			std::uint64_t const* end = &results[i*4+2];
+
+			if( !begin[1] || !end[1] )
+				continue;
+
+			double const ms = double((end[0] - begin[0]) & mMask) * mPeriodNs * 1e-6;
+
+			auto& stat = mStats[slot.scopes[i].stat];
+			stat.last = ms;
+
+			if( stat.window.size() < kReportWindow )
+				stat.window.emplace_back( ms );
+			else
+				stat.window[stat.next] = ms;
+
+			stat.next = (stat.next + 1) % kReportWindow;
+
+			if( onResolve )
+				onResolve( stat.name.c_str(), slot.frame, ms );
+		}
+
+		slot.scopes.clear();
+	}
+
+	std::uint32_t GpuProfiler::find_stat_( char const* aName )
+	{
+		for( std::size_t i = 0; i < mStats.size(); ++i )
+		{
+			if( mStats[i].name == aName )
+				return std::uint32_t(i);
+		}
+
+		mStats.emplace_back();
+		mStats.back().name = aName;
+		return std::uint32_t(mStats.size()-1);
+	}
+}
+
+namespace labutils
+{
+	GpuProfiler create_gpu_profiler( VulkanContext const& aContext, std::uint32_t aFramesInFlight, std::uint32_t aMaxScopesPerFrame )
+	{
+		assert( aFramesInFlight > 0 && aMaxScopesPerFrame > 0 );
+
+		// Timestamps are supported on a queue if it reports a non-zero
+		// number of valid bits.
+		std::uint32_t familyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties( aContext.physicalDevice, &familyCount, nullptr );
+
+		std::vector<VkQueueFamilyProperties> families( familyCount );
+		vkGetPhysicalDeviceQueueFamilyProperties( aContext.physicalDevice, &familyCount, families.data() );
+
+		std::uint32_t const validBits = aContext.graphicsFamilyIndex < familyCount ? families[aContext.graphicsFamilyIndex].timestampValidBits : 0;
+		if( 0 == validBits )
+		{
+			std::fprintf( stderr, "Note: graphics queue does not support timestamps. GPU profiling disabled.\n" );
+			return GpuProfiler();
+		}
+
+		VkPhysicalDeviceProperties props{};
+		vkGetPhysicalDeviceProperties( aContext.physicalDevice, &props );
+
+		VkQueryPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		poolInfo.queryCount = aFramesInFlight * aMaxScopesPerFrame * 2;
+
+		VkQueryPool pool = VK_NULL_HANDLE;
+		if( auto const res = vkCreateQueryPool( aContext.device, &poolInfo, nullptr, &pool ); VK_SUCCESS != res )
+		{
+			throw Error( "Unable to create timestamp query pool\n"
+				"vkCreateQueryPool() returned %s", to_string(res).c_str()
+			);
+		}
+
+		GpuProfiler ret;
+		ret.mDevice = aContext.device;
+		ret.mPool = QueryPool( aContext.device, pool );
+		ret.mPeriodNs = props.limits.timestampPeriod;
+		ret.mMask = validBits >= 64 ? ~std::uint64_t(0) : ((std::uint64_t(1) << validBits) - 1);
+		ret.mMaxScopes = aMaxScopesPerFrame;
+		ret.mSlots.resize( aFramesInFlight );
+		return ret;
+	}
+}
+
+namespace labutils
+{
+	GpuScope::GpuScope( GpuProfiler& aProfiler, VkCommandBuffer aCmdBuff, char const* aName )
+		: mProfiler( aProfiler )
+		, mCmdBuff( aCmdBuff )
+		, mScope( aProfiler.begin_scope( aCmdBuff, aName ) )
+	{}
+
+	GpuScope::~GpuScope()
+	{
+		mProfiler.end_scope( mCmdBuff, mScope );
+	}
+}
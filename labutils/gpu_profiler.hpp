@@ -0,0 +1,144 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+
+#include "vkobject.hpp"
+#include "vulkan_context.hpp"
+
+namespace labutils
+{
+	// GPU timing with timestamp queries. Regions of a command buffer are
+	// bracketed with begin_scope()/end_scope() (or a GpuScope object):
+	//
+	//	profiler.begin_frame( cmd ); // outside of a render pass
+	//	{
+	//		GpuScope scope( profiler, cmd, "render pass" );
+	//		...
+	//	}
+	//
+	// A "frame" is any batch of command buffers that starts with
+	// begin_frame(), so one-off submissions such as uploads work the same way
+	// as per-frame rendering. Each frame uses its own slot of queries. Slots
+	// are reused round-robin, and results are read back (without waiting)
+	// just before a slot is reused, i.e., aFramesInFlight frames later.
+	// Results that are not yet available at that point are dropped.
+	//
+	// Per scope name, the profiler keeps a rolling window of the most recent
+	// results (see report()). onResolve, if set, additionally sees every
+	// individual result.
+	//
+	// A default-constructed GpuProfiler, or one created for a device whose
+	// graphics queue does not support timestamps, is disabled. All methods
+	// are then no-ops.
+	class GpuProfiler
+	{
+		public:
+			struct ScopeReport
+			{
+				std::string name;
+				std::size_t samples; // in rolling window
+
+				double lastMs, avgMs, minMs, maxMs;
+			};
+
+			using ResolveFn = std::function<void (char const* aName, std::uint64_t aFrame, double aMs)>;
+
+		public:
+			GpuProfiler() noexcept, ~GpuProfiler();
+
+			GpuProfiler( GpuProfiler const& ) = delete;
+			GpuProfiler& operator= (GpuProfiler const&) = delete;
+
+			GpuProfiler( GpuProfiler&& ) noexcept;
+			GpuProfiler& operator = (GpuProfiler&&) noexcept;
+
+		public:
+			bool enabled() const noexcept;
+
+			// Number of frames started so far. The next call to begin_frame()
+			// starts the frame with this index.
+			std::uint64_t frame_count() const noexcept;
+
+			void begin_frame( VkCommandBuffer );
+
+			std::uint32_t begin_scope( VkCommandBuffer, char const* aName, VkPipelineStageFlagBits = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT );
+			void end_scope( VkCommandBuffer, std::uint32_t aScope, VkPipelineStageFlagBits = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT );
+
+			// Read back all outstanding results. Call this once the GPU is
+			// idle (e.g., after vkDeviceWaitIdle()).
+			void resolve_all();
+
+			std::vector<ScopeReport> report() const;
+			void print_report( std::FILE* = stdout ) const;
+
+		public:
+			ResolveFn onResolve;
+
+		private:
+			friend GpuProfiler create_gpu_profiler( VulkanContext const&, std::uint32_t, std::uint32_t );
+
+			struct Scope_
+			{
+				std::uint32_t stat; // index into mStats
+			};
+			struct Slot_
+			{
+				std::uint64_t frame = 0;
+				std::vector<Scope_> scopes; // query 2*i and 2*i+1 of the slot
+			};
+			struct Stat_
+			{
+				std::string name;
+
+				std::vector<double> window;
+				std::size_t next = 0;
+				double last = 0.0;
+			};
+
+			void resolve_slot_( std::uint32_t );
+			std::uint32_t find_stat_( char const* );
+
+		private:
+			VkDevice mDevice = VK_NULL_HANDLE;
+			QueryPool mPool;
+
+			double mPeriodNs = 0.0;
+			std::uint64_t mMask = 0;
+
+			std::uint32_t mMaxScopes = 0; // per slot
+			std::uint64_t mFrame = 0;
+			bool mFrameOpen = false;
+
+			std::vector<Slot_> mSlots;
+			std::vector<Stat_> mStats;
+	};
+
+	GpuProfiler create_gpu_profiler( VulkanContext const&, std::uint32_t aFramesInFlight, std::uint32_t aMaxScopesPerFrame = 32 );
+
+
+	// RAII helper for begin_scope()/end_scope()
+	class GpuScope
+	{
+		public:
+			GpuScope( GpuProfiler&, VkCommandBuffer, char const* aName );
+			~GpuScope();
+
+			GpuScope( GpuScope const& ) = delete;
+			GpuScope& operator= (GpuScope const&) = delete;
+
+		private:
+			GpuProfiler& mProfiler;
+			VkCommandBuffer mCmdBuff;
+			std::uint32_t mScope;
+	};
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
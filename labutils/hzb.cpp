@@ -0,0 +1,301 @@
+#include "hzb.hpp"
+
+#include <algorithm>
+
+#include <cassert>
+
+#include "error.hpp"
+#include "vkutil.hpp"
+#include "to_string.hpp"
+
+namespace
+{
+	// Must match hzb.comp
+	constexpr std::uint32_t kWorkGroupSize = 8; // in each dimension
+
+	struct PushConstants_
+	{
+		std::int32_t sourceWidth, sourceHeight;
+		std::int32_t levelWidth, levelHeight;
+		std::uint32_t fromDepth;
+	};
+
+	labutils::ImageView create_view_( labutils::VulkanContext const& aContext, VkImage aImage, std::uint32_t aBaseLevel, std::uint32_t aLevelCount )
+	{
+		using labutils::Error;
+		using labutils::to_string;
+
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = aImage;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = VK_FORMAT_R32_SFLOAT;
+		viewInfo.components = VkComponentMapping{};
+		viewInfo.subresourceRange = VkImageSubresourceRange{
+			VK_IMAGE_ASPECT_COLOR_BIT,
+			aBaseLevel, aLevelCount,
+			0, 1
+		};
+
+		VkImageView view = VK_NULL_HANDLE;
+		if( auto const res = vkCreateImageView( aContext.device, &viewInfo, nullptr, &view ); VK_SUCCESS != res )
+		{
+			throw Error( "Unable to create depth pyramid view\n" "vkCreateImageView() returned %s", to_string(res).c_str() );
+		}
+
+		return labutils::ImageView( aContext.device, view );
+	}
+
+	VkImageMemoryBarrier image_barrier_info_( VkImage aImage, VkAccessFlags aSrcAccess, VkAccessFlags aDstAccess, VkImageLayout aSrcLayout, std::uint32_t aBaseLevel, std::uint32_t aLevelCount )
+	{
+		VkImageMemoryBarrier ret{};
+		ret.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		ret.srcAccessMask = aSrcAccess;
+		ret.dstAccessMask = aDstAccess;
+		ret.oldLayout = aSrcLayout;
+		ret.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		ret.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		ret.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		ret.image = aImage;
+		ret.subresourceRange = VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, aBaseLevel, aLevelCount, 0, 1 };
+		return ret;
+	}
+}
+
+namespace labutils
+{
+	bool is_depth_pyramid_supported( VulkanContext const& aContext, VkFormat aDepthFormat )
+	{
+		std::uint32_t familyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties( aContext.physicalDevice, &familyCount, nullptr );
+
+		std::vector<VkQueueFamilyProperties> families( familyCount );
+		vkGetPhysicalDeviceQueueFamilyProperties( aContext.physicalDevice, &familyCount, families.data() );
+
+		if( aContext.graphicsFamilyIndex >= familyCount || !(families[aContext.graphicsFamilyIndex].queueFlags & VK_QUEUE_COMPUTE_BIT) )
+			return false;
+
+		// R32_SFLOAT storage images are required by the specification; the
+		// depth format is not necessarily sampleable.
+		VkFormatProperties formatProps{};
+		vkGetPhysicalDeviceFormatProperties( aContext.physicalDevice, aDepthFormat, &formatProps );
+
+		return 0 != (formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+	}
+
+	DepthPyramidBuilder create_depth_pyramid_builder( VulkanContext const& aContext, char const* aSpirvPath )
+	{
+		DepthPyramidBuilder ret;
+
+		// Descriptor set layout
+		VkDescriptorSetLayoutBinding bindings[3]{};
+		bindings[0].binding = 0; // depth buffer
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		bindings[0].descriptorCount = 1;
+		bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		bindings[1].binding = 1; // previous level
+		bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		bindings[1].descriptorCount = 1;
+		bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		bindings[2].binding = 2; // level to generate
+		bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		bindings[2].descriptorCount = 1;
+		bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = sizeof(bindings) / sizeof(bindings[0]);
+		layoutInfo.pBindings = bindings;
+
+		VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+		if( auto const res = vkCreateDescriptorSetLayout( aContext.device, &layoutInfo, nullptr, &setLayout ); VK_SUCCESS != res )
+		{
+			throw Error( "Unable to create descriptor set layout\n" "vkCreateDescriptorSetLayout() returned %s", to_string(res).c_str() );
+		}
+
+		ret.setLayout = DescriptorSetLayout( aContext.device, setLayout );
+
+		// Pipeline layout
+		VkPushConstantRange pushRange{};
+		pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushRange.offset = 0;
+		pushRange.size = sizeof(PushConstants_);
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &ret.setLayout.handle;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		if( auto const res = vkCreatePipelineLayout( aContext.device, &pipelineLayoutInfo, nullptr, &pipelineLayout ); VK_SUCCESS != res )
+		{
+			throw Error( "Unable to create pipeline layout\n" "vkCreatePipelineLayout() returned %s", to_string(res).c_str() );
+		}
+
+		ret.pipelineLayout = PipelineLayout( aContext.device, pipelineLayout );
+
+		// Pipeline
+		ShaderModule shader = load_shader_module( aContext, aSpirvPath );
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = shader.handle;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = ret.pipelineLayout.handle;
+
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		if( auto const res = vkCreateComputePipelines( aContext.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline ); VK_SUCCESS != res )
+		{
+			throw Error( "Unable to create compute pipeline\n" "vkCreateComputePipelines() returned %s", to_string(res).c_str() );
+		}
+
+		ret.pipeline = Pipeline( aContext.device, pipeline );
+
+		return ret;
+	}
+
+	DepthPyramid create_depth_pyramid( VulkanContext const& aContext, Allocator const& aAllocator, DepthPyramidBuilder const& aBuilder, VkImageView aDepthView, VkExtent2D const& aDepthExtent )
+	{
+		DepthPyramid ret;
+		ret.depthExtent = aDepthExtent;
+		ret.width = std::max( aDepthExtent.width / 2, 1u );
+		ret.height = std::max( aDepthExtent.height / 2, 1u );
+		ret.levels = compute_mip_level_count( ret.width, ret.height );
+
+		ret.image = create_image_texture2d( aAllocator, ret.width, ret.height, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, MemoryCategory::attachment, ret.levels );
+		ret.view = create_view_( aContext, ret.image.image, 0, ret.levels );
+
+		for( std::uint32_t level = 0; level < ret.levels; ++level )
+			ret.levelViews.emplace_back( create_view_( aContext, ret.image.image, level, 1 ) );
+
+		// Descriptors
+		VkDescriptorPoolSize const poolSizes[] = {
+			{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, ret.levels },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 * ret.levels }
+		};
+
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = ret.levels;
+		poolInfo.poolSizeCount = sizeof(poolSizes) / sizeof(poolSizes[0]);
+		poolInfo.pPoolSizes = poolSizes;
+
+		VkDescriptorPool pool = VK_NULL_HANDLE;
+		if( auto const res = vkCreateDescriptorPool( aContext.device, &poolInfo, nullptr, &pool ); VK_SUCCESS != res )
+		{
+			throw Error( "Unable to create descriptor pool\n" "vkCreateDescriptorPool() returned %s", to_string(res).c_str() );
+		}
+
+		ret.pool = DescriptorPool( aContext.device, pool );
+
+		for( std::uint32_t level = 0; level < ret.levels; ++level )
+		{
+			VkDescriptorSet const set = alloc_desc_set( aContext, ret.pool.handle, aBuilder.setLayout.handle );
+			ret.sets.emplace_back( set );
+
+			VkDescriptorImageInfo depth{};
+			depth.imageView = aDepthView;
+			depth.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+			// Level 0 reads the depth buffer instead; the binding must still
+			// be valid, so it refers to the level itself.
+			VkDescriptorImageInfo source{};
+			source.imageView = ret.levelViews[level > 0 ? level-1 : 0].handle;
+			source.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			VkDescriptorImageInfo target{};
+			target.imageView = ret.levelViews[level].handle;
+			target.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			VkWriteDescriptorSet desc[3]{};
+			desc[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			desc[0].dstSet = set;
+			desc[0].dstBinding = 0;
+			desc[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			desc[0].descriptorCount = 1;
+			desc[0].pImageInfo = &depth;
+
+			desc[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			desc[1].dstSet = set;
+			desc[1].dstBinding = 1;
+			desc[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			desc[1].descriptorCount = 1;
+			desc[1].pImageInfo = &source;
+
+			desc[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			desc[2].dstSet = set;
+			desc[2].dstBinding = 2;
+			desc[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			desc[2].descriptorCount = 1;
+			desc[2].pImageInfo = &target;
+
+			vkUpdateDescriptorSets( aContext.device, sizeof(desc) / sizeof(desc[0]), desc, 0, nullptr );
+		}
+
+		return ret;
+	}
+
+	void record_depth_pyramid( VkCommandBuffer aCmdBuff, DepthPyramidBuilder const& aBuilder, DepthPyramid const& aPyramid )
+	{
+		assert( aPyramid.levels > 0 );
+
+		// The previous contents are discarded. This also waits for earlier
+		// readers of the pyramid (e.g., last frame's culling).
+		VkImageMemoryBarrier const discard = image_barrier_info_( aPyramid.image.image,
+			VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED,
+			0, aPyramid.levels
+		);
+
+		vkCmdPipelineBarrier( aCmdBuff,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0,
+			0, nullptr,
+			0, nullptr,
+			1, &discard
+		);
+
+		vkCmdBindPipeline( aCmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, aBuilder.pipeline.handle );
+
+		for( std::uint32_t level = 0; level < aPyramid.levels; ++level )
+		{
+			std::uint32_t const width = std::max( aPyramid.width >> level, 1u );
+			std::uint32_t const height = std::max( aPyramid.height >> level, 1u );
+
+			PushConstants_ push{};
+			push.sourceWidth = std::int32_t(0 == level ? aPyramid.depthExtent.width : std::max( aPyramid.width >> (level-1), 1u ));
+			push.sourceHeight = std::int32_t(0 == level ? aPyramid.depthExtent.height : std::max( aPyramid.height >> (level-1), 1u ));
+			push.levelWidth = std::int32_t(width);
+			push.levelHeight = std::int32_t(height);
+			push.fromDepth = 0 == level ? 1 : 0;
+
+			vkCmdBindDescriptorSets( aCmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, aBuilder.pipelineLayout.handle, 0, 1, &aPyramid.sets[level], 0, nullptr );
+			vkCmdPushConstants( aCmdBuff, aBuilder.pipelineLayout.handle, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push );
+			vkCmdDispatch( aCmdBuff, (width + kWorkGroupSize - 1) / kWorkGroupSize, (height + kWorkGroupSize - 1) / kWorkGroupSize, 1 );
+
+			// Make the level visible to the next dispatch, or, for the last
+			// one, to the culling shaders
+			VkImageMemoryBarrier const written = image_barrier_info_( aPyramid.image.image,
+				VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_GENERAL,
+				level, 1
+			);
+
+			vkCmdPipelineBarrier( aCmdBuff,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				0,
+				0, nullptr,
+				0, nullptr,
+				1, &written
+			);
+		}
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
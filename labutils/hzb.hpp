@@ -0,0 +1,75 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <vector>
+
+#include <cstdint>
+
+#include "vkimage.hpp"
+#include "vkobject.hpp"
+#include "allocator.hpp"
+#include "vulkan_context.hpp"
+
+namespace labutils
+{
+	// Hierarchical-Z (depth pyramid) for occlusion culling, built with a
+	// compute shader (hzb.comp in cw1/shaders).
+	//
+	// Level 0 of the pyramid has half the size of the depth buffer (rounded
+	// down, like Vulkan mip levels), and each level halves the previous one
+	// down to 1x1. A texel holds the farthest (maximum) depth of the texels
+	// that it covers; where a dimension of the source is odd, the last texel
+	// of that row or column covers three source texels instead of two, so
+	// that no part of the depth buffer is left out. The depth buffer texel
+	// at (x,y) is therefore covered by the texel
+	//
+	//   min( (x,y) >> (level+1), levelSize - 1 )
+	//
+	// of each level. Depth is expected to increase with distance (cleared
+	// to 1, compare op LESS or LESS_OR_EQUAL), as in cw1.
+	//
+	// All levels stay in VK_IMAGE_LAYOUT_GENERAL, for writing by the builder
+	// and for reading (with texelFetch()) by culling shaders.
+	struct DepthPyramidBuilder
+	{
+		DescriptorSetLayout setLayout;
+		PipelineLayout pipelineLayout;
+		Pipeline pipeline;
+	};
+
+	struct DepthPyramid
+	{
+		Image image; // VK_FORMAT_R32_SFLOAT
+		ImageView view; // all levels
+
+		std::vector<ImageView> levelViews;
+
+		DescriptorPool pool;
+		std::vector<VkDescriptorSet> sets; // one per level
+
+		VkExtent2D depthExtent{};
+		std::uint32_t width = 0, height = 0; // of level 0
+		std::uint32_t levels = 0;
+	};
+
+	// Checks that the graphics queue supports compute, and that the depth
+	// format can be sampled.
+	bool is_depth_pyramid_supported( VulkanContext const&, VkFormat aDepthFormat );
+
+	DepthPyramidBuilder create_depth_pyramid_builder( VulkanContext const&, char const* aSpirvPath );
+
+	// aDepthView is a depth-only view of the depth buffer, whose image must
+	// have VK_IMAGE_USAGE_SAMPLED_BIT. The pyramid has to be recreated
+	// whenever the depth buffer is.
+	DepthPyramid create_depth_pyramid( VulkanContext const&, Allocator const&, DepthPyramidBuilder const&, VkImageView aDepthView, VkExtent2D const& aDepthExtent );
+
+	// Records one dispatch per level. The depth buffer must be in
+	// VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, with its writes made
+	// available to the compute shader stage. Previous reads of the pyramid
+	// must have been by compute shaders. On return, the pyramid is visible
+	// to compute shaders.
+	void record_depth_pyramid( VkCommandBuffer, DepthPyramidBuilder const&, DepthPyramid const& );
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
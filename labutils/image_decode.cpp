@@ -0,0 +1,117 @@
+#include "image_decode.hpp"
+
+#include <limits>
+
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+
+#include <stb_image.h>
+
+#include "error.hpp"
+#include "trace.hpp"
+
+namespace labutils
+{
+	// Defined in stb_image.cpp
+	void set_stbi_output_target( void* aTarget, std::size_t aMinSize, std::size_t aCapacity );
+}
+
+namespace
+{
+	// Over-allocation by stb_image's decoders (the JPEG decoder adds one
+	// byte)
+	constexpr std::size_t kDecodeSlack = 16;
+
+	struct OutputTarget_
+	{
+		OutputTarget_( void* aTarget, std::size_t aMinSize, std::size_t aCapacity ) noexcept
+		{
+			labutils::set_stbi_output_target( aTarget, aMinSize, aCapacity );
+		}
+		~OutputTarget_()
+		{
+			labutils::set_stbi_output_target( nullptr, 0, 0 );
+		}
+
+		OutputTarget_( OutputTarget_ const& ) = delete;
+		OutputTarget_& operator= (OutputTarget_ const&) = delete;
+	};
+}
+
+namespace labutils
+{
+	std::vector<std::uint8_t> read_file_bytes( char const* aPath )
+	{
+		LUT_TRACE_SCOPE("read_file_bytes");
+
+		std::FILE* fin = std::fopen( aPath, "rb" );
+		if( !fin )
+			throw Error( "%s: unable to open file for reading", aPath );
+
+		std::fseek( fin, 0, SEEK_END );
+		auto const size = std::ftell( fin );
+		std::fseek( fin, 0, SEEK_SET );
+
+		if( size < 0 )
+		{
+			std::fclose( fin );
+			throw Error( "%s: unable to determine file size", aPath );
+		}
+
+		std::vector<std::uint8_t> ret( static_cast<std::size_t>(size) );
+		auto const read = std::fread( ret.data(), 1, ret.size(), fin );
+		std::fclose( fin );
+
+		if( read != ret.size() )
+			throw Error( "%s: read %zu of %zu bytes", aPath, read, ret.size() );
+
+		return ret;
+	}
+
+	ImageFileInfo image_file_info( std::vector<std::uint8_t> const& aFile, char const* aPath )
+	{
+		if( aFile.size() > std::size_t(std::numeric_limits<int>::max()) )
+			throw Error( "%s: file too large", aPath );
+
+		int width, height, channels;
+		if( 1 != stbi_info_from_memory( aFile.data(), int(aFile.size()), &width, &height, &channels ) )
+			throw Error( "%s: unable to get image information (%s)", aPath, stbi_failure_reason() );
+
+		assert( width > 0 && height > 0 );
+		return ImageFileInfo{ std::uint32_t(width), std::uint32_t(height) };
+	}
+
+	std::size_t decode_rgba8_capacity( ImageFileInfo const& aInfo )
+	{
+		return std::size_t(aInfo.width) * aInfo.height * 4 + kDecodeSlack;
+	}
+
+	bool decode_rgba8_into( std::vector<std::uint8_t> const& aFile, char const* aPath, ImageFileInfo const& aInfo, std::uint8_t* aDst )
+	{
+		LUT_TRACE_SCOPE("decode_rgba8_into");
+
+		auto const size = std::size_t(aInfo.width) * aInfo.height * 4;
+
+		stbi_uc* data;
+		int width, height, channels;
+		{
+			OutputTarget_ target( aDst, size, size + kDecodeSlack );
+			data = stbi_load_from_memory( aFile.data(), int(aFile.size()), &width, &height, &channels, 4 );
+		}
+
+		if( !data )
+			throw Error( "%s: unable to load image (%s)", aPath, stbi_failure_reason() );
+
+		assert( std::uint32_t(width) == aInfo.width && std::uint32_t(height) == aInfo.height );
+
+		if( data == aDst )
+			return true;
+
+		std::memcpy( aDst, data, size );
+		stbi_image_free( data );
+		return false;
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace labutils
+{
+	// Image decoding for uploads. Files are read with a single read, and
+	// decoded straight into the destination (e.g., a mapped staging buffer),
+	// without the intermediate heap allocation and copy that stbi_load()
+	// needs.
+	//
+	// The destination should be in memory that is fast to read back from:
+	// some decoders (e.g., PNG) read rows that they have already written.
+	// See create_mapped_staging_buffer().
+	std::vector<std::uint8_t> read_file_bytes( char const* aPath );
+
+	struct ImageFileInfo
+	{
+		std::uint32_t width, height;
+	};
+
+	// aPath is only used in error messages
+	ImageFileInfo image_file_info( std::vector<std::uint8_t> const& aFile, char const* aPath );
+
+	// Size of the destination of decode_rgba8_into(). This is slightly more
+	// than width*height*4, as some decoders over-allocate their output.
+	std::size_t decode_rgba8_capacity( ImageFileInfo const& );
+
+	// Decodes aFile as tightly packed RGBA8 into aDst, which must hold
+	// decode_rgba8_capacity() bytes and be 16-byte aligned. Returns false if
+	// the decoder's output couldn't be redirected, and the image was copied
+	// instead.
+	bool decode_rgba8_into( std::vector<std::uint8_t> const& aFile, char const* aPath, ImageFileInfo const&, std::uint8_t* aDst );
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,430 @@
+#include "ktx2.hpp"
+
+#include <memory>
+#include <algorithm>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <stb_image.h>
+
+#include "error.hpp"
+#include "trace.hpp"
+
+// stb_image_write.h only declares the zlib compressor in its implementation
+// section. The function itself is part of x-stb (stb_image_write.c).
+extern "C" unsigned char* stbi_zlib_compress( unsigned char* aData, int aDataLen, int* aOutLen, int aQuality );
+
+namespace
+{
+	constexpr std::uint8_t kIdentifier_[12] = {
+		0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+	};
+
+	constexpr std::size_t kHeaderSize_ = 80; // identifier, header and index
+	constexpr std::size_t kLevelIndexEntrySize_ = 24;
+
+	constexpr std::size_t kLevelAlignment_ = 16;
+
+	// Data format descriptor (DFD) constants, from the Khronos Data Format
+	// Specification (khr_df.h)
+	constexpr std::uint8_t kDfModelRgbsda_ = 1;
+	constexpr std::uint8_t kDfModelBc1a_ = 128;
+	constexpr std::uint8_t kDfModelBc4_ = 131;
+	constexpr std::uint8_t kDfModelBc5_ = 132;
+	constexpr std::uint8_t kDfModelBc7_ = 134;
+
+	constexpr std::uint8_t kDfPrimariesBt709_ = 1;
+	constexpr std::uint8_t kDfTransferLinear_ = 1;
+	constexpr std::uint8_t kDfTransferSrgb_ = 2;
+
+	constexpr std::uint8_t kDfSampleLinear_ = 0x10;
+
+	struct FormatInfo_
+	{
+		VkFormat format;
+		std::uint8_t model;
+		bool srgb;
+		std::uint32_t blockDim; // texels per side of a block
+		std::uint32_t blockBytes;
+	};
+
+	constexpr FormatInfo_ kFormats_[] = {
+		{ VK_FORMAT_R8G8B8A8_UNORM, kDfModelRgbsda_, false, 1, 4 },
+		{ VK_FORMAT_R8G8B8A8_SRGB, kDfModelRgbsda_, true, 1, 4 },
+		{ VK_FORMAT_BC1_RGB_UNORM_BLOCK, kDfModelBc1a_, false, 4, 8 },
+		{ VK_FORMAT_BC1_RGB_SRGB_BLOCK, kDfModelBc1a_, true, 4, 8 },
+		{ VK_FORMAT_BC4_UNORM_BLOCK, kDfModelBc4_, false, 4, 8 },
+		{ VK_FORMAT_BC5_UNORM_BLOCK, kDfModelBc5_, false, 4, 16 },
+		{ VK_FORMAT_BC7_UNORM_BLOCK, kDfModelBc7_, false, 4, 16 },
+		{ VK_FORMAT_BC7_SRGB_BLOCK, kDfModelBc7_, true, 4, 16 }
+	};
+
+	FormatInfo_ const& format_info_( VkFormat aFormat )
+	{
+		for( auto const& info : kFormats_ )
+		{
+			if( info.format == aFormat )
+				return info;
+		}
+
+		throw labutils::Error( "KTX2: unsupported format %d", int(aFormat) );
+	}
+
+	std::size_t align_up_( std::size_t aValue, std::size_t aAlignment )
+	{
+		return (aValue + aAlignment - 1) / aAlignment * aAlignment;
+	}
+
+	// KTX2 is little endian. So is every platform that this code targets.
+	template< typename tType >
+	tType read_( std::uint8_t const* aPtr )
+	{
+		tType ret;
+		std::memcpy( &ret, aPtr, sizeof(tType) );
+		return ret;
+	}
+
+	template< typename tType >
+	void append_( std::vector<std::uint8_t>& aOut, tType aValue )
+	{
+		std::uint8_t bytes[sizeof(tType)];
+		std::memcpy( bytes, &aValue, sizeof(tType) );
+		aOut.insert( aOut.end(), bytes, bytes + sizeof(tType) );
+	}
+
+	std::vector<std::uint8_t> make_dfd_( FormatInfo_ const& aInfo )
+	{
+		struct Sample_
+		{
+			std::uint16_t bitOffset;
+			std::uint8_t bitLength; // minus one
+			std::uint8_t channel; // including qualifiers
+			std::uint32_t lower, upper;
+		};
+
+		std::vector<Sample_> samples;
+		switch( aInfo.model )
+		{
+			case kDfModelRgbsda_:
+				samples.push_back( { 0, 7, 0, 0, 255 } );
+				samples.push_back( { 8, 7, 1, 0, 255 } );
+				samples.push_back( { 16, 7, 2, 0, 255 } );
+				samples.push_back( { 24, 7, std::uint8_t(15 | (aInfo.srgb ? kDfSampleLinear_ : 0)), 0, 255 } );
+				break;
+			case kDfModelBc5_:
+				samples.push_back( { 0, 63, 0, 0, ~std::uint32_t(0) } );
+				samples.push_back( { 64, 63, 1, 0, ~std::uint32_t(0) } );
+				break;
+			default:
+				samples.push_back( { 0, std::uint8_t(aInfo.blockBytes * 8 - 1), 0, 0, ~std::uint32_t(0) } );
+				break;
+		}
+
+		auto const blockSize = std::uint16_t(24 + 16 * samples.size());
+
+		std::vector<std::uint8_t> ret;
+		append_<std::uint32_t>( ret, 4 + blockSize ); // dfdTotalSize
+
+		append_<std::uint32_t>( ret, 0 ); // vendorId = Khronos, descriptorType = basic
+		append_<std::uint16_t>( ret, 2 ); // versionNumber
+		append_<std::uint16_t>( ret, blockSize );
+
+		ret.push_back( aInfo.model );
+		ret.push_back( kDfPrimariesBt709_ );
+		ret.push_back( aInfo.srgb ? kDfTransferSrgb_ : kDfTransferLinear_ );
+		ret.push_back( 0 ); // flags: straight alpha
+
+		ret.push_back( std::uint8_t(aInfo.blockDim - 1) );
+		ret.push_back( std::uint8_t(aInfo.blockDim - 1) );
+		ret.push_back( 0 );
+		ret.push_back( 0 );
+
+		ret.push_back( std::uint8_t(aInfo.blockBytes) ); // bytesPlane0
+		ret.insert( ret.end(), 7, 0 );
+
+		for( auto const& sample : samples )
+		{
+			append_<std::uint16_t>( ret, sample.bitOffset );
+			ret.push_back( sample.bitLength );
+			ret.push_back( sample.channel );
+			append_<std::uint32_t>( ret, 0 ); // samplePosition
+			append_<std::uint32_t>( ret, sample.lower );
+			append_<std::uint32_t>( ret, sample.upper );
+		}
+
+		return ret;
+	}
+}
+
+namespace labutils
+{
+	Ktx2Texture load_ktx2( char const* aPath )
+	{
+		LUT_TRACE_SCOPE( "load_ktx2" );
+
+		std::vector<std::uint8_t> file;
+		{
+			std::FILE* fin = std::fopen( aPath, "rb" );
+			if( !fin )
+				throw Error( "Unable to open '%s'", aPath );
+
+			std::fseek( fin, 0, SEEK_END );
+			long const size = std::ftell( fin );
+			std::fseek( fin, 0, SEEK_SET );
+
+			if( size > 0 )
+			{
+				file.resize( std::size_t(size) );
+				if( 1 != std::fread( file.data(), file.size(), 1, fin ) )
+					file.clear();
+			}
+
+			std::fclose( fin );
+		}
+
+		if( file.size() < kHeaderSize_ || 0 != std::memcmp( file.data(), kIdentifier_, sizeof(kIdentifier_) ) )
+			throw Error( "%s: not a KTX2 file", aPath );
+
+		std::uint8_t const* header = file.data() + sizeof(kIdentifier_);
+
+		auto const vkFormat = read_<std::uint32_t>( header + 0 );
+		auto const pixelWidth = read_<std::uint32_t>( header + 8 );
+		auto const pixelHeight = read_<std::uint32_t>( header + 12 );
+		auto const pixelDepth = read_<std::uint32_t>( header + 16 );
+		auto const layerCount = read_<std::uint32_t>( header + 20 );
+		auto const faceCount = read_<std::uint32_t>( header + 24 );
+		auto const levelCount = read_<std::uint32_t>( header + 28 );
+		auto const scheme = read_<std::uint32_t>( header + 32 );
+
+		if( 0 == pixelWidth || 0 == pixelHeight || 0 != pixelDepth || layerCount > 1 || 1 != faceCount )
+			throw Error( "%s: only 2D textures are supported", aPath );
+
+		if( 0 == levelCount )
+			throw Error( "%s: file does not contain mip levels (levelCount = 0)", aPath );
+
+		if( levelCount > 32 || 0 == (std::max( pixelWidth, pixelHeight ) >> (levelCount-1)) )
+			throw Error( "%s: invalid level count %u for %ux%u texture", aPath, levelCount, pixelWidth, pixelHeight );
+
+		if( std::uint32_t(Ktx2Supercompression::none) != scheme && std::uint32_t(Ktx2Supercompression::zlib) != scheme )
+			throw Error( "%s: unsupported supercompression scheme %u", aPath, scheme );
+
+		if( file.size() < kHeaderSize_ + levelCount * kLevelIndexEntrySize_ )
+			throw Error( "%s: truncated level index", aPath );
+
+		Ktx2Texture ret;
+		ret.format = VkFormat(vkFormat);
+		ret.width = pixelWidth;
+		ret.height = pixelHeight;
+
+		// Determine the uncompressed layout first, so that data is only
+		// allocated once.
+		std::uint8_t const* levelIndex = file.data() + kHeaderSize_;
+
+		std::size_t total = 0;
+		for( std::uint32_t i = 0; i < levelCount; ++i )
+		{
+			auto const byteOffset = read_<std::uint64_t>( levelIndex + i*kLevelIndexEntrySize_ + 0 );
+			auto const byteLength = read_<std::uint64_t>( levelIndex + i*kLevelIndexEntrySize_ + 8 );
+			auto const uncompressedLength = read_<std::uint64_t>( levelIndex + i*kLevelIndexEntrySize_ + 16 );
+
+			if( byteOffset > file.size() || byteLength > file.size() - byteOffset )
+				throw Error( "%s: level %u is out of bounds", aPath, i );
+
+			if( std::uint32_t(Ktx2Supercompression::none) == scheme && byteLength != uncompressedLength )
+				throw Error( "%s: level %u has inconsistent sizes", aPath, i );
+
+			// The level is uploaded with the extent of a full mip chain, so
+			// its size must match that extent exactly
+			std::uint32_t const levelWidth = std::max( pixelWidth >> i, 1u );
+			std::uint32_t const levelHeight = std::max( pixelHeight >> i, 1u );
+			std::size_t const expected = ktx2_level_size( ret.format, levelWidth, levelHeight );
+			if( uncompressedLength != expected )
+				throw Error( "%s: level %u is %llu bytes, expected %zu for %ux%u", aPath, i, static_cast<unsigned long long>(uncompressedLength), expected, levelWidth, levelHeight );
+
+			total = align_up_( total, kLevelAlignment_ );
+			ret.levels.emplace_back( Ktx2Texture::Level{ total, std::size_t(uncompressedLength) } );
+			total += std::size_t(uncompressedLength);
+		}
+
+		ret.data.resize( total );
+
+		for( std::uint32_t i = 0; i < levelCount; ++i )
+		{
+			auto const byteOffset = read_<std::uint64_t>( levelIndex + i*kLevelIndexEntrySize_ + 0 );
+			auto const byteLength = read_<std::uint64_t>( levelIndex + i*kLevelIndexEntrySize_ + 8 );
+
+			auto const& level = ret.levels[i];
+			auto const* src = file.data() + byteOffset;
+			auto* dst = ret.data.data() + level.offset;
+
+			if( std::uint32_t(Ktx2Supercompression::none) == scheme )
+			{
+				std::memcpy( dst, src, level.size );
+			}
+			else
+			{
+				int const decoded = stbi_zlib_decode_buffer(
+					reinterpret_cast<char*>(dst), int(level.size),
+					reinterpret_cast<char const*>(src), int(byteLength)
+				);
+
+				if( decoded < 0 || std::size_t(decoded) != level.size )
+					throw Error( "%s: unable to decompress level %u", aPath, i );
+			}
+		}
+
+		return ret;
+	}
+
+	VkFormat read_ktx2_format( char const* aPath )
+	{
+		std::uint8_t head[sizeof(kIdentifier_) + 4];
+
+		std::FILE* fin = std::fopen( aPath, "rb" );
+		if( !fin )
+			return VK_FORMAT_UNDEFINED;
+
+		bool const ok = (1 == std::fread( head, sizeof(head), 1, fin ));
+		std::fclose( fin );
+
+		if( !ok || 0 != std::memcmp( head, kIdentifier_, sizeof(kIdentifier_) ) )
+			return VK_FORMAT_UNDEFINED;
+
+		return VkFormat(read_<std::uint32_t>( head + sizeof(kIdentifier_) ));
+	}
+
+	void write_ktx2( char const* aPath, Ktx2Texture const& aTexture, Ktx2Supercompression aScheme, char const* aWriterName )
+	{
+		LUT_TRACE_SCOPE( "write_ktx2" );
+
+		auto const& info = format_info_( aTexture.format );
+		auto const levelCount = std::uint32_t(aTexture.levels.size());
+
+		if( 0 == levelCount )
+			throw Error( "%s: texture has no levels", aPath );
+
+		// Level data, possibly compressed
+		std::vector<std::unique_ptr<std::uint8_t, decltype(&std::free)>> compressed;
+		std::vector<std::uint8_t const*> levelData( levelCount );
+		std::vector<std::uint64_t> levelLength( levelCount );
+
+		for( std::uint32_t i = 0; i < levelCount; ++i )
+		{
+			auto const& level = aTexture.levels[i];
+			auto* src = const_cast<std::uint8_t*>(aTexture.data.data() + level.offset);
+
+			if( Ktx2Supercompression::zlib == aScheme )
+			{
+				int length = 0;
+				std::uint8_t* zdata = stbi_zlib_compress( src, int(level.size), &length, 8 );
+				if( !zdata )
+					throw Error( "%s: unable to compress level %u", aPath, i );
+
+				compressed.emplace_back( zdata, &std::free );
+				levelData[i] = zdata;
+				levelLength[i] = std::uint64_t(length);
+			}
+			else
+			{
+				levelData[i] = src;
+				levelLength[i] = level.size;
+			}
+		}
+
+		auto const dfd = make_dfd_( info );
+
+		std::vector<std::uint8_t> kvd;
+		{
+			std::size_t const keyLength = std::strlen( "KTXwriter" ) + 1;
+			std::size_t const valueLength = std::strlen( aWriterName ) + 1;
+
+			append_<std::uint32_t>( kvd, std::uint32_t(keyLength + valueLength) );
+			kvd.insert( kvd.end(), "KTXwriter", "KTXwriter" + keyLength );
+			kvd.insert( kvd.end(), aWriterName, aWriterName + valueLength );
+			kvd.resize( align_up_( kvd.size(), 4 ), 0 );
+		}
+
+		std::size_t const dfdOffset = kHeaderSize_ + levelCount * kLevelIndexEntrySize_;
+		std::size_t const kvdOffset = dfdOffset + dfd.size();
+		std::size_t const dataOffset = kvdOffset + kvd.size();
+
+		// Levels are stored smallest first. Without supercompression, each
+		// level must be aligned to lcm(texel block size, 4).
+		std::size_t const alignment = Ktx2Supercompression::none == aScheme ? (info.blockBytes % 4 ? info.blockBytes * 4 : info.blockBytes) : 1;
+
+		std::vector<std::uint64_t> levelOffset( levelCount );
+		std::size_t fileSize = dataOffset;
+		for( std::uint32_t i = levelCount; i-- > 0; )
+		{
+			fileSize = align_up_( fileSize, alignment );
+			levelOffset[i] = fileSize;
+			fileSize += std::size_t(levelLength[i]);
+		}
+
+		std::vector<std::uint8_t> out;
+		out.reserve( fileSize );
+
+		out.insert( out.end(), kIdentifier_, kIdentifier_ + sizeof(kIdentifier_) );
+		append_<std::uint32_t>( out, std::uint32_t(aTexture.format) );
+		append_<std::uint32_t>( out, 1 ); // typeSize
+		append_<std::uint32_t>( out, aTexture.width );
+		append_<std::uint32_t>( out, aTexture.height );
+		append_<std::uint32_t>( out, 0 ); // pixelDepth
+		append_<std::uint32_t>( out, 0 ); // layerCount
+		append_<std::uint32_t>( out, 1 ); // faceCount
+		append_<std::uint32_t>( out, levelCount );
+		append_<std::uint32_t>( out, std::uint32_t(aScheme) );
+
+		append_<std::uint32_t>( out, std::uint32_t(dfdOffset) );
+		append_<std::uint32_t>( out, std::uint32_t(dfd.size()) );
+		append_<std::uint32_t>( out, std::uint32_t(kvdOffset) );
+		append_<std::uint32_t>( out, std::uint32_t(kvd.size()) );
+		append_<std::uint64_t>( out, 0 ); // sgdByteOffset
+		append_<std::uint64_t>( out, 0 ); // sgdByteLength
+
+		for( std::uint32_t i = 0; i < levelCount; ++i )
+		{
+			append_<std::uint64_t>( out, levelOffset[i] );
+			append_<std::uint64_t>( out, levelLength[i] );
+			append_<std::uint64_t>( out, aTexture.levels[i].size );
+		}
+
+		out.insert( out.end(), dfd.begin(), dfd.end() );
+		out.insert( out.end(), kvd.begin(), kvd.end() );
+
+		for( std::uint32_t i = levelCount; i-- > 0; )
+		{
+			out.resize( std::size_t(levelOffset[i]), 0 );
+			out.insert( out.end(), levelData[i], levelData[i] + levelLength[i] );
+		}
+
+		std::FILE* fout = std::fopen( aPath, "wb" );
+		if( !fout )
+			throw Error( "Unable to open '%s' for writing", aPath );
+
+		bool const ok = (1 == std::fwrite( out.data(), out.size(), 1, fout ));
+		if( 0 != std::fclose( fout ) || !ok )
+			throw Error( "Error while writing '%s'", aPath );
+	}
+
+	std::size_t ktx2_level_size( VkFormat aFormat, std::uint32_t aWidth, std::uint32_t aHeight )
+	{
+		auto const& info = format_info_( aFormat );
+
+		std::size_t const blocksX = (aWidth + info.blockDim - 1) / info.blockDim;
+		std::size_t const blocksY = (aHeight + info.blockDim - 1) / info.blockDim;
+		return blocksX * blocksY * info.blockBytes;
+	}
+
+	std::uint8_t* ktx2_add_level( Ktx2Texture& aTexture, std::size_t aSize )
+	{
+		std::size_t const offset = align_up_( aTexture.data.size(), kLevelAlignment_ );
+		aTexture.data.resize( offset + aSize );
+		aTexture.levels.emplace_back( Ktx2Texture::Level{ offset, aSize } );
+		return aTexture.data.data() + offset;
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace labutils
+{
+	// Minimal reader and writer for KTX2 files, see
+	//   https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+	//
+	// Only 2D textures (one layer, one face) with pre-generated mip levels are
+	// supported. Level data may be stored as is or supercompressed with zlib
+	// (supercompressionScheme = 3). BasisLZ and Zstandard are not supported.
+	//
+	// The reader accepts any VkFormat; whether the format can be used is up
+	// to the caller. The writer can create the data format descriptor for
+	// R8G8B8A8 and BC1/BC4/BC5/BC7 formats (see ktx2_level_size()).
+	enum class Ktx2Supercompression : std::uint32_t
+	{
+		none = 0,
+		zlib = 3
+	};
+
+	struct Ktx2Texture
+	{
+		struct Level
+		{
+			std::size_t offset; // into data
+			std::size_t size;
+		};
+
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		std::uint32_t width = 0, height = 0;
+
+		// Uncompressed level data, level 0 (the largest) first. Each level
+		// starts at a multiple of 16 bytes, so the offsets can be used as
+		// VkBufferImageCopy::bufferOffset for any of the supported formats.
+		std::vector<Level> levels;
+		std::vector<std::uint8_t> data;
+	};
+
+	Ktx2Texture load_ktx2( char const* aPath );
+
+	// Format of a KTX2 file, from its header only. Returns VK_FORMAT_UNDEFINED
+	// if the file can't be read or is not a KTX2 file.
+	VkFormat read_ktx2_format( char const* aPath );
+
+	void write_ktx2(
+		char const* aPath,
+		Ktx2Texture const&,
+		Ktx2Supercompression = Ktx2Supercompression::zlib,
+		char const* aWriterName = "labutils"
+	);
+
+	// Size in bytes of a level of the given dimensions. Throws for formats
+	// that write_ktx2() does not support.
+	std::size_t ktx2_level_size( VkFormat, std::uint32_t aWidth, std::uint32_t aHeight );
+
+	// Appends a level to aTexture, respecting the alignment described above.
+	// Returns a pointer to the level's (uninitialized) data.
+	std::uint8_t* ktx2_add_level( Ktx2Texture& aTexture, std::size_t aSize );
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
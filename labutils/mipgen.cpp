@@ -0,0 +1,370 @@
+#include "mipgen.hpp"
+
+#include <cassert>
+
+#include "error.hpp"
+#include "vkutil.hpp"
+#include "vkimage.hpp"
+#include "to_string.hpp"
+
+namespace
+{
+	// Must match mipgen.comp
+	constexpr std::uint32_t kWorkGroupSize = 256;
+	constexpr std::uint32_t kTileSize = 64;
+	constexpr std::uint32_t kMaxGeneratedLevels = 12;
+
+	struct PushConstants_
+	{
+		std::int32_t width, height;
+		std::uint32_t levelCount;
+		std::uint32_t workGroupCount;
+		std::uint32_t counterIndex;
+	};
+
+	labutils::ImageView create_level_view_( labutils::VulkanContext const& aContext, VkImage aImage, VkFormat aFormat, VkImageUsageFlags aUsage, std::uint32_t aLevel )
+	{
+		using labutils::Error;
+		using labutils::to_string;
+
+		// The image has usages that its format doesn't support (see
+		// kComputeMipImageFlags); each view is restricted to the one usage
+		// that its format does.
+		VkImageViewUsageCreateInfo usageInfo{};
+		usageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO;
+		usageInfo.usage = aUsage;
+
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.pNext = &usageInfo;
+		viewInfo.image = aImage;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = aFormat;
+		viewInfo.components = VkComponentMapping{};
+		viewInfo.subresourceRange = VkImageSubresourceRange{
+			VK_IMAGE_ASPECT_COLOR_BIT,
+			aLevel, 1,
+			0, 1
+		};
+
+		VkImageView view = VK_NULL_HANDLE;
+		if( auto const res = vkCreateImageView( aContext.device, &viewInfo, nullptr, &view ); VK_SUCCESS != res )
+		{
+			throw Error( "Unable to create image view for mip level %u\n" "vkCreateImageView() returned %s", aLevel, to_string(res).c_str() );
+		}
+
+		return labutils::ImageView( aContext.device, view );
+	}
+
+	VkImageMemoryBarrier image_barrier_info_( VkImage aImage, VkAccessFlags aSrcAccess, VkAccessFlags aDstAccess, VkImageLayout aSrcLayout, VkImageLayout aDstLayout, std::uint32_t aBaseLevel, std::uint32_t aLevelCount )
+	{
+		VkImageMemoryBarrier ret{};
+		ret.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		ret.srcAccessMask = aSrcAccess;
+		ret.dstAccessMask = aDstAccess;
+		ret.oldLayout = aSrcLayout;
+		ret.newLayout = aDstLayout;
+		ret.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		ret.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		ret.image = aImage;
+		ret.subresourceRange = VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, aBaseLevel, aLevelCount, 0, 1 };
+		return ret;
+	}
+}
+
+namespace labutils
+{
+	bool is_compute_mip_generation_supported( VulkanContext const& aContext )
+	{
+		std::uint32_t familyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties( aContext.physicalDevice, &familyCount, nullptr );
+
+		std::vector<VkQueueFamilyProperties> families( familyCount );
+		vkGetPhysicalDeviceQueueFamilyProperties( aContext.physicalDevice, &familyCount, families.data() );
+
+		if( aContext.graphicsFamilyIndex >= familyCount || !(families[aContext.graphicsFamilyIndex].queueFlags & VK_QUEUE_COMPUTE_BIT) )
+			return false;
+
+		VkPhysicalDeviceProperties props{};
+		vkGetPhysicalDeviceProperties( aContext.physicalDevice, &props );
+
+		if( props.limits.maxComputeWorkGroupInvocations < kWorkGroupSize || props.limits.maxComputeWorkGroupSize[0] < kWorkGroupSize )
+			return false;
+
+		if( props.limits.maxPerStageDescriptorStorageImages < kMaxGeneratedLevels )
+			return false;
+
+		VkFormatProperties formatProps{};
+		vkGetPhysicalDeviceFormatProperties( aContext.physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProps );
+
+		return 0 != (formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+	}
+
+	ComputeMipGenerator create_compute_mip_generator( VulkanContext const& aContext, char const* aSpirvPath )
+	{
+		ComputeMipGenerator ret;
+
+		// Descriptor set layout
+		VkDescriptorSetLayoutBinding bindings[3]{};
+		bindings[0].binding = 0; // level 0, sampled
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		bindings[0].descriptorCount = 1;
+		bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		bindings[1].binding = 1; // levels 1-12, storage
+		bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		bindings[1].descriptorCount = kMaxGeneratedLevels;
+		bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		bindings[2].binding = 2; // workgroup counters
+		bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[2].descriptorCount = 1;
+		bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = sizeof(bindings) / sizeof(bindings[0]);
+		layoutInfo.pBindings = bindings;
+
+		VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+		if( auto const res = vkCreateDescriptorSetLayout( aContext.device, &layoutInfo, nullptr, &setLayout ); VK_SUCCESS != res )
+		{
+			throw Error( "Unable to create descriptor set layout\n" "vkCreateDescriptorSetLayout() returned %s", to_string(res).c_str() );
+		}
+
+		ret.setLayout = DescriptorSetLayout( aContext.device, setLayout );
+
+		// Pipeline layout
+		VkPushConstantRange pushRange{};
+		pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushRange.offset = 0;
+		pushRange.size = sizeof(PushConstants_);
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &ret.setLayout.handle;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		if( auto const res = vkCreatePipelineLayout( aContext.device, &pipelineLayoutInfo, nullptr, &pipelineLayout ); VK_SUCCESS != res )
+		{
+			throw Error( "Unable to create pipeline layout\n" "vkCreatePipelineLayout() returned %s", to_string(res).c_str() );
+		}
+
+		ret.pipelineLayout = PipelineLayout( aContext.device, pipelineLayout );
+
+		// Pipeline
+		ShaderModule shader = load_shader_module( aContext, aSpirvPath );
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = shader.handle;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = ret.pipelineLayout.handle;
+
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		if( auto const res = vkCreateComputePipelines( aContext.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline ); VK_SUCCESS != res )
+		{
+			throw Error( "Unable to create compute pipeline\n" "vkCreateComputePipelines() returned %s", to_string(res).c_str() );
+		}
+
+		ret.pipeline = Pipeline( aContext.device, pipeline );
+
+		return ret;
+	}
+
+	ComputeMipBatch record_compute_mips( VkCommandBuffer aCmdBuff, VulkanContext const& aContext, Allocator const& aAllocator, ComputeMipGenerator const& aGenerator, std::vector<ComputeMipTarget> const& aTargets )
+	{
+		ComputeMipBatch ret;
+		if( aTargets.empty() )
+			return ret;
+
+		auto const count = std::uint32_t(aTargets.size());
+
+		// One counter per image, so that the dispatches don't depend on each
+		// other. The shader resets the counters when done.
+		ret.counters = create_buffer( aAllocator, count * sizeof(std::uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY );
+		vkCmdFillBuffer( aCmdBuff, ret.counters.buffer, 0, VK_WHOLE_SIZE, 0 );
+
+		// Descriptors
+		VkDescriptorPoolSize const poolSizes[] = {
+			{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, count },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, count * kMaxGeneratedLevels },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, count }
+		};
+
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = count;
+		poolInfo.poolSizeCount = sizeof(poolSizes) / sizeof(poolSizes[0]);
+		poolInfo.pPoolSizes = poolSizes;
+
+		VkDescriptorPool pool = VK_NULL_HANDLE;
+		if( auto const res = vkCreateDescriptorPool( aContext.device, &poolInfo, nullptr, &pool ); VK_SUCCESS != res )
+		{
+			throw Error( "Unable to create descriptor pool\n" "vkCreateDescriptorPool() returned %s", to_string(res).c_str() );
+		}
+
+		ret.pool = DescriptorPool( aContext.device, pool );
+
+		std::vector<VkDescriptorSet> sets( count );
+		std::vector<std::uint32_t> levelCounts( count );
+
+		for( std::uint32_t i = 0; i < count; ++i )
+		{
+			auto const& target = aTargets[i];
+			assert( target.width <= kComputeMipMaxExtent && target.height <= kComputeMipMaxExtent );
+
+			levelCounts[i] = compute_mip_level_count( target.width, target.height ) - 1;
+			assert( levelCounts[i] <= kMaxGeneratedLevels );
+
+			if( 0 == levelCounts[i] )
+				continue; // 1x1, nothing to generate
+
+			sets[i] = alloc_desc_set( aContext, ret.pool.handle, aGenerator.setLayout.handle );
+
+			VkDescriptorImageInfo level0{};
+			ret.views.emplace_back( create_level_view_( aContext, target.image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT, 0 ) );
+			level0.imageView = ret.views.back().handle;
+			level0.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+			// All array elements must be valid. Unused ones repeat the last
+			// level; the shader doesn't access them.
+			VkDescriptorImageInfo levels[kMaxGeneratedLevels]{};
+			for( std::uint32_t level = 1; level <= kMaxGeneratedLevels; ++level )
+			{
+				if( level <= levelCounts[i] )
+					ret.views.emplace_back( create_level_view_( aContext, target.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_STORAGE_BIT, level ) );
+
+				levels[level-1].imageView = ret.views.back().handle;
+				levels[level-1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+			}
+
+			VkDescriptorBufferInfo counters{};
+			counters.buffer = ret.counters.buffer;
+			counters.offset = 0;
+			counters.range = VK_WHOLE_SIZE;
+
+			VkWriteDescriptorSet desc[3]{};
+			desc[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			desc[0].dstSet = sets[i];
+			desc[0].dstBinding = 0;
+			desc[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			desc[0].descriptorCount = 1;
+			desc[0].pImageInfo = &level0;
+
+			desc[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			desc[1].dstSet = sets[i];
+			desc[1].dstBinding = 1;
+			desc[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			desc[1].descriptorCount = kMaxGeneratedLevels;
+			desc[1].pImageInfo = levels;
+
+			desc[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			desc[2].dstSet = sets[i];
+			desc[2].dstBinding = 2;
+			desc[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			desc[2].descriptorCount = 1;
+			desc[2].pBufferInfo = &counters;
+
+			vkUpdateDescriptorSets( aContext.device, sizeof(desc) / sizeof(desc[0]), desc, 0, nullptr );
+		}
+
+		// Transition all images at once: level 0 for reading, the others for
+		// writing. The counter fill is covered by a global memory barrier.
+		std::vector<VkImageMemoryBarrier> barriers;
+		barriers.reserve( 2 * count );
+
+		for( std::uint32_t i = 0; i < count; ++i )
+		{
+			barriers.emplace_back( image_barrier_info_( aTargets[i].image,
+				VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				0, 1
+			) );
+
+			if( levelCounts[i] > 0 )
+			{
+				barriers.emplace_back( image_barrier_info_( aTargets[i].image,
+					0, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+					VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+					1, levelCounts[i]
+				) );
+			}
+		}
+
+		VkMemoryBarrier fillBarrier{};
+		fillBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		fillBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+		vkCmdPipelineBarrier( aCmdBuff,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0,
+			1, &fillBarrier,
+			0, nullptr,
+			std::uint32_t(barriers.size()), barriers.data()
+		);
+
+		// Dispatch
+		vkCmdBindPipeline( aCmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, aGenerator.pipeline.handle );
+
+		for( std::uint32_t i = 0; i < count; ++i )
+		{
+			if( 0 == levelCounts[i] )
+				continue;
+
+			auto const& target = aTargets[i];
+			std::uint32_t const groupsX = (target.width + kTileSize - 1) / kTileSize;
+			std::uint32_t const groupsY = (target.height + kTileSize - 1) / kTileSize;
+
+			PushConstants_ push{};
+			push.width = std::int32_t(target.width);
+			push.height = std::int32_t(target.height);
+			push.levelCount = levelCounts[i];
+			push.workGroupCount = groupsX * groupsY;
+			push.counterIndex = i;
+
+			vkCmdBindDescriptorSets( aCmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, aGenerator.pipelineLayout.handle, 0, 1, &sets[i], 0, nullptr );
+			vkCmdPushConstants( aCmdBuff, aGenerator.pipelineLayout.handle, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push );
+			vkCmdDispatch( aCmdBuff, groupsX, groupsY, 1 );
+		}
+
+		// Generated levels to sampling; level 0 already is in the right
+		// layout, but needs to be made visible to fragment shaders.
+		barriers.clear();
+		for( std::uint32_t i = 0; i < count; ++i )
+		{
+			barriers.emplace_back( image_barrier_info_( aTargets[i].image,
+				0, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				0, 1
+			) );
+
+			if( levelCounts[i] > 0 )
+			{
+				barriers.emplace_back( image_barrier_info_( aTargets[i].image,
+					VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+					VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+					1, levelCounts[i]
+				) );
+			}
+		}
+
+		vkCmdPipelineBarrier( aCmdBuff,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0,
+			0, nullptr,
+			0, nullptr,
+			std::uint32_t(barriers.size()), barriers.data()
+		);
+
+		return ret;
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <vector>
+
+#include <cstdint>
+
+#include "vkobject.hpp"
+#include "vkbuffer.hpp"
+#include "allocator.hpp"
+#include "vulkan_context.hpp"
+
+namespace labutils
+{
+	// Single-pass GPU mip generation with a compute shader (mipgen.comp in
+	// cw1/shaders). One dispatch generates all levels of an image: each
+	// workgroup reduces a 64x64 tile to six levels through shared memory, and
+	// the last workgroup to finish reduces the remaining (at most 64x64)
+	// texels to 1x1. Filtering is a 2x2 box filter in linear space, like
+	// MipFilter::box in mipmap.hpp.
+	//
+	// Compared to a blit per level, this needs two barriers per batch of
+	// images instead of two per level and image, and no TRANSFER_SRC usage.
+	//
+	// Images must be R8G8B8A8_SRGB, be created with kComputeMipImageFlags and
+	// kComputeMipImageUsage (in addition to any other usage), and be no larger
+	// than kComputeMipMaxExtent in either dimension. Storage images with sRGB
+	// formats are not generally supported, so the shader writes through
+	// R8G8B8A8_UNORM views and encodes sRGB itself.
+	constexpr std::uint32_t kComputeMipMaxExtent = 4096;
+	constexpr VkImageCreateFlags kComputeMipImageFlags = VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT | VK_IMAGE_CREATE_EXTENDED_USAGE_BIT;
+	constexpr VkImageUsageFlags kComputeMipImageUsage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+
+	struct ComputeMipGenerator
+	{
+		DescriptorSetLayout setLayout;
+		PipelineLayout pipelineLayout;
+		Pipeline pipeline;
+	};
+
+	struct ComputeMipTarget
+	{
+		VkImage image;
+		std::uint32_t width, height;
+	};
+
+	// Resources referenced by the commands from record_compute_mips(). Keep
+	// these alive until the command buffer has completed.
+	struct ComputeMipBatch
+	{
+		DescriptorPool pool;
+		std::vector<ImageView> views;
+		Buffer counters;
+	};
+
+	// Checks that the graphics queue supports compute, and that the device
+	// supports the shader's workgroup size and storage image format.
+	bool is_compute_mip_generation_supported( VulkanContext const& );
+
+	ComputeMipGenerator create_compute_mip_generator( VulkanContext const&, char const* aSpirvPath );
+
+	// Records one dispatch per image. On entry, level 0 of each image must
+	// hold the image data in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, written by
+	// a transfer command; the contents of the other levels are discarded. On
+	// return, all levels are in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL and
+	// visible to fragment shaders.
+	ComputeMipBatch record_compute_mips(
+		VkCommandBuffer,
+		VulkanContext const&,
+		Allocator const&,
+		ComputeMipGenerator const&,
+		std::vector<ComputeMipTarget> const&
+	);
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,452 @@
+#include "mipmap.hpp"
+
+#include <memory>
+#include <utility>
+#include <algorithm>
+
+#include <cmath>
+#include <cassert>
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#	define LUT_MIPMAP_AVX2_ 1
+#	include <immintrin.h>
+#else
+#	define LUT_MIPMAP_AVX2_ 0
+#endif
+
+#include "parallel.hpp"
+
+namespace
+{
+	// Conversion tables. Both have two halves, so that a single (gather)
+	// lookup can handle the RGB and alpha channels of a pixel: the index of
+	// each channel is offset by the start of the half to use. See
+	// ChannelOffsets_.
+	struct Tables_
+	{
+		// [0,256): sRGB to linear, [256,512): UNORM to float
+		alignas(32) float toLinear[512];
+
+		// Indexed by round(value * 4095). [0,4096): linear to sRGB,
+		// [4096,8192): float to UNORM. Stored as 32-bit integers for
+		// _mm256_i32gather_epi32().
+		alignas(32) std::int32_t fromLinear[8192];
+	};
+
+	Tables_ const& tables_()
+	{
+		static Tables_ const tables = [] {
+			Tables_ ret{};
+
+			for( int i = 0; i < 256; ++i )
+			{
+				float const c = float(i) / 255.f;
+				ret.toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow( (c + 0.055f) / 1.055f, 2.4f );
+				ret.toLinear[256+i] = c;
+			}
+
+			for( int i = 0; i < 4096; ++i )
+			{
+				float const l = float(i) / 4095.f;
+				float const c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow( l, 1.f/2.4f ) - 0.055f;
+				ret.fromLinear[i] = std::int32_t(std::clamp( c * 255.f + 0.5f, 0.f, 255.f ));
+				ret.fromLinear[4096+i] = std::int32_t(l * 255.f + 0.5f);
+			}
+
+			return ret;
+		}();
+
+		return tables;
+	}
+
+	// Per-channel offsets into Tables_::toLinear and Tables_::fromLinear
+	struct ChannelOffsets_
+	{
+		std::int32_t in[4];
+		std::int32_t out[4];
+	};
+
+	ChannelOffsets_ channel_offsets_( bool aSrgb )
+	{
+		if( aSrgb )
+			return { { 0, 0, 0, 256 }, { 0, 0, 0, 4096 } };
+
+		return { { 256, 256, 256, 256 }, { 4096, 4096, 4096, 4096 } };
+	}
+
+	// Separable 1D kernel for a 2:1 reduction. Destination pixel x uses the
+	// source pixels 2x + first + k, for k in [0,taps). taps is even, and at
+	// most six.
+	struct Kernel_
+	{
+		std::uint32_t taps;
+		std::int32_t first;
+		float weights[6];
+	};
+
+	// Modified Bessel function of the first kind, order zero
+	double bessel_i0_( double aX )
+	{
+		double sum = 1.0, term = 1.0;
+		for( int k = 1; k < 32; ++k )
+		{
+			double const t = aX / (2.0 * k);
+			term *= t * t;
+			sum += term;
+		}
+		return sum;
+	}
+
+	Kernel_ kaiser_kernel_()
+	{
+		// Kaiser-windowed sinc. Tap k sits at (k - 2.5) / 2 destination
+		// pixels from the destination pixel's center. The window covers
+		// 1.5 destination pixels on either side.
+		constexpr double kAlpha = 4.0;
+		constexpr double kRadius = 1.5;
+		constexpr double kPi = 3.14159265358979323846;
+
+		Kernel_ ret{ 6, -2, {} };
+
+		double w[6], sum = 0.0;
+		for( int k = 0; k < 6; ++k )
+		{
+			double const x = (k - 2.5) / 2.0;
+			double const sinc = std::sin( kPi * x ) / (kPi * x);
+			double const t = x / kRadius;
+			double const window = bessel_i0_( kAlpha * std::sqrt( 1.0 - t*t ) ) / bessel_i0_( kAlpha );
+
+			w[k] = sinc * window;
+			sum += w[k];
+		}
+
+		for( int k = 0; k < 6; ++k )
+			ret.weights[k] = float(w[k] / sum);
+
+		return ret;
+	}
+
+	// 2x2 box filter for one destination row. aRow0 and aRow1 are the two
+	// source rows (the same row if the source is one pixel high). Linearize,
+	// filter and encode are fused, as the source pixels aren't shared between
+	// destination pixels.
+	void box_row_( std::uint8_t const* aRow0, std::uint8_t const* aRow1, std::uint32_t aWidth, std::uint32_t aDstWidth, Tables_ const& aTables, ChannelOffsets_ const& aOffsets, std::uint8_t* aOut )
+	{
+		std::uint32_t x = 0;
+
+#		if LUT_MIPMAP_AVX2_
+		__m256i const inOffsets = _mm256_setr_epi32(
+			aOffsets.in[0], aOffsets.in[1], aOffsets.in[2], aOffsets.in[3],
+			aOffsets.in[0], aOffsets.in[1], aOffsets.in[2], aOffsets.in[3]
+		);
+		__m256i const outOffsets = _mm256_setr_epi32(
+			aOffsets.out[0], aOffsets.out[1], aOffsets.out[2], aOffsets.out[3],
+			aOffsets.out[0], aOffsets.out[1], aOffsets.out[2], aOffsets.out[3]
+		);
+
+		__m256 const scale = _mm256_set1_ps( 0.25f * 4095.f );
+		__m256 const half = _mm256_set1_ps( 0.5f );
+		__m256 const zero = _mm256_setzero_ps();
+		__m256 const one = _mm256_set1_ps( 4095.f );
+
+		auto const load2 = [&] (std::uint8_t const* aPixels) {
+			__m128i const bytes = _mm_loadl_epi64( reinterpret_cast<__m128i const*>(aPixels) );
+			__m256i const index = _mm256_add_epi32( _mm256_cvtepu8_epi32( bytes ), inOffsets );
+			return _mm256_i32gather_ps( aTables.toLinear, index, 4 );
+		};
+
+		// Two destination pixels (four source columns) at a time. Requires
+		// aWidth >= 2, so that no source columns need to be clamped.
+		for( ; aWidth >= 2 && x + 2 <= aDstWidth; x += 2 )
+		{
+			// Source pixels (2x, 2x+1) and (2x+2, 2x+3), summed vertically
+			__m256 const s0 = _mm256_add_ps( load2( aRow0 + x*8 ), load2( aRow1 + x*8 ) );
+			__m256 const s1 = _mm256_add_ps( load2( aRow0 + x*8 + 8 ), load2( aRow1 + x*8 + 8 ) );
+
+			// ... and horizontally
+			__m256 const even = _mm256_permute2f128_ps( s0, s1, 0x20 );
+			__m256 const odd = _mm256_permute2f128_ps( s0, s1, 0x31 );
+			__m256 const sum = _mm256_add_ps( even, odd );
+
+			__m256 const v = _mm256_min_ps( _mm256_max_ps( _mm256_fmadd_ps( sum, scale, half ), zero ), one );
+			__m256i const index = _mm256_add_epi32( _mm256_cvttps_epi32( v ), outOffsets );
+			__m256i const encoded = _mm256_i32gather_epi32( aTables.fromLinear, index, 4 );
+
+			__m128i const words = _mm_packus_epi32( _mm256_castsi256_si128( encoded ), _mm256_extracti128_si256( encoded, 1 ) );
+			_mm_storel_epi64( reinterpret_cast<__m128i*>(aOut + x*4), _mm_packus_epi16( words, words ) );
+		}
+#		endif // ~ AVX2
+
+		for( ; x < aDstWidth; ++x )
+		{
+			std::uint32_t const x0 = std::min( 2*x, aWidth-1 ) * 4;
+			std::uint32_t const x1 = std::min( 2*x+1, aWidth-1 ) * 4;
+
+			for( std::uint32_t c = 0; c < 4; ++c )
+			{
+				std::int32_t const in = aOffsets.in[c];
+				float const sum = aTables.toLinear[in + aRow0[x0+c]] + aTables.toLinear[in + aRow0[x1+c]]
+					+ aTables.toLinear[in + aRow1[x0+c]] + aTables.toLinear[in + aRow1[x1+c]];
+
+				float const v = std::clamp( sum * (0.25f * 4095.f) + 0.5f, 0.f, 4095.f );
+				aOut[x*4+c] = std::uint8_t(aTables.fromLinear[aOffsets.out[c] + int(v)]);
+			}
+		}
+	}
+
+	// Converts a source row to linear RGBA floats. aOut receives aCount
+	// pixels, where pixel i is source pixel i - aPad, clamped to the row.
+	void linearize_row_( std::uint8_t const* aSrc, std::uint32_t aWidth, std::uint32_t aPad, std::uint32_t aCount, Tables_ const& aTables, ChannelOffsets_ const& aOffsets, float* aOut )
+	{
+		std::uint32_t const begin = std::min( aPad, aCount );
+		std::uint32_t const end = std::min( aPad + aWidth, aCount );
+
+		std::uint32_t i = begin;
+
+#		if LUT_MIPMAP_AVX2_
+		__m256i const offsets = _mm256_setr_epi32(
+			aOffsets.in[0], aOffsets.in[1], aOffsets.in[2], aOffsets.in[3],
+			aOffsets.in[0], aOffsets.in[1], aOffsets.in[2], aOffsets.in[3]
+		);
+
+		// Two pixels at a time
+		for( ; i + 2 <= end; i += 2 )
+		{
+			__m128i const bytes = _mm_loadl_epi64( reinterpret_cast<__m128i const*>(aSrc + (i - aPad) * 4) );
+			__m256i const index = _mm256_add_epi32( _mm256_cvtepu8_epi32( bytes ), offsets );
+			_mm256_storeu_ps( aOut + i * 4, _mm256_i32gather_ps( aTables.toLinear, index, 4 ) );
+		}
+#		endif // ~ AVX2
+
+		for( ; i < end; ++i )
+		{
+			std::uint8_t const* src = aSrc + (i - aPad) * 4;
+			for( std::uint32_t c = 0; c < 4; ++c )
+				aOut[i*4+c] = aTables.toLinear[aOffsets.in[c] + src[c]];
+		}
+
+		// Clamp to edge
+		for( i = 0; i < begin; ++i )
+		{
+			for( std::uint32_t c = 0; c < 4; ++c )
+				aOut[i*4+c] = aOut[begin*4+c];
+		}
+		for( i = end; i < aCount; ++i )
+		{
+			for( std::uint32_t c = 0; c < 4; ++c )
+				aOut[i*4+c] = aOut[(end-1)*4+c];
+		}
+	}
+
+	// Horizontal pass: aLinear holds the row from linearize_row_(), with
+	// aPad = -aKernel.first. Writes aDstWidth RGBA pixels to aOut.
+	void filter_row_( float const* aLinear, std::uint32_t aDstWidth, Kernel_ const& aKernel, float* aOut )
+	{
+		std::uint32_t x = 0;
+
+#		if LUT_MIPMAP_AVX2_
+		// Source pixels 2x+k and 2x+k+1 are adjacent, so each 256-bit load
+		// covers two taps. The two halves are summed at the end.
+		__m256 pairWeights[3];
+		for( std::uint32_t j = 0; j < aKernel.taps/2; ++j )
+		{
+			float const w0 = aKernel.weights[2*j], w1 = aKernel.weights[2*j+1];
+			pairWeights[j] = _mm256_setr_ps( w0, w0, w0, w0, w1, w1, w1, w1 );
+		}
+
+		for( ; x < aDstWidth; ++x )
+		{
+			float const* src = aLinear + std::size_t(2*x) * 4;
+
+			__m256 acc = _mm256_mul_ps( _mm256_loadu_ps( src ), pairWeights[0] );
+			for( std::uint32_t j = 1; j < aKernel.taps/2; ++j )
+				acc = _mm256_fmadd_ps( _mm256_loadu_ps( src + j*8 ), pairWeights[j], acc );
+
+			__m128 const sum = _mm_add_ps( _mm256_castps256_ps128( acc ), _mm256_extractf128_ps( acc, 1 ) );
+			_mm_storeu_ps( aOut + x*4, sum );
+		}
+#		endif // ~ AVX2
+
+		for( ; x < aDstWidth; ++x )
+		{
+			float const* src = aLinear + std::size_t(2*x) * 4;
+			for( std::uint32_t c = 0; c < 4; ++c )
+			{
+				float sum = 0.f;
+				for( std::uint32_t k = 0; k < aKernel.taps; ++k )
+					sum += aKernel.weights[k] * src[k*4+c];
+				aOut[x*4+c] = sum;
+			}
+		}
+	}
+
+	// Vertical pass: combines the horizontally filtered rows aRows[k], one
+	// per tap, and converts the result back to 8 bits. aCount is the number
+	// of floats per row (destination width * 4).
+	void filter_column_encode_( float const* const* aRows, std::uint32_t aCount, Kernel_ const& aKernel, Tables_ const& aTables, ChannelOffsets_ const& aOffsets, std::uint8_t* aOut )
+	{
+		std::uint32_t i = 0;
+
+#		if LUT_MIPMAP_AVX2_
+		__m256i const offsets = _mm256_setr_epi32(
+			aOffsets.out[0], aOffsets.out[1], aOffsets.out[2], aOffsets.out[3],
+			aOffsets.out[0], aOffsets.out[1], aOffsets.out[2], aOffsets.out[3]
+		);
+
+		__m256 const scale = _mm256_set1_ps( 4095.f );
+		__m256 const half = _mm256_set1_ps( 0.5f );
+		__m256 const zero = _mm256_setzero_ps();
+
+		__m256 weights[6];
+		for( std::uint32_t k = 0; k < aKernel.taps; ++k )
+			weights[k] = _mm256_set1_ps( aKernel.weights[k] );
+
+		// Eight channels (two pixels) at a time
+		for( ; i + 8 <= aCount; i += 8 )
+		{
+			__m256 acc = _mm256_mul_ps( _mm256_loadu_ps( aRows[0] + i ), weights[0] );
+			for( std::uint32_t k = 1; k < aKernel.taps; ++k )
+				acc = _mm256_fmadd_ps( _mm256_loadu_ps( aRows[k] + i ), weights[k], acc );
+
+			__m256 const v = _mm256_min_ps( _mm256_max_ps( _mm256_fmadd_ps( acc, scale, half ), zero ), scale );
+			__m256i const index = _mm256_add_epi32( _mm256_cvttps_epi32( v ), offsets );
+			__m256i const encoded = _mm256_i32gather_epi32( aTables.fromLinear, index, 4 );
+
+			__m128i const words = _mm_packus_epi32( _mm256_castsi256_si128( encoded ), _mm256_extracti128_si256( encoded, 1 ) );
+			_mm_storel_epi64( reinterpret_cast<__m128i*>(aOut + i), _mm_packus_epi16( words, words ) );
+		}
+#		endif // ~ AVX2
+
+		for( ; i < aCount; ++i )
+		{
+			float sum = 0.f;
+			for( std::uint32_t k = 0; k < aKernel.taps; ++k )
+				sum += aKernel.weights[k] * aRows[k][i];
+
+			float const v = std::clamp( sum * 4095.f + 0.5f, 0.f, 4095.f );
+			aOut[i] = std::uint8_t(aTables.fromLinear[aOffsets.out[i % 4] + int(v)]);
+		}
+	}
+}
+
+namespace labutils
+{
+	char const* to_string( MipFilter aFilter )
+	{
+		switch( aFilter )
+		{
+			case MipFilter::box: return "box";
+			case MipFilter::kaiser: return "kaiser";
+		}
+
+		return "unknown";
+	}
+
+	char const* mip_simd_isa() noexcept
+	{
+		return LUT_MIPMAP_AVX2_ ? "avx2" : "scalar";
+	}
+
+	void downsample_rgba8( std::uint8_t const* aSrc, std::uint32_t aWidth, std::uint32_t aHeight, std::uint8_t* aDst, bool aSrgb, MipFilter aFilter, std::uint32_t aThreadCount )
+	{
+		assert( aSrc && aDst );
+		assert( aWidth > 0 && aHeight > 0 );
+
+		auto const& tables = tables_();
+		auto const offsets = channel_offsets_( aSrgb );
+
+		std::uint32_t const dstWidth = std::max( aWidth / 2, 1u );
+		std::uint32_t const dstHeight = std::max( aHeight / 2, 1u );
+
+		// Channels per destination row: bytes in aDst, floats in the
+		// intermediate rows of the separable filter
+		std::size_t const rowElements = std::size_t(dstWidth) * 4;
+
+		// Rows are handed out in chunks of roughly 32k destination pixels
+		std::size_t const grain = std::max<std::size_t>( 4, 32*1024 / dstWidth );
+
+		if( MipFilter::box == aFilter )
+		{
+			labutils::parallel_for( dstHeight, [&] (std::size_t aBegin, std::size_t aEnd) {
+				for( std::size_t y = aBegin; y < aEnd; ++y )
+				{
+					std::uint8_t const* row0 = aSrc + std::size_t(std::min<std::size_t>( 2*y, aHeight-1 )) * aWidth * 4;
+					std::uint8_t const* row1 = aSrc + std::size_t(std::min<std::size_t>( 2*y+1, aHeight-1 )) * aWidth * 4;
+
+					box_row_( row0, row1, aWidth, dstWidth, tables, offsets, aDst + y * rowElements );
+				}
+			}, aThreadCount, grain );
+
+			return;
+		}
+
+		auto const kernel = kaiser_kernel_();
+
+		// Linearized source pixels needed for one destination row
+		std::uint32_t const pad = std::uint32_t(-kernel.first);
+		std::uint32_t const lineCount = 2*dstWidth + kernel.taps - 2;
+
+		// Each destination row needs kernel.taps horizontally filtered source
+		// rows, two of which are new; the others are shared with the previous
+		// row. These are kept in a ring of kernel.taps rows, where source row
+		// r (relative to the chunk) lives in slot r % kernel.taps.
+		labutils::parallel_for( dstHeight, [&] (std::size_t aBegin, std::size_t aEnd) {
+			auto const y0 = std::uint32_t(aBegin), y1 = std::uint32_t(aEnd);
+
+			std::int64_t const rowBegin = std::int64_t(2*y0) + kernel.first;
+
+			// Scratch memory, deliberately left uninitialized
+			std::unique_ptr<float[]> linear( new float[std::size_t(lineCount) * 4] );
+			std::unique_ptr<float[]> ring( new float[kernel.taps * rowElements] );
+
+			std::uint32_t nextRow = 0;
+			float const* rows[6];
+
+			for( std::uint32_t y = y0; y < y1; ++y )
+			{
+				std::uint32_t const first = 2*(y-y0);
+				for( ; nextRow < first + kernel.taps; ++nextRow )
+				{
+					auto const sy = std::clamp<std::int64_t>( rowBegin + nextRow, 0, aHeight-1 );
+					std::uint8_t const* src = aSrc + std::size_t(sy) * aWidth * 4;
+
+					linearize_row_( src, aWidth, pad, lineCount, tables, offsets, linear.get() );
+					filter_row_( linear.get(), dstWidth, kernel, ring.get() + (nextRow % kernel.taps) * rowElements );
+				}
+
+				for( std::uint32_t k = 0; k < kernel.taps; ++k )
+					rows[k] = ring.get() + ((first + k) % kernel.taps) * rowElements;
+
+				filter_column_encode_( rows, std::uint32_t(rowElements), kernel, tables, offsets, aDst + std::size_t(y) * rowElements );
+			}
+		}, aThreadCount, grain );
+	}
+
+	std::vector<MipLevelRGBA8> generate_mip_chain_rgba8( std::uint8_t const* aRgba, std::uint32_t aWidth, std::uint32_t aHeight, bool aSrgb, MipFilter aFilter, std::uint32_t aThreadCount )
+	{
+		std::vector<MipLevelRGBA8> ret;
+
+		std::uint8_t const* src = aRgba;
+		std::uint32_t width = aWidth, height = aHeight;
+
+		while( width > 1 || height > 1 )
+		{
+			MipLevelRGBA8 level;
+			level.width = std::max( width / 2, 1u );
+			level.height = std::max( height / 2, 1u );
+			level.texels.resize( std::size_t(level.width) * level.height * 4 );
+
+			downsample_rgba8( src, width, height, level.texels.data(), aSrgb, aFilter, aThreadCount );
+
+			ret.emplace_back( std::move(level) );
+
+			src = ret.back().texels.data();
+			width = ret.back().width;
+			height = ret.back().height;
+		}
+
+		return ret;
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
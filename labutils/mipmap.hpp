@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+
+#include <cstdint>
+
+namespace labutils
+{
+	// CPU mip chain generation for tightly packed RGBA8 images.
+	//
+	// With aSrgb set, the RGB channels are converted to linear before
+	// filtering and back to sRGB afterwards. Alpha is always filtered as
+	// linear data. Filtering happens in 32-bit float; conversions to and from
+	// linear use lookup tables.
+	//
+	// Filters:
+	//   box     2x2 average, equivalent to a linear blit at half size
+	//   kaiser  separable 6x6 Kaiser-windowed sinc (alpha = 4). Keeps more
+	//           detail in the smaller levels than the box filter, but is
+	//           slower. Results are clamped to [0,1].
+	//
+	// The Kaiser filter is applied separably: each source row is linearized
+	// and filtered horizontally, then the rows are combined vertically. The
+	// box filter does all of this in one step per destination row. The inner
+	// loops use AVX2 when the compiler targets it (e.g., -march=native or
+	// /arch:AVX2), and plain C++ otherwise; see mip_simd_isa(). Rows of the
+	// destination image are processed in parallel (see parallel_for()).
+	//
+	// For odd source dimensions, the destination is rounded down, as with
+	// vkCmdBlitImage() at half size. Samples outside the image are clamped to
+	// the edge.
+	enum class MipFilter
+	{
+		box,
+		kaiser
+	};
+
+	char const* to_string( MipFilter );
+
+	// "avx2" or "scalar", depending on which code path was compiled in
+	char const* mip_simd_isa() noexcept;
+
+	struct MipLevelRGBA8
+	{
+		std::uint32_t width = 0, height = 0;
+		std::vector<std::uint8_t> texels; // width * height * 4 bytes
+	};
+
+	// Halves each dimension (rounding down, minimum of one). aDst must have
+	// room for the resulting image. aThreadCount = 0 uses
+	// default_thread_count().
+	void downsample_rgba8(
+		std::uint8_t const* aSrc,
+		std::uint32_t aWidth, std::uint32_t aHeight,
+		std::uint8_t* aDst,
+		bool aSrgb = true,
+		MipFilter = MipFilter::box,
+		std::uint32_t aThreadCount = 0
+	);
+
+	// Returns levels 1 and onwards, down to 1x1. Level 0 is aRgba itself.
+	// Each level is filtered from the previous one.
+	std::vector<MipLevelRGBA8> generate_mip_chain_rgba8(
+		std::uint8_t const* aRgba,
+		std::uint32_t aWidth, std::uint32_t aHeight,
+		bool aSrgb = true,
+		MipFilter = MipFilter::box,
+		std::uint32_t aThreadCount = 0
+	);
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,271 @@
+#include "parallel.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include <utility>
+#include <exception>
+#include <algorithm>
+#include <system_error>
+
+#include <cassert>
+
+namespace labutils
+{
+	std::uint32_t default_thread_count() noexcept
+	{
+		auto const count = std::thread::hardware_concurrency();
+		return count > 0 ? count : 1;
+	}
+
+	void parallel_for( std::size_t aCount, std::function<void (std::size_t, std::size_t)> const& aFn, std::uint32_t aThreadCount, std::size_t aGrain )
+	{
+		assert( aGrain > 0 );
+
+		if( 0 == aCount )
+			return;
+
+		std::size_t const chunks = (aCount + aGrain - 1) / aGrain;
+
+		if( 0 == aThreadCount )
+			aThreadCount = default_thread_count();
+
+		aThreadCount = std::uint32_t(std::min<std::size_t>( aThreadCount, chunks ));
+
+		if( aThreadCount <= 1 )
+		{
+			aFn( 0, aCount );
+			return;
+		}
+
+		std::atomic<std::size_t> next{ 0 };
+		std::atomic<bool> failed{ false };
+
+		std::mutex errorMutex;
+		std::exception_ptr error;
+
+		auto const worker = [&] {
+			try
+			{
+				for( ;; )
+				{
+					std::size_t const chunk = next.fetch_add( 1, std::memory_order_relaxed );
+					if( chunk >= chunks || failed.load( std::memory_order_relaxed ) )
+						break;
+
+					std::size_t const begin = chunk * aGrain;
+					aFn( begin, std::min( begin + aGrain, aCount ) );
+				}
+			}
+			catch( ... )
+			{
+				std::lock_guard<std::mutex> lock( errorMutex );
+				if( !error )
+					error = std::current_exception();
+
+				failed.store( true, std::memory_order_relaxed );
+			}
+		};
+
+		std::vector<std::thread> threads;
+		threads.reserve( aThreadCount - 1 );
+
+		// If a thread can't be started, continue with the ones that are
+		// running. Destroying a joinable std::thread would terminate.
+		try
+		{
+			for( std::uint32_t i = 1; i < aThreadCount; ++i )
+				threads.emplace_back( worker );
+		}
+		catch( std::system_error const& )
+		{}
+
+		worker();
+
+		for( auto& thread : threads )
+			thread.join();
+
+		if( error )
+			std::rethrow_exception( error );
+	}
+
+
+	struct WorkerPool::State_
+	{
+		std::vector<std::thread> threads;
+
+		std::mutex mutex;
+		std::condition_variable wake; // workers, for a new job or quit
+		std::condition_variable done; // caller, for the last worker
+
+		bool quit = false;
+		std::uint64_t job = 0; // incremented for each parallel_for()
+		std::uint32_t busy = 0; // workers that haven't finished the job
+
+		// The current job
+		std::function<void (std::size_t, std::size_t)> const* fn = nullptr;
+		std::size_t count = 0, grain = 1, chunks = 0;
+
+		std::atomic<std::size_t> next{ 0 };
+		std::atomic<bool> failed{ false };
+		std::exception_ptr error; // guarded by mutex
+
+		void run()
+		{
+			try
+			{
+				for( ;; )
+				{
+					std::size_t const chunk = next.fetch_add( 1, std::memory_order_relaxed );
+					if( chunk >= chunks || failed.load( std::memory_order_relaxed ) )
+						break;
+
+					std::size_t const begin = chunk * grain;
+					(*fn)( begin, std::min( begin + grain, count ) );
+				}
+			}
+			catch( ... )
+			{
+				std::lock_guard<std::mutex> lock( mutex );
+				if( !error )
+					error = std::current_exception();
+
+				failed.store( true, std::memory_order_relaxed );
+			}
+		}
+
+		void work()
+		{
+			std::uint64_t seen = 0;
+			for( ;; )
+			{
+				{
+					std::unique_lock<std::mutex> lock( mutex );
+					wake.wait( lock, [&] { return quit || job != seen; } );
+					if( quit )
+						return;
+
+					seen = job;
+				}
+
+				run();
+
+				std::lock_guard<std::mutex> lock( mutex );
+				if( 0 == --busy )
+					done.notify_one();
+			}
+		}
+	};
+
+	WorkerPool::WorkerPool() noexcept = default;
+
+	WorkerPool::~WorkerPool()
+	{
+		if( !mState )
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock( mState->mutex );
+			mState->quit = true;
+		}
+
+		mState->wake.notify_all();
+
+		for( auto& thread : mState->threads )
+			thread.join();
+	}
+
+	WorkerPool::WorkerPool( WorkerPool&& aOther ) noexcept
+		: mState( std::move( aOther.mState ) )
+		, mThreadCount( std::exchange( aOther.mThreadCount, 0 ) )
+	{}
+
+	WorkerPool& WorkerPool::operator=( WorkerPool&& aOther ) noexcept
+	{
+		std::swap( mState, aOther.mState );
+		std::swap( mThreadCount, aOther.mThreadCount );
+		return *this;
+	}
+
+	std::uint32_t WorkerPool::thread_count() const noexcept
+	{
+		return mThreadCount;
+	}
+
+	void WorkerPool::parallel_for( std::size_t aCount, std::function<void (std::size_t, std::size_t)> const& aFn, std::size_t aGrain )
+	{
+		assert( aGrain > 0 );
+
+		if( 0 == aCount )
+			return;
+
+		std::size_t const chunks = (aCount + aGrain - 1) / aGrain;
+
+		if( !mState || mState->threads.empty() || chunks <= 1 )
+		{
+			aFn( 0, aCount );
+			return;
+		}
+
+		auto& state = *mState;
+
+		{
+			std::lock_guard<std::mutex> lock( state.mutex );
+
+			state.fn = &aFn;
+			state.count = aCount;
+			state.grain = aGrain;
+			state.chunks = chunks;
+			state.next.store( 0, std::memory_order_relaxed );
+			state.failed.store( false, std::memory_order_relaxed );
+			state.error = nullptr;
+
+			state.busy = std::uint32_t(state.threads.size());
+			++state.job;
+		}
+
+		state.wake.notify_all();
+
+		state.run();
+
+		std::exception_ptr error;
+		{
+			std::unique_lock<std::mutex> lock( state.mutex );
+			state.done.wait( lock, [&] { return 0 == state.busy; } );
+
+			state.fn = nullptr;
+			std::swap( error, state.error );
+		}
+
+		if( error )
+			std::rethrow_exception( error );
+	}
+
+	WorkerPool create_worker_pool( std::uint32_t aThreadCount )
+	{
+		if( 0 == aThreadCount )
+			aThreadCount = default_thread_count();
+
+		WorkerPool ret;
+		ret.mState = std::make_unique<WorkerPool::State_>();
+		ret.mThreadCount = aThreadCount;
+
+		// As in parallel_for(): continue with the threads that are running
+		try
+		{
+			for( std::uint32_t i = 1; i < aThreadCount; ++i )
+			{
+				auto* const state = ret.mState.get();
+				state->threads.emplace_back( [state] { state->work(); } );
+			}
+		}
+		catch( std::system_error const& )
+		{}
+
+		return ret;
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
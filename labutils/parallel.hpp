@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+#include <functional>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace labutils
+{
+	// Number of worker threads used when a thread count of zero is passed to
+	// parallel_for(). This is std::thread::hardware_concurrency(), or one if
+	// that is unknown.
+	std::uint32_t default_thread_count() noexcept;
+
+	// Calls aFn( aBegin, aEnd ) for consecutive ranges of at most aGrain items
+	// that together cover [0, aCount). Ranges are handed out dynamically to
+	// up to aThreadCount threads, including the calling thread, which
+	// participates. Returns once all items have been processed. If aFn throws,
+	// remaining ranges are skipped and the first exception is rethrown on the
+	// calling thread.
+	//
+	// Threads are started for each call, so this is intended for coarse work
+	// items (e.g., rows of blocks in a texture), not for fine-grained tasks.
+	// Work that is repeated often (e.g., every frame) should use a
+	// WorkerPool instead.
+	void parallel_for(
+		std::size_t aCount,
+		std::function<void (std::size_t aBegin, std::size_t aEnd)> const& aFn,
+		std::uint32_t aThreadCount = 0,
+		std::size_t aGrain = 1
+	);
+
+	// Worker threads that are kept between parallel_for() calls. They sleep
+	// while there is no work.
+	class WorkerPool
+	{
+		public:
+			WorkerPool() noexcept, ~WorkerPool();
+
+			WorkerPool( WorkerPool const& ) = delete;
+			WorkerPool& operator= (WorkerPool const&) = delete;
+
+			WorkerPool( WorkerPool&& ) noexcept;
+			WorkerPool& operator = (WorkerPool&&) noexcept;
+
+		public:
+			// As requested from create_worker_pool(), including the calling
+			// thread; zero for an empty pool
+			std::uint32_t thread_count() const noexcept;
+
+			// As labutils::parallel_for(), with the pool's threads. An empty
+			// pool runs aFn on the calling thread. Calls must not overlap.
+			void parallel_for(
+				std::size_t aCount,
+				std::function<void (std::size_t aBegin, std::size_t aEnd)> const& aFn,
+				std::size_t aGrain = 1
+			);
+
+		private:
+			friend WorkerPool create_worker_pool( std::uint32_t );
+
+			struct State_;
+			std::unique_ptr<State_> mState;
+
+			std::uint32_t mThreadCount = 0;
+	};
+
+	// Starts aThreadCount - 1 threads (the caller of parallel_for() being the
+	// last); zero selects default_thread_count(). If a thread can't be
+	// started, the pool continues with those that are running.
+	WorkerPool create_worker_pool( std::uint32_t aThreadCount = 0 );
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
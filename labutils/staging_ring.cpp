@@ -0,0 +1,448 @@
+#include "staging_ring.hpp"
+
+#include <limits>
+#include <utility>
+#include <algorithm>
+
+#include <cassert>
+#include <cstring>
+
+#include "error.hpp"
+#include "trace.hpp"
+#include "vkutil.hpp"
+#include "to_string.hpp"
+
+namespace
+{
+	// Smallest piece that upload_buffer() splits uploads into
+	constexpr VkDeviceSize kMinBufferPiece = VkDeviceSize(64) << 10;
+
+	VkDeviceSize align_up_( VkDeviceSize aValue, VkDeviceSize aAlignment ) noexcept
+	{
+		return (aValue + aAlignment - 1) / aAlignment * aAlignment;
+	}
+}
+
+namespace labutils
+{
+	StagingRing::StagingRing() noexcept = default;
+
+	StagingRing::~StagingRing()
+	{
+		// The buffer must outlive any submissions that read from it
+		for( auto const& sub : mPending )
+			vkWaitForFences( mContext->device, 1, &sub.fence.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max() );
+	}
+
+	StagingRing::StagingRing( StagingRing&& ) noexcept = default;
+	StagingRing& StagingRing::operator=( StagingRing&& aOther ) noexcept
+	{
+		// As in the destructor: this ring's buffer and fences go to aOther,
+		// and are destroyed with it, so its submissions must complete first
+		for( auto const& sub : mPending )
+			vkWaitForFences( mContext->device, 1, &sub.fence.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max() );
+
+		std::swap( mContext, aOther.mContext );
+		std::swap( mAllocator, aOther.mAllocator );
+		std::swap( mBuffer, aOther.mBuffer );
+		std::swap( mCapacity, aOther.mCapacity );
+		std::swap( mCmdPool, aOther.mCmdPool );
+		std::swap( mCurrent, aOther.mCurrent );
+		std::swap( mPending, aOther.mPending );
+		std::swap( mFree, aOther.mFree );
+		std::swap( mHead, aOther.mHead );
+		std::swap( mTail, aOther.mTail );
+		std::swap( mUsed, aOther.mUsed );
+		std::swap( mDirectWrites, aOther.mDirectWrites );
+		std::swap( mSubmissions, aOther.mSubmissions );
+		std::swap( mWaits, aOther.mWaits );
+		std::swap( mAllocatedBytes, aOther.mAllocatedBytes );
+		std::swap( mDirectBytes, aOther.mDirectBytes );
+		return *this;
+	}
+
+
+	VkDeviceSize StagingRing::capacity() const noexcept
+	{
+		return mCapacity;
+	}
+
+	VkCommandBuffer StagingRing::command_buffer()
+	{
+		if( VK_NULL_HANDLE != mCurrent.cmdBuff )
+			return mCurrent.cmdBuff;
+
+		Submission_ sub;
+		if( !mFree.empty() )
+		{
+			sub = std::move( mFree.back() );
+			mFree.pop_back();
+		}
+		else
+		{
+			sub.fence = create_fence( *mContext );
+			sub.cmdBuff = alloc_command_buffer( *mContext, mCmdPool.handle );
+		}
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		if( auto const res = vkBeginCommandBuffer( sub.cmdBuff, &beginInfo ); VK_SUCCESS != res )
+		{
+			mFree.emplace_back( std::move(sub) );
+			throw Error( "Beginning command buffer recording\n" "vkBeginCommandBuffer() returned %s", to_string(res).c_str() );
+		}
+
+		sub.bytes = 0;
+		mCurrent = std::move(sub);
+		return mCurrent.cmdBuff;
+	}
+
+	StagingRing::Region StagingRing::allocate( VkDeviceSize aSize, VkDeviceSize aAlignment )
+	{
+		assert( aSize > 0 && aAlignment > 0 );
+
+		if( aSize > mCapacity )
+			throw Error( "Staging allocation of %llu bytes exceeds the ring's %llu bytes", static_cast<unsigned long long>(aSize), static_cast<unsigned long long>(mCapacity) );
+
+		// Allocations always belong to a submission
+		command_buffer();
+
+		collect_( false );
+
+		VkDeviceSize offset = 0;
+		while( !try_allocate_( aSize, aAlignment, offset ) )
+		{
+			if( mPending.empty() )
+				flush();
+
+			collect_( true );
+			command_buffer();
+		}
+
+		return region_( offset, aSize );
+	}
+
+	StagingRing::Region StagingRing::allocate_up_to( VkDeviceSize aMaxSize, VkDeviceSize aMinSize, VkDeviceSize aAlignment )
+	{
+		assert( aMinSize > 0 && aMinSize <= aMaxSize && aAlignment > 0 );
+
+		if( aMinSize > mCapacity )
+			throw Error( "Staging allocation of %llu bytes exceeds the ring's %llu bytes", static_cast<unsigned long long>(aMinSize), static_cast<unsigned long long>(mCapacity) );
+
+		command_buffer();
+
+		collect_( false );
+
+		VkDeviceSize available = largest_free_( aAlignment );
+		while( available < aMinSize )
+		{
+			if( mPending.empty() )
+				flush();
+
+			collect_( true );
+			command_buffer();
+
+			available = largest_free_( aAlignment );
+		}
+
+		VkDeviceSize const size = available >= aMaxSize ? aMaxSize : available - available % aMinSize;
+
+		VkDeviceSize offset = 0;
+		bool const ok = try_allocate_( size, aAlignment, offset );
+		assert( ok );
+		(void)ok;
+
+		return region_( offset, size );
+	}
+
+	void StagingRing::upload_buffer( VkBuffer aDst, VkDeviceSize aDstOffset, void const* aData, VkDeviceSize aSize )
+	{
+		auto const* src = static_cast<std::uint8_t const*>(aData);
+
+		while( aSize > 0 )
+		{
+			VkDeviceSize const minSize = std::min( { aSize, kMinBufferPiece, mCapacity } );
+			auto const region = allocate_up_to( aSize, minSize, 4 );
+
+			std::memcpy( region.data, src, std::size_t(region.size) );
+
+			VkBufferCopy copy{};
+			copy.srcOffset = region.offset;
+			copy.dstOffset = aDstOffset;
+			copy.size = region.size;
+
+			vkCmdCopyBuffer( command_buffer(), region.buffer, aDst, 1, &copy );
+
+			src += region.size;
+			aDstOffset += region.size;
+			aSize -= region.size;
+		}
+	}
+
+	void StagingRing::upload_image_level( VkImage aImage, std::uint32_t aLevel, std::uint32_t aWidth, std::uint32_t aHeight, void const* aData, std::uint32_t aBytesPerBlock, std::uint32_t aBlockExtent, std::uint32_t aLayer )
+	{
+		assert( aBlockExtent > 0 && aBytesPerBlock > 0 );
+
+		VkDeviceSize const rowBytes = VkDeviceSize( (aWidth + aBlockExtent - 1) / aBlockExtent ) * aBytesPerBlock;
+		std::uint32_t const rows = (aHeight + aBlockExtent - 1) / aBlockExtent;
+
+		// Buffer offsets must be multiples of four and of the block size
+		VkDeviceSize const alignment = std::max<VkDeviceSize>( 4, aBytesPerBlock );
+
+		auto const* src = static_cast<std::uint8_t const*>(aData);
+
+		std::uint32_t row = 0;
+		while( row < rows )
+		{
+			auto const region = allocate_up_to( (rows - row) * rowBytes, rowBytes, alignment );
+			auto const count = std::uint32_t(region.size / rowBytes);
+
+			std::memcpy( region.data, src + row * rowBytes, std::size_t(region.size) );
+
+			// The last row of blocks may extend past the image
+			std::uint32_t const y = row * aBlockExtent;
+
+			VkBufferImageCopy copy{};
+			copy.bufferOffset = region.offset;
+			copy.bufferRowLength = 0;
+			copy.bufferImageHeight = 0;
+			copy.imageSubresource = VkImageSubresourceLayers{ VK_IMAGE_ASPECT_COLOR_BIT, aLevel, aLayer, 1 };
+			copy.imageOffset = VkOffset3D{ 0, std::int32_t(y), 0 };
+			copy.imageExtent = VkExtent3D{ aWidth, std::min( count * aBlockExtent, aHeight - y ), 1 };
+
+			vkCmdCopyBufferToImage( command_buffer(), region.buffer, aImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy );
+
+			row += count;
+		}
+	}
+
+	bool StagingRing::direct_writes() const noexcept
+	{
+		return mDirectWrites;
+	}
+
+	Buffer StagingRing::create_device_buffer( void const* aData, VkDeviceSize aSize, VkBufferUsageFlags aUsage, VkAccessFlags aDstAccess, VkPipelineStageFlags aDstStage, MemoryCategory aCategory )
+	{
+		if( mDirectWrites )
+		{
+			MappedBuffer direct = create_mapped_device_buffer( *mAllocator, aSize, aUsage, aCategory );
+			if( VK_NULL_HANDLE != direct.buffer.buffer )
+			{
+				std::memcpy( direct.data, aData, std::size_t(aSize) );
+				mDirectBytes += aSize;
+				return std::move(direct.buffer);
+			}
+		}
+
+		Buffer ret = create_buffer( *mAllocator, aSize, aUsage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, aCategory );
+
+		upload_buffer( ret.buffer, 0, aData, aSize );
+
+		buffer_barrier( command_buffer(),
+			ret.buffer,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			aDstAccess,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			aDstStage
+		);
+
+		return ret;
+	}
+
+	void StagingRing::flush()
+	{
+		if( VK_NULL_HANDLE == mCurrent.cmdBuff )
+			return;
+
+		LUT_TRACE_SCOPE( "StagingRing::flush" );
+
+		if( auto const res = vkEndCommandBuffer( mCurrent.cmdBuff ); VK_SUCCESS != res )
+		{
+			throw Error( "Ending command buffer recording\n" "vkEndCommandBuffer() returned %s", to_string(res).c_str() );
+		}
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &mCurrent.cmdBuff;
+
+		if( auto const res = vkQueueSubmit( mContext->graphicsQueue, 1, &submitInfo, mCurrent.fence.handle ); VK_SUCCESS != res )
+		{
+			throw Error( "Submitting staging commands\n" "vkQueueSubmit() returned %s", to_string(res).c_str() );
+		}
+
+		mCurrent.end = mHead;
+		mPending.emplace_back( std::move(mCurrent) );
+
+		mCurrent = Submission_{};
+		++mSubmissions;
+	}
+
+	void StagingRing::finish()
+	{
+		LUT_TRACE_SCOPE( "StagingRing::finish" );
+
+		flush();
+
+		while( !mPending.empty() )
+			collect_( true );
+	}
+
+	StagingRingStats StagingRing::stats() const noexcept
+	{
+		StagingRingStats ret{};
+		ret.submissions = mSubmissions;
+		ret.waits = mWaits;
+		ret.allocatedBytes = mAllocatedBytes;
+		ret.directBytes = mDirectBytes;
+		return ret;
+	}
+
+	void StagingRing::print_stats( std::FILE* aOut ) const
+	{
+		auto const st = stats();
+
+		std::fprintf( aOut, "Staging ring: %.1f MiB, %.1f MiB uploaded in %llu submissions, %llu waits for space, %.1f MiB written directly%s\n",
+			mCapacity / (1024.0*1024.0),
+			st.allocatedBytes / (1024.0*1024.0),
+			static_cast<unsigned long long>(st.submissions),
+			static_cast<unsigned long long>(st.waits),
+			st.directBytes / (1024.0*1024.0),
+			mDirectWrites ? "" : " (disabled)"
+		);
+	}
+
+
+	bool StagingRing::try_allocate_( VkDeviceSize aSize, VkDeviceSize aAlignment, VkDeviceSize& aOffset )
+	{
+		assert( VK_NULL_HANDLE != mCurrent.cmdBuff );
+
+		// Start over at the beginning whenever the ring is empty, which
+		// leaves the most room in one piece
+		if( 0 == mUsed )
+			mHead = mTail = 0;
+		else if( mCapacity == mUsed )
+			return false;
+
+		VkDeviceSize const aligned = align_up_( mHead, aAlignment );
+
+		VkDeviceSize taken = 0;
+		if( mHead >= mTail )
+		{
+			// Free: [mHead, mCapacity) and [0, mTail)
+			if( aligned + aSize <= mCapacity )
+			{
+				aOffset = aligned;
+				taken = aligned + aSize - mHead;
+			}
+			else if( aSize <= mTail )
+			{
+				// Skip the remainder of the buffer
+				aOffset = 0;
+				taken = mCapacity - mHead + aSize;
+			}
+			else
+				return false;
+		}
+		else
+		{
+			// Free: [mHead, mTail)
+			if( aligned + aSize > mTail )
+				return false;
+
+			aOffset = aligned;
+			taken = aligned + aSize - mHead;
+		}
+
+		mHead = aOffset + aSize;
+		mUsed += taken;
+		mCurrent.bytes += taken;
+		mAllocatedBytes += aSize;
+		return true;
+	}
+
+	VkDeviceSize StagingRing::largest_free_( VkDeviceSize aAlignment ) const noexcept
+	{
+		if( 0 == mUsed )
+			return mCapacity;
+		if( mCapacity == mUsed )
+			return 0;
+
+		VkDeviceSize const aligned = align_up_( mHead, aAlignment );
+
+		if( mHead >= mTail )
+		{
+			VkDeviceSize const end = aligned < mCapacity ? mCapacity - aligned : 0;
+			return std::max( end, mTail );
+		}
+
+		return aligned < mTail ? mTail - aligned : 0;
+	}
+
+	void StagingRing::collect_( bool aWaitForOldest )
+	{
+		if( aWaitForOldest && !mPending.empty() )
+		{
+			LUT_TRACE_SCOPE( "StagingRing wait" );
+
+			auto const& oldest = mPending.front();
+			if( auto const res = vkWaitForFences( mContext->device, 1, &oldest.fence.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max() ); VK_SUCCESS != res )
+			{
+				throw Error( "Waiting for staging submission\n" "vkWaitForFences() returned %s", to_string(res).c_str() );
+			}
+
+			++mWaits;
+		}
+
+		std::size_t done = 0;
+		for( ; done < mPending.size(); ++done )
+		{
+			auto& sub = mPending[done];
+
+			auto const status = vkGetFenceStatus( mContext->device, sub.fence.handle );
+			if( VK_NOT_READY == status )
+				break;
+			if( VK_SUCCESS != status )
+				throw Error( "Querying staging submission\n" "vkGetFenceStatus() returned %s", to_string(status).c_str() );
+
+			// Submissions without allocations don't own any memory, and their
+			// end may predate a reset of the ring
+			if( sub.bytes > 0 )
+			{
+				mTail = sub.end;
+				mUsed -= sub.bytes;
+			}
+
+			if( auto const res = vkResetFences( mContext->device, 1, &sub.fence.handle ); VK_SUCCESS != res )
+				throw Error( "Resetting fence\n" "vkResetFences() returned %s", to_string(res).c_str() );
+			if( auto const res = vkResetCommandBuffer( sub.cmdBuff, 0 ); VK_SUCCESS != res )
+				throw Error( "Resetting command buffer\n" "vkResetCommandBuffer() returned %s", to_string(res).c_str() );
+
+			mFree.emplace_back( std::move(sub) );
+		}
+
+		mPending.erase( mPending.begin(), mPending.begin() + std::ptrdiff_t(done) );
+	}
+
+	StagingRing::Region StagingRing::region_( VkDeviceSize aOffset, VkDeviceSize aSize ) noexcept
+	{
+		return Region{ mBuffer.buffer.buffer, aOffset, aSize, mBuffer.data + aOffset };
+	}
+
+
+	StagingRing create_staging_ring( VulkanContext const& aContext, Allocator const& aAllocator, VkDeviceSize aCapacity, bool aAllowDirectWrites )
+	{
+		StagingRing ret;
+		ret.mContext = &aContext;
+		ret.mAllocator = &aAllocator;
+		ret.mDirectWrites = aAllowDirectWrites && is_device_memory_host_visible( aAllocator );
+		ret.mBuffer = create_mapped_staging_buffer( aAllocator, aCapacity );
+		ret.mCapacity = aCapacity;
+		ret.mCmdPool = create_command_pool( aContext, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT );
+		return ret;
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
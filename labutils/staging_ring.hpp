@@ -0,0 +1,165 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <vector>
+
+#include <cstdio>
+#include <cstdint>
+
+#include "vkobject.hpp"
+#include "vkbuffer.hpp"
+#include "allocator.hpp"
+#include "vulkan_context.hpp"
+
+namespace labutils
+{
+	struct StagingRingStats
+	{
+		std::uint64_t submissions;
+		std::uint64_t waits; // times an allocation had to wait for the GPU
+		VkDeviceSize allocatedBytes;
+
+		VkDeviceSize directBytes; // written without staging, see create_device_buffer()
+	};
+
+	// Uploads through one persistently mapped staging buffer, instead of a
+	// new buffer (and vmaMapMemory()) per upload.
+	//
+	// The buffer is used as a ring: allocations are made linearly, at the
+	// requested alignment, and wrap around to the start when they reach the
+	// end. The ring also records the transfer commands. Commands go into the
+	// current command buffer (see command_buffer()) until flush() submits
+	// it to the graphics queue. Memory allocated since the previous flush()
+	// is recycled once the GPU signals that submission's fence.
+	//
+	// If an allocation doesn't fit, the ring waits for the oldest submission
+	// to complete, and repeats until there is room. With nothing else pending,
+	// it first flushes the current command buffer. Allocations therefore never
+	// fail, except for ones larger than the ring. Larger uploads are split
+	// into pieces with allocate_up_to(), or with upload_buffer() and
+	// upload_image_level(), which do this themselves. The pieces may end up in
+	// different submissions; since they are submitted to the same queue in
+	// order, this makes no difference to later commands.
+	// The command buffer can change with each allocation. Fetch it again
+	// after allocating, and fill in (or read) a region and record the
+	// commands that use it before allocating the next one: once a region's
+	// submission has completed, its memory may be handed out again.
+	//
+	// Where device local memory is host visible anyway (integrated GPUs, CPU
+	// implementations, resizable BAR; see is_device_memory_host_visible()),
+	// create_device_buffer() skips the ring and writes buffer contents
+	// through a mapping of the buffer itself.
+	class StagingRing
+	{
+		public:
+			struct Region
+			{
+				VkBuffer buffer;
+				VkDeviceSize offset; // into buffer
+				VkDeviceSize size;
+				std::uint8_t* data; // mapped, at offset
+			};
+
+		public:
+			StagingRing() noexcept, ~StagingRing();
+
+			StagingRing( StagingRing const& ) = delete;
+			StagingRing& operator= (StagingRing const&) = delete;
+
+			StagingRing( StagingRing&& ) noexcept;
+			StagingRing& operator = (StagingRing&&) noexcept;
+
+		public:
+			VkDeviceSize capacity() const noexcept;
+
+			// In the recording state. Begun on demand.
+			VkCommandBuffer command_buffer();
+
+			// Throws if aSize exceeds capacity()
+			Region allocate( VkDeviceSize aSize, VkDeviceSize aAlignment = 16 );
+
+			// Returns between aMinSize and aMaxSize bytes, a multiple of
+			// aMinSize unless it is aMaxSize: as much as is free in one
+			// piece, without waiting, as long as that's at least aMinSize.
+			Region allocate_up_to( VkDeviceSize aMaxSize, VkDeviceSize aMinSize, VkDeviceSize aAlignment = 16 );
+
+			// Copies aData to aDst, in as many pieces as needed
+			void upload_buffer( VkBuffer aDst, VkDeviceSize aDstOffset, void const* aData, VkDeviceSize aSize );
+
+			// Copies tightly packed texel data to one level (of array layer
+			// aLayer) of an image in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL.
+			// Pieces are whole rows, or rows of blocks for block compressed
+			// formats (aBlockExtent = 4).
+			void upload_image_level( VkImage, std::uint32_t aLevel, std::uint32_t aWidth, std::uint32_t aHeight, void const* aData, std::uint32_t aBytesPerBlock = 4, std::uint32_t aBlockExtent = 1, std::uint32_t aLayer = 0 );
+
+			// Whether create_device_buffer() writes buffers directly
+			bool direct_writes() const noexcept;
+
+			// Creates a device local buffer with the given contents, ready
+			// for aDstAccess in aDstStage by later submissions. With
+			// direct_writes(), the buffer is placed in host visible memory
+			// and written through its mapping; host writes are visible to
+			// the device from the next vkQueueSubmit() on, so there are no
+			// commands. Otherwise, or if that memory is exhausted, the data is
+			// copied through the ring, followed by a barrier.
+			Buffer create_device_buffer( void const* aData, VkDeviceSize aSize, VkBufferUsageFlags, VkAccessFlags aDstAccess, VkPipelineStageFlags aDstStage, MemoryCategory = MemoryCategory::other );
+
+			// Submits the current command buffer, if any
+			void flush();
+
+			// Flushes and waits for all submissions to complete
+			void finish();
+
+			StagingRingStats stats() const noexcept;
+			void print_stats( std::FILE* = stdout ) const;
+
+		private:
+			friend StagingRing create_staging_ring( VulkanContext const&, Allocator const&, VkDeviceSize, bool );
+
+			struct Submission_
+			{
+				Fence fence;
+				VkCommandBuffer cmdBuff = VK_NULL_HANDLE;
+				VkDeviceSize end = 0; // ring head when submitted
+				VkDeviceSize bytes = 0; // allocated by the submission, including padding
+			};
+
+			bool try_allocate_( VkDeviceSize aSize, VkDeviceSize aAlignment, VkDeviceSize& aOffset );
+			VkDeviceSize largest_free_( VkDeviceSize aAlignment ) const noexcept;
+
+			void collect_( bool aWaitForOldest );
+			Region region_( VkDeviceSize aOffset, VkDeviceSize aSize ) noexcept;
+
+		private:
+			VulkanContext const* mContext = nullptr;
+			Allocator const* mAllocator = nullptr;
+
+			MappedBuffer mBuffer;
+			VkDeviceSize mCapacity = 0;
+
+			CommandPool mCmdPool;
+
+			Submission_ mCurrent; // cmdBuff is null until command_buffer()
+			std::vector<Submission_> mPending; // oldest first
+			std::vector<Submission_> mFree;
+
+			// Allocated memory is [mTail, mHead), wrapping around, and
+			// mUsed bytes (which tells a full ring from an empty one). mTail
+			// is the start of the oldest pending submission's memory.
+			VkDeviceSize mHead = 0, mTail = 0, mUsed = 0;
+
+			bool mDirectWrites = false;
+
+			std::uint64_t mSubmissions = 0, mWaits = 0;
+			VkDeviceSize mAllocatedBytes = 0, mDirectBytes = 0;
+	};
+
+	constexpr VkDeviceSize kDefaultStagingRingSize = VkDeviceSize(64) << 20;
+
+	// Direct writes are used where available, unless aAllowDirectWrites is
+	// false
+	StagingRing create_staging_ring( VulkanContext const&, Allocator const&, VkDeviceSize aCapacity = kDefaultStagingRingSize, bool aAllowDirectWrites = true );
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
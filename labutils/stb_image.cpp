@@ -0,0 +1,77 @@
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+
+/* stb_image's implementation, with allocation hooks for decoding into
+ * caller-provided memory (see image_decode.cpp). This replaces the stock
+ * stb/src/stb_image.c, which x-stb therefore doesn't build.
+ *
+ * While a target is set, the first allocation whose size lies in
+ * [aMinSize, aCapacity] returns the target instead of new memory. Freeing
+ * the target is a no-op. The caller compares the pointer returned by
+ * stbi_load*() to the target to find out if the image was decoded in place.
+ * If some other allocation was redirected instead, the result simply ends up
+ * elsewhere, so this is safe regardless of stb_image's internals.
+ */
+namespace
+{
+	thread_local void* sTarget = nullptr;
+	thread_local std::size_t sTargetMin = 0;
+	thread_local std::size_t sTargetCapacity = 0;
+	thread_local bool sTargetIssued = false;
+
+	void* stbi_malloc_( std::size_t aSize )
+	{
+		if( sTarget && !sTargetIssued && aSize >= sTargetMin && aSize <= sTargetCapacity )
+		{
+			sTargetIssued = true;
+			return sTarget;
+		}
+
+		return std::malloc( aSize );
+	}
+
+	void stbi_free_( void* aPtr )
+	{
+		if( aPtr && aPtr == sTarget )
+			return;
+
+		std::free( aPtr );
+	}
+
+	void* stbi_realloc_( void* aPtr, std::size_t aSize )
+	{
+		if( aPtr && aPtr == sTarget )
+		{
+			if( aSize <= sTargetCapacity )
+				return aPtr;
+
+			void* ret = std::malloc( aSize );
+			if( ret )
+				std::memcpy( ret, aPtr, sTargetCapacity );
+			return ret;
+		}
+
+		return std::realloc( aPtr, aSize );
+	}
+}
+
+#define STBI_MALLOC(sz) stbi_malloc_(sz)
+#define STBI_FREE(p) stbi_free_(p)
+#define STBI_REALLOC(p,sz) stbi_realloc_(p,sz)
+
+#define STB_IMAGE_IMPLEMENTATION 1
+#include <stb_image.h>
+
+namespace labutils
+{
+	void set_stbi_output_target( void* aTarget, std::size_t aMinSize, std::size_t aCapacity )
+	{
+		sTarget = aTarget;
+		sTargetMin = aMinSize;
+		sTargetCapacity = aCapacity;
+		sTargetIssued = false;
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,562 @@
+#include "texture_streamer.hpp"
+
+#include <limits>
+#include <utility>
+#include <algorithm>
+
+#include <cassert>
+#include <cstring>
+
+#include "error.hpp"
+#include "trace.hpp"
+#include "image_decode.hpp"
+#include "vkutil.hpp"
+#include "parallel.hpp"
+#include "to_string.hpp"
+
+namespace
+{
+	void write_descriptor_( labutils::VulkanContext const& aContext, VkDescriptorSet aSet, VkImageView aView, VkSampler aSampler )
+	{
+		VkDescriptorImageInfo imageInfo{};
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfo.imageView = aView;
+		imageInfo.sampler = aSampler;
+
+		VkWriteDescriptorSet desc{};
+		desc.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		desc.dstSet = aSet;
+		desc.dstBinding = 0;
+		desc.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		desc.descriptorCount = 1;
+		desc.pImageInfo = &imageInfo;
+
+		vkUpdateDescriptorSets( aContext.device, 1, &desc, 0, nullptr );
+	}
+
+	VkImageMemoryBarrier image_barrier_info_( VkImage aImage, VkAccessFlags aSrcAccess, VkAccessFlags aDstAccess, VkImageLayout aSrcLayout, VkImageLayout aDstLayout )
+	{
+		VkImageMemoryBarrier ret{};
+		ret.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		ret.srcAccessMask = aSrcAccess;
+		ret.dstAccessMask = aDstAccess;
+		ret.oldLayout = aSrcLayout;
+		ret.newLayout = aDstLayout;
+		ret.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		ret.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		ret.image = aImage;
+		ret.subresourceRange = VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 };
+		return ret;
+	}
+}
+
+namespace labutils
+{
+	TextureStreamer::TextureStreamer() noexcept = default;
+
+	TextureStreamer::~TextureStreamer()
+	{
+		// Images of a batch in flight are destroyed with it
+		for( auto const& batch : mInFlight )
+			vkWaitForFences( mContext->device, 1, &batch.fence.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max() );
+	}
+
+	TextureStreamer::TextureStreamer( TextureStreamer&& ) noexcept = default;
+	TextureStreamer& TextureStreamer::operator=( TextureStreamer&& ) noexcept = default;
+
+
+	std::uint32_t TextureStreamer::texture_count() const noexcept
+	{
+		return std::uint32_t(mTextures.size());
+	}
+
+	std::uint32_t TextureStreamer::width( std::uint32_t aTexture ) const noexcept
+	{
+		assert( aTexture < mTextures.size() );
+		return mTextures[aTexture].levels[0].width;
+	}
+	std::uint32_t TextureStreamer::height( std::uint32_t aTexture ) const noexcept
+	{
+		assert( aTexture < mTextures.size() );
+		return mTextures[aTexture].levels[0].height;
+	}
+	std::uint32_t TextureStreamer::level_count( std::uint32_t aTexture ) const noexcept
+	{
+		assert( aTexture < mTextures.size() );
+		return std::uint32_t(mTextures[aTexture].levels.size());
+	}
+
+	std::uint32_t TextureStreamer::resident_level( std::uint32_t aTexture ) const noexcept
+	{
+		assert( aTexture < mTextures.size() );
+		return mTextures[aTexture].residentLevel;
+	}
+
+	VkDescriptorSet TextureStreamer::descriptor_set( std::uint32_t aTexture ) const noexcept
+	{
+		assert( aTexture < mTextures.size() );
+		auto const& tex = mTextures[aTexture];
+		return tex.sets[tex.currentSet];
+	}
+
+	void TextureStreamer::request_level( std::uint32_t aTexture, std::uint32_t aLevel ) noexcept
+	{
+		assert( aTexture < mTextures.size() );
+		auto& tex = mTextures[aTexture];
+		tex.wantedLevel = std::min( tex.wantedLevel, aLevel );
+	}
+
+	void TextureStreamer::update( std::uint32_t aFrameSlot, bool aWait )
+	{
+		LUT_TRACE_SCOPE("TextureStreamer::update");
+		assert( aFrameSlot < mSlotCount );
+
+		release_retired_( aFrameSlot );
+		finish_batch_( aFrameSlot, aWait );
+
+		for( auto& tex : mTextures )
+		{
+			if( tex.wantedLevel <= tex.residentLevel )
+				tex.lastNeeded = mFrame;
+		}
+
+		if( aWait )
+		{
+			while( start_batch_() )
+			{
+				finish_batch_( aFrameSlot, true );
+				release_retired_( aFrameSlot );
+			}
+		}
+		else if( mInFlight.empty() )
+		{
+			start_batch_();
+		}
+
+		for( auto& tex : mTextures )
+			tex.wantedLevel = tex.floorLevel;
+
+		++mFrame;
+	}
+
+	TextureStreamerStats TextureStreamer::stats() const
+	{
+		TextureStreamerStats ret{};
+		ret.residentBytes = mResidentBytes;
+		ret.budgetBytes = mConfig.budgetBytes;
+		ret.uploads = mUploads;
+		ret.evictions = mEvictions;
+		ret.uploadedBytes = mUploadedBytes;
+
+		for( auto const& tex : mTextures )
+		{
+			if( tex.residentLevel >= ret.texturesPerLevel.size() )
+				ret.texturesPerLevel.resize( tex.residentLevel + 1 );
+
+			++ret.texturesPerLevel[tex.residentLevel];
+		}
+
+		return ret;
+	}
+
+	void TextureStreamer::print_stats( std::FILE* aOut ) const
+	{
+		auto const st = stats();
+
+		std::fprintf( aOut, "Texture streaming: %.1f of %.1f MiB resident, %llu uploads (%.1f MiB), %llu evictions\n",
+			st.residentBytes / (1024.0*1024.0),
+			st.budgetBytes / (1024.0*1024.0),
+			static_cast<unsigned long long>(st.uploads),
+			st.uploadedBytes / (1024.0*1024.0),
+			static_cast<unsigned long long>(st.evictions)
+		);
+
+		for( std::size_t level = 0; level < st.texturesPerLevel.size(); ++level )
+		{
+			if( 0 != st.texturesPerLevel[level] )
+				std::fprintf( aOut, "  level %2zu: %u textures\n", level, st.texturesPerLevel[level] );
+		}
+	}
+
+
+	VkDeviceSize TextureStreamer::chain_bytes_( std::uint32_t aTexture, std::uint32_t aLevel ) const noexcept
+	{
+		auto const& levels = mTextures[aTexture].levels;
+
+		VkDeviceSize ret = 0;
+		for( std::size_t level = aLevel; level < levels.size(); ++level )
+			ret += VkDeviceSize(levels[level].width) * levels[level].height * 4;
+
+		return ret;
+	}
+
+	bool TextureStreamer::finish_batch_( std::uint32_t aFrameSlot, bool aWait )
+	{
+		if( mInFlight.empty() )
+			return false;
+
+		auto& batch = mInFlight.front();
+
+		if( aWait )
+		{
+			if( auto const res = vkWaitForFences( mContext->device, 1, &batch.fence.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max() ); VK_SUCCESS != res )
+			{
+				throw Error( "Waiting for texture streaming upload\n" "vkWaitForFences() returned %s", to_string(res).c_str() );
+			}
+		}
+		else if( auto const res = vkGetFenceStatus( mContext->device, batch.fence.handle ); VK_NOT_READY == res )
+		{
+			return false;
+		}
+		else if( VK_SUCCESS != res )
+		{
+			throw Error( "Querying texture streaming upload\n" "vkGetFenceStatus() returned %s", to_string(res).c_str() );
+		}
+
+		// The current frame slot is about to be re-recorded and its previous
+		// use has completed, so only the other slots can still reference the
+		// replaced images.
+		std::uint64_t const allSlots = 64 == mSlotCount ? ~std::uint64_t(0) : (std::uint64_t(1) << mSlotCount) - 1;
+		std::uint64_t const pendingSlots = allSlots & ~(std::uint64_t(1) << aFrameSlot);
+
+		for( auto& change : batch.changes )
+		{
+			auto& tex = mTextures[change.texture];
+			auto const previousLevel = tex.residentLevel;
+
+			tex.currentSet = 1 - tex.currentSet;
+			write_descriptor_( *mContext, tex.sets[tex.currentSet], change.view.handle, mSampler );
+
+			Retired_ retired{
+				std::exchange( tex.image, std::move(change.image) ),
+				std::exchange( tex.view, std::move(change.view) ),
+				change.texture,
+				chain_bytes_( change.texture, previousLevel ),
+				pendingSlots
+			};
+
+			tex.residentLevel = change.level;
+
+			if( VK_NULL_HANDLE == retired.image.image || 0 == retired.pendingSlots )
+			{
+				mResidentBytes -= retired.bytes;
+				tex.busy = false;
+			}
+			else
+			{
+				mRetired.emplace_back( std::move(retired) );
+			}
+		}
+
+		vkFreeCommandBuffers( mContext->device, mCmdPool.handle, 1, &batch.cmdBuff );
+		mInFlight.clear();
+		return true;
+	}
+
+	void TextureStreamer::release_retired_( std::uint32_t aFrameSlot )
+	{
+		for( auto& retired : mRetired )
+			retired.pendingSlots &= ~(std::uint64_t(1) << aFrameSlot);
+
+		auto const it = std::partition( mRetired.begin(), mRetired.end(), [] (Retired_ const& aRetired) {
+			return 0 != aRetired.pendingSlots;
+		} );
+
+		for( auto jt = it; jt != mRetired.end(); ++jt )
+		{
+			mResidentBytes -= jt->bytes;
+			mTextures[jt->texture].busy = false;
+		}
+
+		mRetired.erase( it, mRetired.end() );
+	}
+
+	bool TextureStreamer::start_batch_()
+	{
+		assert( mInFlight.empty() );
+
+		std::vector<std::uint32_t> upgrades, evictable;
+		for( std::uint32_t i = 0; i < mTextures.size(); ++i )
+		{
+			auto const& tex = mTextures[i];
+			if( tex.busy )
+				continue;
+
+			if( tex.wantedLevel < tex.residentLevel )
+				upgrades.push_back( i );
+			else if( tex.wantedLevel > tex.residentLevel )
+				evictable.push_back( i );
+		}
+
+		if( upgrades.empty() )
+			return false;
+
+		// Most missing levels first; least recently needed first
+		std::stable_sort( upgrades.begin(), upgrades.end(), [this] (std::uint32_t aX, std::uint32_t aY) {
+			auto const& x = mTextures[aX], & y = mTextures[aY];
+			return x.residentLevel - x.wantedLevel > y.residentLevel - y.wantedLevel;
+		} );
+		std::stable_sort( evictable.begin(), evictable.end(), [this] (std::uint32_t aX, std::uint32_t aY) {
+			return mTextures[aX].lastNeeded < mTextures[aY].lastNeeded;
+		} );
+
+		std::vector<std::uint32_t> textures, levels;
+		VkDeviceSize uploadBytes = 0;
+		std::size_t nextEviction = 0;
+
+		auto schedule = [&] (std::uint32_t aTexture, std::uint32_t aLevel) {
+			textures.push_back( aTexture );
+			levels.push_back( aLevel );
+			mTextures[aTexture].busy = true;
+
+			auto const bytes = chain_bytes_( aTexture, aLevel );
+			mResidentBytes += bytes;
+			uploadBytes += bytes;
+		};
+
+		for( auto const i : upgrades )
+		{
+			if( uploadBytes >= mConfig.uploadBytesPerUpdate && !textures.empty() )
+				break;
+
+			auto const& tex = mTextures[i];
+			VkDeviceSize const available = mConfig.budgetBytes > mResidentBytes ? mConfig.budgetBytes - mResidentBytes : 0;
+
+			// Evict to make room for the full upgrade. The memory becomes
+			// available once the evicted images are released.
+			VkDeviceSize const needed = chain_bytes_( i, tex.wantedLevel );
+			VkDeviceSize freed = 0;
+			while( available + freed < needed && nextEviction < evictable.size() )
+			{
+				auto const e = evictable[nextEviction++];
+				auto const& victim = mTextures[e];
+
+				freed += chain_bytes_( e, victim.residentLevel ) - chain_bytes_( e, victim.wantedLevel );
+				schedule( e, victim.wantedLevel );
+			}
+
+			// Upgrade as far as the budget allows right now
+			std::uint32_t level = tex.wantedLevel;
+			while( level < tex.residentLevel && chain_bytes_( i, level ) > available )
+				++level;
+
+			if( level < tex.residentLevel )
+				schedule( i, level );
+		}
+
+		if( textures.empty() )
+			return false;
+
+		LUT_TRACE_SCOPE("TextureStreamer::start_batch_");
+
+		Batch_ batch;
+		batch.fence = create_fence( *mContext );
+		batch.cmdBuff = alloc_command_buffer( *mContext, mCmdPool.handle );
+
+		record_batch_( batch, textures, levels );
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &batch.cmdBuff;
+
+		if( auto const res = vkQueueSubmit( mContext->graphicsQueue, 1, &submitInfo, batch.fence.handle ); VK_SUCCESS != res )
+		{
+			throw Error( "Submitting texture streaming upload\n" "vkQueueSubmit() returned %s", to_string(res).c_str() );
+		}
+
+		for( std::size_t i = 0; i < textures.size(); ++i )
+		{
+			if( levels[i] < mTextures[textures[i]].residentLevel )
+				++mUploads;
+			else
+				++mEvictions;
+		}
+
+		mUploadedBytes += uploadBytes;
+		mInFlight.emplace_back( std::move(batch) );
+
+		return true;
+	}
+
+	TextureStreamer::Change_ TextureStreamer::prepare_change_( std::uint32_t aTexture, std::uint32_t aLevel )
+	{
+		auto const& tex = mTextures[aTexture];
+		auto const& top = tex.levels[aLevel];
+
+		Change_ ret;
+		ret.texture = aTexture;
+		ret.level = aLevel;
+		ret.image = create_image_texture2d( *mAllocator, top.width, top.height, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, MemoryCategory::texture, std::uint32_t(tex.levels.size()) - aLevel );
+		ret.view = create_image_view_texture2d_array( *mContext, ret.image.image, VK_FORMAT_R8G8B8A8_SRGB );
+		return ret;
+	}
+
+	void TextureStreamer::record_batch_( Batch_& aBatch, std::vector<std::uint32_t> const& aTextures, std::vector<std::uint32_t> const& aLevels )
+	{
+		assert( aTextures.size() == aLevels.size() );
+
+		// Staging layout
+		std::vector<std::vector<VkBufferImageCopy>> copies( aTextures.size() );
+		VkDeviceSize totalSize = 0;
+
+		for( std::size_t i = 0; i < aTextures.size(); ++i )
+		{
+			auto const& levels = mTextures[aTextures[i]].levels;
+			for( std::uint32_t level = aLevels[i]; level < levels.size(); ++level )
+			{
+				VkBufferImageCopy copy{};
+				copy.bufferOffset = totalSize;
+				copy.imageSubresource = VkImageSubresourceLayers{ VK_IMAGE_ASPECT_COLOR_BIT, level - aLevels[i], 0, 1 };
+				copy.imageOffset = VkOffset3D{ 0, 0, 0 };
+				copy.imageExtent = VkExtent3D{ levels[level].width, levels[level].height, 1 };
+				copies[i].emplace_back( copy );
+
+				totalSize += levels[level].texels.size();
+			}
+		}
+
+		aBatch.staging = create_buffer( *mAllocator, totalSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::staging );
+
+		void* sptr = nullptr;
+		if( auto const res = vmaMapMemory( mAllocator->allocator, aBatch.staging.allocation, &sptr ); VK_SUCCESS != res )
+		{
+			throw Error( "Mapping memory for writing\n" "vmaMapMemory() returned %s", to_string(res).c_str() );
+		}
+
+		for( std::size_t i = 0; i < aTextures.size(); ++i )
+		{
+			auto const& levels = mTextures[aTextures[i]].levels;
+			for( std::uint32_t level = aLevels[i]; level < levels.size(); ++level )
+			{
+				auto const& copy = copies[i][level - aLevels[i]];
+				std::memcpy( static_cast<std::uint8_t*>(sptr) + copy.bufferOffset, levels[level].texels.data(), levels[level].texels.size() );
+			}
+		}
+
+		vmaUnmapMemory( mAllocator->allocator, aBatch.staging.allocation );
+
+		// Images
+		aBatch.changes.reserve( aTextures.size() );
+		for( std::size_t i = 0; i < aTextures.size(); ++i )
+			aBatch.changes.emplace_back( prepare_change_( aTextures[i], aLevels[i] ) );
+
+		// Commands
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		if( auto const res = vkBeginCommandBuffer( aBatch.cmdBuff, &beginInfo ); VK_SUCCESS != res )
+		{
+			throw Error( "Beginning command buffer recording\n" "vkBeginCommandBuffer() returned %s", to_string(res).c_str() );
+		}
+
+		std::vector<VkImageMemoryBarrier> barriers;
+		barriers.reserve( aBatch.changes.size() );
+
+		for( auto const& change : aBatch.changes )
+			barriers.emplace_back( image_barrier_info_( change.image.image, 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL ) );
+
+		vkCmdPipelineBarrier( aBatch.cmdBuff, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, std::uint32_t(barriers.size()), barriers.data() );
+
+		for( std::size_t i = 0; i < aBatch.changes.size(); ++i )
+			vkCmdCopyBufferToImage( aBatch.cmdBuff, aBatch.staging.buffer, aBatch.changes[i].image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, std::uint32_t(copies[i].size()), copies[i].data() );
+
+		// Frames submitted after this batch sample the images once they are
+		// swapped in; the barrier covers those later submissions.
+		barriers.clear();
+		for( auto const& change : aBatch.changes )
+			barriers.emplace_back( image_barrier_info_( change.image.image, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL ) );
+
+		vkCmdPipelineBarrier( aBatch.cmdBuff, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, std::uint32_t(barriers.size()), barriers.data() );
+
+		if( auto const res = vkEndCommandBuffer( aBatch.cmdBuff ); VK_SUCCESS != res )
+		{
+			throw Error( "Ending command buffer recording\n" "vkEndCommandBuffer() returned %s", to_string(res).c_str() );
+		}
+	}
+
+
+	TextureStreamer create_texture_streamer( VulkanContext const& aContext, Allocator const& aAllocator, VkDescriptorSetLayout aSetLayout, VkSampler aSampler, std::vector<std::string> const& aPaths, std::uint32_t aFrameSlotCount, TextureStreamerConfig const& aConfig )
+	{
+		LUT_TRACE_SCOPE("create_texture_streamer");
+		assert( aFrameSlotCount >= 1 && aFrameSlotCount <= 64 );
+
+		TextureStreamer ret;
+		ret.mContext = &aContext;
+		ret.mAllocator = &aAllocator;
+		ret.mSampler = aSampler;
+		ret.mConfig = aConfig;
+		ret.mSlotCount = aFrameSlotCount;
+
+		// Decode and generate the full mip chains. Each texture is handled by
+		// one thread.
+		ret.mTextures.resize( aPaths.size() );
+
+		parallel_for( aPaths.size(), [&] (std::size_t aBegin, std::size_t aEnd) {
+			for( std::size_t i = aBegin; i < aEnd; ++i )
+			{
+				LUT_TRACE_SCOPE("decode texture");
+
+				auto const file = read_file_bytes( aPaths[i].c_str() );
+				auto const info = image_file_info( file, aPaths[i].c_str() );
+
+				// Decoded in place, the slack is dropped afterwards
+				auto& levels = ret.mTextures[i].levels;
+				levels.emplace_back();
+				levels[0].width = info.width;
+				levels[0].height = info.height;
+				levels[0].texels.resize( decode_rgba8_capacity( info ) );
+
+				decode_rgba8_into( file, aPaths[i].c_str(), info, levels[0].texels.data() );
+				levels[0].texels.resize( std::size_t(info.width) * info.height * 4 );
+
+				auto mips = generate_mip_chain_rgba8( levels[0].texels.data(), levels[0].width, levels[0].height, true, MipFilter::box, 1 );
+				for( auto& mip : mips )
+					levels.emplace_back( std::move(mip) );
+			}
+		} );
+
+		// Descriptor sets
+		auto const setCount = std::max( std::uint32_t(2 * aPaths.size()), 2u );
+		ret.mPool = create_descriptor_pool( aContext, setCount, setCount );
+
+		for( auto& tex : ret.mTextures )
+		{
+			tex.sets[0] = alloc_desc_set( aContext, ret.mPool.handle, aSetLayout );
+			tex.sets[1] = alloc_desc_set( aContext, ret.mPool.handle, aSetLayout );
+		}
+
+		ret.mCmdPool = create_command_pool( aContext, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT );
+
+		// Startup levels. These don't count against the per-update limit.
+		for( auto& tex : ret.mTextures )
+		{
+			auto const levelCount = std::uint32_t(tex.levels.size());
+
+			tex.floorLevel = levelCount - 1;
+			while( tex.floorLevel > 0 && std::max( tex.levels[tex.floorLevel-1].width, tex.levels[tex.floorLevel-1].height ) <= aConfig.residentMaxExtent )
+				--tex.floorLevel;
+
+			tex.residentLevel = levelCount; // nothing
+			tex.wantedLevel = tex.floorLevel;
+		}
+
+		if( !ret.mTextures.empty() )
+		{
+			ret.mConfig.uploadBytesPerUpdate = std::numeric_limits<VkDeviceSize>::max();
+			ret.mConfig.budgetBytes = std::numeric_limits<VkDeviceSize>::max();
+
+			ret.start_batch_();
+			ret.finish_batch_( 0, true );
+
+			ret.mConfig = aConfig;
+			ret.mUploads = 0;
+			ret.mUploadedBytes = 0;
+		}
+
+		return ret;
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstdint>
+
+#include "mipmap.hpp"
+#include "vkimage.hpp"
+#include "vkobject.hpp"
+#include "vkbuffer.hpp"
+#include "allocator.hpp"
+#include "vulkan_context.hpp"
+
+namespace labutils
+{
+	struct TextureStreamerConfig
+	{
+		// Device memory that streamed textures may use. Evictions are copies
+		// themselves, so the budget can briefly be exceeded by the (smaller)
+		// evicted images.
+		VkDeviceSize budgetBytes = VkDeviceSize(256) << 20;
+
+		// Levels up to this size (largest dimension) are uploaded at startup
+		// and are never evicted.
+		std::uint32_t residentMaxExtent = 64;
+
+		// Upper limit on the data uploaded by one update(). At least one
+		// texture is uploaded per batch regardless.
+		VkDeviceSize uploadBytesPerUpdate = VkDeviceSize(16) << 20;
+	};
+
+	struct TextureStreamerStats
+	{
+		VkDeviceSize residentBytes; // including uploads in flight and images pending release
+		VkDeviceSize budgetBytes;
+
+		std::uint64_t uploads; // residency changes to a finer level
+		std::uint64_t evictions; // ... to a coarser level
+		VkDeviceSize uploadedBytes;
+
+		std::vector<std::uint32_t> texturesPerLevel; // by resident level
+	};
+
+	// Streams the mip levels of RGBA8 (sRGB) textures based on what the
+	// application requests each frame.
+	//
+	// All textures are decoded at creation, and full mip chains are kept in
+	// host memory. Only the smallest levels (see residentMaxExtent) are
+	// uploaded before rendering starts. Each frame, the application calls
+	// request_level() for the textures it draws with the finest level that
+	// it needs (e.g., from the camera distance), and then update(). Textures
+	// that aren't requested in a frame want only their startup levels.
+	//
+	// A texture is resident from some level down to 1x1. Vulkan images can't
+	// change their level count, so changing this creates a new image for the
+	// texture, uploads its levels from host memory, and swaps it in once the
+	// upload has completed. Changes are batched into one command buffer per
+	// update(), with at most one batch in flight.
+	//
+	// Textures are upgraded in order of how many levels they are missing. If
+	// an upgrade doesn't fit into the budget, the streamer evicts the
+	// unneeded high levels of other textures (those resident at a finer
+	// level than they want), least recently needed first. The upgrade is
+	// retried once the evicted images have been released. It is reduced to
+	// the finest level that fits if evictions can't make enough room.
+	//
+	// Each texture has its own descriptor set (see descriptor_set()), bound to
+	// the current image. Since sets can't be updated while in use, every
+	// texture has two sets that are used in turn. The previous image is
+	// released, and its set can be reused, once none of the application's
+	// command buffers can still reference them: update() takes the index of
+	// the frame slot (e.g., swapchain image) whose command buffer has just
+	// been waited for and is about to be re-recorded. A replaced image is
+	// released once each slot has come around again. A texture isn't changed
+	// again before that.
+	class TextureStreamer
+	{
+		public:
+			TextureStreamer() noexcept, ~TextureStreamer();
+
+			TextureStreamer( TextureStreamer const& ) = delete;
+			TextureStreamer& operator= (TextureStreamer const&) = delete;
+
+			TextureStreamer( TextureStreamer&& ) noexcept;
+			TextureStreamer& operator = (TextureStreamer&&) noexcept;
+
+		public:
+			std::uint32_t texture_count() const noexcept;
+
+			// Of level 0, and the number of levels in the full chain
+			std::uint32_t width( std::uint32_t aTexture ) const noexcept;
+			std::uint32_t height( std::uint32_t aTexture ) const noexcept;
+			std::uint32_t level_count( std::uint32_t aTexture ) const noexcept;
+
+			// Finest level currently visible through descriptor_set()
+			std::uint32_t resident_level( std::uint32_t aTexture ) const noexcept;
+
+			VkDescriptorSet descriptor_set( std::uint32_t aTexture ) const noexcept;
+
+			// Requests for the same texture in a frame combine to the finest
+			// level
+			void request_level( std::uint32_t aTexture, std::uint32_t aLevel ) noexcept;
+
+			// Swaps in completed uploads, releases images that are no longer
+			// referenced and starts the next batch of uploads and evictions.
+			// Call once per frame, after the command buffer of aFrameSlot has
+			// completed and before recording it. This resets the requests.
+			//
+			// With aWait set, this waits for the batch and keeps going until
+			// the requested levels are resident or the budget is exhausted.
+			// Results are then independent of GPU timing (e.g., headless
+			// captures).
+			void update( std::uint32_t aFrameSlot, bool aWait = false );
+
+			TextureStreamerStats stats() const;
+			void print_stats( std::FILE* = stdout ) const;
+
+		private:
+			friend TextureStreamer create_texture_streamer( VulkanContext const&, Allocator const&, VkDescriptorSetLayout, VkSampler, std::vector<std::string> const&, std::uint32_t, TextureStreamerConfig const& );
+
+			struct Texture_
+			{
+				std::vector<MipLevelRGBA8> levels; // full chain, including level 0
+
+				Image image; // levels residentLevel and onwards
+				ImageView view;
+
+				VkDescriptorSet sets[2]{};
+				std::uint32_t currentSet = 0;
+
+				std::uint32_t floorLevel = 0; // uploaded at startup, never evicted
+				std::uint32_t residentLevel = 0;
+				std::uint32_t wantedLevel = 0; // this frame
+
+				std::uint64_t lastNeeded = 0; // frame in which the resident levels were last requested
+				bool busy = false; // change in flight or previous image not yet released
+			};
+
+			struct Change_
+			{
+				std::uint32_t texture;
+				std::uint32_t level;
+
+				Image image;
+				ImageView view;
+			};
+
+			struct Batch_
+			{
+				Fence fence;
+				VkCommandBuffer cmdBuff = VK_NULL_HANDLE;
+				Buffer staging;
+
+				std::vector<Change_> changes;
+			};
+
+			struct Retired_
+			{
+				Image image;
+				ImageView view;
+				std::uint32_t texture;
+				VkDeviceSize bytes;
+
+				std::uint64_t pendingSlots; // bit per frame slot that hasn't come around yet
+			};
+
+			VkDeviceSize chain_bytes_( std::uint32_t aTexture, std::uint32_t aLevel ) const noexcept;
+
+			bool finish_batch_( std::uint32_t aFrameSlot, bool aWait );
+			void release_retired_( std::uint32_t aFrameSlot );
+			bool start_batch_();
+
+			Change_ prepare_change_( std::uint32_t aTexture, std::uint32_t aLevel );
+			void record_batch_( Batch_&, std::vector<std::uint32_t> const& aTextures, std::vector<std::uint32_t> const& aLevels );
+
+		private:
+			VulkanContext const* mContext = nullptr;
+			Allocator const* mAllocator = nullptr;
+			VkSampler mSampler = VK_NULL_HANDLE;
+
+			TextureStreamerConfig mConfig;
+
+			DescriptorPool mPool;
+			CommandPool mCmdPool;
+
+			std::vector<Texture_> mTextures;
+
+			std::vector<Batch_> mInFlight; // zero or one
+			std::vector<Retired_> mRetired;
+
+			std::uint32_t mSlotCount = 1;
+			std::uint64_t mFrame = 1;
+
+			VkDeviceSize mResidentBytes = 0;
+
+			std::uint64_t mUploads = 0, mEvictions = 0;
+			VkDeviceSize mUploadedBytes = 0;
+	};
+
+	// Decodes the images in aPaths and uploads their startup levels. The
+	// descriptor sets use aSetLayout, whose binding 0 must be a combined
+	// image sampler; it is given a 2D array view with one layer.
+	// aFrameSlotCount is the number of command buffers in flight (see
+	// TextureStreamer::update()), at most 64.
+	TextureStreamer create_texture_streamer(
+		VulkanContext const&,
+		Allocator const&,
+		VkDescriptorSetLayout aSetLayout,
+		VkSampler,
+		std::vector<std::string> const& aPaths,
+		std::uint32_t aFrameSlotCount,
+		TextureStreamerConfig const& = TextureStreamerConfig{}
+	);
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
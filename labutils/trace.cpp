@@ -0,0 +1,192 @@
+#include "trace.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <cstdio>
+
+#include "error.hpp"
+
+namespace
+{
+	// Events per thread. At 24 bytes per event, this is 1.5MB per thread
+	// that records any events.
+	constexpr std::size_t kRingSize = std::size_t(1) << 16;
+
+	struct Event_
+	{
+		char const* name;
+		std::uint64_t beginNs, endNs;
+	};
+
+	// Written only by the owning thread. `written` counts all events ever
+	// recorded; the most recent min(written, kRingSize) are in the ring.
+	struct ThreadRing_
+	{
+		std::uint32_t tid = 0;
+		std::atomic<char const*> name{ nullptr };
+
+		std::atomic<std::uint64_t> written{ 0 };
+		std::unique_ptr<Event_[]> events{ new Event_[kRingSize] };
+	};
+
+	std::atomic<bool> gEnabled_{ false };
+
+	// Rings are never freed (threads may exit before the trace is written).
+	// The mutex is only taken when a thread records its first event and when
+	// the trace is written.
+	std::mutex& rings_mutex_()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+	std::vector<std::unique_ptr<ThreadRing_>>& rings_()
+	{
+		static std::vector<std::unique_ptr<ThreadRing_>> rings;
+		return rings;
+	}
+
+	ThreadRing_& thread_ring_()
+	{
+		thread_local ThreadRing_* ring = nullptr;
+
+		if( !ring )
+		{
+			std::lock_guard<std::mutex> lock( rings_mutex_() );
+
+			auto& rings = rings_();
+			rings.emplace_back( std::make_unique<ThreadRing_>() );
+			rings.back()->tid = std::uint32_t(rings.size());
+
+			ring = rings.back().get();
+		}
+
+		return *ring;
+	}
+
+	auto const kEpoch_ = std::chrono::steady_clock::now();
+
+	std::uint64_t now_ns_() noexcept
+	{
+		auto const delta = std::chrono::steady_clock::now() - kEpoch_;
+		return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(delta).count());
+	}
+
+	void write_json_string_( std::FILE* aOut, char const* aStr )
+	{
+		std::fputc( '"', aOut );
+		for( ; *aStr; ++aStr )
+		{
+			if( '"' == *aStr || '\\' == *aStr )
+				std::fputc( '\\', aOut );
+
+			if( static_cast<unsigned char>(*aStr) >= 0x20 )
+				std::fputc( *aStr, aOut );
+		}
+		std::fputc( '"', aOut );
+	}
+}
+
+namespace labutils
+{
+	void trace_enable( bool aEnabled )
+	{
+		gEnabled_.store( aEnabled, std::memory_order_relaxed );
+	}
+
+	bool trace_enabled() noexcept
+	{
+		return gEnabled_.load( std::memory_order_relaxed );
+	}
+
+	void trace_set_thread_name( char const* aName )
+	{
+		thread_ring_().name.store( aName, std::memory_order_relaxed );
+	}
+
+	void write_chrome_trace( char const* aPath )
+	{
+		std::FILE* fout = std::fopen( aPath, "w" );
+		if( !fout )
+			throw Error( "Unable to open '%s' for writing", aPath );
+
+		std::fprintf( fout, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+
+		bool first = true;
+		std::size_t eventCount = 0;
+
+		{
+			std::lock_guard<std::mutex> lock( rings_mutex_() );
+
+			for( auto const& ring : rings_() )
+			{
+				if( char const* name = ring->name.load( std::memory_order_relaxed ) )
+				{
+					std::fprintf( fout, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", ring->tid );
+					write_json_string_( fout, name );
+					std::fprintf( fout, "}}" );
+					first = false;
+				}
+
+				std::uint64_t const written = ring->written.load( std::memory_order_acquire );
+				std::uint64_t const begin = written > kRingSize ? written - kRingSize : 0;
+
+				for( std::uint64_t i = begin; i < written; ++i )
+				{
+					auto const& ev = ring->events[i % kRingSize];
+
+					// Complete ("X") events; times are in microseconds.
+					std::fprintf( fout, "%s{\"name\":", first ? "" : ",\n" );
+					write_json_string_( fout, ev.name );
+					std::fprintf( fout, ",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+						ring->tid, double(ev.beginNs) * 1e-3, double(ev.endNs - ev.beginNs) * 1e-3
+					);
+
+					first = false;
+					++eventCount;
+				}
+			}
+		}
+
+		std::fprintf( fout, "\n]}\n" );
+
+		bool const ok = (0 == std::ferror( fout ));
+		std::fclose( fout );
+
+		if( !ok )
+			throw Error( "Error while writing trace '%s'", aPath );
+
+		std::printf( "Wrote %zu trace events to '%s'\n", eventCount, aPath );
+	}
+}
+
+namespace labutils
+{
+	TraceScope::TraceScope( char const* aName ) noexcept
+		: mName( aName )
+		, mBeginNs( 0 )
+		, mActive( trace_enabled() )
+	{
+		if( mActive )
+			mBeginNs = now_ns_();
+	}
+
+	TraceScope::~TraceScope()
+	{
+		if( !mActive )
+			return;
+
+		std::uint64_t const endNs = now_ns_();
+
+		auto& ring = thread_ring_();
+		std::uint64_t const index = ring.written.load( std::memory_order_relaxed );
+
+		ring.events[index % kRingSize] = Event_{ mName, mBeginNs, endNs };
+		ring.written.store( index + 1, std::memory_order_release );
+	}
+}
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+
+// Lightweight CPU tracing. Code marks regions with LUT_TRACE_SCOPE():
+//
+//	void load_something()
+//	{
+//		LUT_TRACE_SCOPE( "load_something" );
+//		...
+//	}
+//
+// Each thread records completed scopes into its own fixed-size ring buffer,
+// so recording does not take locks or allocate. When a ring is full, the
+// oldest events are overwritten. Recording only happens while tracing is
+// enabled at runtime (trace_enable()); otherwise a scope costs a single
+// relaxed atomic load.
+//
+// write_chrome_trace() writes the recorded events in the Chrome trace event
+// format (JSON), which can be loaded into chrome://tracing or Perfetto
+// (https://ui.perfetto.dev). It should be called when the traced threads
+// are idle; events that are recorded concurrently may be torn.
+//
+// Defining LABUTILS_ENABLE_TRACE=0 removes all instrumentation at compile
+// time.
+//
+// Scope names must be string literals (or otherwise outlive the trace).
+
+#if !defined(LABUTILS_ENABLE_TRACE)
+#	define LABUTILS_ENABLE_TRACE 1
+#endif
+
+namespace labutils
+{
+	void trace_enable( bool );
+	bool trace_enabled() noexcept;
+
+	// Name the calling thread in the trace output
+	void trace_set_thread_name( char const* );
+
+	void write_chrome_trace( char const* aPath );
+
+	class TraceScope
+	{
+		public:
+			explicit TraceScope( char const* aName ) noexcept;
+			~TraceScope();
+
+			TraceScope( TraceScope const& ) = delete;
+			TraceScope& operator= (TraceScope const&) = delete;
+
+		private:
+			char const* mName;
+			std::uint64_t mBeginNs;
+			bool mActive; // tracing was enabled when the scope was entered
+	};
+}
+
+#if LABUTILS_ENABLE_TRACE
+#	define LUT_TRACE_CONCAT_(a,b) a##b
+#	define LUT_TRACE_CONCAT(a,b) LUT_TRACE_CONCAT_(a,b)
+#	define LUT_TRACE_SCOPE(name) ::labutils::TraceScope LUT_TRACE_CONCAT(lutTraceScope_,__LINE__)( name )
+#else
+#	define LUT_TRACE_SCOPE(name) do {} while(0)
+#endif
+
+//EOF vim:syntax=cpp:foldmethod=marker:ts=4:noexpandtab:
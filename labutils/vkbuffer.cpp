@@ -17,6 +17,7 @@ namespace labutils
 		{
 			assert( VK_NULL_HANDLE != mAllocator );
 			assert( VK_NULL_HANDLE != allocation );
+			detail::untrack_allocation( mAllocator, allocation );
 			vmaDestroyBuffer( mAllocator, buffer, allocation );
 		}
 	}
@@ -43,7 +44,7 @@ namespace labutils
 
 namespace labutils
 {
-	Buffer create_buffer( Allocator const& aAllocator, VkDeviceSize aSize, VkBufferUsageFlags aBufferUsage, VmaMemoryUsage aMemoryUsage )
+	Buffer create_buffer( Allocator const& aAllocator, VkDeviceSize aSize, VkBufferUsageFlags aBufferUsage, VmaMemoryUsage aMemoryUsage, MemoryCategory aCategory )
 	{
 		VkBufferCreateInfo bufferInfo{};
 		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -61,6 +62,97 @@ namespace labutils
 			throw Error("Unable to allocate buffer.\n" "vmaCreateBuffer() returned %s", to_string(res).c_str());
 		}
 
+		track_allocation(aAllocator, allocation, aCategory);
+
 		return Buffer(aAllocator.allocator, buffer, allocation);
 	}
+
+	MappedBuffer create_mapped_staging_buffer( Allocator const& aAllocator, VkDeviceSize aSize, MemoryCategory aCategory )
+	{
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = aSize;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+		VmaAllocationCreateInfo allocInfo{};
+		allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+		allocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		allocInfo.preferredFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VmaAllocation allocation = VK_NULL_HANDLE;
+		VmaAllocationInfo info{};
+
+		if (auto const res = vmaCreateBuffer(aAllocator.allocator, &bufferInfo, &allocInfo, &buffer, &allocation, &info); VK_SUCCESS != res)
+		{
+			throw Error("Unable to allocate staging buffer.\n" "vmaCreateBuffer() returned %s", to_string(res).c_str());
+		}
+
+		track_allocation(aAllocator, allocation, aCategory);
+
+		MappedBuffer ret;
+		ret.buffer = Buffer(aAllocator.allocator, buffer, allocation);
+		ret.data = static_cast<std::uint8_t*>(info.pMappedData);
+		return ret;
+	}
+
+	bool is_device_memory_host_visible( Allocator const& aAllocator )
+	{
+		VkPhysicalDeviceMemoryProperties const* memProps = nullptr;
+		vmaGetMemoryProperties(aAllocator.allocator, &memProps);
+		assert(memProps);
+
+		// Largest device local heap
+		std::uint32_t mainHeap = memProps->memoryHeapCount;
+		for (std::uint32_t i = 0; i < memProps->memoryHeapCount; ++i)
+		{
+			if (!(memProps->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+				continue;
+
+			if (mainHeap == memProps->memoryHeapCount || memProps->memoryHeaps[i].size > memProps->memoryHeaps[mainHeap].size)
+				mainHeap = i;
+		}
+
+		VkMemoryPropertyFlags const required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		for (std::uint32_t i = 0; i < memProps->memoryTypeCount; ++i)
+		{
+			auto const& type = memProps->memoryTypes[i];
+			if (type.heapIndex == mainHeap && required == (type.propertyFlags & required))
+				return true;
+		}
+
+		return false;
+	}
+
+	MappedBuffer create_mapped_device_buffer( Allocator const& aAllocator, VkDeviceSize aSize, VkBufferUsageFlags aUsage, MemoryCategory aCategory )
+	{
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = aSize;
+		bufferInfo.usage = aUsage;
+
+		VmaAllocationCreateInfo allocInfo{};
+		allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+		allocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VmaAllocation allocation = VK_NULL_HANDLE;
+		VmaAllocationInfo info{};
+
+		auto const res = vmaCreateBuffer(aAllocator.allocator, &bufferInfo, &allocInfo, &buffer, &allocation, &info);
+		if (VK_ERROR_FEATURE_NOT_PRESENT == res || VK_ERROR_OUT_OF_DEVICE_MEMORY == res)
+			return MappedBuffer{};
+
+		if (VK_SUCCESS != res)
+		{
+			throw Error("Unable to allocate buffer.\n" "vmaCreateBuffer() returned %s", to_string(res).c_str());
+		}
+
+		track_allocation(aAllocator, allocation, aCategory);
+
+		MappedBuffer ret;
+		ret.buffer = Buffer(aAllocator.allocator, buffer, allocation);
+		ret.data = static_cast<std::uint8_t*>(info.pMappedData);
+		return ret;
+	}
 }
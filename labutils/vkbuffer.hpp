@@ -6,6 +6,7 @@
 #include <utility>
 
 #include <cassert>
+#include <cstdint>
 
 #include "allocator.hpp"
 
@@ -32,5 +33,29 @@ namespace labutils
 			VmaAllocator mAllocator = VK_NULL_HANDLE;
 	};
 
-	Buffer create_buffer( Allocator const&, VkDeviceSize, VkBufferUsageFlags, VmaMemoryUsage );
+	Buffer create_buffer( Allocator const&, VkDeviceSize, VkBufferUsageFlags, VmaMemoryUsage, MemoryCategory = MemoryCategory::other );
+
+	// Staging buffer (TRANSFER_SRC) that stays mapped for its lifetime.
+	// HOST_CACHED memory is preferred, so that reading back from the mapping
+	// is fast too; the memory is always HOST_COHERENT.
+	struct MappedBuffer
+	{
+		Buffer buffer;
+		std::uint8_t* data = nullptr;
+	};
+
+	MappedBuffer create_mapped_staging_buffer( Allocator const&, VkDeviceSize, MemoryCategory = MemoryCategory::staging );
+
+	// Checks whether the device's main memory heap is host visible, i.e.,
+	// whether device local memory that is also HOST_VISIBLE and
+	// HOST_COHERENT is available in quantity. This is the case for integrated
+	// GPUs, CPU implementations (e.g., lavapipe) and discrete GPUs with
+	// resizable BAR, but not for the 256 MiB BAR window of other discrete
+	// GPUs.
+	bool is_device_memory_host_visible( Allocator const& );
+
+	// Buffer in host visible device local memory that stays mapped for its
+	// lifetime, so that the GPU's data can be written directly. Returns an
+	// empty MappedBuffer if there is no such memory (left).
+	MappedBuffer create_mapped_device_buffer( Allocator const&, VkDeviceSize, VkBufferUsageFlags, MemoryCategory = MemoryCategory::other );
 }
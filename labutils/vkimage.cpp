@@ -1,5 +1,6 @@
 #include "vkimage.hpp"
 
+#include <limits>
 #include <vector>
 #include <utility>
 #include <algorithm>
@@ -10,9 +11,15 @@
 
 #include <stb_image.h>
 
+#include "ktx2.hpp"
 #include "error.hpp"
+#include "image_decode.hpp"
+#include "trace.hpp"
+#include "mipgen.hpp"
+#include "mipmap.hpp"
 #include "vkutil.hpp"
 #include "vkbuffer.hpp"
+#include "staging_ring.hpp"
 #include "to_string.hpp"
 
 namespace
@@ -42,6 +49,91 @@ namespace
 
 		return res;
 	}
+
+	VkFormat bc_vk_format_( labutils::BcFormat aFormat )
+	{
+		switch( aFormat )
+		{
+			case labutils::BcFormat::bc1: return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+			case labutils::BcFormat::bc4: return VK_FORMAT_BC4_UNORM_BLOCK;
+			case labutils::BcFormat::bc5: return VK_FORMAT_BC5_UNORM_BLOCK;
+			case labutils::BcFormat::bc7: return VK_FORMAT_BC7_SRGB_BLOCK;
+		}
+
+		return VK_FORMAT_UNDEFINED;
+	}
+
+	// Records the upload of one level (of array layer aLayer) of an image,
+	// which must be in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL. aFill writes the
+	// aSize bytes of tightly packed level data to the pointer it is given. If
+	// the level fits into the staging ring, that is ring memory, so the data
+	// is written in place. Otherwise it is aScratch, and the level is uploaded
+	// from there in pieces. Returns the data, which can be read until the next
+	// allocation from the ring.
+	template< class tFill >
+	std::uint8_t const* upload_level_( labutils::StagingRing& aRing, VkImage aImage, std::uint32_t aLevel, std::uint32_t aLayer, std::uint32_t aWidth, std::uint32_t aHeight, VkDeviceSize aSize, std::uint32_t aBytesPerBlock, std::uint32_t aBlockExtent, std::vector<std::uint8_t>& aScratch, tFill&& aFill )
+	{
+		if( aSize <= aRing.capacity() )
+		{
+			auto const region = aRing.allocate( aSize, 16 );
+			aFill( region.data );
+
+			VkBufferImageCopy copy{};
+			copy.bufferOffset = region.offset;
+			copy.bufferRowLength = 0;
+			copy.bufferImageHeight = 0;
+			copy.imageSubresource = VkImageSubresourceLayers{ VK_IMAGE_ASPECT_COLOR_BIT, aLevel, aLayer, 1 };
+			copy.imageOffset = VkOffset3D{ 0, 0, 0 };
+			copy.imageExtent = VkExtent3D{ aWidth, aHeight, 1 };
+
+			vkCmdCopyBufferToImage( aRing.command_buffer(), region.buffer, aImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy );
+			return region.data;
+		}
+
+		aScratch.resize( std::size_t(aSize) );
+		aFill( aScratch.data() );
+
+		aRing.upload_image_level( aImage, aLevel, aWidth, aHeight, aScratch.data(), aBytesPerBlock, aBlockExtent, aLayer );
+		return aScratch.data();
+	}
+
+	// Transitions all levels of an image for upload, before its first copy
+	void begin_image_upload_( VkCommandBuffer aCmdBuff, VkImage aImage, std::uint32_t aLevels )
+	{
+		labutils::image_barrier( aCmdBuff, aImage,
+			0,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, aLevels, 0, 1 }
+		);
+	}
+
+	// ... and for sampling, once all levels have been copied
+	void end_image_upload_( VkCommandBuffer aCmdBuff, VkImage aImage, std::uint32_t aLevels )
+	{
+		labutils::image_barrier( aCmdBuff, aImage,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, aLevels, 0, 1 }
+		);
+	}
+
+	// Upload commands stay in the ring's current command buffer, and are
+	// submitted together with later uploads. Timed uploads are the exception:
+	// their results must be available by the time the profiler reuses their
+	// query slot, so these are submitted and waited for.
+	void end_upload_( labutils::StagingRing& aRing, labutils::GpuProfiler const* aProfiler )
+	{
+		if( aProfiler && aProfiler->enabled() )
+			aRing.finish();
+	}
 }
 
 namespace labutils
@@ -54,6 +146,7 @@ namespace labutils
 		{
 			assert( VK_NULL_HANDLE != mAllocator );
 			assert( VK_NULL_HANDLE != allocation );
+			detail::untrack_allocation( mAllocator, allocation );
 			vmaDestroyImage( mAllocator, image, allocation );
 		}
 	}
@@ -80,37 +173,31 @@ namespace labutils
 
 namespace labutils
 {
-	Image load_image_texture2d(char const* aPattern, VulkanContext const& aContext, VkCommandPool aCmdPool, Allocator const& aAllocator)
+	Image load_image_texture2d(char const* aPattern, VulkanContext const&, StagingRing& aRing, Allocator const& aAllocator, GpuProfiler* aProfiler)
 	{
+		LUT_TRACE_SCOPE("load_image_texture2d");
 		
-		// Determine base image size 
-		int baseWidthi, baseHeighti, baseChannelsi;
-		if (1 != stbi_info(aPattern, &baseWidthi, &baseHeighti, &baseChannelsi))
-		{
-			throw Error("%s: unable to get image information (%s)", aPattern, stbi_failure_reason());
-		}
-
-		assert(baseWidthi > 0 && baseHeighti > 0);
+		// Read the file once, and decode it straight into staging memory
+		auto const file = read_file_bytes(aPattern);
+		auto const info = image_file_info(file, aPattern);
 
-		auto const baseWidth = std::uint32_t(baseWidthi);
-		auto const baseHeight = std::uint32_t(baseHeighti);
+		auto const baseWidth = info.width;
+		auto const baseHeight = info.height;
 
 		auto const mipLevels = compute_mip_level_count(baseWidth, baseHeight);
 
 		Image ret = create_image_texture2d(aAllocator, baseWidth, baseHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
 
-		// Create command buffer for data upload and begin recording 
-		VkCommandBuffer cbuff = alloc_command_buffer(aContext, aCmdPool);
+		// Commands are recorded into the staging ring's command buffer, which
+		// can change when staging memory is allocated
+		VkCommandBuffer cbuff = aRing.command_buffer();
 
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = 0;
-		beginInfo.pInheritanceInfo = nullptr;
+		// The upload is timed as a separate "frame" if a profiler is given
+		GpuProfiler noProfiler;
+		GpuProfiler& profiler = aProfiler ? *aProfiler : noProfiler;
 
-		if (auto const res = vkBeginCommandBuffer(cbuff, &beginInfo); VK_SUCCESS != res)
-		{
-			throw Error("Beginning command buffer recording\n" "vkBeginCommandBuffer() returned %s", to_string(res).c_str());
-		}
+		profiler.begin_frame(cbuff);
+		auto const uploadScope = profiler.begin_scope(cbuff, "texture upload");
 
 		// Transition whole image layout 
 		// When copying data to the image, the imagefs layout must be 
@@ -130,55 +217,17 @@ namespace labutils
 			}
 		);
 
-		// Upload mip levels 1
-		std::uint32_t width = baseWidth, height = baseHeight;
-		std::vector<Buffer> stagingBuffers(mipLevels);
-
-		// Load image data 
-		int widthj, heightj, channelsi;
-		stbi_uc* data = stbi_load(aPattern, &widthj, &heightj, &channelsi, 4);
-
-		if (!data)
-		{
-			throw Error("%s: unable to load image for level %u (%s)", aPattern, 0, stbi_failure_reason());
-		}
-
-		assert(widthj > 0 && std::uint32_t(widthj) == width);
-		assert(heightj > 0 && std::uint32_t(heightj) == height);
-
-		auto const sizeInBytes = width * height * 4;
-
-		// Create staging buffer and copy image data to it 
-		auto& staging = stagingBuffers.emplace_back(create_buffer(aAllocator, sizeInBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU));
-
-		void* sptr = nullptr;
-		if (auto const res = vmaMapMemory(aAllocator.allocator, staging.allocation, &sptr); VK_SUCCESS != res)
-		{
-			throw Error("Mapping memory for writing\n" "vmaMapMemory() returned %s", to_string(res).c_str());
-
-		}
-
-		std::memcpy(sptr, data, sizeInBytes);
-		vmaUnmapMemory(aAllocator.allocator, staging.allocation);
-
-		// Free image data 42
-		stbi_image_free(data);
-
-		// Upload data from staging buffer to image 
-		VkBufferImageCopy copy;
-		copy.bufferOffset = 0;
-		copy.bufferRowLength = 0;
-		copy.bufferImageHeight = 0;
-		copy.imageSubresource = VkImageSubresourceLayers{
-			VK_IMAGE_ASPECT_COLOR_BIT,
-			0,
-			0, 1
-		};
+		// Upload mip level 0
+		std::vector<std::uint8_t> scratch;
+		upload_level_(aRing, ret.image, 0, 0, baseWidth, baseHeight, decode_rgba8_capacity(info), 4, 1, scratch, [&](std::uint8_t* aDst) {
+			decode_rgba8_into(file, aPattern, info, aDst);
+		});
 
-		copy.imageOffset = VkOffset3D{ 0, 0, 0 };
-		copy.imageExtent = VkExtent3D{ width, height, 1 };
+		cbuff = aRing.command_buffer();
+		std::uint32_t width = baseWidth, height = baseHeight;
 
-		vkCmdCopyBufferToImage(cbuff, staging.buffer, ret.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+		profiler.end_scope(cbuff, uploadScope);
+		auto const mipScope = profiler.begin_scope(cbuff, "mip generation");
 
 		for (uint32_t i = 0; i < mipLevels - 1; ++i) {
 
@@ -254,52 +303,533 @@ namespace labutils
 			}
 		);
 
-		// End command recording 
-		if (auto const res = vkEndCommandBuffer(cbuff); VK_SUCCESS != res)
+		profiler.end_scope(cbuff, mipScope);
+
+		// The staging memory is recycled by the ring once the commands have
+		// completed
+		end_upload_(aRing, aProfiler);
+
+		return ret;
+	}
+
+	Image load_image_texture2d(char const* aPath, VulkanContext const&, StagingRing& aRing, Allocator const& aAllocator, MipFilter aMipFilter, GpuProfiler* aProfiler)
+	{
+		LUT_TRACE_SCOPE("load_image_texture2d");
+
+		auto const file = read_file_bytes(aPath);
+		auto const info = image_file_info(file, aPath);
+
+		auto const baseWidth = info.width;
+		auto const baseHeight = info.height;
+		auto const mipLevels = compute_mip_level_count(baseWidth, baseHeight);
+
+		Image ret = create_image_texture2d(aAllocator, baseWidth, baseHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+
+		GpuProfiler noProfiler;
+		GpuProfiler& profiler = aProfiler ? *aProfiler : noProfiler;
+
+		profiler.begin_frame(aRing.command_buffer());
+		auto const uploadScope = profiler.begin_scope(aRing.command_buffer(), "texture upload");
+
+		begin_image_upload_(aRing.command_buffer(), ret.image, mipLevels);
+
+		// Level 0 is decoded straight into staging memory, and the other
+		// levels are generated from there. The ring's memory is HOST_CACHED
+		// if possible, so reading it back is fast.
+		std::vector<std::uint8_t> scratch;
+		std::uint8_t const* base = upload_level_(aRing, ret.image, 0, 0, baseWidth, baseHeight, decode_rgba8_capacity(info), 4, 1, scratch, [&](std::uint8_t* aDst) {
+			decode_rgba8_into(file, aPath, info, aDst);
+		});
+
+		std::vector<MipLevelRGBA8> mips;
 		{
-			throw Error("Ending command buffer recording\n" "vkEndCommandBuffer() returned %s", to_string(res).c_str());
+			LUT_TRACE_SCOPE("generate_mip_chain");
+			mips = generate_mip_chain_rgba8(base, baseWidth, baseHeight, true, aMipFilter);
 		}
 
-		// Submit command buffer and wait for commands to complete
-		// Commands must have completed before we can destroy the temporary 
-		// resources, such as the staging buffers. 
-		Fence uploadComplete = create_fence(aContext);
+		assert(mips.size() + 1 == mipLevels);
+
+		for (std::uint32_t level = 1; level < mipLevels; ++level)
+		{
+			auto const& mip = mips[level-1];
+			aRing.upload_image_level(ret.image, level, mip.width, mip.height, mip.texels.data());
+		}
+
+		end_image_upload_(aRing.command_buffer(), ret.image, mipLevels);
+		profiler.end_scope(aRing.command_buffer(), uploadScope);
+
+		end_upload_(aRing, aProfiler);
+
+		return ret;
+	}
+
+	std::vector<Image> load_image_textures2d(std::vector<std::string> const& aPaths, VulkanContext const& aContext, StagingRing& aRing, Allocator const& aAllocator, ComputeMipGenerator const* aGenerator, GpuProfiler* aProfiler)
+	{
+		LUT_TRACE_SCOPE("load_image_textures2d");
 
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &cbuff;
+		std::vector<Image> ret(aPaths.size());
+		if (aPaths.empty())
+			return ret;
 
-		if (auto const res = vkQueueSubmit(aContext.graphicsQueue, 1, &submitInfo, uploadComplete.handle); VK_SUCCESS != res)
+		// Read all files first, to find the images that the compute shader
+		// can handle
+		struct Decoded_
 		{
-			throw Error("Submitting commands\n" "vkQueueSubmit() returned %s", to_string(res).c_str());
+			std::size_t index;
+			std::vector<std::uint8_t> file;
+			ImageFileInfo info;
+		};
+
+		std::vector<Decoded_> decoded;
+		decoded.reserve(aPaths.size());
 
+		std::vector<std::size_t> fallback;
+
+		for (std::size_t i = 0; i < aPaths.size(); ++i)
+		{
+			if (!aGenerator)
+			{
+				fallback.push_back(i);
+				continue;
+			}
+
+			auto file = read_file_bytes(aPaths[i].c_str());
+			auto const info = image_file_info(file, aPaths[i].c_str());
+
+			if (info.width > kComputeMipMaxExtent || info.height > kComputeMipMaxExtent)
+			{
+				// Too large for the compute shader. These use the blits
+				// instead, below.
+				fallback.push_back(i);
+				continue;
+			}
+
+			decoded.push_back({ i, std::move(file), info });
 		}
 
-		if (auto const res = vkWaitForFences(aContext.device, 1, &uploadComplete.handle, VK_TRUE, std::numeric_limits<std::uint64_t>::max()); VK_SUCCESS != res)
+		if (decoded.empty())
 		{
-			throw Error("Waiting for upload to complete\n" "vkWaitForFences() returned %s", to_string(res).c_str());
+			for (auto const i : fallback)
+				ret[i] = load_image_texture2d(aPaths[i].c_str(), aContext, aRing, aAllocator, aProfiler);
+
+			aRing.finish();
+			return ret;
+		}
+
+		// Create images and record everything into the ring's command
+		// buffer(s)
+		std::vector<ComputeMipTarget> targets;
+		targets.reserve(decoded.size());
 
+		for (auto const& dec : decoded)
+		{
+			ret[dec.index] = create_image_texture2d(aAllocator, dec.info.width, dec.info.height, VK_FORMAT_R8G8B8A8_SRGB, kComputeMipImageUsage | VK_IMAGE_USAGE_TRANSFER_DST_BIT, MemoryCategory::texture, 0, kComputeMipImageFlags);
+			targets.push_back({ ret[dec.index].image, dec.info.width, dec.info.height });
 		}
 
-		vkFreeCommandBuffers(aContext.device, aCmdPool, 1, &cbuff);
+		GpuProfiler noProfiler;
+		GpuProfiler& profiler = aProfiler ? *aProfiler : noProfiler;
+
+		profiler.begin_frame(aRing.command_buffer());
+		auto const uploadScope = profiler.begin_scope(aRing.command_buffer(), "texture upload");
+
+		// One barrier for level 0 of all images. The other levels are
+		// transitioned by record_compute_mips().
+		std::vector<VkImageMemoryBarrier> barriers(decoded.size());
+		for (std::size_t i = 0; i < decoded.size(); ++i)
+		{
+			auto& barrier = barriers[i];
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = targets[i].image;
+			barrier.subresourceRange = VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		}
+
+		vkCmdPipelineBarrier(aRing.command_buffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, std::uint32_t(barriers.size()), barriers.data());
+
+		// Level 0 of each image is decoded straight into staging memory. When
+		// the ring is full, it submits the copies recorded so far.
+		std::vector<std::uint8_t> scratch;
+		for (auto& dec : decoded)
+		{
+			upload_level_(aRing, ret[dec.index].image, 0, 0, dec.info.width, dec.info.height, decode_rgba8_capacity(dec.info), 4, 1, scratch, [&](std::uint8_t* aDst) {
+				decode_rgba8_into(dec.file, aPaths[dec.index].c_str(), dec.info, aDst);
+			});
+
+			dec.file = std::vector<std::uint8_t>();
+		}
+
+		profiler.end_scope(aRing.command_buffer(), uploadScope);
+		auto const mipScope = profiler.begin_scope(aRing.command_buffer(), "mip generation");
+
+		ComputeMipBatch batch = record_compute_mips(aRing.command_buffer(), aContext, aAllocator, *aGenerator, targets);
+
+		profiler.end_scope(aRing.command_buffer(), mipScope);
+
+		// The batch's resources must outlive the commands
+		aRing.finish();
+
+		for (auto const i : fallback)
+			ret[i] = load_image_texture2d(aPaths[i].c_str(), aContext, aRing, aAllocator, aProfiler);
+
+		if (!fallback.empty())
+			aRing.finish();
 
 		return ret;
 	}
 
-	Image create_image_texture2d( Allocator const& aAllocator, std::uint32_t aWidth, std::uint32_t aHeight, VkFormat aFormat, VkImageUsageFlags aUsage )
+	std::vector<std::vector<std::size_t>> group_textures_by_size(std::vector<std::string> const& aPaths, std::uint32_t aMinLayers, std::uint32_t aMaxLayers)
 	{
-		auto const mipLevels = compute_mip_level_count(aWidth, aHeight);
+		LUT_TRACE_SCOPE("group_textures_by_size");
+
+		assert(aMinLayers >= 1 && aMaxLayers >= aMinLayers);
+
+		// Only the headers are read here
+		std::vector<std::tuple<std::uint32_t, std::uint32_t, std::size_t>> sized;
+		for (std::size_t i = 0; i < aPaths.size(); ++i)
+		{
+			int width = 0, height = 0, channels = 0;
+			if (!stbi_info(aPaths[i].c_str(), &width, &height, &channels))
+				continue;
+
+			sized.emplace_back(std::uint32_t(width), std::uint32_t(height), i);
+		}
+
+		std::sort(sized.begin(), sized.end());
+
+		std::vector<std::vector<std::size_t>> ret;
+
+		std::size_t first = 0;
+		while (first < sized.size())
+		{
+			std::size_t last = first;
+			while (last < sized.size() && std::get<0>(sized[last]) == std::get<0>(sized[first]) && std::get<1>(sized[last]) == std::get<1>(sized[first]))
+				++last;
+
+			for (std::size_t begin = first; begin < last; begin += aMaxLayers)
+			{
+				std::size_t const end = std::min<std::size_t>(last, begin + aMaxLayers);
+				if (end - begin < aMinLayers)
+					continue;
+
+				std::vector<std::size_t> group;
+				for (std::size_t j = begin; j < end; ++j)
+					group.push_back(std::get<2>(sized[j]));
+
+				ret.emplace_back(std::move(group));
+			}
+
+			first = last;
+		}
+
+		return ret;
+	}
+
+	Image load_image_texture2d_array(std::vector<std::string> const& aPaths, VulkanContext const&, StagingRing& aRing, Allocator const& aAllocator, GpuProfiler* aProfiler)
+	{
+		LUT_TRACE_SCOPE("load_image_texture2d_array");
+
+		assert(!aPaths.empty());
+
+		std::vector<std::vector<std::uint8_t>> files(aPaths.size());
+		std::vector<ImageFileInfo> infos(aPaths.size());
+
+		for (std::size_t i = 0; i < aPaths.size(); ++i)
+		{
+			files[i] = read_file_bytes(aPaths[i].c_str());
+			infos[i] = image_file_info(files[i], aPaths[i].c_str());
+
+			if (infos[i].width != infos[0].width || infos[i].height != infos[0].height)
+				throw Error("%s: image is %ux%u, but the other layers are %ux%u", aPaths[i].c_str(), infos[i].width, infos[i].height, infos[0].width, infos[0].height);
+		}
+
+		auto const baseWidth = infos[0].width;
+		auto const baseHeight = infos[0].height;
+		auto const layers = std::uint32_t(aPaths.size());
+		auto const mipLevels = compute_mip_level_count(baseWidth, baseHeight);
+
+		Image ret = create_image_texture2d(aAllocator, baseWidth, baseHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, MemoryCategory::texture, 0, 0, layers);
+
+		GpuProfiler noProfiler;
+		GpuProfiler& profiler = aProfiler ? *aProfiler : noProfiler;
+
+		profiler.begin_frame(aRing.command_buffer());
+		auto const uploadScope = profiler.begin_scope(aRing.command_buffer(), "texture upload");
+
+		image_barrier(aRing.command_buffer(), ret.image,
+			0,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, layers }
+		);
+
+		// Level 0 of each layer is decoded straight into staging memory
+		std::vector<std::uint8_t> scratch;
+		for (std::uint32_t layer = 0; layer < layers; ++layer)
+		{
+			upload_level_(aRing, ret.image, 0, layer, baseWidth, baseHeight, decode_rgba8_capacity(infos[layer]), 4, 1, scratch, [&](std::uint8_t* aDst) {
+				decode_rgba8_into(files[layer], aPaths[layer].c_str(), infos[layer], aDst);
+			});
+
+			files[layer] = std::vector<std::uint8_t>();
+		}
+
+		// As load_image_texture2d(), but each blit covers all layers
+		VkCommandBuffer const cbuff = aRing.command_buffer();
+
+		profiler.end_scope(cbuff, uploadScope);
+		auto const mipScope = profiler.begin_scope(cbuff, "mip generation");
+
+		std::uint32_t width = baseWidth, height = baseHeight;
+		for (std::uint32_t i = 0; i + 1 < mipLevels; ++i)
+		{
+			image_barrier(cbuff, ret.image,
+				VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_ACCESS_TRANSFER_READ_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, layers }
+			);
+
+			std::uint32_t const nextWidth = std::max(width / 2, 1u);
+			std::uint32_t const nextHeight = std::max(height / 2, 1u);
+
+			VkImageBlit blit{};
+			blit.srcOffsets[0] = { 0, 0, 0 };
+			blit.srcOffsets[1] = { std::int32_t(width), std::int32_t(height), 1 };
+			blit.srcSubresource = VkImageSubresourceLayers{ VK_IMAGE_ASPECT_COLOR_BIT, i, 0, layers };
+			blit.dstOffsets[0] = { 0, 0, 0 };
+			blit.dstOffsets[1] = { std::int32_t(nextWidth), std::int32_t(nextHeight), 1 };
+			blit.dstSubresource = VkImageSubresourceLayers{ VK_IMAGE_ASPECT_COLOR_BIT, i + 1, 0, layers };
+
+			vkCmdBlitImage(cbuff, ret.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, ret.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+			image_barrier(cbuff, ret.image,
+				VK_ACCESS_TRANSFER_READ_BIT,
+				VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, layers }
+			);
+
+			width = nextWidth;
+			height = nextHeight;
+		}
+
+		image_barrier(cbuff, ret.image,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, mipLevels - 1, 1, 0, layers }
+		);
+
+		profiler.end_scope(cbuff, mipScope);
+
+		end_upload_(aRing, aProfiler);
+
+		return ret;
+	}
+
+	std::tuple<Image, VkFormat> load_image_texture2d_bc(char const* aPath, VulkanContext const& aContext, StagingRing& aRing, Allocator const& aAllocator, BcFormat aFormat, BcQuality aQuality, MipFilter aMipFilter, GpuProfiler* aProfiler)
+	{
+		LUT_TRACE_SCOPE("load_image_texture2d_bc");
+
+		VkFormat const format = bc_vk_format_(aFormat);
+		if (!is_texture_format_supported(aContext, format))
+		{
+			std::fprintf(stderr, "%s: %s textures not supported by device, using uncompressed RGBA8\n", aPath, to_string(aFormat));
+			return { load_image_texture2d(aPath, aContext, aRing, aAllocator, aMipFilter, aProfiler), VK_FORMAT_R8G8B8A8_SRGB };
+		}
+
+		int widthi, heighti, channelsi;
+		stbi_uc* data = stbi_load(aPath, &widthi, &heighti, &channelsi, 4);
+		if (!data)
+		{
+			throw Error("%s: unable to load image (%s)", aPath, stbi_failure_reason());
+		}
+
+		assert(widthi > 0 && heighti > 0);
+
+		auto const baseWidth = std::uint32_t(widthi);
+		auto const baseHeight = std::uint32_t(heighti);
+
+		// Mip levels are generated on the CPU, since compressed images can't
+		// be blit targets. BC4/BC5 hold non-color data, so filter those
+		// linearly.
+		bool const srgb = (BcFormat::bc1 == aFormat || BcFormat::bc7 == aFormat);
+		std::vector<MipLevelRGBA8> mips;
+		{
+			LUT_TRACE_SCOPE("generate_mip_chain");
+			mips = generate_mip_chain_rgba8(data, baseWidth, baseHeight, srgb, aMipFilter);
+		}
+
+		auto const mipLevels = std::uint32_t(mips.size() + 1);
+		assert(mipLevels == compute_mip_level_count(baseWidth, baseHeight));
+
+		Image ret = create_image_texture2d(aAllocator, baseWidth, baseHeight, format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+
+		GpuProfiler noProfiler;
+		GpuProfiler& profiler = aProfiler ? *aProfiler : noProfiler;
+
+		profiler.begin_frame(aRing.command_buffer());
+		auto const uploadScope = profiler.begin_scope(aRing.command_buffer(), "texture upload");
+
+		begin_image_upload_(aRing.command_buffer(), ret.image, mipLevels);
+
+		// Each level is encoded directly into staging memory
+		auto const blockBytes = std::uint32_t(bc_block_bytes(aFormat));
+
+		VkDeviceSize compressedSize = 0, uncompressedSize = 0;
+		std::vector<std::uint8_t> scratch;
+
+		for (std::uint32_t level = 0; level < mipLevels; ++level)
+		{
+			std::uint32_t const width = 0 == level ? baseWidth : mips[level-1].width;
+			std::uint32_t const height = 0 == level ? baseHeight : mips[level-1].height;
+			std::uint8_t const* texels = 0 == level ? data : mips[level-1].texels.data();
+
+			VkDeviceSize const levelSize = bc_compressed_size(aFormat, width, height);
+			upload_level_(aRing, ret.image, level, 0, width, height, levelSize, blockBytes, 4, scratch, [&](std::uint8_t* aDst) {
+				encode_bc(aFormat, aQuality, texels, width, height, aDst);
+			});
+
+			compressedSize += levelSize;
+			uncompressedSize += VkDeviceSize(width) * height * 4;
+		}
+
+		stbi_image_free(data);
+
+		end_image_upload_(aRing.command_buffer(), ret.image, mipLevels);
+		profiler.end_scope(aRing.command_buffer(), uploadScope);
+
+		end_upload_(aRing, aProfiler);
+
+		std::printf("%s: %s (%s) %ux%u, %u levels: %.1f KiB, uncompressed %.1f KiB (%.1fx smaller)\n",
+			aPath, to_string(aFormat), to_string(aQuality), baseWidth, baseHeight, mipLevels,
+			compressedSize / 1024.0, uncompressedSize / 1024.0, double(uncompressedSize) / double(compressedSize)
+		);
+
+		return { std::move(ret), format };
+	}
+
+	std::tuple<Image, VkFormat> load_image_texture2d_ktx2(char const* aPath, VulkanContext const& aContext, StagingRing& aRing, Allocator const& aAllocator, GpuProfiler* aProfiler)
+	{
+		LUT_TRACE_SCOPE("load_image_texture2d_ktx2");
+
+		Ktx2Texture const ktx = load_ktx2(aPath);
+
+		if (!is_texture_format_supported(aContext, ktx.format))
+		{
+			throw Error("%s: format %d is not supported by the device", aPath, int(ktx.format));
+		}
+
+		auto const levelCount = std::uint32_t(ktx.levels.size());
+
+		// The whole chain is copied with a single command when it fits into
+		// the staging ring. Otherwise, each level is uploaded on its own, and
+		// levels that don't fit are split into rows of blocks.
+		auto const blockBytes = std::uint32_t(ktx2_level_size(ktx.format, 1, 1));
+		std::uint32_t const blockExtent = ktx2_level_size(ktx.format, 4, 4) == blockBytes ? 4 : 1;
+
+		Image ret = create_image_texture2d(aAllocator, ktx.width, ktx.height, ktx.format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, MemoryCategory::texture, levelCount);
+
+		GpuProfiler noProfiler;
+		GpuProfiler& profiler = aProfiler ? *aProfiler : noProfiler;
+
+		profiler.begin_frame(aRing.command_buffer());
+		auto const uploadScope = profiler.begin_scope(aRing.command_buffer(), "texture upload");
+
+		begin_image_upload_(aRing.command_buffer(), ret.image, levelCount);
+
+		if (ktx.data.size() <= aRing.capacity())
+		{
+			// Level offsets are multiples of 16 bytes, so they remain valid
+			// buffer offsets for any block size
+			auto const region = aRing.allocate(ktx.data.size(), 16);
+			std::memcpy(region.data, ktx.data.data(), ktx.data.size());
+
+			std::vector<VkBufferImageCopy> copies(levelCount);
+			for (std::uint32_t level = 0; level < levelCount; ++level)
+			{
+				auto& copy = copies[level];
+				copy.bufferOffset = region.offset + ktx.levels[level].offset;
+				copy.bufferRowLength = 0;
+				copy.bufferImageHeight = 0;
+				copy.imageSubresource = VkImageSubresourceLayers{ VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+				copy.imageOffset = VkOffset3D{ 0, 0, 0 };
+				copy.imageExtent = VkExtent3D{ std::max(ktx.width >> level, 1u), std::max(ktx.height >> level, 1u), 1 };
+			}
+
+			vkCmdCopyBufferToImage(aRing.command_buffer(), region.buffer, ret.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, levelCount, copies.data());
+		}
+		else
+		{
+			for (std::uint32_t level = 0; level < levelCount; ++level)
+			{
+				std::uint32_t const width = std::max(ktx.width >> level, 1u);
+				std::uint32_t const height = std::max(ktx.height >> level, 1u);
+
+				aRing.upload_image_level(ret.image, level, width, height, ktx.data.data() + ktx.levels[level].offset, blockBytes, blockExtent);
+			}
+		}
+
+		end_image_upload_(aRing.command_buffer(), ret.image, levelCount);
+		profiler.end_scope(aRing.command_buffer(), uploadScope);
+
+		end_upload_(aRing, aProfiler);
+
+		return { std::move(ret), ktx.format };
+	}
+
+	bool is_texture_format_supported(VulkanContext const& aContext, VkFormat aFormat)
+	{
+		// Block compressed formats can only be used if the feature is enabled.
+		// The device is created with it whenever it is supported.
+		if (aFormat >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && aFormat <= VK_FORMAT_BC7_SRGB_BLOCK)
+		{
+			VkPhysicalDeviceFeatures features{};
+			vkGetPhysicalDeviceFeatures(aContext.physicalDevice, &features);
+
+			if (!features.textureCompressionBC)
+				return false;
+		}
+
+		VkFormatProperties props{};
+		vkGetPhysicalDeviceFormatProperties(aContext.physicalDevice, aFormat, &props);
+
+		VkFormatFeatureFlags const required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+		return required == (props.optimalTilingFeatures & required);
+	}
+
+	Image create_image_texture2d( Allocator const& aAllocator, std::uint32_t aWidth, std::uint32_t aHeight, VkFormat aFormat, VkImageUsageFlags aUsage, MemoryCategory aCategory, std::uint32_t aMipLevels, VkImageCreateFlags aFlags, std::uint32_t aArrayLayers )
+	{
+		auto const mipLevels = 0 != aMipLevels ? aMipLevels : compute_mip_level_count(aWidth, aHeight);
 
 		VkImageCreateInfo imageInfo{};
 		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.flags = aFlags;
 		imageInfo.imageType = VK_IMAGE_TYPE_2D;
 		imageInfo.format = aFormat;
 		imageInfo.extent.width = aWidth;
 		imageInfo.extent.height = aHeight;
 		imageInfo.extent.depth = 1;
 		imageInfo.mipLevels = mipLevels;
-		imageInfo.arrayLayers = 1;
+		imageInfo.arrayLayers = aArrayLayers;
 		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
 		imageInfo.usage = aUsage;
@@ -318,6 +848,8 @@ namespace labutils
 
 		}
 
+		track_allocation(aAllocator, allocation, aCategory);
+
 		return Image(aAllocator.allocator, image, allocation);
 	}
 
@@ -3,14 +3,23 @@
 #include <volk/volk.h>
 #include <vk_mem_alloc.h>
 
+#include <tuple>
+#include <string>
+#include <vector>
 #include <utility>
 
 #include <cassert>
 
+#include "bcenc.hpp"
+#include "mipmap.hpp"
 #include "allocator.hpp"
+#include "gpu_profiler.hpp"
 
 namespace labutils
 {
+	struct ComputeMipGenerator;
+	class StagingRing;
+
 	class Image
 	{
 		public:
@@ -32,7 +41,58 @@ namespace labutils
 			VmaAllocator mAllocator = VK_NULL_HANDLE;
 	};
 
-	Image create_image_texture2d( Allocator const&, std::uint32_t aWidth, std::uint32_t aHeight, VkFormat, VkImageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT );
-	Image load_image_texture2d(char const* aPattern, VulkanContext const&, VkCommandPool, Allocator const&);
+	Image create_image_texture2d( Allocator const&, std::uint32_t aWidth, std::uint32_t aHeight, VkFormat, VkImageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, MemoryCategory = MemoryCategory::texture, std::uint32_t aMipLevels = 0 /* full chain */, VkImageCreateFlags = 0, std::uint32_t aArrayLayers = 1 );
+
+	// The loaders below upload through a staging ring (see staging_ring.hpp)
+	// and record their commands into its command buffer. The commands are
+	// submitted when the ring fills up, or by its flush() or finish(), which
+	// must be called before the images are used. Uploads that are timed with
+	// an (enabled) profiler are submitted and waited for right away.
+	Image load_image_texture2d(char const* aPattern, VulkanContext const&, StagingRing&, Allocator const&, GpuProfiler* = nullptr);
+
+	// As above, but the mip chain is generated on the CPU with the given
+	// filter (see mipmap.hpp), in linear space, instead of with linear blits
+	// on the GPU. The image does not need VK_IMAGE_USAGE_TRANSFER_SRC_BIT or
+	// blit support for its format.
+	Image load_image_texture2d(char const* aPath, VulkanContext const&, StagingRing&, Allocator const&, MipFilter, GpuProfiler* = nullptr);
+
+	// Loads several images with as few submits as the staging ring allows,
+	// and waits for them to complete. Mip chains are generated with the
+	// compute shader from mipgen.hpp, one dispatch per image, if aGenerator
+	// is non-null. Images larger than kComputeMipMaxExtent (and
+	// all images, without a generator) use load_image_texture2d() instead.
+	// Images created here also have the usages and flags that mipgen.hpp
+	// requires, so views of them must be restricted to
+	// VK_IMAGE_USAGE_SAMPLED_BIT (see create_image_view_texture2d()).
+	std::vector<Image> load_image_textures2d(std::vector<std::string> const& aPaths, VulkanContext const&, StagingRing&, Allocator const&, ComputeMipGenerator const* aGenerator, GpuProfiler* = nullptr);
+
+	// Groups images of the same size, e.g., for load_image_texture2d_array().
+	// Returns groups of indices into aPaths, each with between aMinLayers
+	// and aMaxLayers images (larger sets are split). Images in no group, or
+	// whose header can't be read, have to be loaded separately.
+	std::vector<std::vector<std::size_t>> group_textures_by_size(std::vector<std::string> const& aPaths, std::uint32_t aMinLayers, std::uint32_t aMaxLayers);
+
+	// Loads images of equal size into the array layers of one image, in the
+	// order of aPaths, for sampling through a VK_IMAGE_VIEW_TYPE_2D_ARRAY view
+	// (see create_image_view_texture2d_array()). Mip chains are generated
+	// with linear blits, one for all layers per level. Throws if the sizes
+	// differ.
+	Image load_image_texture2d_array(std::vector<std::string> const& aPaths, VulkanContext const&, StagingRing&, Allocator const&, GpuProfiler* = nullptr);
+
+	// Loads an image and uploads it block compressed, with a full mip chain
+	// that is generated and encoded on the CPU. BC1 and BC7 use the _SRGB
+	// formats, BC4 and BC5 the _UNORM ones. Prints the memory used compared
+	// to an uncompressed RGBA8 texture. If the device does not support the
+	// format, this falls back to load_image_texture2d(). Returns the image
+	// and its format (for the image view).
+	std::tuple<Image, VkFormat> load_image_texture2d_bc(char const* aPath, VulkanContext const&, StagingRing&, Allocator const&, BcFormat, BcQuality = BcQuality::normal, MipFilter = MipFilter::box, GpuProfiler* = nullptr);
+
+	// Loads a KTX2 file (see ktx2.hpp) with all of its mip levels. Levels
+	// are uploaded as stored. Throws if the device can't sample the file's
+	// format. Returns the image and its format.
+	std::tuple<Image, VkFormat> load_image_texture2d_ktx2(char const* aPath, VulkanContext const&, StagingRing&, Allocator const&, GpuProfiler* = nullptr);
+
+	// Checks that images of the format can be sampled and be copy targets
+	bool is_texture_format_supported(VulkanContext const&, VkFormat);
 	std::uint32_t compute_mip_level_count( std::uint32_t aWidth, std::uint32_t aHeight );
 }
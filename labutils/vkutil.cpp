@@ -1,6 +1,7 @@
 #include "vkutil.hpp"
 
 #include <vector>
+#include <algorithm>
 
 #include <cstdio>
 #include <cassert>
@@ -208,8 +209,16 @@ namespace labutils
 		samplerInfo.minLod = 0.f;
 		samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 		samplerInfo.mipLodBias = 0.f;
-		samplerInfo.anisotropyEnable = VK_TRUE;
-		samplerInfo.maxAnisotropy = 16.0f;
+		// Anisotropic filtering is only enabled by create_device() if the
+		// device supports it (see vulkan_context.cpp/vulkan_window.cpp).
+		VkPhysicalDeviceFeatures features{};
+		vkGetPhysicalDeviceFeatures(aContext.physicalDevice, &features);
+
+		VkPhysicalDeviceProperties props{};
+		vkGetPhysicalDeviceProperties(aContext.physicalDevice, &props);
+
+		samplerInfo.anisotropyEnable = features.samplerAnisotropy;
+		samplerInfo.maxAnisotropy = std::min(16.0f, props.limits.maxSamplerAnisotropy);
 
 		VkSampler sampler = VK_NULL_HANDLE;
 		if (auto const res = vkCreateSampler(aContext.device, &samplerInfo, nullptr, &sampler); VK_SUCCESS != res)
@@ -221,10 +230,15 @@ namespace labutils
 		return Sampler(aContext.device, sampler);
 	}
 
-	ImageView create_image_view_texture2d(VulkanContext const& aContext, VkImage aImage, VkFormat aFormat)
+	ImageView create_image_view_texture2d(VulkanContext const& aContext, VkImage aImage, VkFormat aFormat, VkImageUsageFlags aUsage, std::uint32_t aLayer)
 	{
+		VkImageViewUsageCreateInfo usageInfo{};
+		usageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO;
+		usageInfo.usage = aUsage;
+
 		VkImageViewCreateInfo viewInfo{};
 		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.pNext = 0 != aUsage ? &usageInfo : nullptr;
 		viewInfo.image = aImage;
 		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 		viewInfo.format = aFormat;
@@ -232,7 +246,7 @@ namespace labutils
 		viewInfo.subresourceRange = VkImageSubresourceRange{
 			VK_IMAGE_ASPECT_COLOR_BIT,
 			0, VK_REMAINING_MIP_LEVELS,
-			0, 1
+			aLayer, 1
 		};
 
 		VkImageView view = VK_NULL_HANDLE;
@@ -246,6 +260,34 @@ namespace labutils
 
 	}
 
+	ImageView create_image_view_texture2d_array(VulkanContext const& aContext, VkImage aImage, VkFormat aFormat, VkImageUsageFlags aUsage)
+	{
+		VkImageViewUsageCreateInfo usageInfo{};
+		usageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO;
+		usageInfo.usage = aUsage;
+
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.pNext = 0 != aUsage ? &usageInfo : nullptr;
+		viewInfo.image = aImage;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+		viewInfo.format = aFormat;
+		viewInfo.components = VkComponentMapping{}; // == identity 
+		viewInfo.subresourceRange = VkImageSubresourceRange{
+			VK_IMAGE_ASPECT_COLOR_BIT,
+			0, VK_REMAINING_MIP_LEVELS,
+			0, VK_REMAINING_ARRAY_LAYERS
+		};
+
+		VkImageView view = VK_NULL_HANDLE;
+		if (auto const res = vkCreateImageView(aContext.device, &viewInfo, nullptr, &view); VK_SUCCESS != res)
+		{
+			throw Error("Unable to create image view\n" "vkCreateImageView() returned %s", to_string(res).c_str());
+		}
+
+		return ImageView(aContext.device, view);
+	}
+
 	void image_barrier(VkCommandBuffer aCmdBuff, VkImage aImage, VkAccessFlags aSrcAccessMask,
 		VkAccessFlags aDstAccessMask, VkImageLayout aSrcLayout, VkImageLayout aDstLayout,
 		VkPipelineStageFlags aSrcStageMask, VkPipelineStageFlags aDstStageMask,
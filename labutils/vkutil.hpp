@@ -30,7 +30,15 @@ namespace labutils
 	DescriptorPool create_descriptor_pool(VulkanContext const&, std::uint32_t aMaxDescriptors = 2048, std::uint32_t aMaxSets = 1024);
 	VkDescriptorSet alloc_desc_set(VulkanContext const&, VkDescriptorPool, VkDescriptorSetLayout);
 
-	ImageView create_image_view_texture2d(VulkanContext const&, VkImage, VkFormat);
+	// aUsage restricts the usage of the view (VkImageViewUsageCreateInfo).
+	// This is required if the image has usages that aFormat does not support,
+	// see mipgen.hpp. Zero inherits the image's usage. The view covers all
+	// levels of the array layer aLayer.
+	ImageView create_image_view_texture2d(VulkanContext const&, VkImage, VkFormat, VkImageUsageFlags aUsage = 0, std::uint32_t aLayer = 0);
+
+	// As above, but a VK_IMAGE_VIEW_TYPE_2D_ARRAY view of all array layers.
+	// This is what the texture shader samples, also for single images.
+	ImageView create_image_view_texture2d_array(VulkanContext const&, VkImage, VkFormat, VkImageUsageFlags aUsage = 0);
 	void image_barrier(
 		VkCommandBuffer,
 		VkImage,
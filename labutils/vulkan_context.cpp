@@ -21,7 +21,8 @@ namespace
 
 	VkDevice create_device( 
 		VkPhysicalDevice,
-		std::uint32_t aQueueFamily
+		std::uint32_t aQueueFamily,
+		std::vector<char const*> const& aEnabledDeviceExtensions = {}
 	);
 }
 
@@ -51,6 +52,10 @@ namespace labutils
 		, device( std::exchange( aOther.device, VK_NULL_HANDLE ) )
 		, graphicsFamilyIndex( aOther.graphicsFamilyIndex )
 		, graphicsQueue( std::exchange( aOther.graphicsQueue, VK_NULL_HANDLE ) )
+		, haveMemoryBudget( aOther.haveMemoryBudget )
+		, haveMultiDrawIndirect( aOther.haveMultiDrawIndirect )
+		, haveDrawIndirectFirstInstance( aOther.haveDrawIndirectFirstInstance )
+		, havePipelineStatistics( aOther.havePipelineStatistics )
 		, debugMessenger( std::exchange( aOther.debugMessenger, VK_NULL_HANDLE ) )
 	{}
 
@@ -72,6 +77,10 @@ namespace labutils
 		std::swap( device, aOther.device );
 		std::swap( graphicsFamilyIndex, aOther.graphicsFamilyIndex );
 		std::swap( graphicsQueue, aOther.graphicsQueue );
+		std::swap( haveMemoryBudget, aOther.haveMemoryBudget );
+		std::swap( haveMultiDrawIndirect, aOther.haveMultiDrawIndirect );
+		std::swap( haveDrawIndirectFirstInstance, aOther.haveDrawIndirectFirstInstance );
+		std::swap( havePipelineStatistics, aOther.havePipelineStatistics );
 		std::swap( debugMessenger, aOther.debugMessenger );
 		return *this;
 	}
@@ -149,7 +158,27 @@ namespace labutils
 			throw lut::Error( "No queue family with GRAPHICS" );
 		}
 
-		ret.device = create_device( ret.physicalDevice, ret.graphicsFamilyIndex );
+		// Enable optional extensions, if supported
+		std::vector<char const*> enabledDevExensions;
+
+		auto const supportedDevExtensions = detail::get_device_extensions( ret.physicalDevice );
+		if( supportedDevExtensions.count( VK_EXT_MEMORY_BUDGET_EXTENSION_NAME ) )
+		{
+			ret.haveMemoryBudget = true;
+			enabledDevExensions.emplace_back( VK_EXT_MEMORY_BUDGET_EXTENSION_NAME );
+		}
+
+		for( auto const& ext : enabledDevExensions )
+			std::fprintf( stderr, "Enabling device extension: %s\n", ext );
+
+		ret.device = create_device( ret.physicalDevice, ret.graphicsFamilyIndex, enabledDevExensions );
+
+		// Optional features are enabled where supported, see create_device()
+		VkPhysicalDeviceFeatures features{};
+		vkGetPhysicalDeviceFeatures( ret.physicalDevice, &features );
+		ret.haveMultiDrawIndirect = VK_TRUE == features.multiDrawIndirect;
+		ret.haveDrawIndirectFirstInstance = VK_TRUE == features.drawIndirectFirstInstance;
+		ret.havePipelineStatistics = VK_TRUE == features.pipelineStatisticsQuery;
 
 		// Retrieve VkQueue
 		vkGetDeviceQueue( ret.device, ret.graphicsFamilyIndex, 0, &ret.graphicsQueue );
@@ -182,7 +211,7 @@ namespace
 		return {};
 	}
 
-	VkDevice create_device( VkPhysicalDevice aPhysicalDev, std::uint32_t aQueueFamily )
+	VkDevice create_device( VkPhysicalDevice aPhysicalDev, std::uint32_t aQueueFamily, std::vector<char const*> const& aEnabledExtensions )
 	{
 		float queuePriorities[1] = { 1.f };
 
@@ -192,8 +221,20 @@ namespace
 		queueInfo.queueCount        = 1;
 		queueInfo.pQueuePriorities  = queuePriorities;
 
+		// Only request anisotropic filtering where available. Some software
+		// implementations (e.g., SwiftShader) do not support it. The same
+		// applies to block compressed (BC) textures, multi-draw indirect,
+		// indirect draws with a first instance and pipeline statistics
+		// queries.
+		VkPhysicalDeviceFeatures supportedFeatures{};
+		vkGetPhysicalDeviceFeatures( aPhysicalDev, &supportedFeatures );
+
 		VkPhysicalDeviceFeatures deviceFeatures{};
-		deviceFeatures.samplerAnisotropy = VK_TRUE;
+		deviceFeatures.samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+		deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+		deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+		deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
 
 		
 		VkDeviceCreateInfo deviceInfo{};
@@ -204,6 +245,9 @@ namespace
 
 		deviceInfo.pEnabledFeatures      = &deviceFeatures;
 
+		deviceInfo.enabledExtensionCount    = std::uint32_t(aEnabledExtensions.size());
+		deviceInfo.ppEnabledExtensionNames  = aEnabledExtensions.data();
+
 		VkDevice device = VK_NULL_HANDLE;
 		if( auto const res = vkCreateDevice( aPhysicalDev, &deviceInfo, nullptr, &device ); VK_SUCCESS != res )
 		{
@@ -28,6 +28,14 @@ namespace labutils
 			std::uint32_t graphicsFamilyIndex = 0;
 			VkQueue graphicsQueue = VK_NULL_HANDLE;
 
+			// Optional device extensions
+			bool haveMemoryBudget = false; // VK_EXT_memory_budget
+
+			// Optional device features
+			bool haveMultiDrawIndirect = false; // drawCount > 1 in vkCmdDraw*Indirect()
+			bool haveDrawIndirectFirstInstance = false; // firstInstance != 0 in indirect commands
+			bool havePipelineStatistics = false; // VK_QUERY_TYPE_PIPELINE_STATISTICS
+
 			
 			//bool haveDebugUtils = false;
 			VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
@@ -224,7 +224,12 @@ namespace labutils
 		std::vector<char const*> enabledDevExensions;
 		enabledDevExensions.emplace_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 
-		//TODO: list necessary extensions here
+		// Optional extensions
+		if (lut::detail::get_device_extensions(ret.physicalDevice).count(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+		{
+			ret.haveMemoryBudget = true;
+			enabledDevExensions.emplace_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		}
 
 		for( auto const& ext : enabledDevExensions )
 			std::fprintf( stderr, "Enabling device extension: %s\n", ext );
@@ -257,6 +262,13 @@ namespace labutils
 
 		ret.device = create_device( ret.physicalDevice, queueFamilyIndices, enabledDevExensions );
 
+		// Optional features are enabled where supported, see create_device()
+		VkPhysicalDeviceFeatures features{};
+		vkGetPhysicalDeviceFeatures( ret.physicalDevice, &features );
+		ret.haveMultiDrawIndirect = VK_TRUE == features.multiDrawIndirect;
+		ret.haveDrawIndirectFirstInstance = VK_TRUE == features.drawIndirectFirstInstance;
+		ret.havePipelineStatistics = VK_TRUE == features.pipelineStatisticsQuery;
+
 		// Retrieve VkQueues
 		vkGetDeviceQueue( ret.device, ret.graphicsFamilyIndex, 0, &ret.graphicsQueue );
 
@@ -600,8 +612,15 @@ namespace
 			queueInfo.pQueuePriorities  = queuePriorities;
 		}
 
+		VkPhysicalDeviceFeatures supportedFeatures{};
+		vkGetPhysicalDeviceFeatures( aPhysicalDev, &supportedFeatures );
+
 		VkPhysicalDeviceFeatures deviceFeatures{};
-		deviceFeatures.samplerAnisotropy = VK_TRUE;
+		deviceFeatures.samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+		deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+		deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+		deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
 		
 		VkDeviceCreateInfo deviceInfo{};
 		deviceInfo.sType  = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
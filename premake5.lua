@@ -88,7 +88,8 @@ project "cw1"
 project "cw1-shaders"
 	local shaders = { 
 		"cw1/shaders/*.vert",
-		"cw1/shaders/*.frag"
+		"cw1/shaders/*.frag",
+		"cw1/shaders/*.comp"
 	}
 
 	kind "Utility"
@@ -98,6 +99,29 @@ project "cw1-shaders"
 
 	handle_glsl_files( "-O", "assets/cw1/shaders", {} )
 
+project "cw1-bake"
+	local sources = { 
+		"cw1-bake/**.cpp",
+		"cw1-bake/**.hpp",
+
+		-- OBJ loading and cell packs (--cells)
+		"cw1/model.cpp",
+		"cw1/model.hpp",
+		"cw1/cell_pack.cpp",
+		"cw1/cell_pack.hpp"
+	}
+
+	kind "ConsoleApp"
+	location "cw1-bake"
+
+	files( sources )
+
+	links "labutils"
+	links "x-stb"
+	links "x-tinyobj"
+
+	dependson "x-glm"
+
 project "labutils"
 	local sources = { 
 		"labutils/**.cpp",
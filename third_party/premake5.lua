@@ -30,7 +30,9 @@ project( "x-stb" )
 
 	location "."
 
-	files( "stb/src/*.c" )
+	-- stb_image's implementation is built by labutils (stb_image.cpp), with
+	-- allocation hooks
+	files( "stb/src/stb_image_write.c" )
 
 project( "x-glfw" )
 	kind "StaticLib"